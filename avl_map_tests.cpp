@@ -0,0 +1,405 @@
+#include <avl_map.hpp>
+#include <test.h>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Распределитель с идентификатором: экземпляры с разными id не равны, при
+ * перемещающем присваивании контейнера не передаются. live - счётчик
+ * выделенных и ещё не освобождённых объектов
+ */
+template <typename T>
+struct tagged_allocator
+{
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::false_type;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using is_always_equal = std::false_type;
+
+    tagged_allocator(int id, long *live) : id(id), live(live) {}
+
+    template <typename U>
+    tagged_allocator(const tagged_allocator<U> &other) : id(other.id), live(other.live) {}
+
+    T *allocate(std::size_t n)
+    {
+        *live += (long)n;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T *p, std::size_t n)
+    {
+        *live -= (long)n;
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    friend bool operator==(const tagged_allocator &f, const tagged_allocator &s) { return f.id == s.id; }
+    friend bool operator!=(const tagged_allocator &f, const tagged_allocator &s) { return f.id != s.id; }
+
+    int id;
+    long *live;
+};
+
+/**
+ * Ресурс памяти, который считает выделенные и ещё не освобождённые блоки
+ */
+class counting_resource : public std::pmr::memory_resource
+{
+public:
+    long live = 0;
+    long total = 0;
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        ++live;
+        ++total;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override
+    {
+        --live;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+};
+
+using tagged_map = avl::map<int, std::string, std::less<int>, tagged_allocator<std::pair<const int, std::string>>>;
+
+/**
+ * Проверяет, что m содержит ключи first, first + step, ... (count штук)
+ * со значениями, равными ключу, при обходе в обоих направлениях
+ */
+template <typename Map>
+bool contains_sequence(const Map &m, int first, int step, int count)
+{
+    if (m.size() != (std::size_t)count) {
+        return false;
+    }
+
+    int key = first;
+    for (auto it = m.begin(); it != m.end(); ++it, key += step)
+    {
+        if (it->first != key || it->second != std::to_string(key)) {
+            return false;
+        }
+    }
+
+    for (auto it = m.rbegin(); it != m.rend(); ++it)
+    {
+        key -= step;
+        if (it->first != key) {
+            return false;
+        }
+    }
+    return key == first;
+}
+
+/*****************************************************************************/
+
+C_TEST(iteration_test)
+{
+    avl::map<int, int> m;
+    ASSERT_TRUE(m.begin() == m.end());
+
+    for (int i = 0; i < 1000; ++i) {
+        m.emplace((i * 7919) % 1000, i);
+    }
+    ASSERT_EQ(m.size(), 1000u);
+
+    int expected = 0;
+    for (auto it = m.begin(); it != m.end(); ++it, ++expected) {
+        ASSERT_EQ(it->first, expected);
+    }
+    ASSERT_EQ(expected, 1000);
+
+    /* Обход назад, начиная с --end() */
+    auto it = m.end();
+    for (expected = 999; expected >= 0; --expected)
+    {
+        --it;
+        ASSERT_EQ(it->first, expected);
+    }
+    ASSERT_TRUE(it == m.begin());
+
+    /* Постфиксные формы и константные итераторы */
+    const avl::map<int, int> &cm = m;
+    avl::map<int, int>::const_iterator cit = cm.end();
+    cit--;
+    ASSERT_EQ(cit->first, 999);
+    avl::map<int, int>::const_iterator old = cit--;
+    ASSERT_EQ(old->first, 999);
+    ASSERT_EQ(cit->first, 998);
+    ASSERT_TRUE((avl::map<int, int>::const_iterator(m.begin()) == cm.cbegin()));
+
+    expected = 999;
+    for (auto rit = cm.rbegin(); rit != cm.rend(); ++rit, --expected) {
+        ASSERT_EQ(rit->first, expected);
+    }
+    ASSERT_EQ(expected, -1);
+    ASSERT_EQ(std::distance(m.begin(), m.end()), 1000);
+
+    /* --end() у контейнера из одного элемента */
+    avl::map<int, int> single;
+    single.emplace(5, 5);
+    ASSERT_EQ((--single.end())->first, 5);
+    ASSERT_TRUE(--single.end() == single.begin());
+}
+
+C_TEST(erase_test)
+{
+    avl::map<int, int> m;
+    for (int i = 0; i < 100; ++i) {
+        m.emplace(i, i);
+    }
+
+    /* Удаление каждого второго элемента через возвращаемый итератор */
+    for (auto it = m.begin(); it != m.end(); )
+    {
+        if (it->first % 2 == 0)
+        {
+            int key = it->first;
+            it = m.erase(it);
+            if (it != m.end()) {
+                ASSERT_EQ(it->first, key + 1);
+            }
+        }
+        else {
+            ++it;
+        }
+    }
+    ASSERT_EQ(m.size(), 50u);
+
+    int expected = 1;
+    for (const auto &value : m)
+    {
+        ASSERT_EQ(value.first, expected);
+        expected += 2;
+    }
+
+    /* Удаление последнего элемента возвращает end() */
+    ASSERT_TRUE(m.erase(--m.end()) == m.end());
+    ASSERT_EQ((--m.end())->first, 97);
+
+    ASSERT_EQ(m.erase(97), 1u);
+    ASSERT_EQ(m.erase(97), 0u);
+    ASSERT_EQ(m.size(), 48u);
+
+    while (!m.empty())
+    {
+        auto next = m.erase(m.cbegin());
+        ASSERT_TRUE(next == m.begin());
+    }
+    ASSERT_TRUE(m.begin() == m.end());
+}
+
+C_TEST(copy_move_test)
+{
+    avl::map<int, std::string> m;
+    for (int i = 0; i < 64; ++i) {
+        m.emplace(i, std::to_string(i));
+    }
+
+    avl::map<int, std::string> copy(m);
+    ASSERT_TRUE(contains_sequence(copy, 0, 1, 64));
+    ASSERT_TRUE(copy == m);
+    ASSERT_NE(&copy.begin()->second, &m.begin()->second);
+
+    /* Копия не зависит от исходного контейнера */
+    copy.erase(0);
+    copy[100] = "100";
+    ASSERT_TRUE(contains_sequence(m, 0, 1, 64));
+    ASSERT_TRUE(copy != m);
+
+    avl::map<int, std::string> assigned;
+    assigned.emplace(-1, "-1");
+    assigned = m;
+    ASSERT_TRUE(assigned == m);
+    avl::map<int, std::string> &self = assigned;
+    assigned = self;
+    ASSERT_TRUE(contains_sequence(assigned, 0, 1, 64));
+
+    /* Перемещение забирает узлы: ссылки на элементы остаются действительными */
+    const std::string *first_value = &m.begin()->second;
+    avl::map<int, std::string> moved(std::move(m));
+    ASSERT_TRUE(m.empty());
+    ASSERT_TRUE(m.begin() == m.end());
+    ASSERT_TRUE(contains_sequence(moved, 0, 1, 64));
+    ASSERT_EQ(&moved.begin()->second, first_value);
+
+    avl::map<int, std::string> move_assigned;
+    move_assigned.emplace(-1, "-1");
+    move_assigned = std::move(moved);
+    ASSERT_TRUE(moved.empty());
+    ASSERT_TRUE(contains_sequence(move_assigned, 0, 1, 64));
+    ASSERT_EQ(&move_assigned.begin()->second, first_value);
+
+    /* Контейнер, из которого переместили элементы, можно использовать снова */
+    moved.emplace(1, "1");
+    ASSERT_TRUE(contains_sequence(moved, 1, 1, 1));
+}
+
+C_TEST(allocator_test)
+{
+    long live_a = 0;
+    long live_b = 0;
+    tagged_allocator<std::pair<const int, std::string>> alloc_a(1, &live_a);
+    tagged_allocator<std::pair<const int, std::string>> alloc_b(2, &live_b);
+
+    {
+        tagged_map a(alloc_a);
+        for (int i = 0; i < 32; ++i) {
+            a.emplace(i, std::to_string(i));
+        }
+        ASSERT_EQ(live_a, 32);
+
+        /* Равные распределители: узлы забираются без выделения памяти */
+        tagged_map same(alloc_a);
+        const std::string *first_value = &a.begin()->second;
+        same = std::move(a);
+        ASSERT_EQ(live_a, 32);
+        ASSERT_TRUE(a.empty());
+        ASSERT_EQ(&same.begin()->second, first_value);
+        ASSERT_TRUE(contains_sequence(same, 0, 1, 32));
+
+        /* Разные распределители: элементы перемещаются в узлы из alloc_b */
+        tagged_map other(alloc_b);
+        other.emplace(-1, "-1");
+        other = std::move(same);
+        ASSERT_EQ(live_a, 0);
+        ASSERT_EQ(live_b, 32);
+        ASSERT_TRUE(same.empty());
+        ASSERT_TRUE(other.get_allocator() == alloc_b);
+        ASSERT_TRUE(contains_sequence(other, 0, 1, 32));
+
+        /* Копирующее присваивание без распространения оставляет свой распределитель */
+        tagged_map copy(alloc_a);
+        copy = other;
+        ASSERT_TRUE(copy.get_allocator() == alloc_a);
+        ASSERT_EQ(live_a, 32);
+        ASSERT_EQ(live_b, 32);
+        ASSERT_TRUE(copy == other);
+
+        /* Перемещающий конструктор забирает распределитель вместе с узлами */
+        tagged_map moved(std::move(copy));
+        ASSERT_TRUE(moved.get_allocator() == alloc_a);
+        ASSERT_EQ(live_a, 32);
+        ASSERT_TRUE(contains_sequence(moved, 0, 1, 32));
+    }
+
+    ASSERT_EQ(live_a, 0);
+    ASSERT_EQ(live_b, 0);
+}
+
+C_TEST(pmr_test)
+{
+    counting_resource resource;
+    counting_resource other_resource;
+
+    {
+        avl::pmr::map<int, std::string> m(&resource);
+        for (int i = 0; i < 16; ++i) {
+            m.emplace(i, std::to_string(i));
+        }
+        ASSERT_EQ(resource.live, 16);
+        ASSERT_TRUE(m.get_allocator().resource() == &resource);
+
+        /* Перемещающий конструктор сохраняет ресурс */
+        avl::pmr::map<int, std::string> moved(std::move(m));
+        ASSERT_TRUE(moved.get_allocator().resource() == &resource);
+        ASSERT_EQ(resource.total, 16);
+
+        /* Копирующий конструктор, как у std::pmr, берёт ресурс по умолчанию */
+        avl::pmr::map<int, std::string> copy(moved);
+        ASSERT_TRUE(copy.get_allocator().resource() == std::pmr::get_default_resource());
+        ASSERT_EQ(resource.live, 16);
+        ASSERT_TRUE(contains_sequence(copy, 0, 1, 16));
+
+        /* Присваивание не меняет ресурс: узлы выделяются из other_resource */
+        avl::pmr::map<int, std::string> other(&other_resource);
+        other = moved;
+        ASSERT_TRUE(other.get_allocator().resource() == &other_resource);
+        ASSERT_EQ(other_resource.live, 16);
+
+        other = std::move(moved);
+        ASSERT_TRUE(other.get_allocator().resource() == &other_resource);
+        ASSERT_TRUE(moved.empty());
+        ASSERT_EQ(resource.live, 0);
+        ASSERT_EQ(other_resource.live, 16);
+        ASSERT_TRUE(contains_sequence(other, 0, 1, 16));
+
+        other.clear();
+        ASSERT_EQ(other_resource.live, 0);
+    }
+
+    ASSERT_EQ(resource.live, 0);
+    ASSERT_EQ(other_resource.live, 0);
+}
+
+C_TEST(move_only_test)
+{
+    avl::map<int, std::unique_ptr<int>> m;
+
+    auto result = m.emplace(1, std::make_unique<int>(10));
+    ASSERT_TRUE(result.second);
+    ASSERT_EQ(*result.first->second, 10);
+
+    /* Повторный ключ: emplace не вставляет элемент */
+    result = m.emplace(1, std::make_unique<int>(20));
+    ASSERT_TRUE(!result.second);
+    ASSERT_EQ(*result.first->second, 10);
+
+    std::unique_ptr<int> value = std::make_unique<int>(30);
+    result = m.try_emplace(2, std::move(value));
+    ASSERT_TRUE(result.second);
+    ASSERT_TRUE(value == nullptr);
+    ASSERT_EQ(*m.at(2), 30);
+
+    /* try_emplace по существующему ключу не перемещает аргументы */
+    value = std::make_unique<int>(40);
+    result = m.try_emplace(2, std::move(value));
+    ASSERT_TRUE(!result.second);
+    ASSERT_TRUE(value != nullptr);
+    ASSERT_EQ(*m.at(2), 30);
+
+    /* Значение, созданное конструктором по умолчанию */
+    ASSERT_TRUE(m[3] == nullptr);
+    m[3] = std::move(value);
+    ASSERT_EQ(*m[3], 40);
+
+    /* Контейнер только перемещаемых значений перемещается целиком */
+    avl::map<int, std::unique_ptr<int>> moved(std::move(m));
+    ASSERT_EQ(moved.size(), 3u);
+    ASSERT_EQ(*moved.at(1), 10);
+
+    avl::map<int, std::unique_ptr<int>> assigned;
+    assigned = std::move(moved);
+    ASSERT_EQ(assigned.size(), 3u);
+    ASSERT_EQ(*(--assigned.end())->second, 40);
+}
+
+C_TEST_SUITE(all_tests)
+{
+    C_RUN_TEST(iteration_test);
+    C_RUN_TEST(erase_test);
+    C_RUN_TEST(copy_move_test);
+    C_RUN_TEST(allocator_test);
+    C_RUN_TEST(pmr_test);
+    C_RUN_TEST(move_only_test);
+}
+
+int main(int argc, char *argv[])
+{
+    C_RUN_SUITE(all_tests);
+
+    C_TEST_REPORT();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,155 @@
+/**
+ * Бенчмарк C++ контейнера avl::map в сравнении с std::map и map из C API
+ *
+ * В каждый контейнер вставляются KEYS_COUNT случайных ключей int, затем
+ * выполняется столько же поисков и удалений. Отдельно измеряется вставка
+ * только перемещаемых значений (std::unique_ptr) и вставка в avl::pmr::map
+ * с пулом памяти std::pmr::unsynchronized_pool_resource
+ * Для каждой операции печатается время в наносекундах на операцию
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+#include <avl_map.hpp>
+#include <map.h>
+
+constexpr std::size_t KEYS_COUNT = 1 << 20;
+
+/**
+ * Замеряет время выполнения f и возвращает его в наносекундах на операцию
+ */
+template <typename F>
+double measure(F &&f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / KEYS_COUNT;
+}
+
+/**
+ * Вставка, поиск и удаление для контейнеров с интерфейсом std::map
+ */
+template <typename Map>
+void bench_stl_like(const char *name, Map &container, const std::vector<int> &keys)
+{
+    volatile long long sink = 0;
+
+    double insert = measure([&] {
+        for (std::size_t i = 0; i < KEYS_COUNT; ++i) {
+            container.emplace(keys[i], static_cast<int>(i));
+        }
+    });
+    double find = measure([&] {
+        for (std::size_t i = 0; i < KEYS_COUNT; ++i) {
+            sink += container.find(keys[i])->second;
+        }
+    });
+    double erase = measure([&] {
+        for (std::size_t i = 0; i < KEYS_COUNT; ++i) {
+            container.erase(keys[i]);
+        }
+    });
+
+    std::printf("%s\t%.1f\t%.1f\t%.1f\n", name, insert, find, erase);
+}
+
+int int_compare_func(const void *f, const void *s)
+{
+    int int_f = *(const int*)f;
+    int int_s = *(const int*)s;
+    if (int_f < int_s) { return -1; }
+    if (int_f > int_s) { return 1; }
+    return 0;
+}
+
+void bench_c_map(const std::vector<int> &keys)
+{
+    map *mp = map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+    volatile long long sink = 0;
+
+    double insert = measure([&] {
+        for (std::size_t i = 0; i < KEYS_COUNT; ++i)
+        {
+            int key = keys[i], value = static_cast<int>(i);
+            map_insert(mp, key, value);
+        }
+    });
+    double find = measure([&] {
+        for (std::size_t i = 0; i < KEYS_COUNT; ++i)
+        {
+            int key = keys[i];
+            sink += map_iterator_get_value(map_find(mp, key), int);
+        }
+    });
+    double erase = measure([&] {
+        for (std::size_t i = 0; i < KEYS_COUNT; ++i)
+        {
+            int key = keys[i];
+            map_iterator it = map_find(mp, key);
+            if (map_iterator_compare(it, map_iterator_end(mp)) != 0) {
+                map_erase(mp, it);
+            }
+        }
+    });
+
+    std::printf("C map\t\t%.1f\t%.1f\t%.1f\n", insert, find, erase);
+    map_free(mp);
+}
+
+/**
+ * Вставка только перемещаемых значений
+ */
+template <typename Map>
+double bench_move_only(Map &container, const std::vector<int> &keys)
+{
+    return measure([&] {
+        for (std::size_t i = 0; i < KEYS_COUNT; ++i) {
+            container.try_emplace(keys[i], std::make_unique<int>(static_cast<int>(i)));
+        }
+    });
+}
+
+int main()
+{
+    std::vector<int> keys(KEYS_COUNT);
+    std::uint32_t state = 2463534242u;
+    for (int &key : keys)
+    {
+        /* xorshift32 */
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        key = static_cast<int>(state >> 1);
+    }
+
+    std::printf("int/int\t\tinsert\tfind\terase (ns/op)\n");
+    {
+        avl::map<int, int> container;
+        bench_stl_like("avl::map", container, keys);
+    }
+    {
+        std::map<int, int> container;
+        bench_stl_like("std::map", container, keys);
+    }
+    {
+        std::pmr::unsynchronized_pool_resource pool;
+        avl::pmr::map<int, int> container(&pool);
+        bench_stl_like("avl::pmr::map", container, keys);
+    }
+    bench_c_map(keys);
+
+    avl::map<int, std::unique_ptr<int>> avl_move_only;
+    std::map<int, std::unique_ptr<int>> std_move_only;
+    std::printf("\nunique_ptr insert (ns/op)\n");
+    std::printf("avl::map\t%.1f\n", bench_move_only(avl_move_only, keys));
+    std::printf("std::map\t%.1f\n", bench_move_only(std_move_only, keys));
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+/**
+ * Бенчмарк хранилищ MAP_BACKEND_AVL и MAP_BACKEND_BTREE
+ * 
+ * Для каждого размера контейнера от MIN_KEYS до MAX_KEYS (с шагом x4) в оба
+ * контейнера вставляются случайные ключи uint64_t (MAP_KEY_U64), затем
+ * выполняется LOOKUPS_COUNT случайных поисков существующих ключей и полный
+ * обход итератором. Для каждой операции печатается время в наносекундах на
+ * операцию и ускорение B+-дерева относительно AVL-дерева - по нему видно,
+ * с какого размера контейнера (переставшего помещаться в кэш) B+-дерево
+ * выгоднее
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <map.h>
+
+#define MIN_KEYS         (1 << 10)
+#define MAX_KEYS         (1 << 22)
+#define LOOKUPS_COUNT    (1 << 20)
+
+double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Заполняет контейнер n ключами и замеряет вставку, поиск и обход.
+ * Результаты в наносекундах на операцию записываются в times
+ */
+void bench_backend(map_backend backend, const uint64_t *keys, size_t n, double times[3])
+{
+    map *mp = map_create_backend(sizeof(uint64_t), sizeof(uint64_t), MAP_KEY_U64, NULL, NULL, backend);
+    volatile uint64_t sink = 0;
+    double start;
+
+    start = now_seconds();
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint64_t key = keys[i], value = i;
+        map_insert(mp, key, value);
+    }
+    times[0] = (now_seconds() - start) * 1e9 / n;
+
+    /* Индексы поисков не зависят от результатов, чтобы процессор мог перекрывать промахи */
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    start = now_seconds();
+    for (size_t i = 0; i < LOOKUPS_COUNT; ++i)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        uint64_t key = keys[state % n];
+        sink += map_iterator_get_value(map_find(mp, key), uint64_t);
+    }
+    times[1] = (now_seconds() - start) * 1e9 / LOOKUPS_COUNT;
+
+    start = now_seconds();
+    for (map_iterator it = map_iterator_first(mp); map_iterator_compare(it, map_iterator_end(mp)) != 0;
+        map_iterator_next(mp, it))
+    {
+        sink += map_iterator_get_key(it, uint64_t);
+    }
+    times[2] = (now_seconds() - start) * 1e9 / n;
+
+    map_free(mp);
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t *keys = malloc(MAX_KEYS * sizeof(uint64_t));
+    if (keys == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < MAX_KEYS; ++i)
+    {
+        /* xorshift64 */
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        keys[i] = state;
+    }
+
+    printf("keys\t\tinsert avl/btree\tfind avl/btree\t\titerate avl/btree (ns/op)\tfind speedup\n");
+    for (size_t n = MIN_KEYS; n <= MAX_KEYS; n *= 4)
+    {
+        double avl[3], btree[3];
+        bench_backend(MAP_BACKEND_AVL, keys, n, avl);
+        bench_backend(MAP_BACKEND_BTREE, keys, n, btree);
+
+        printf("%zu\t\t%.1f / %.1f\t\t%.1f / %.1f\t\t%.1f / %.1f\t\t\t%.2fx\n", n, avl[0], btree[0],
+            avl[1], btree[1], avl[2], btree[2], avl[1] / btree[1]);
+    }
+
+    free(keys);
+    return 0;
+}
@@ -0,0 +1,87 @@
+/**
+ * Бенчмарк построения контейнера map из неотсортированных данных
+ * 
+ * KEYS_COUNT случайных пар ключ-значение загружаются в контейнер 
+ * последовательными вызовами map_insert, а затем функцией map_build_parallel
+ * с количеством потоков от 1 до 32
+ * Для каждого способа печатается время построения и ускорение относительно
+ * map_insert
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <map.h>
+
+#define KEYS_COUNT      (1 << 20)
+#define MAX_THREADS     32
+
+int int_compare_func(const void *f, const void *s) 
+{
+    int int_f = *(const int*)f;
+    int int_s = *(const int*)s;
+    if (int_f < int_s) { return -1; }
+    if (int_f > int_s) { return 1; }
+    return 0;
+}
+
+double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[])
+{
+    int *keys = malloc(KEYS_COUNT * sizeof(int));
+    int *values = malloc(KEYS_COUNT * sizeof(int));
+    if (keys == NULL || values == NULL)
+    {
+        perror("");
+        return EXIT_FAILURE;
+    }
+
+    uint32_t state = 2463534242u;
+    for (int i = 0; i < KEYS_COUNT; ++i)
+    {
+        /* xorshift32 */
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        keys[i] = (int)(state % (KEYS_COUNT * 2));
+        values[i] = i;
+    }
+
+    printf("method\t\tthreads\tseconds\tspeedup\n");
+
+    map *mp = map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+    double start = now_seconds();
+    for (int i = 0; i < KEYS_COUNT; ++i) {
+        map_insert(mp, keys[i], values[i]);
+    }
+    double insert_seconds = now_seconds() - start;
+    map_free(mp);
+
+    printf("map_insert\t1\t%.3f\t1.00x\n", insert_seconds);
+
+    for (size_t threads = 1; threads <= MAX_THREADS; threads *= 2)
+    {
+        mp = map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+        start = now_seconds();
+        map_build_parallel(mp, keys, values, KEYS_COUNT, threads);
+        double build_seconds = now_seconds() - start;
+        map_free(mp);
+
+        printf("build_parallel\t%zu\t%.3f\t%.2fx\n", threads, build_seconds, insert_seconds / build_seconds);
+    }
+
+    free(keys);
+    free(values);
+
+    return EXIT_SUCCESS;
+}
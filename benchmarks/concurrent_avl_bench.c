@@ -0,0 +1,155 @@
+/**
+ * Бенчмарк масштабирования записи контейнеров concurrent_avl и concurrent_map
+ *
+ * От 1 до 32 потоков одновременно выполняют по OPS_PER_THREAD операций
+ * (вставка, поиск, удаление в равных долях) над непересекающимися диапазонами
+ * ключей по KEYS_PER_THREAD ключей на поток
+ * Для каждого количества потоков печатается суммарная пропускная способность
+ * обоих контейнеров
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <concurrent_avl.h>
+#include <concurrent_map.h>
+
+#define KEYS_PER_THREAD     (1 << 14)
+#define OPS_PER_THREAD      (1 << 16)
+#define MAX_THREADS         32
+
+int int_compare_func(const void *f, const void *s)
+{
+    int int_f = *(const int*)f;
+    int int_s = *(const int*)s;
+    if (int_f < int_s) { return -1; }
+    if (int_f > int_s) { return 1; }
+    return 0;
+}
+
+typedef struct worker_args
+{
+    concurrent_avl *    cavl;
+    concurrent_map *    cmap;
+    int                 first_key;
+    uint32_t            seed;
+} worker_args;
+
+double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void *worker(void *arg)
+{
+    worker_args *args = (worker_args *)arg;
+    uint32_t state = args->seed;
+
+    for (size_t i = 0; i < OPS_PER_THREAD; ++i)
+    {
+        /* xorshift32 */
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        int key = args->first_key + (int)(state % KEYS_PER_THREAD);
+        int value = key;
+
+        switch ((state >> 24) % 3)
+        {
+            case 0:
+                if (args->cavl != NULL) {
+                    concurrent_avl_insert(args->cavl, key, value);
+                }
+                else {
+                    concurrent_map_insert(args->cmap, key, value);
+                }
+                break;
+            case 1:
+                if (args->cavl != NULL) {
+                    concurrent_avl_find(args->cavl, key, value);
+                }
+                else {
+                    concurrent_map_find(args->cmap, key, value);
+                }
+                break;
+            default:
+                if (args->cavl != NULL) {
+                    concurrent_avl_erase(args->cavl, key);
+                }
+                else {
+                    concurrent_map_erase(args->cmap, key);
+                }
+                break;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Запускает threads_count потоков над одним из контейнеров (второй указатель
+ * равен NULL) и возвращает пропускную способность в миллионах операций в секунду
+ */
+double run
+(
+    concurrent_avl *    cavl,
+    concurrent_map *    cmap,
+    int                 threads_count
+)
+{
+    pthread_t threads[MAX_THREADS];
+    worker_args args[MAX_THREADS];
+
+    double start = now_seconds();
+
+    for (int t = 0; t < threads_count; ++t)
+    {
+        args[t] = (worker_args){.cavl = cavl, .cmap = cmap,
+            .first_key = t * KEYS_PER_THREAD, .seed = 2463534242u + t};
+        pthread_create(&threads[t], NULL, worker, &args[t]);
+    }
+    for (int t = 0; t < threads_count; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+
+    double elapsed = now_seconds() - start;
+    return (double)threads_count * OPS_PER_THREAD / elapsed / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    printf("threads\tavl Mops/s\tavl speedup\tmap Mops/s\tmap speedup\n");
+
+    double avl_single_thread = 0;
+    double map_single_thread = 0;
+
+    for (int threads_count = 1; threads_count <= MAX_THREADS; threads_count *= 2)
+    {
+        concurrent_avl *cavl = concurrent_avl_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+        concurrent_map *cmap = concurrent_map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+
+        double avl_throughput = run(cavl, NULL, threads_count);
+        double map_throughput = run(NULL, cmap, threads_count);
+        if (threads_count == 1)
+        {
+            avl_single_thread = avl_throughput;
+            map_single_thread = map_throughput;
+        }
+
+        printf("%d\t%.2f\t\t%.2fx\t\t%.2f\t\t%.2fx\n", threads_count,
+            avl_throughput, avl_throughput / avl_single_thread,
+            map_throughput, map_throughput / map_single_thread);
+
+        concurrent_avl_free(cavl);
+        concurrent_map_free(cmap);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+/**
+ * Бенчмарк масштабирования чтения контейнера concurrent_map
+ * 
+ * Контейнер заполняется KEYS_COUNT элементами, после чего от 1 до 32 потоков 
+ * одновременно выполняют по LOOKUPS_PER_THREAD поисков случайных ключей
+ * Для каждого количества потоков печатается суммарная пропускная способность
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <concurrent_map.h>
+
+#define KEYS_COUNT          (1 << 20)
+#define LOOKUPS_PER_THREAD  (1 << 16)
+#define MAX_THREADS         32
+
+int int_compare_func(const void *f, const void *s) 
+{
+    int int_f = *(const int*)f;
+    int int_s = *(const int*)s;
+    if (int_f < int_s) { return -1; }
+    if (int_f > int_s) { return 1; }
+    return 0;
+}
+
+typedef struct reader_args
+{
+    concurrent_map *    cmap;
+    uint32_t            seed;
+    size_t              found;
+} reader_args;
+
+double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void *reader(void *arg)
+{
+    reader_args *args = (reader_args *)arg;
+    uint32_t state = args->seed;
+
+    for (size_t i = 0; i < LOOKUPS_PER_THREAD; ++i)
+    {
+        /* xorshift32 */
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        int key = (int)(state % KEYS_COUNT);
+        int value;
+        if (concurrent_map_find(args->cmap, key, value)) {
+            args->found++;
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    concurrent_map *cmap = concurrent_map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+
+    map *mp = concurrent_map_write_lock(cmap);
+    for (int i = 0; i < KEYS_COUNT; ++i) {
+        map_insert(mp, i, i);
+    }
+    concurrent_map_write_unlock(cmap);
+
+    pthread_t threads[MAX_THREADS];
+    reader_args args[MAX_THREADS];
+
+    printf("threads\tMops/s\tspeedup\n");
+
+    double single_thread_throughput = 0;
+
+    for (int threads_count = 1; threads_count <= MAX_THREADS; threads_count *= 2)
+    {
+        double start = now_seconds();
+
+        for (int t = 0; t < threads_count; ++t)
+        {
+            args[t] = (reader_args){.cmap = cmap, .seed = 2463534242u + t, .found = 0};
+            pthread_create(&threads[t], NULL, reader, &args[t]);
+        }
+        for (int t = 0; t < threads_count; ++t) {
+            pthread_join(threads[t], NULL);
+        }
+
+        double elapsed = now_seconds() - start;
+        double throughput = (double)threads_count * LOOKUPS_PER_THREAD / elapsed / 1e6;
+        if (threads_count == 1) {
+            single_thread_throughput = throughput;
+        }
+
+        printf("%d\t%.2f\t%.2fx\n", threads_count, throughput, throughput / single_thread_throughput);
+    }
+
+    concurrent_map_free(cmap);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,100 @@
+/**
+ * Бенчмарк поиска в frozen_map в сравнении с map
+ * 
+ * Для каждого размера от MIN_KEYS до MAX_KEYS (с шагом x4) контейнер map
+ * заполняется случайными ключами uint64_t (MAP_KEY_U64) и замораживается
+ * функцией map_freeze. Затем в map и frozen_map выполняется LOOKUPS_COUNT
+ * случайных поисков существующих ключей. Печатается время построения
+ * frozen_map, время поиска в наносекундах на операцию и ускорение
+ * 
+ * Для ключей MAP_KEY_U64 frozen_map использует блочный индекс с поиском
+ * командами SIMD
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <map.h>
+
+#define MIN_KEYS         (1 << 10)
+#define MAX_KEYS         (1 << 24)
+#define LOOKUPS_COUNT    (1 << 20)
+
+double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Следующее значение генератора xorshift64
+ */
+uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t *keys = malloc(MAX_KEYS * sizeof(uint64_t));
+    if (keys == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < MAX_KEYS; ++i) {
+        keys[i] = next_random(&state);
+    }
+
+    printf("keys\t\tfreeze (ns/key)\tmap find\tfrozen find (ns/op)\tspeedup\n");
+    for (size_t n = MIN_KEYS; n <= MAX_KEYS; n *= 4)
+    {
+        map *mp = map_create(sizeof(uint64_t), sizeof(uint64_t), MAP_KEY_U64, NULL, NULL);
+        for (size_t i = 0; i < n; ++i)
+        {
+            uint64_t key = keys[i], value = i;
+            map_insert(mp, key, value);
+        }
+
+        double start = now_seconds();
+        frozen_map *fm = map_freeze(mp);
+        double freeze = (now_seconds() - start) * 1e9 / n;
+
+        volatile uint64_t sink = 0;
+        state = 0x9E3779B97F4A7C15ull;
+        start = now_seconds();
+        for (size_t i = 0; i < LOOKUPS_COUNT; ++i)
+        {
+            uint64_t key = keys[next_random(&state) % n];
+            sink += map_iterator_get_value(map_find(mp, key), uint64_t);
+        }
+        double tree = (now_seconds() - start) * 1e9 / LOOKUPS_COUNT;
+
+        state = 0x9E3779B97F4A7C15ull;
+        start = now_seconds();
+        for (size_t i = 0; i < LOOKUPS_COUNT; ++i)
+        {
+            uint64_t key = keys[next_random(&state) % n];
+            sink += frozen_map_get_value(fm, frozen_map_find(fm, key), uint64_t);
+        }
+        double frozen = (now_seconds() - start) * 1e9 / LOOKUPS_COUNT;
+
+        printf("%zu\t\t%.1f\t\t%.1f\t\t%.1f\t\t\t%.2fx\n", n, freeze, tree, frozen, tree / frozen);
+
+        frozen_map_free(fm);
+        map_free(mp);
+    }
+
+    free(keys);
+    return 0;
+}
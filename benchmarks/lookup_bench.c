@@ -0,0 +1,110 @@
+/**
+ * Бенчмарк задержки поиска map_find
+ * 
+ * Для каждого размера контейнера от MIN_KEYS до MAX_KEYS (с шагом x4) в контейнер
+ * вставляются случайные ключи uint64_t (MAP_KEY_U64), после чего выполняется
+ * LOOKUPS_COUNT поисков, образующих цепочку зависимостей: значение найденного
+ * элемента задаёт индекс следующего искомого ключа (цепочка проходит по случайной
+ * циклической перестановке всех ключей). Процессор не может начать
+ * следующий поиск до окончания предыдущего, поэтому время на операцию равно
+ * задержке одного спуска по дереву, а не пропускной способности
+ * 
+ * Для сравнения печатается и время независимых поисков
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <map.h>
+
+#define MIN_KEYS         (1 << 10)
+#define MAX_KEYS         (1 << 22)
+#define LOOKUPS_COUNT    (1 << 20)
+
+double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t *keys = malloc(MAX_KEYS * sizeof(uint64_t));
+    uint64_t *next = malloc(MAX_KEYS * sizeof(uint64_t));
+    if (keys == NULL || next == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < MAX_KEYS; ++i)
+    {
+        /* xorshift64 */
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        keys[i] = state;
+    }
+
+    printf("keys\t\tdependent find (ns/op)\tindependent find (ns/op)\n");
+    for (size_t n = MIN_KEYS; n <= MAX_KEYS; n *= 4)
+    {
+        /* 
+         * Алгоритм Саттоло: перестановка из одного цикла длины n, чтобы цепочка
+         * обходила все ключи и не зацикливалась на нескольких горячих элементах
+         */
+        for (size_t i = 0; i < n; ++i) {
+            next[i] = i;
+        }
+        for (size_t i = n - 1; i > 0; --i)
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            size_t j = state % i;
+            uint64_t tmp = next[i];
+            next[i] = next[j];
+            next[j] = tmp;
+        }
+
+        map *mp = map_create(sizeof(uint64_t), sizeof(uint64_t), MAP_KEY_U64, NULL, NULL);
+        for (size_t i = 0; i < n; ++i)
+        {
+            /* Значение - индекс следующего ключа цепочки */
+            uint64_t key = keys[i], value = next[i];
+            map_insert(mp, key, value);
+        }
+
+        double start = now_seconds();
+        uint64_t index = 0;
+        for (size_t i = 0; i < LOOKUPS_COUNT; ++i) {
+            index = map_iterator_get_value(map_find(mp, keys[index]), uint64_t);
+        }
+        double dependent = (now_seconds() - start) * 1e9 / LOOKUPS_COUNT;
+
+        volatile uint64_t sink = index;
+        state = 0x9E3779B97F4A7C15ull;
+        start = now_seconds();
+        for (size_t i = 0; i < LOOKUPS_COUNT; ++i)
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            sink += map_iterator_get_value(map_find(mp, keys[state % n]), uint64_t);
+        }
+        double independent = (now_seconds() - start) * 1e9 / LOOKUPS_COUNT;
+
+        printf("%zu\t\t%.1f\t\t\t%.1f\n", n, dependent, independent);
+        map_free(mp);
+    }
+
+    free(keys);
+    free(next);
+    return 0;
+}
@@ -0,0 +1,213 @@
+/**
+ * Бенчмарк типизированных контейнеров MAP_DEFINE в сравнении с map
+ * 
+ * Для пар int/int и uint64_t/структура из 32 байт в каждый контейнер
+ * вставляются KEYS_COUNT случайных ключей, затем выполняется столько же
+ * поисков и удалений. Для каждой операции печатается время в наносекундах
+ * и ускорение MAP_DEFINE относительно map
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <map.h>
+#include <map_define.h>
+
+#define KEYS_COUNT      (1 << 20)
+
+typedef struct payload
+{
+    uint64_t    a;
+    uint64_t    b;
+    uint64_t    c;
+    uint64_t    d;
+} payload;
+
+MAP_DEFINE(int_map, int, int, MAP_CMP_NUMBER)
+MAP_DEFINE(u64_map, uint64_t, payload, MAP_CMP_NUMBER)
+
+int int_compare_func(const void *f, const void *s)
+{
+    int int_f = *(const int*)f;
+    int int_s = *(const int*)s;
+    if (int_f < int_s) { return -1; }
+    if (int_f > int_s) { return 1; }
+    return 0;
+}
+
+int u64_compare_func(const void *f, const void *s)
+{
+    uint64_t u64_f = *(const uint64_t*)f;
+    uint64_t u64_s = *(const uint64_t*)s;
+    if (u64_f < u64_s) { return -1; }
+    if (u64_f > u64_s) { return 1; }
+    return 0;
+}
+
+double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void print_row(const char *operation, double generic, double typed)
+{
+    printf("%s\t%.1f\t\t%.1f\t\t%.2fx\n", operation, generic * 1e9 / KEYS_COUNT,
+        typed * 1e9 / KEYS_COUNT, generic / typed);
+}
+
+void bench_int(const uint64_t *random)
+{
+    map *mp = map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+    int_map tm;
+    int_map_init(&tm);
+    double generic[3], typed[3], start;
+    volatile long long sink = 0;
+
+    start = now_seconds();
+    for (size_t i = 0; i < KEYS_COUNT; ++i)
+    {
+        int key = (int)random[i], value = (int)i;
+        map_insert(mp, key, value);
+    }
+    generic[0] = now_seconds() - start;
+
+    start = now_seconds();
+    for (size_t i = 0; i < KEYS_COUNT; ++i) {
+        int_map_insert(&tm, (int)random[i], (int)i);
+    }
+    typed[0] = now_seconds() - start;
+
+    start = now_seconds();
+    for (size_t i = 0; i < KEYS_COUNT; ++i)
+    {
+        int key = (int)random[i];
+        sink += map_iterator_get_value(map_find(mp, key), int);
+    }
+    generic[1] = now_seconds() - start;
+
+    start = now_seconds();
+    for (size_t i = 0; i < KEYS_COUNT; ++i) {
+        sink += *int_map_find(&tm, (int)random[i]);
+    }
+    typed[1] = now_seconds() - start;
+
+    start = now_seconds();
+    for (size_t i = 0; i < KEYS_COUNT; ++i)
+    {
+        int key = (int)random[i];
+        map_iterator it = map_find(mp, key);
+        if (map_iterator_compare(it, map_iterator_end(mp)) != 0) {
+            map_erase(mp, it);
+        }
+    }
+    generic[2] = now_seconds() - start;
+
+    start = now_seconds();
+    for (size_t i = 0; i < KEYS_COUNT; ++i) {
+        int_map_erase(&tm, (int)random[i]);
+    }
+    typed[2] = now_seconds() - start;
+
+    printf("int/int\t\tmap ns/op\tMAP_DEFINE ns/op\tspeedup\n");
+    print_row("insert", generic[0], typed[0]);
+    print_row("find", generic[1], typed[1]);
+    print_row("erase", generic[2], typed[2]);
+
+    map_free(mp);
+    int_map_free(&tm);
+}
+
+void bench_u64(const uint64_t *random)
+{
+    map *mp = map_create(sizeof(uint64_t), sizeof(payload), u64_compare_func, NULL, NULL);
+    u64_map tm;
+    u64_map_init(&tm);
+    double generic[3], typed[3], start;
+    volatile uint64_t sink = 0;
+
+    start = now_seconds();
+    for (size_t i = 0; i < KEYS_COUNT; ++i)
+    {
+        uint64_t key = random[i];
+        payload value = {i, i, i, i};
+        map_insert(mp, key, value);
+    }
+    generic[0] = now_seconds() - start;
+
+    start = now_seconds();
+    for (size_t i = 0; i < KEYS_COUNT; ++i) {
+        u64_map_insert(&tm, random[i], (payload){i, i, i, i});
+    }
+    typed[0] = now_seconds() - start;
+
+    start = now_seconds();
+    for (size_t i = 0; i < KEYS_COUNT; ++i)
+    {
+        uint64_t key = random[i];
+        sink += map_iterator_get_value(map_find(mp, key), payload).a;
+    }
+    generic[1] = now_seconds() - start;
+
+    start = now_seconds();
+    for (size_t i = 0; i < KEYS_COUNT; ++i) {
+        sink += u64_map_find(&tm, random[i])->a;
+    }
+    typed[1] = now_seconds() - start;
+
+    start = now_seconds();
+    for (size_t i = 0; i < KEYS_COUNT; ++i)
+    {
+        uint64_t key = random[i];
+        map_iterator it = map_find(mp, key);
+        if (map_iterator_compare(it, map_iterator_end(mp)) != 0) {
+            map_erase(mp, it);
+        }
+    }
+    generic[2] = now_seconds() - start;
+
+    start = now_seconds();
+    for (size_t i = 0; i < KEYS_COUNT; ++i) {
+        u64_map_erase(&tm, random[i]);
+    }
+    typed[2] = now_seconds() - start;
+
+    printf("\nuint64/struct\tmap ns/op\tMAP_DEFINE ns/op\tspeedup\n");
+    print_row("insert", generic[0], typed[0]);
+    print_row("find", generic[1], typed[1]);
+    print_row("erase", generic[2], typed[2]);
+
+    map_free(mp);
+    u64_map_free(&tm);
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t *random = malloc(KEYS_COUNT * sizeof(uint64_t));
+    if (random == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < KEYS_COUNT; ++i)
+    {
+        /* xorshift64 */
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        random[i] = state;
+    }
+
+    bench_int(random);
+    bench_u64(random);
+
+    free(random);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,148 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef __AVL_LINK_H__
+#define __AVL_LINK_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Связи узла AVL-дерева без ключа и значения
+ * 
+ * Вставка, удаление и перебалансировка работают только со связями, поэтому
+ * одна и та же реализация используется контейнером map и типизированными
+ * контейнерами MAP_DEFINE (см. map_define.h). Структура узла таких контейнеров
+ * должна начинаться с avl_link
+ * 
+ * child[0] - левый ребёнок, child[1] - правый. Спуск выбирает ребёнка 
+ * индексом по результату сравнения, без ветвления
+ * 
+ * balance - разность высот левого и правого поддеревьев
+ */
+typedef struct avl_link
+{
+    struct avl_link *    parent;
+    struct avl_link *    child[2];
+    int8_t               balance;
+} avl_link;
+
+/**
+ * Владелец узлов дерева, часть которых разделяется с другими деревьями 
+ * (см. avl_link_insert_owned и avl_link_erase_owned)
+ * 
+ * Разделяемый узел менять нельзя. Прежде чем изменить узел parent->child[dir],
+ * перебалансировка вызывает own(parent, dir, ctx): функция должна сделать 
+ * ребёнка собственным узлом дерева (при необходимости заменив его в parent
+ * копией) и записать в его поле parent значение parent. parent к этому 
+ * моменту уже является собственным узлом
+ */
+typedef struct avl_link_owner
+{
+    void     (*own)    (avl_link *parent, int dir, void *ctx);
+    void *   ctx;
+} avl_link_owner;
+
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/**
+ * Присоединяет узел node к дереву и восстанавливает балансировку
+ * 
+ * Принимает в качестве аргументов указатель на корень дерева, будущего родителя
+ * узла (NULL - дерево пустое), сторону, с которой присоединяется узел
+ * (true - левый ребёнок), и сам узел
+ * Поля связей узла node инициализируются функцией
+ */
+void
+avl_link_insert
+(
+    avl_link **    root,
+    avl_link *     parent,
+    bool           left,
+    avl_link *     node
+);
+
+/**
+ * То же, что avl_link_insert, для дерева с разделяемыми узлами: узлы, не 
+ * лежащие на пути от корня к parent, перед изменением передаются owner
+ * 
+ * Путь от корня к parent должен состоять из собственных узлов с верными
+ * указателями parent
+ */
+void
+avl_link_insert_owned
+(
+    avl_link **              root,
+    avl_link *               parent,
+    bool                     left,
+    avl_link *               node,
+    const avl_link_owner *   owner
+);
+
+/**
+ * Исключает узел node из дерева и восстанавливает балансировку
+ * 
+ * Принимает в качестве аргументов указатель на корень дерева и исключаемый узел
+ * 
+ * Остальные узлы дерева не перемещаются в памяти: узел с двумя детьми
+ * заменяется на своё место следующим за ним узлом. Освобождение node
+ * остаётся за вызывающей стороной
+ */
+void
+avl_link_erase
+(
+    avl_link **    root,
+    avl_link *     node
+);
+
+/**
+ * То же, что avl_link_erase, для дерева с разделяемыми узлами (см. 
+ * avl_link_insert_owned). Путь от корня к node должен состоять из собственных
+ * узлов с верными указателями parent
+ */
+void
+avl_link_erase_owned
+(
+    avl_link **              root,
+    avl_link *               node,
+    const avl_link_owner *   owner
+);
+
+/**
+ * Возвращает узел с минимальным (avl_link_first) или максимальным
+ * (avl_link_last) ключом в поддереве с корнем root или NULL, если root == NULL
+ */
+avl_link *
+avl_link_first
+(
+    avl_link *root
+);
+
+avl_link *
+avl_link_last
+(
+    avl_link *root
+);
+
+/**
+ * Возвращает узел, следующий за node (avl_link_next) или предшествующий ему
+ * (avl_link_prev) в порядке возрастания ключей, или NULL, если такого нет
+ */
+avl_link *
+avl_link_next
+(
+    avl_link *node
+);
+
+avl_link *
+avl_link_prev
+(
+    avl_link *node
+);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
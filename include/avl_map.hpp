@@ -0,0 +1,544 @@
+#ifndef __AVL_MAP_HPP__
+#define __AVL_MAP_HPP__
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+#include <avl_link.h>
+
+namespace avl
+{
+
+/**
+ * Упорядоченный ассоциативный контейнер для C++ на основе того же AVL-дерева,
+ * что и map (перебалансировка выполняется функциями avl_link.h)
+ * 
+ * В отличие от C API:
+ * - Ключи и значения хранятся в узле как std::pair<const K, V> и создаются
+ *   на месте конструкторами (emplace, try_emplace), без побайтового копирования.
+ *   Значения могут быть только перемещаемыми
+ * - Функция сравнения Compare - объект, вызов которого подставляется в код
+ * - Итераторы двунаправленные и совместимы с алгоритмами STL
+ * - Память узлов выделяется через Allocator, в том числе std::pmr
+ *   (см. avl::pmr::map)
+ * 
+ * Итераторы и ссылки на элементы остаются действительными до удаления
+ * самого элемента. Исключение - итератор end() контейнера, из которого
+ * перемещены элементы: переход от него назад (--end()) недопустим
+ */
+template
+<
+    typename K,
+    typename V,
+    typename Compare = std::less<K>,
+    typename Allocator = std::allocator<std::pair<const K, V>>
+>
+class map
+{
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<const K, V>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using key_compare = Compare;
+    using allocator_type = Allocator;
+    using reference = value_type &;
+    using const_reference = const value_type &;
+
+private:
+    /**
+     * Узел дерева. Связи узла - базовый класс, поэтому указатель на avl_link
+     * приводится к указателю на узел через static_cast
+     */
+    struct node : avl_link
+    {
+        value_type value;
+    };
+
+    using node_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<node>;
+    using node_traits = std::allocator_traits<node_allocator>;
+    using value_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<value_type>;
+    using value_traits = std::allocator_traits<value_allocator>;
+
+    template <bool Const>
+    class basic_iterator
+    {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = typename map::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const value_type *, value_type *>;
+        using reference = std::conditional_t<Const, const value_type &, value_type &>;
+
+        basic_iterator() = default;
+
+        /* Неконстантный итератор неявно приводится к константному */
+        template <bool OtherConst, typename = std::enable_if_t<Const && !OtherConst>>
+        basic_iterator(const basic_iterator<OtherConst> &other)
+            : link_(other.link_), root_(other.root_)
+        {}
+
+        reference operator*() const { return static_cast<node *>(link_)->value; }
+        pointer operator->() const { return &static_cast<node *>(link_)->value; }
+
+        basic_iterator &operator++()
+        {
+            link_ = avl_link_next(link_);
+            return *this;
+        }
+
+        basic_iterator operator++(int)
+        {
+            basic_iterator old = *this;
+            ++(*this);
+            return old;
+        }
+
+        /* Переход назад от end() возвращает последний элемент */
+        basic_iterator &operator--()
+        {
+            link_ = (link_ != nullptr) ? avl_link_prev(link_) : avl_link_last(*root_);
+            return *this;
+        }
+
+        basic_iterator operator--(int)
+        {
+            basic_iterator old = *this;
+            --(*this);
+            return old;
+        }
+
+        friend bool operator==(const basic_iterator &f, const basic_iterator &s) { return f.link_ == s.link_; }
+        friend bool operator!=(const basic_iterator &f, const basic_iterator &s) { return f.link_ != s.link_; }
+
+    private:
+        friend class map;
+        template <bool> friend class basic_iterator;
+
+        basic_iterator(avl_link *link, avl_link *const *root) : link_(link), root_(root) {}
+
+        /* Текущий узел (nullptr - end()) */
+        avl_link *link_ = nullptr;
+        /* Корень дерева контейнера - нужен для перехода назад от end() */
+        avl_link *const *root_ = nullptr;
+    };
+
+public:
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    map() : map(Compare(), Allocator()) {}
+
+    explicit map(const Allocator &alloc) : map(Compare(), alloc) {}
+
+    explicit map(const Compare &compare, const Allocator &alloc = Allocator())
+        : compare_(compare), alloc_(alloc)
+    {}
+
+    map(std::initializer_list<value_type> values, const Compare &compare = Compare(),
+        const Allocator &alloc = Allocator())
+        : map(compare, alloc)
+    {
+        for (const value_type &value : values) {
+            insert(value);
+        }
+    }
+
+    map(const map &other)
+        : compare_(other.compare_),
+          alloc_(node_traits::select_on_container_copy_construction(other.alloc_))
+    {
+        copy_from(other);
+    }
+
+    map(map &&other) noexcept
+        : root_(other.root_), size_(other.size_),
+          compare_(std::move(other.compare_)), alloc_(std::move(other.alloc_))
+    {
+        other.root_ = nullptr;
+        other.size_ = 0;
+    }
+
+    map &operator=(const map &other)
+    {
+        if (this != &other)
+        {
+            clear();
+            if constexpr (node_traits::propagate_on_container_copy_assignment::value) {
+                alloc_ = other.alloc_;
+            }
+            compare_ = other.compare_;
+            copy_from(other);
+        }
+        return *this;
+    }
+
+    map &operator=(map &&other) noexcept(node_traits::is_always_equal::value
+        || node_traits::propagate_on_container_move_assignment::value)
+    {
+        if (this == &other) {
+            return *this;
+        }
+
+        clear();
+        compare_ = std::move(other.compare_);
+        if constexpr (node_traits::propagate_on_container_move_assignment::value) {
+            alloc_ = std::move(other.alloc_);
+        }
+        else if (!node_traits::is_always_equal::value && alloc_ != other.alloc_)
+        /* Узлы другого распределителя забрать нельзя - перемещаем элементы */
+        {
+            for (value_type &value : other) {
+                emplace(std::move(const_cast<K &>(value.first)), std::move(value.second));
+            }
+            other.clear();
+            return *this;
+        }
+
+        root_ = other.root_;
+        size_ = other.size_;
+        other.root_ = nullptr;
+        other.size_ = 0;
+        return *this;
+    }
+
+    ~map() { clear(); }
+
+    allocator_type get_allocator() const { return allocator_type(alloc_); }
+    key_compare key_comp() const { return compare_; }
+
+    /* Итераторы */
+
+    iterator begin() noexcept { return make_iterator(avl_link_first(root_)); }
+    const_iterator begin() const noexcept { return make_iterator(avl_link_first(root_)); }
+    const_iterator cbegin() const noexcept { return begin(); }
+    iterator end() noexcept { return make_iterator(nullptr); }
+    const_iterator end() const noexcept { return make_iterator(nullptr); }
+    const_iterator cend() const noexcept { return end(); }
+
+    reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+    const_reverse_iterator rbegin() const noexcept { return const_reverse_iterator(end()); }
+    reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+    const_reverse_iterator rend() const noexcept { return const_reverse_iterator(begin()); }
+
+    /* Размер */
+
+    bool empty() const noexcept { return size_ == 0; }
+    size_type size() const noexcept { return size_; }
+
+    /* Доступ к элементам */
+
+    V &operator[](const K &key) { return try_emplace(key).first->second; }
+    V &operator[](K &&key) { return try_emplace(std::move(key)).first->second; }
+
+    V &at(const K &key)
+    {
+        iterator it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("avl::map::at: ключ не найден");
+        }
+        return it->second;
+    }
+
+    const V &at(const K &key) const
+    {
+        const_iterator it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("avl::map::at: ключ не найден");
+        }
+        return it->second;
+    }
+
+    /* Вставка */
+
+    /**
+     * Создаёт элемент из args на месте и добавляет его, если ключа ещё нет.
+     * Возвращает итератор на элемент с этим ключом и флаг вставки
+     */
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args &&... args)
+    {
+        node *new_node = create_node(std::forward<Args>(args)...);
+
+        bool left;
+        avl_link *parent;
+        avl_link *found = descend(new_node->value.first, parent, left);
+        if (found != nullptr)
+        {
+            destroy_node(new_node);
+            return {make_iterator(found), false};
+        }
+
+        link_node(parent, left, new_node);
+        return {make_iterator(new_node), true};
+    }
+
+    /**
+     * Если ключа key нет, добавляет элемент со значением, созданным из args.
+     * В противном случае ничего не делает (args не перемещаются)
+     */
+    template <typename Key, typename... Args>
+    std::pair<iterator, bool> try_emplace(Key &&key, Args &&... args)
+    {
+        bool left;
+        avl_link *parent;
+        avl_link *found = descend(key, parent, left);
+        if (found != nullptr) {
+            return {make_iterator(found), false};
+        }
+
+        node *new_node = create_node(std::piecewise_construct,
+            std::forward_as_tuple(std::forward<Key>(key)),
+            std::forward_as_tuple(std::forward<Args>(args)...));
+        link_node(parent, left, new_node);
+        return {make_iterator(new_node), true};
+    }
+
+    std::pair<iterator, bool> insert(const value_type &value) { return try_emplace(value.first, value.second); }
+
+    std::pair<iterator, bool> insert(value_type &&value)
+    {
+        return try_emplace(std::move(const_cast<K &>(value.first)), std::move(value.second));
+    }
+
+    /**
+     * Добавляет элемент или заменяет значение существующего
+     */
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(const K &key, M &&value)
+    {
+        std::pair<iterator, bool> result = try_emplace(key, std::forward<M>(value));
+        if (!result.second) {
+            result.first->second = std::forward<M>(value);
+        }
+        return result;
+    }
+
+    /* Удаление */
+
+    /**
+     * Удаляет элемент, на который указывает pos, и возвращает итератор на
+     * следующий элемент
+     */
+    iterator erase(const_iterator pos)
+    {
+        avl_link *next = avl_link_next(pos.link_);
+        avl_link_erase(&root_, pos.link_);
+        destroy_node(static_cast<node *>(pos.link_));
+        --size_;
+        return make_iterator(next);
+    }
+
+    iterator erase(iterator pos) { return erase(const_iterator(pos)); }
+
+    size_type erase(const K &key)
+    {
+        iterator it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    void clear() noexcept
+    {
+        avl_link *link = root_;
+        while (link != nullptr)
+        /* Обход в обратном порядке без стека: лист удаляется и отцепляется от отца */
+        {
+            if (link->child[0] != nullptr) {
+                link = link->child[0];
+            }
+            else if (link->child[1] != nullptr) {
+                link = link->child[1];
+            }
+            else
+            {
+                avl_link *parent = link->parent;
+                if (parent != nullptr && parent->child[0] == link) {
+                    parent->child[0] = nullptr;
+                }
+                else if (parent != nullptr) {
+                    parent->child[1] = nullptr;
+                }
+                destroy_node(static_cast<node *>(link));
+                link = parent;
+            }
+        }
+        root_ = nullptr;
+        size_ = 0;
+    }
+
+    void swap(map &other) noexcept
+    {
+        using std::swap;
+        swap(root_, other.root_);
+        swap(size_, other.size_);
+        swap(compare_, other.compare_);
+        if constexpr (node_traits::propagate_on_container_swap::value) {
+            swap(alloc_, other.alloc_);
+        }
+    }
+
+    /* Поиск */
+
+    iterator find(const K &key) { return make_iterator(find_link(key)); }
+    const_iterator find(const K &key) const { return make_iterator(find_link(key)); }
+
+    size_type count(const K &key) const { return find_link(key) != nullptr ? 1 : 0; }
+    bool contains(const K &key) const { return find_link(key) != nullptr; }
+
+    /* Первый элемент с ключом, не меньшим key */
+    iterator lower_bound(const K &key) { return make_iterator(bound(key, false)); }
+    const_iterator lower_bound(const K &key) const { return make_iterator(bound(key, false)); }
+
+    /* Первый элемент с ключом, большим key */
+    iterator upper_bound(const K &key) { return make_iterator(bound(key, true)); }
+    const_iterator upper_bound(const K &key) const { return make_iterator(bound(key, true)); }
+
+    std::pair<iterator, iterator> equal_range(const K &key) { return {lower_bound(key), upper_bound(key)}; }
+
+    std::pair<const_iterator, const_iterator> equal_range(const K &key) const
+    {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    friend bool operator==(const map &f, const map &s)
+    {
+        return f.size() == s.size() && std::equal(f.begin(), f.end(), s.begin());
+    }
+
+    friend bool operator!=(const map &f, const map &s) { return !(f == s); }
+
+    friend void swap(map &f, map &s) noexcept { f.swap(s); }
+
+private:
+    iterator make_iterator(avl_link *link) { return iterator(link, &root_); }
+    const_iterator make_iterator(avl_link *link) const { return const_iterator(link, &root_); }
+
+    static const K &key_of(avl_link *link) { return static_cast<node *>(link)->value.first; }
+
+    /**
+     * Спускается от корня к узлу с ключом key и возвращает его или nullptr.
+     * В parent записывается последний пройденный узел, в left - сторона, с
+     * которой к нему нужно присоединить новый узел
+     */
+    template <typename Key>
+    avl_link *descend(const Key &key, avl_link *&parent, bool &left) const
+    {
+        parent = nullptr;
+        left = false;
+        avl_link *current = root_;
+        while (current != nullptr)
+        {
+            parent = current;
+            if (compare_(key, key_of(current)))
+            {
+                left = true;
+                current = current->child[0];
+            }
+            else if (compare_(key_of(current), key))
+            {
+                left = false;
+                current = current->child[1];
+            }
+            else {
+                return current;
+            }
+        }
+        return nullptr;
+    }
+
+    avl_link *find_link(const K &key) const
+    {
+        avl_link *parent;
+        bool left;
+        return descend(key, parent, left);
+    }
+
+    /* Первый узел с ключом, большим key (upper == true) или не меньшим key */
+    avl_link *bound(const K &key, bool upper) const
+    {
+        avl_link *result = nullptr;
+        avl_link *current = root_;
+        while (current != nullptr)
+        {
+            bool go_left = upper ? compare_(key, key_of(current)) : !compare_(key_of(current), key);
+            result = go_left ? current : result;
+            current = current->child[!go_left];
+        }
+        return result;
+    }
+
+    template <typename... Args>
+    node *create_node(Args &&... args)
+    {
+        node *new_node = node_traits::allocate(alloc_, 1);
+        value_allocator value_alloc(alloc_);
+        try {
+            value_traits::construct(value_alloc, &new_node->value, std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            node_traits::deallocate(alloc_, new_node, 1);
+            throw;
+        }
+        return new_node;
+    }
+
+    void destroy_node(node *old_node) noexcept
+    {
+        value_allocator value_alloc(alloc_);
+        value_traits::destroy(value_alloc, &old_node->value);
+        node_traits::deallocate(alloc_, old_node, 1);
+    }
+
+    void link_node(avl_link *parent, bool left, node *new_node) noexcept
+    {
+        avl_link_insert(&root_, parent, left, new_node);
+        ++size_;
+    }
+
+    /* Элементы other добавляются по порядку, поэтому поиск места не нужен */
+    void copy_from(const map &other)
+    {
+        avl_link *last = nullptr;
+        for (const value_type &value : other)
+        {
+            node *new_node = create_node(value);
+            link_node(last, false, new_node);
+            last = new_node;
+        }
+    }
+
+    avl_link *root_ = nullptr;
+    size_type size_ = 0;
+    Compare compare_;
+    node_allocator alloc_;
+};
+
+namespace pmr
+{
+
+/**
+ * avl::map, узлы которого выделяются из std::pmr::memory_resource
+ */
+template <typename K, typename V, typename Compare = std::less<K>>
+using map = avl::map<K, V, Compare, std::pmr::polymorphic_allocator<std::pair<const K, V>>>;
+
+}
+
+}
+
+#endif
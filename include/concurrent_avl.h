@@ -0,0 +1,143 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef __CONCURRENT_AVL_H__
+#define __CONCURRENT_AVL_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+/**
+ * Упорядоченный ассоциативный контейнер с мелкозернистыми блокировками
+ * (оптимистичное конкурентное AVL-дерево Бронсона и др.)
+ * 
+ * Особенности:
+ * - Поиск не захватывает блокировок: узлы содержат версии, и читатель 
+ *   проверяет, что поддерево не было повёрнуто во время спуска
+ * - Вставка и удаление блокируют только узлы, которые они изменяют, поэтому
+ *   операции над непересекающимися диапазонами ключей выполняются параллельно
+ * - Удаление узла с двумя потомками оставляет в дереве узел-маршрутизатор без
+ *   значения, который вырезается позже при перебалансировке
+ * - Удалённые узлы и заменённые значения не освобождаются сразу (их могут 
+ *   читать другие потоки), а откладываются до вызова concurrent_avl_collect
+ *   или concurrent_avl_free
+ * 
+ * Для работы с контейнером используйте предоставленное API
+ */
+typedef struct _concurrent_avl concurrent_avl;
+
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/** 
+ * Выделяет ресурсы для контейнера concurrent_avl и возвращает указатель на него 
+ * 
+ * Аргументы совпадают с аргументами map_create
+ * Удалители вызываются, когда удалённые элементы освобождаются функциями
+ * concurrent_avl_collect и concurrent_avl_free
+ */
+concurrent_avl *
+concurrent_avl_create
+(
+    uint16_t    key_size, 
+    uint16_t    value_size, 
+    int         (*compare_func)       (const void *f, const void *s),
+    void        (*key_destroyer)      (void *key),
+    void        (*value_destroyer)    (void *value)
+);
+
+/**
+ * Освобождает ресурсы, занятые контейнером concurrent_avl
+ * 
+ * Принимает в качестве аргумента указатель на контейнер concurrent_avl
+ * На момент вызова контейнер не должен использоваться другими потоками
+ */
+void
+concurrent_avl_free
+(
+    concurrent_avl *cavl
+);
+
+/**
+ * Освобождает удалённые узлы и заменённые значения, освобождение которых
+ * было отложено
+ * 
+ * Принимает в качестве аргумента указатель на контейнер concurrent_avl
+ * На момент вызова контейнер не должен использоваться другими потоками
+ */
+void
+concurrent_avl_collect
+(
+    concurrent_avl *cavl
+);
+
+/**
+ * Возвращает количество элементов в контейнере
+ * 
+ * Принимает в качестве аргумента указатель на контейнер concurrent_avl
+ */
+size_t
+concurrent_avl_size
+(
+    concurrent_avl *cavl
+);
+
+/**
+ * Добавляет пару ключ-значение в контейнер или заменяет значение, если
+ * элемент с ключом key уже есть
+ * 
+ * Принимает в качестве аргументов указатель на контейнер concurrent_avl, ключ key
+ * и значение value
+ * key и value должны быть lvalue (иметь адрес)
+ */
+#define concurrent_avl_insert(cavl,key,value) _concurrent_avl_insert(cavl,&(key),&(value))
+
+void
+_concurrent_avl_insert
+(
+    concurrent_avl *    cavl,
+    void *              key,
+    void *              value
+);
+
+/**
+ * Выполняет поиск элемента с ключом key и, если элемент найден, копирует его
+ * значение в value и возвращает true. В противном случае возвращает false
+ * 
+ * Принимает в качестве аргументов указатель на контейнер concurrent_avl, ключ key
+ * и переменную value, в которую будет скопировано значение
+ * key и value должны быть lvalue (иметь адрес)
+ */
+#define concurrent_avl_find(cavl,key,value) _concurrent_avl_find(cavl,&(key),&(value))
+
+bool
+_concurrent_avl_find
+(
+    concurrent_avl *    cavl,
+    void *              key,
+    void *              value
+);
+
+/**
+ * Удаляет из контейнера элемент с ключом key. Возвращает true, если элемент 
+ * был удалён
+ * 
+ * Принимает в качестве аргументов указатель на контейнер concurrent_avl и ключ key
+ * key должен быть lvalue (иметь адрес)
+ */
+#define concurrent_avl_erase(cavl,key) _concurrent_avl_erase(cavl,&(key))
+
+bool
+_concurrent_avl_erase
+(
+    concurrent_avl *    cavl,
+    void *              key
+);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
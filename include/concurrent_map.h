@@ -0,0 +1,174 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef __CONCURRENT_MAP_H__
+#define __CONCURRENT_MAP_H__
+
+#include <map.h>
+
+/**
+ * Потокобезопасная обёртка над контейнером map
+ * 
+ * Особенности:
+ * - Защищена блокировкой читатель-писатель: поиск и обход из разных потоков 
+ *   выполняются параллельно, изменения - эксклюзивно
+ * - Несколько изменений можно объединить в одну пишущую секцию 
+ *   (см. concurrent_map_write_lock)
+ * 
+ * Для работы с контейнером используйте предоставленное API
+ */
+typedef struct _concurrent_map concurrent_map;
+
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/** 
+ * Выделяет ресурсы для контейнера concurrent_map и возвращает указатель на него 
+ * 
+ * Аргументы совпадают с аргументами map_create
+ */
+concurrent_map *
+concurrent_map_create
+(
+    uint16_t    key_size, 
+    uint16_t    value_size, 
+    int         (*compare_func)       (const void *f, const void *s),
+    void        (*key_destroyer)      (void *key),
+    void        (*value_destroyer)    (void *value)
+);
+
+/**
+ * Освобождает ресурсы, занятые контейнером concurrent_map
+ * 
+ * Принимает в качестве аргумента указатель на контейнер concurrent_map
+ * На момент вызова контейнер не должен использоваться другими потоками
+ */
+void
+concurrent_map_free
+(
+    concurrent_map *cmap
+);
+
+/**
+ * Возвращает количество элементов в контейнере
+ * 
+ * Принимает в качестве аргумента указатель на контейнер concurrent_map
+ */
+size_t
+concurrent_map_size
+(
+    concurrent_map *cmap
+);
+
+/**
+ * Добавляет пару ключ-значение в контейнер (см. map_insert)
+ * 
+ * Принимает в качестве аргументов указатель на контейнер concurrent_map, ключ key
+ * и значение value
+ * key и value должны быть lvalue (иметь адрес)
+ */
+#define concurrent_map_insert(cmap,key,value) _concurrent_map_insert(cmap,&(key),&(value))
+
+void
+_concurrent_map_insert
+(
+    concurrent_map *    cmap,
+    void *              key,
+    void *              value
+);
+
+/**
+ * Выполняет поиск элемента с ключом key и, если элемент найден, копирует его
+ * значение в value и возвращает true. В противном случае возвращает false
+ * 
+ * Принимает в качестве аргументов указатель на контейнер concurrent_map, ключ key
+ * и переменную value, в которую будет скопировано значение
+ * key и value должны быть lvalue (иметь адрес)
+ * 
+ * Значение копируется, так как итератор перестаёт быть валидным сразу после
+ * снятия блокировки
+ */
+#define concurrent_map_find(cmap,key,value) _concurrent_map_find(cmap,&(key),&(value))
+
+bool
+_concurrent_map_find
+(
+    concurrent_map *    cmap,
+    void *              key,
+    void *              value
+);
+
+/**
+ * Удаляет из контейнера элемент с ключом key с вызовом пользовательских 
+ * удалителей (если они есть). Возвращает true, если элемент был удалён
+ * 
+ * Принимает в качестве аргументов указатель на контейнер concurrent_map и ключ key
+ * key должен быть lvalue (иметь адрес)
+ */
+#define concurrent_map_erase(cmap,key) _concurrent_map_erase(cmap,&(key))
+
+bool
+_concurrent_map_erase
+(
+    concurrent_map *    cmap,
+    void *              key
+);
+
+/**
+ * Начинает читающую секцию и возвращает указатель на внутренний контейнер map
+ * 
+ * Принимает в качестве аргумента указатель на контейнер concurrent_map
+ * 
+ * Внутри читающей секции с возвращённым контейнером можно выполнять только
+ * операции, которые его не изменяют (map_find, итераторы, map_scan, map_clone
+ * и т.д.). Читающие секции разных потоков выполняются параллельно
+ * Секция завершается вызовом concurrent_map_read_unlock
+ */
+map *
+concurrent_map_read_lock
+(
+    concurrent_map *cmap
+);
+
+/**
+ * Завершает читающую секцию
+ * 
+ * Принимает в качестве аргумента указатель на контейнер concurrent_map
+ */
+void
+concurrent_map_read_unlock
+(
+    concurrent_map *cmap
+);
+
+/**
+ * Начинает пишущую секцию и возвращает указатель на внутренний контейнер map
+ * 
+ * Принимает в качестве аргумента указатель на контейнер concurrent_map
+ * 
+ * Внутри пишущей секции с возвращённым контейнером можно выполнять любые 
+ * операции, что позволяет выполнить пачку изменений за одно взятие блокировки
+ * Секция завершается вызовом concurrent_map_write_unlock
+ */
+map *
+concurrent_map_write_lock
+(
+    concurrent_map *cmap
+);
+
+/**
+ * Завершает пишущую секцию
+ * 
+ * Принимает в качестве аргумента указатель на контейнер concurrent_map
+ */
+void
+concurrent_map_write_unlock
+(
+    concurrent_map *cmap
+);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -50,6 +50,207 @@ typedef struct map_iterator
     int16_t dummy8;
 } map_iterator;
 
+/**
+ * Токен продолжения для постраничного обхода контейнера функцией map_scan
+ * 
+ * ВАЖНО: Не пытайтесь напрямую работать с полями токена. Перед первым 
+ *        вызовом map_scan токен должен быть получен из map_resume_token_init
+ */
+typedef struct map_resume_token
+{
+    int16_t dummy1;
+    int16_t dummy2;
+    int16_t dummy3;
+    int16_t dummy4;
+    int16_t dummy5;
+    int16_t dummy6;
+    int16_t dummy7;
+    int16_t dummy8;
+    int16_t dummy9;
+    int16_t dummy10;
+    int16_t dummy11;
+    int16_t dummy12;
+} map_resume_token;
+
+/**
+ * Курсор для поиска ключей, близких к предыдущему искомому (см. map_cursor_seek)
+ * 
+ * ВАЖНО: Не пытайтесь напрямую работать с полями курсора. Курсор должен быть
+ *        получен из map_cursor_init
+ */
+typedef struct map_cursor
+{
+    int16_t dummy1;
+    int16_t dummy2;
+    int16_t dummy3;
+    int16_t dummy4;
+    int16_t dummy5;
+    int16_t dummy6;
+    int16_t dummy7;
+    int16_t dummy8;
+    int16_t dummy9;
+    int16_t dummy10;
+    int16_t dummy11;
+    int16_t dummy12;
+} map_cursor;
+
+/**
+ * Слот читателя контейнера, находящегося в режиме RCU (см. map_rcu_enable)
+ * 
+ * Каждый поток-читатель получает собственный слот функцией map_rcu_register
+ */
+typedef struct _map_rcu_reader map_rcu_reader;
+
+/**
+ * Встроенные функции сравнения для распространённых типов ключей
+ * 
+ * Их можно передавать в map_create вместо пользовательской функции сравнения.
+ * Контейнер распознаёт их и при поиске и вставке сравнивает ключи встроенным
+ * кодом, без косвенного вызова на каждом уровне дерева
+ * 
+ * MAP_KEY_I32   - ключ int32_t (key_size == sizeof(int32_t))
+ * MAP_KEY_U64   - ключ uint64_t (key_size == sizeof(uint64_t))
+ * MAP_KEY_CSTR  - ключ char * - указатель на строку, завершающуюся нулём
+ *                 (key_size == sizeof(char *)), строки сравниваются strcmp
+ * MAP_KEY_BYTES - ключ произвольного размера, сравнивается побайтово (memcmp)
+ */
+#define MAP_KEY_I32 map_key_compare_i32
+#define MAP_KEY_U64 map_key_compare_u64
+#define MAP_KEY_CSTR map_key_compare_cstr
+
+int map_key_compare_i32(const void *f, const void *s);
+int map_key_compare_u64(const void *f, const void *s);
+int map_key_compare_cstr(const void *f, const void *s);
+
+/**
+ * Сравнение без размера ключа невозможно, поэтому MAP_KEY_BYTES - не функция,
+ * а метка режима для map_create, и вызывать её нельзя. Код, который сравнивает
+ * ключи сам (например, обёртки над map), должен использовать map_key_compare_sized
+ */
+#define MAP_KEY_BYTES ((int (*)(const void *f, const void *s))1)
+
+/**
+ * Сравнивает ключи f и s размера key_size так же, как контейнер, созданный с 
+ * функцией сравнения compare_func: для MAP_KEY_BYTES (и MAP_KEY_NORMALIZED) - 
+ * побайтово на всю длину ключа, иначе вызовом compare_func
+ */
+int
+map_key_compare_sized
+(
+    int             (*compare_func)       (const void *f, const void *s),
+    uint16_t        key_size,
+    const void *    f,
+    const void *    s
+);
+
+/**
+ * Режим нормализованных ключей: ключ - байтовая строка длины key_size, 
+ * порядок ключей совпадает с порядком memcmp, поэтому пользовательская функция
+ * сравнения не нужна. Составные ключи приводятся к такому виду кодировщиком 
+ * map_key_encoder (см. ниже). Ключи длиной 8 и 16 байт сравниваются как
+ * 64-битные слова без вызова memcmp. Режим поддерживают и обёртки над map 
+ * (concurrent_map, concurrent_avl, sharded_map) - сравнивают они так же
+ */
+#define MAP_KEY_NORMALIZED MAP_KEY_BYTES
+
+/**
+ * Встроенная функция получения префикса ключа для строковых ключей char *
+ * (см. map_set_key_prefix): первые 8 байт строки в порядке big-endian,
+ * недостающие байты дополняются нулями. Согласована с MAP_KEY_CSTR и strcmp
+ */
+#define MAP_KEY_PREFIX_CSTR map_key_prefix_cstr
+
+uint64_t map_key_prefix_cstr(const void *key);
+
+/**
+ * Встроенные хеш-функции ключей для кэша поиска, фильтра Блума и хеш-индекса
+ * (см. map_set_find_cache, map_set_bloom_filter и map_set_hash_index).
+ * Согласованы с MAP_KEY_I32, MAP_KEY_U64 и MAP_KEY_CSTR: равные ключи имеют
+ * равные хеши
+ */
+#define MAP_KEY_HASH_I32 map_key_hash_i32
+#define MAP_KEY_HASH_U64 map_key_hash_u64
+#define MAP_KEY_HASH_CSTR map_key_hash_cstr
+
+uint64_t map_key_hash_i32(const void *key);
+uint64_t map_key_hash_u64(const void *key);
+uint64_t map_key_hash_cstr(const void *key);
+
+/**
+ * Счётчики кэша поиска (см. map_get_find_cache_stats)
+ */
+typedef struct map_find_cache_stats
+{
+    /**
+     * Количество вызовов map_find, узел для которых найден в кэше
+     */
+    size_t    hits;
+    /**
+     * Количество вызовов map_find, которым пришлось спускаться по дереву
+     */
+    size_t    misses;
+} map_find_cache_stats;
+
+/**
+ * Кодировщик составных ключей для режима MAP_KEY_NORMALIZED
+ * 
+ * Поля ключа записываются в буфер по очереди функциями map_key_encode_*, 
+ * каждое в виде, сохраняющем порядок при побайтовом сравнении. Ключи
+ * сравниваются по первому полю, при равенстве - по второму и т.д.
+ * 
+ * Пример (ключ - пара (int32_t, строка до 12 байт), key_size == 16):
+ * 
+ *   uint8_t key[16];
+ *   map_key_encoder enc;
+ *   map_key_encoder_init(&enc, key, sizeof(key));
+ *   map_key_encode_i32(&enc, id);
+ *   map_key_encode_str(&enc, name, 12);
+ *   map_insert(mp, key, value);
+ * 
+ * ВАЖНО: Не пытайтесь напрямую работать с полями кодировщика
+ */
+typedef struct map_key_encoder
+{
+    uint8_t *    buf;
+    size_t       size;
+    size_t       pos;
+} map_key_encoder;
+
+/**
+ * Начинает кодирование ключа в буфер buf размера size. Буфер заполняется нулями,
+ * поэтому незаписанный хвост ключа не влияет на сравнение
+ */
+void
+map_key_encoder_init
+(
+    map_key_encoder *    enc,
+    void *               buf,
+    size_t               size
+);
+
+/**
+ * Записывают в ключ целое число: старшим байтом вперёд, у знаковых чисел 
+ * инвертируется знаковый бит (отрицательные числа меньше положительных)
+ */
+void map_key_encode_i32(map_key_encoder *enc, int32_t value);
+void map_key_encode_i64(map_key_encoder *enc, int64_t value);
+void map_key_encode_u32(map_key_encoder *enc, uint32_t value);
+void map_key_encode_u64(map_key_encoder *enc, uint64_t value);
+
+/**
+ * Записывает в ключ число с плавающей точкой: у положительных чисел 
+ * инвертируется знаковый бит, у отрицательных - все биты. -0.0 кодируется
+ * как 0.0, NaN больше любого числа
+ */
+void map_key_encode_f64(map_key_encoder *enc, double value);
+
+/**
+ * Записывает в ключ строку str, занимающую ровно width байт: строка короче 
+ * width дополняется нулями, более длинная обрезается (строки, совпадающие 
+ * в первых width байтах, дают одинаковые ключи)
+ */
+void map_key_encode_str(map_key_encoder *enc, const char *str, size_t width);
+
 /*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
 
 /** 
@@ -63,6 +264,10 @@ typedef struct map_iterator
  * будет просто освобождена память, которая была выделена в контейнере 
  * 
  * Пример использования пользовательского удалителя можно посмотреть в examples
+ * 
+ * В качестве функции сравнения можно передать MAP_KEY_I32, MAP_KEY_U64, 
+ * MAP_KEY_CSTR или MAP_KEY_BYTES (см. выше). Размер ключа должен
+ * соответствовать выбранному типу
  */
 map *
 map_create
@@ -74,6 +279,196 @@ map_create
     void        (*value_destroyer)    (void *value)
 );
 
+/**
+ * Структура данных, в которой контейнер хранит элементы (см. map_create_backend)
+ * 
+ * MAP_BACKEND_AVL - AVL-дерево: каждый элемент в отдельном узле. Поддерживает
+ * все функции контейнера, итераторы не инвалидируются при вставке и при
+ * удалении других элементов
+ * 
+ * MAP_BACKEND_BTREE - B+-дерево с широкими (512 байт и больше) узлами: ключи
+ * узла хранятся подряд, а листья связаны в список. Поиск затрагивает
+ * несколько соседних кэш-линий на уровень вместо кэш-промаха на каждом из
+ * ~1.44 * log2(n) уровней AVL-дерева, поэтому на больших контейнерах с
+ * небольшими ключами B+-дерево быстрее (см. benchmarks/btree_bench.c)
+ * 
+ * MAP_BACKEND_SMALL - для контейнеров, которые обычно содержат немного 
+ * элементов: пока элементов не больше 16, они хранятся отсортированным
+ * массивом в том же блоке памяти, что и сам контейнер (без выделения памяти
+ * на элемент и без переходов по указателям при поиске). При вставке 17-го 
+ * элемента контейнер переходит на AVL-дерево, а когда после удалений в нём
+ * остаётся 8 элементов - возвращается к массиву
+ */
+typedef enum map_backend
+{
+    MAP_BACKEND_AVL,
+    MAP_BACKEND_BTREE,
+    MAP_BACKEND_SMALL
+} map_backend;
+
+/**
+ * То же, что map_create, но позволяет выбрать структуру данных, в которой 
+ * хранятся элементы
+ * 
+ * Для MAP_BACKEND_BTREE и MAP_BACKEND_SMALL ключи и значения копируются 
+ * внутри узлов (массива) при вставке и удалении, поэтому любое изменение 
+ * контейнера (map_insert, map_erase, map_steal, map_clear) делает 
+ * недействительными все его итераторы и указатели, полученные через 
+ * map_iterator_get_key/map_iterator_get_value.
+ * Функции map_clone, map_snapshot, map_scan, map_rcu_enable, 
+ * map_parallel_for(_range), map_parallel_reduce(_range), map_set_key_prefix,
+ * map_set_find_cache, map_set_hash_index и map_cursor_init для B+-дерева
+ * не поддерживаются. Для MAP_BACKEND_SMALL функции чтения (map_clone, 
+ * map_snapshot, map_scan, map_cursor_init, map_parallel_*) работают с 
+ * массивом и не меняют контейнер (снимок массива - его копия), а 
+ * map_rcu_enable, map_set_key_prefix, map_set_find_cache и map_set_hash_index
+ * окончательно переводят контейнер на AVL-дерево (к массиву он больше не 
+ * возвращается), что делает недействительными его итераторы. 
+ * map_build_parallel для обоих вставляет элементы по одному
+ */
+map *
+map_create_backend
+(
+    uint16_t       key_size, 
+    uint16_t       value_size, 
+    int            (*compare_func)       (const void *f, const void *s),
+    void           (*key_destroyer)      (void *key),
+    void           (*value_destroyer)    (void *value),
+    map_backend    backend
+);
+
+/**
+ * Создаёт упорядоченное множество - контейнер map без значений 
+ * (value_size == 0) - и возвращает указатель на него
+ * 
+ * Принимает в качестве аргументов размер ключа, функцию сравнения ключей и
+ * пользовательский удалитель ключа (см. map_create)
+ * 
+ * Память под значения не выделяется: узел множества занимает два блока
+ * памяти (узел и ключ) вместо трёх. Ключи добавляются макросом 
+ * map_insert_key, итераторы возвращают только ключи (map_iterator_get_key).
+ * Все остальные функции работают так же, как для обычного контейнера
+ * 
+ * То же самое можно получить, передав value_size == 0 в map_create или
+ * map_create_backend; удалитель значения при этом должен быть NULL
+ */
+map *
+map_create_set
+(
+    uint16_t    key_size, 
+    int         (*compare_func)     (const void *f, const void *s),
+    void        (*key_destroyer)    (void *key)
+);
+
+/**
+ * Включает хранение префиксов ключей в узлах дерева. При поиске и вставке
+ * сначала сравниваются префиксы (целые числа, хранящиеся прямо в узле), и
+ * только при их совпадении вызывается функция сравнения. Для ключей, которые
+ * хранят указатель на данные (например, строки char *), это избавляет от
+ * обращения к ключу на большинстве уровней дерева
+ * 
+ * Принимает в качестве аргументов указатель на контейнер map и функцию
+ * получения префикса ключа (NULL - отключить префиксы)
+ * 
+ * Функция key_prefix должна быть согласована с функцией сравнения: если 
+ * key_prefix(a) < key_prefix(b), то ключ a меньше ключа b. Для строк 
+ * можно использовать MAP_KEY_PREFIX_CSTR
+ * 
+ * Префиксы элементов, уже находящихся в контейнере, вычисляются при вызове
+ */
+void
+map_set_key_prefix
+(
+    map *       mp,
+    uint64_t    (*key_prefix)    (const void *key)
+);
+
+/**
+ * Включает кэш поиска перед деревом. Кэш запоминает узлы, недавно найденные
+ * функцией map_find, и при повторном поиске того же ключа возвращает узел
+ * после одного сравнения ключей вместо спуска от корня. Полезен, когда
+ * большая часть поисков приходится на небольшое число "горячих" ключей
+ * 
+ * Принимает в качестве аргументов указатель на контейнер map, число записей
+ * кэша entries и хеш-функцию ключа key_hash (entries == 0 или key_hash == NULL -
+ * отключить кэш). Для встроенных типов ключей можно использовать MAP_KEY_HASH_*
+ * 
+ * Кэш четырёхканальный ассоциативный: набор из четырёх записей выбирается по
+ * хешу ключа и занимает одну кэш-линию. Число записей округляется вверх до
+ * степени двойки, но не меньше четырёх. Удаление элемента и замена узла копией
+ * (см. map_snapshot) убирают его из кэша, очистка контейнера очищает кэш целиком
+ * 
+ * Поиск изменяет кэш, поэтому контейнер с кэшем нельзя читать функцией
+ * map_find из нескольких потоков одновременно. Не поддерживается для 
+ * MAP_BACKEND_BTREE. Повторный вызов очищает кэш и обнуляет счётчики
+ */
+void
+map_set_find_cache
+(
+    map *       mp,
+    size_t      entries,
+    uint64_t    (*key_hash)    (const void *key)
+);
+
+/**
+ * Возвращает количество попаданий и промахов кэша поиска с момента его 
+ * включения (см. map_set_find_cache). Если кэш отключён, оба счётчика равны 0
+ */
+map_find_cache_stats
+map_get_find_cache_stats
+(
+    map *mp
+);
+
+/**
+ * Включает фильтр Блума ключей контейнера. map_find сначала проверяет ключ 
+ * фильтром и, если ключа точно нет, возвращает map_iterator_end(mp), не
+ * обращаясь к дереву. Полезен, когда значительная часть поисков - промахи
+ * 
+ * Принимает в качестве аргументов указатель на контейнер map и хеш-функцию
+ * ключа key_hash (NULL - отключить фильтр). Для встроенных типов ключей можно
+ * использовать MAP_KEY_HASH_*. Биты, которые проверяет фильтр, берутся из 
+ * всех 64 бит хеша, поэтому хеш должен хорошо перемешивать ключ
+ * 
+ * Фильтр блочный: все биты ключа лежат в одном блоке размером с кэш-линию, 
+ * поэтому проверка читает одну кэш-линию. Размер выбирается автоматически:
+ * фильтр строится заново, когда количество элементов превышает расчётное 
+ * (не менее 8 бит на ключ, сразу после построения - не менее 16), и после 
+ * серии удалений (биты удалённых ключей остаются в фильтре и увеличивают 
+ * долю ложных срабатываний). Сам вызов строит фильтр по текущим элементам 
+ * за O(n)
+ */
+void
+map_set_bloom_filter
+(
+    map *       mp,
+    uint64_t    (*key_hash)    (const void *key)
+);
+
+/**
+ * Включает хеш-индекс узлов дерева: хеш-таблицу с открытой адресацией, 
+ * которая хранит указатели на все узлы контейнера. map_find ищет ключ в 
+ * индексе за O(1) в среднем вместо спуска по дереву за O(log n), а 
+ * map_lower_bound_with, map_upper_bound_with, итераторы и остальные функции
+ * по-прежнему работают с деревом
+ * 
+ * Принимает в качестве аргументов указатель на контейнер map и хеш-функцию
+ * ключа key_hash (NULL - отключить индекс). Для встроенных типов ключей можно
+ * использовать MAP_KEY_HASH_*
+ * 
+ * map_insert и map_erase изменяют индекс вместе с деревом. Индекс занимает
+ * от 32 до 64 байт на элемент и увеличивается вдвое при заполнении наполовину.
+ * Сам вызов строит индекс по текущим элементам за O(n). Кэш поиска 
+ * (map_set_find_cache) при включённом индексе не используется. Не 
+ * поддерживается для MAP_BACKEND_BTREE
+ */
+void
+map_set_hash_index
+(
+    map *       mp,
+    uint64_t    (*key_hash)    (const void *key)
+);
+
 /**
  * Освобождает ресурсы, занятые контейнером map
  * 
@@ -116,6 +511,14 @@ map_empty
  */
 #define map_insert(mp,key,value) _map_insert(mp,&(key),&(value))
 
+/**
+ * Добавляет ключ в множество (контейнер с value_size == 0, см. map_create_set)
+ * 
+ * Принимает в качестве аргументов указатель на контейнер map и ключ key
+ * key должен быть lvalue (иметь адрес)
+ */
+#define map_insert_key(mp,key) _map_insert(mp,&(key),NULL)
+
 void 
 _map_insert
 (
@@ -229,6 +632,44 @@ _map_find
     void *    key
 );
 
+/**
+ * Поиск по пробе - значению произвольного типа, которое не обязано быть ключом
+ * контейнера (например, подстрока буфера без завершающего нуля при строковых
+ * ключах). Ключ не создаётся, память не выделяется
+ * 
+ * probe_cmp(node_key, probe) возвращает отрицательное число, 0 или положительное
+ * число, если ключ узла меньше пробы, равен ей или больше неё. Порядок должен
+ * быть согласован с функцией сравнения контейнера
+ * 
+ * map_find_with возвращает итератор на элемент, равный пробе, 
+ * map_lower_bound_with - на первый элемент, не меньший пробы,
+ * map_upper_bound_with - на первый элемент, больший пробы.
+ * Если такого элемента нет, возвращается map_iterator_end(mp)
+ */
+map_iterator
+map_find_with
+(
+    map *           mp,
+    const void *    probe,
+    int             (*probe_cmp)    (const void *node_key, const void *probe)
+);
+
+map_iterator
+map_lower_bound_with
+(
+    map *           mp,
+    const void *    probe,
+    int             (*probe_cmp)    (const void *node_key, const void *probe)
+);
+
+map_iterator
+map_upper_bound_with
+(
+    map *           mp,
+    const void *    probe,
+    int             (*probe_cmp)    (const void *node_key, const void *probe)
+);
+
 /**
  * Возвращает итератор, содержащий первый элемент контейнера
  * Если контейнер пуст, результат вызова функции
@@ -288,6 +729,7 @@ _map_iterator_get_key
  * Принимает в качестве аргументов итератор и тип значения
  * 
  * Обратите внимание: операция map_iterator_get_value(map_iterator_end(mp),T) запрещена
+ * У множества (value_size == 0) значений нет, и значение читать нельзя
  */
 #define map_iterator_get_value(iter,type) (*(type *)_map_iterator_get_value(iter))
 
@@ -297,6 +739,503 @@ _map_iterator_get_value
     map_iterator iter
 );
 
+/**
+ * Создаёт полную копию контейнера map и возвращает указатель на неё
+ * 
+ * Принимает в качестве аргументов указатель на контейнер map, функцию копирования
+ * ключа и функцию копирования значения. Функции копирования получают указатель
+ * на уже выделенный буфер dst (key_size или value_size байт) и на исходный 
+ * ключ/значение src
+ * 
+ * Если передать в качестве функций копирования NULL, то ключи и значения будут
+ * скопированы побайтово. Обратите внимание: если ключи или значения владеют
+ * ресурсами (например, являются указателями на строки) и для контейнера заданы
+ * удалители, функции копирования необходимо передать, иначе ресурсы будут
+ * освобождены дважды
+ * 
+ * Копия повторяет форму исходного дерева узел в узел и строится за один 
+ * линейный проход без сравнений ключей и поворотов. Копия контейнера 
+ * MAP_BACKEND_SMALL, элементы которого хранятся в массиве, тоже хранит их
+ * в массиве
+ */
+map *
+map_clone
+(
+    map *    mp,
+    void     (*key_copier)      (void *dst, const void *src),
+    void     (*value_copier)    (void *dst, const void *src)
+);
+
+/**
+ * То же, что map_clone, но копирует дерево, используя до threads потоков:
+ * левое поддерево узла копирует новый поток, правое - текущий, пока потоки
+ * не закончатся (как при построении дерева в map_build_parallel)
+ * 
+ * Функции копирования вызываются из нескольких потоков одновременно и 
+ * должны быть потокобезопасны. Копирование упирается в malloc и пропускную
+ * способность памяти, поэтому выигрыш заметен на больших деревьях и при
+ * дорогих функциях копирования
+ */
+map *
+map_clone_parallel
+(
+    map *     mp,
+    void      (*key_copier)      (void *dst, const void *src),
+    void      (*value_copier)    (void *dst, const void *src),
+    size_t    threads
+);
+
+/**
+ * Задаёт функции копирования ключа и значения, которые контейнер использует,
+ * когда ему нужно сделать собственную копию узла, разделяемого со снимками
+ * (см. map_snapshot)
+ * 
+ * Принимает в качестве аргументов указатель на контейнер map, функцию копирования
+ * ключа и функцию копирования значения (см. map_clone)
+ * 
+ * По умолчанию (NULL) ключи и значения копируются побайтово
+ */
+void
+map_set_copiers
+(
+    map *    mp,
+    void     (*key_copier)      (void *dst, const void *src),
+    void     (*value_copier)    (void *dst, const void *src)
+);
+
+/**
+ * Создаёт неизменяемый снимок текущего состояния контейнера map за O(1) и 
+ * возвращает указатель на него
+ * 
+ * Принимает в качестве аргумента указатель на контейнер map
+ * 
+ * Снимок является обычным контейнером map, доступным только для чтения: с ним
+ * работают map_find, итераторы, map_scan и т.д., а попытка изменить его 
+ * завершает программу с ошибкой. Снимок освобождается функцией map_free
+ * 
+ * Снимки и контейнер разделяют узлы дерева, каждый узел освобождается вместе
+ * с последней ссылкой на него. Пока у контейнера есть живые снимки, вставка и
+ * удаление копируют только узлы на пути от корня и узлы, затронутые поворотами, -
+ * O(log n) узлов (см. map_set_copiers). Каждое такое изменение делает итераторы
+ * контейнера невалидными. Снимки при этом не меняются, поэтому их можно читать
+ * из других потоков, пока владелец контейнера продолжает его изменять
+ * 
+ * Указатели на родителей у разделяемых узлов могут относиться к другому 
+ * дереву, поэтому переход итератора к соседнему элементу у контейнера, 
+ * изменённого после снимка, и у снимков таких контейнеров занимает O(log n).
+ * Первое изменение после освобождения всех снимков восстанавливает 
+ * указатели за O(n)
+ */
+map *
+map_snapshot
+(
+    map *mp
+);
+
+/**
+ * Возвращает новый токен продолжения для функции map_scan
+ */
+map_resume_token
+map_resume_token_init
+(
+    void
+);
+
+/**
+ * Копирует до max элементов контейнера в порядке возрастания ключей в плоские
+ * массивы keys_out (по key_size байт на ключ) и values_out (по value_size байт
+ * на значение) и возвращает количество скопированных элементов
+ * 
+ * Принимает в качестве аргументов указатель на контейнер map, ключ start_key,
+ * максимальное количество элементов max, буферы keys_out и values_out, а так же
+ * указатель на токен продолжения token
+ * 
+ * При первом вызове с новым токеном обход начинается с первого элемента, ключ
+ * которого не меньше start_key (если start_key == NULL - с первого элемента 
+ * контейнера). Последующие вызовы с тем же токеном продолжают обход с места 
+ * остановки, start_key при этом игнорируется. Если функция вернула 0, обход окончен
+ * 
+ * Любой из буферов keys_out и values_out может быть NULL - тогда соответствующий
+ * столбец не копируется
+ * 
+ * Обратите внимание: вставка новых и удаление элементов между вызовами делают 
+ * токен невалидным (обход нужно начать заново с новым токеном). Замена значения 
+ * по существующему ключу токен не инвалидирует
+ */
+size_t
+map_scan
+(
+    map *                 mp,
+    const void *          start_key,
+    size_t                max,
+    void *                keys_out,
+    void *                values_out,
+    map_resume_token *    token
+);
+
+/**
+ * Возвращает новый курсор контейнера map
+ */
+map_cursor
+map_cursor_init
+(
+    map *mp
+);
+
+/**
+ * Возвращает итератор на первый элемент, ключ которого не меньше key, или
+ * map_iterator_end(mp), если такого элемента нет, и запоминает найденный узел
+ * в курсоре
+ * 
+ * Принимает в качестве аргументов курсор и ключ key (оба должны быть lvalue)
+ * 
+ * Поиск начинается не от корня, а от узла, найденного предыдущим вызовом: 
+ * поднимаемся от него до поддерева, в диапазон которого попадает key, и 
+ * спускаемся в этом поддереве. Если между предыдущим и новым ключом d 
+ * элементов, поиск занимает O(log d) шагов, поэтому последовательность 
+ * близких ключей (например, отсортированная пачка поисков) обрабатывается 
+ * быстрее, чем отдельными вызовами map_find
+ * 
+ * Вставка новых и удаление элементов сбрасывают курсор: следующий поиск 
+ * начнётся от корня. Замена значения по существующему ключу курсор не сбрасывает
+ */
+#define map_cursor_seek(cursor,key) _map_cursor_seek(&(cursor),&key)
+
+map_iterator
+_map_cursor_seek
+(
+    map_cursor *    cursor,
+    const void *    key
+);
+
+/**
+ * Переводит контейнер map в режим RCU: один поток-писатель и любое количество
+ * потоков-читателей, которые выполняют поиск функцией map_rcu_find без 
+ * блокировок и без атомарных операций чтения-модификации-записи
+ * 
+ * Принимает в качестве аргумента указатель на контейнер map
+ * 
+ * В режиме RCU:
+ * - Изменять контейнер (map_insert, map_erase, map_clear) может только один
+ *   поток одновременно; остальные функции API, кроме map_rcu_find, также 
+ *   можно вызывать только из потока-писателя
+ * - Узлы, удалённые из дерева, и заменённые значения освобождаются не сразу, 
+ *   а после того, как все читатели, которые могли их видеть, завершат поиск
+ *   (освобождение на основе эпох). Удалители вызываются в момент освобождения
+ * - Замена значения по существующему ключу выделяет новый буфер значения, 
+ *   поэтому указатели на значение, полученные ранее через итератор, становятся
+ *   невалидными
+ * - Снимки (map_snapshot) не поддерживаются
+ * 
+ * Функция должна быть вызвана до того, как контейнер начнут читать другие потоки
+ */
+void
+map_rcu_enable
+(
+    map *mp
+);
+
+/**
+ * Выделяет слот для потока-читателя и возвращает указатель на него
+ * 
+ * Принимает в качестве аргумента указатель на контейнер map в режиме RCU
+ * Слот используется только одним потоком и освобождается функцией map_rcu_unregister
+ */
+map_rcu_reader *
+map_rcu_register
+(
+    map *mp
+);
+
+/**
+ * Освобождает слот читателя. Слот может быть повторно выдан map_rcu_register
+ * 
+ * Принимает в качестве аргументов указатель на контейнер map и слот читателя
+ */
+void
+map_rcu_unregister
+(
+    map *               mp,
+    map_rcu_reader *    reader
+);
+
+/**
+ * Выполняет поиск элемента с ключом key и, если элемент найден, копирует его
+ * значение в value и возвращает true. В противном случае возвращает false
+ * 
+ * Принимает в качестве аргументов указатель на контейнер map в режиме RCU, 
+ * слот читателя, ключ key и переменную value, в которую будет скопировано значение
+ * key и value должны быть lvalue (иметь адрес)
+ * 
+ * Функцию можно вызывать одновременно с изменением контейнера писателем. 
+ * Если дерево изменилось во время поиска, поиск повторяется
+ */
+#define map_rcu_find(mp,reader,key,value) _map_rcu_find(mp,reader,&(key),&(value))
+
+bool
+_map_rcu_find
+(
+    map *               mp,
+    map_rcu_reader *    reader,
+    void *              key,
+    void *              value
+);
+
+/**
+ * Дожидается, пока все читатели завершат поиски, начатые до вызова функции, 
+ * и освобождает все отложенные узлы и значения
+ * 
+ * Принимает в качестве аргумента указатель на контейнер map
+ * Вызывается потоком-писателем
+ */
+void
+map_rcu_synchronize
+(
+    map *mp
+);
+
+/**
+ * Заполняет контейнер map n парами ключ-значение из плоских массивов keys 
+ * (по key_size байт на ключ) и values (по value_size байт на значение), 
+ * используя до threads потоков
+ * 
+ * Принимает в качестве аргументов указатель на контейнер map, массивы keys и
+ * values, количество элементов n и количество потоков threads. У множества
+ * (value_size == 0) values может быть NULL
+ * 
+ * Входные данные могут быть не отсортированы и содержать повторяющиеся ключи:
+ * из них в контейнер попадает значение, встретившееся последним (как при 
+ * последовательных вызовах map_insert). Пустой контейнер строится за 
+ * O(n log n / threads + n): массив сортируется параллельной сортировкой
+ * слиянием, после чего сбалансированные поддеревья строятся параллельно.
+ * В непустой контейнер элементы вставляются по одному функцией map_insert
+ */
+void
+map_build_parallel
+(
+    map *           mp,
+    const void *    keys,
+    const void *    values,
+    size_t          n,
+    size_t          threads
+);
+
+/**
+ * Вызывает функцию fn для каждого элемента контейнера map, распределяя 
+ * элементы между threads потоками
+ * 
+ * Принимает в качестве аргументов указатель на контейнер map, функцию fn,
+ * пользовательский контекст ctx (передаётся в fn) и количество потоков threads
+ * 
+ * Дерево разбивается на поддеревья (примерно 8 на поток), которые потоки 
+ * разбирают по мере освобождения. Порядок вызовов fn не определён, вызовы 
+ * из разных потоков выполняются одновременно. fn может изменять значение, 
+ * но не ключ; изменять контейнер во время обхода нельзя
+ */
+void
+map_parallel_for
+(
+    map *     mp,
+    void      (*fn)    (const void *key, void *value, void *ctx),
+    void *    ctx,
+    size_t    threads
+);
+
+/**
+ * То же, что map_parallel_for, но только для элементов с ключами из 
+ * полуинтервала [lo, hi). Если lo (hi) равен NULL, диапазон не ограничен 
+ * снизу (сверху)
+ */
+void
+map_parallel_for_range
+(
+    map *           mp,
+    const void *    lo,
+    const void *    hi,
+    void            (*fn)    (const void *key, void *value, void *ctx),
+    void *          ctx,
+    size_t          threads
+);
+
+/**
+ * Сворачивает элементы контейнера map в значение размером acc_size байт,
+ * распределяя элементы между threads потоками, и записывает его в result
+ * 
+ * Принимает в качестве аргументов указатель на контейнер map, функцию map_fn,
+ * добавляющую элемент к аккумулятору acc, функцию combine_fn, добавляющую 
+ * к аккумулятору acc аккумулятор other, нейтральный элемент identity, размер
+ * аккумулятора acc_size, буфер result, контекст ctx и количество потоков threads
+ * 
+ * Каждое поддерево сворачивается в собственный аккумулятор, начиная с identity,
+ * после чего аккумуляторы объединяются в порядке возрастания ключей. Поэтому
+ * combine_fn должна быть ассоциативной, но не обязана быть коммутативной
+ */
+void
+map_parallel_reduce
+(
+    map *           mp,
+    void            (*map_fn)        (const void *key, const void *value, void *acc, void *ctx),
+    void            (*combine_fn)    (void *acc, const void *other, void *ctx),
+    const void *    identity,
+    size_t          acc_size,
+    void *          result,
+    void *          ctx,
+    size_t          threads
+);
+
+/**
+ * То же, что map_parallel_reduce, но только для элементов с ключами из 
+ * полуинтервала [lo, hi). Если lo (hi) равен NULL, диапазон не ограничен 
+ * снизу (сверху)
+ */
+void
+map_parallel_reduce_range
+(
+    map *           mp,
+    const void *    lo,
+    const void *    hi,
+    void            (*map_fn)        (const void *key, const void *value, void *acc, void *ctx),
+    void            (*combine_fn)    (void *acc, const void *other, void *ctx),
+    const void *    identity,
+    size_t          acc_size,
+    void *          result,
+    void *          ctx,
+    size_t          threads
+);
+
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/**
+ * Неизменяемая копия контейнера map, оптимизированная для поиска
+ * 
+ * Ключи лежат в одном массиве без указателей в порядке Эйтцингера (неявное
+ * двоичное дерево поиска, записанное по уровням), поиск не содержит 
+ * непредсказуемых ветвлений и заранее загружает следующие уровни. Подходит
+ * для контейнеров, которые строятся один раз, а затем только читаются
+ * 
+ * Для ключей MAP_KEY_I32 и MAP_KEY_U64 ключи хранятся по возрастанию блоками
+ * по 16 с многоуровневым индексом из таких же блоков, и каждый блок 
+ * сравнивается с искомым ключом одной последовательностью команд AVX2 или
+ * SSE4.2 (набор команд выбирается во время выполнения, на других процессорах
+ * используется обычный код)
+ * 
+ * Элемент задаётся позицией типа size_t. Позиция FROZEN_MAP_END обозначает
+ * отсутствие элемента. Позиции не меняются до освобождения frozen_map
+ */
+typedef struct _frozen_map frozen_map;
+
+#define FROZEN_MAP_END ((size_t)0)
+
+/**
+ * Создаёт frozen_map из текущего содержимого контейнера за O(n)
+ * 
+ * Принимает в качестве аргумента указатель на контейнер map
+ * 
+ * Ключи и значения копируются побайтово, удалители к ним не применяются.
+ * Если ключи или значения содержат указатели на данные, принадлежащие map,
+ * frozen_map можно использовать, пока эти данные не освобождены
+ */
+frozen_map *
+map_freeze
+(
+    map *mp
+);
+
+/**
+ * Освобождает ресурсы, занятые frozen_map
+ */
+void
+frozen_map_free
+(
+    frozen_map *fm
+);
+
+/**
+ * Возвращает количество элементов frozen_map
+ */
+size_t
+frozen_map_size
+(
+    frozen_map *fm
+);
+
+/**
+ * Возвращает позицию элемента с ключом key или FROZEN_MAP_END
+ * key должен быть lvalue (иметь адрес)
+ */
+#define frozen_map_find(fm,key) _frozen_map_find(fm,&(key))
+
+size_t
+_frozen_map_find
+(
+    frozen_map *    fm,
+    const void *    key
+);
+
+/**
+ * Возвращают позицию первого элемента, ключ которого не меньше 
+ * (frozen_map_lower_bound) или больше (frozen_map_upper_bound) key, либо
+ * FROZEN_MAP_END. Вместе с frozen_map_next используются для обхода диапазона
+ * key должен быть lvalue (иметь адрес)
+ */
+#define frozen_map_lower_bound(fm,key) _frozen_map_lower_bound(fm,&(key))
+#define frozen_map_upper_bound(fm,key) _frozen_map_upper_bound(fm,&(key))
+
+size_t
+_frozen_map_lower_bound
+(
+    frozen_map *    fm,
+    const void *    key
+);
+
+size_t
+_frozen_map_upper_bound
+(
+    frozen_map *    fm,
+    const void *    key
+);
+
+/**
+ * Возвращает позицию элемента с минимальным ключом или FROZEN_MAP_END,
+ * если frozen_map пуст
+ */
+size_t
+frozen_map_first
+(
+    frozen_map *fm
+);
+
+/**
+ * Возвращает позицию элемента, следующего за pos в порядке возрастания 
+ * ключей, или FROZEN_MAP_END. Обход всех элементов занимает O(n)
+ */
+size_t
+frozen_map_next
+(
+    frozen_map *    fm,
+    size_t          pos
+);
+
+/**
+ * Получение ключа и значения элемента по позиции
+ */
+#define frozen_map_get_key(fm,pos,type) (*(type *)_frozen_map_get_key(fm,pos))
+#define frozen_map_get_value(fm,pos,type) (*(type *)_frozen_map_get_value(fm,pos))
+
+void *
+_frozen_map_get_key
+(
+    frozen_map *    fm,
+    size_t          pos
+);
+
+void *
+_frozen_map_get_value
+(
+    frozen_map *    fm,
+    size_t          pos
+);
+
 /*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
 
 void map_print(map *mp, char *(*key_to_str)(const void *), char *(*value_to_str)(const void *));
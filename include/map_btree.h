@@ -0,0 +1,163 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef __MAP_BTREE_H__
+#define __MAP_BTREE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * B+-дерево с широкими узлами - альтернативное хранилище контейнера map
+ * (см. MAP_BACKEND_BTREE в map.h)
+ * 
+ * Ключи узла хранятся подряд, поэтому поиск внутри узла затрагивает несколько
+ * соседних строк кэша вместо одной строки на каждый уровень AVL-дерева.
+ * Листья связаны в двусвязный список
+ * 
+ * Элемент дерева задаётся слотом - указателем на ключ внутри листа. Слот
+ * остаётся действительным до следующего изменения дерева
+ * 
+ * Функции предназначены для использования контейнером map и не проверяют
+ * аргументы
+ */
+typedef struct _map_btree map_btree;
+
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/**
+ * Создаёт пустое дерево
+ * 
+ * Принимает в качестве аргументов размер ключа, размер значения и функцию
+ * сравнения ключей (встроенные функции MAP_KEY_* распознаются так же, как
+ * в map_create)
+ */
+map_btree *
+map_btree_create
+(
+    uint16_t    key_size,
+    uint16_t    value_size,
+    int         (*compare_func)    (const void *f, const void *s)
+);
+
+/**
+ * Удаляет все элементы дерева, вызывая для них удалители (могут быть NULL)
+ */
+void
+map_btree_clear
+(
+    map_btree *    bt,
+    void           (*key_destroyer)      (void *key),
+    void           (*value_destroyer)    (void *value)
+);
+
+/**
+ * Освобождает дерево вместе с элементами (см. map_btree_clear)
+ */
+void
+map_btree_free
+(
+    map_btree *    bt,
+    void           (*key_destroyer)      (void *key),
+    void           (*value_destroyer)    (void *value)
+);
+
+/**
+ * Добавляет пару ключ-значение. Если ключ уже есть, заменяет значение
+ * Возвращает true, если был добавлен новый элемент
+ */
+bool
+map_btree_insert
+(
+    map_btree *     bt,
+    const void *    key,
+    const void *    value
+);
+
+/**
+ * Возвращает слот элемента с ключом key или NULL, если такого элемента нет
+ */
+void *
+map_btree_find
+(
+    map_btree *     bt,
+    const void *    key
+);
+
+/**
+ * Возвращает слот первого элемента, ключ которого больше пробы (upper == true)
+ * или не меньше неё, либо NULL. probe_cmp(node_key, probe) сравнивает ключ
+ * с пробой (см. map_lower_bound_with)
+ */
+void *
+map_btree_bound
+(
+    map_btree *     bt,
+    const void *    probe,
+    int             (*probe_cmp)    (const void *node_key, const void *probe),
+    bool            upper
+);
+
+/**
+ * Удаляет элемент, заданный слотом, вызывая для него удалители (могут быть NULL)
+ */
+void
+map_btree_erase
+(
+    map_btree *    bt,
+    void *         slot,
+    void           (*key_destroyer)      (void *key),
+    void           (*value_destroyer)    (void *value)
+);
+
+/**
+ * Возвращают слот первого (map_btree_first) или последнего (map_btree_last)
+ * элемента, либо NULL, если дерево пусто
+ */
+void *
+map_btree_first
+(
+    map_btree *bt
+);
+
+void *
+map_btree_last
+(
+    map_btree *bt
+);
+
+/**
+ * Возвращают слот следующего (map_btree_next) или предыдущего (map_btree_prev)
+ * элемента, либо NULL, если такого нет
+ */
+void *
+map_btree_next
+(
+    map_btree *    bt,
+    void *         slot
+);
+
+void *
+map_btree_prev
+(
+    map_btree *    bt,
+    void *         slot
+);
+
+/**
+ * Возвращает указатель на значение элемента, заданного слотом
+ */
+void *
+map_btree_value
+(
+    map_btree *    bt,
+    void *         slot
+);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
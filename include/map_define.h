@@ -0,0 +1,246 @@
+#ifndef __MAP_DEFINE_H__
+#define __MAP_DEFINE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <avl_link.h>
+
+/**
+ * Генератор типизированных контейнеров на основе AVL-дерева
+ * 
+ * MAP_DEFINE(name, K, V, CMP) определяет тип контейнера name с ключами типа K
+ * и значениями типа V и набор static inline функций для работы с ним:
+ * 
+ *   name_init, name_free, name_size, name_find, name_insert, name_erase,
+ *   name_first, name_last, name_next, name_prev
+ * 
+ * В отличие от map, ключ и значение хранятся прямо в узле, копируются
+ * присваиванием, а сравнение ключей CMP подставляется в код поиска.
+ * Перебалансировка дерева общая с map (см. avl_link.h)
+ * 
+ * CMP(a,b) - выражение или макрос, возвращающий отрицательное число, 0 или
+ * положительное число, если ключ a меньше, равен или больше ключа b
+ * соответственно. Для чисел можно использовать MAP_CMP_NUMBER
+ * 
+ * Пример:
+ * 
+ *   MAP_DEFINE(int_map, int, int, MAP_CMP_NUMBER)
+ * 
+ *   int_map m;
+ *   int_map_init(&m);
+ *   int_map_insert(&m, 1, 10);
+ *   int *value = int_map_find(&m, 1);
+ *   int_map_free(&m);
+ * 
+ * MAP_DEFINE следует использовать один раз для каждого name в области
+ * видимости файла
+ */
+
+/**
+ * Сравнение чисел для MAP_DEFINE
+ */
+#define MAP_CMP_NUMBER(a,b) (((a) > (b)) - ((a) < (b)))
+
+#define MAP_DEFINE(name,K,V,CMP)                                                        \
+                                                                                        \
+typedef struct name##_node                                                              \
+{                                                                                       \
+    avl_link    link;                                                                   \
+    K           key;                                                                    \
+    V           value;                                                                  \
+} name##_node;                                                                          \
+                                                                                        \
+typedef struct name                                                                     \
+{                                                                                       \
+    avl_link *    root;                                                                 \
+    size_t        size;                                                                 \
+} name;                                                                                 \
+                                                                                        \
+/* Инициализирует пустой контейнер */                                                   \
+static inline void                                                                      \
+name##_init                                                                             \
+(                                                                                       \
+    name *mp                                                                            \
+)                                                                                       \
+{                                                                                       \
+    mp->root = NULL;                                                                    \
+    mp->size = 0;                                                                       \
+}                                                                                       \
+                                                                                        \
+/* Освобождает все узлы контейнера. После вызова контейнер пуст */                      \
+static inline void                                                                      \
+name##_free                                                                             \
+(                                                                                       \
+    name *mp                                                                            \
+)                                                                                       \
+{                                                                                       \
+    avl_link *node = mp->root;                                                          \
+    while (node)                                                                        \
+    {                                                                                   \
+        if (node->child[0]) {                                                           \
+            node = node->child[0];                                                      \
+        }                                                                               \
+        else if (node->child[1]) {                                                      \
+            node = node->child[1];                                                      \
+        }                                                                               \
+        else                                                                            \
+        {                                                                               \
+            avl_link *parent = node->parent;                                            \
+            if (parent && parent->child[0] == node) {                                   \
+                parent->child[0] = NULL;                                                \
+            }                                                                           \
+            else if (parent) {                                                          \
+                parent->child[1] = NULL;                                                \
+            }                                                                           \
+            free(node);                                                                 \
+            node = parent;                                                              \
+        }                                                                               \
+    }                                                                                   \
+    name##_init(mp);                                                                    \
+}                                                                                       \
+                                                                                        \
+/* Возвращает количество элементов */                                                   \
+static inline size_t                                                                    \
+name##_size                                                                             \
+(                                                                                       \
+    const name *mp                                                                      \
+)                                                                                       \
+{                                                                                       \
+    return mp->size;                                                                    \
+}                                                                                       \
+                                                                                        \
+/* Возвращает узел с ключом key или NULL, если такого узла нет */                       \
+static inline name##_node *                                                             \
+name##_find_node                                                                        \
+(                                                                                       \
+    const name *    mp,                                                                 \
+    K               key                                                                 \
+)                                                                                       \
+{                                                                                       \
+    avl_link *current = mp->root;                                                       \
+    while (current)                                                                     \
+    {                                                                                   \
+        int cmp = CMP(((name##_node *)current)->key, key);                              \
+        if (cmp == 0) {                                                                 \
+            return (name##_node *)current;                                              \
+        }                                                                               \
+        current = current->child[cmp < 0];                                              \
+    }                                                                                   \
+    return NULL;                                                                        \
+}                                                                                       \
+                                                                                        \
+/* Возвращает указатель на значение с ключом key или NULL, если его нет */              \
+static inline V *                                                                       \
+name##_find                                                                             \
+(                                                                                       \
+    const name *    mp,                                                                 \
+    K               key                                                                 \
+)                                                                                       \
+{                                                                                       \
+    name##_node *node = name##_find_node(mp, key);                                      \
+    return node ? &node->value : NULL;                                                  \
+}                                                                                       \
+                                                                                        \
+/**                                                                                     \
+ * Добавляет пару ключ-значение. Если ключ уже есть, заменяет значение                  \
+ * Возвращает true, если был добавлен новый элемент                                     \
+ */                                                                                     \
+static inline bool                                                                      \
+name##_insert                                                                           \
+(                                                                                       \
+    name *    mp,                                                                       \
+    K         key,                                                                      \
+    V         value                                                                     \
+)                                                                                       \
+{                                                                                       \
+    int cmp = 0;                                                                        \
+    avl_link *parent = NULL;                                                            \
+    avl_link *current = mp->root;                                                       \
+    while (current)                                                                     \
+    {                                                                                   \
+        parent = current;                                                               \
+        cmp = CMP(((name##_node *)current)->key, key);                                  \
+        if (cmp == 0)                                                                   \
+        {                                                                               \
+            ((name##_node *)current)->value = value;                                    \
+            return false;                                                               \
+        }                                                                               \
+        current = current->child[cmp < 0];                                              \
+    }                                                                                   \
+                                                                                        \
+    name##_node *node = (name##_node *)malloc(sizeof(name##_node));                     \
+    if (node == NULL)                                                                   \
+    {                                                                                   \
+        perror("");                                                                     \
+        exit(EXIT_FAILURE);                                                             \
+    }                                                                                   \
+    node->key = key;                                                                    \
+    node->value = value;                                                                \
+                                                                                        \
+    avl_link_insert(&mp->root, parent, cmp > 0, &node->link);                           \
+    (mp->size)++;                                                                       \
+    return true;                                                                        \
+}                                                                                       \
+                                                                                        \
+/* Удаляет элемент с ключом key. Возвращает true, если элемент был удалён */            \
+static inline bool                                                                      \
+name##_erase                                                                            \
+(                                                                                       \
+    name *    mp,                                                                       \
+    K         key                                                                       \
+)                                                                                       \
+{                                                                                       \
+    name##_node *node = name##_find_node(mp, key);                                      \
+    if (node == NULL) {                                                                 \
+        return false;                                                                   \
+    }                                                                                   \
+    avl_link_erase(&mp->root, &node->link);                                             \
+    free(node);                                                                         \
+    (mp->size)--;                                                                       \
+    return true;                                                                        \
+}                                                                                       \
+                                                                                        \
+/**                                                                                     \
+ * Обход в порядке возрастания ключей: first/last возвращают крайние узлы,              \
+ * next/prev - соседние узлы. NULL означает, что узлов больше нет                       \
+ */                                                                                     \
+static inline name##_node *                                                             \
+name##_first                                                                            \
+(                                                                                       \
+    const name *mp                                                                      \
+)                                                                                       \
+{                                                                                       \
+    return (name##_node *)avl_link_first(mp->root);                                     \
+}                                                                                       \
+                                                                                        \
+static inline name##_node *                                                             \
+name##_last                                                                             \
+(                                                                                       \
+    const name *mp                                                                      \
+)                                                                                       \
+{                                                                                       \
+    return (name##_node *)avl_link_last(mp->root);                                      \
+}                                                                                       \
+                                                                                        \
+static inline name##_node *                                                             \
+name##_next                                                                             \
+(                                                                                       \
+    name##_node *node                                                                   \
+)                                                                                       \
+{                                                                                       \
+    return (name##_node *)avl_link_next(&node->link);                                   \
+}                                                                                       \
+                                                                                        \
+static inline name##_node *                                                             \
+name##_prev                                                                             \
+(                                                                                       \
+    name##_node *node                                                                   \
+)                                                                                       \
+{                                                                                       \
+    return (name##_node *)avl_link_prev(&node->link);                                   \
+}
+
+#endif
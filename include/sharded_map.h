@@ -0,0 +1,271 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef __SHARDED_MAP_H__
+#define __SHARDED_MAP_H__
+
+#include <map.h>
+
+/**
+ * Потокобезопасный упорядоченный ассоциативный контейнер, разбитый на шарды
+ * по диапазонам ключей
+ * 
+ * Особенности:
+ * - Каждый шард - отдельный контейнер map со своей блокировкой, поэтому
+ *   изменения в разных шардах выполняются параллельно. Разбиение на шарды
+ *   вставка, поиск и удаление читают без блокировок и без записи в общую
+ *   память (см. benchmarks/sharded_map_bench.c)
+ * - Шард i содержит ключи из полуинтервала [split_keys[i - 1], split_keys[i])
+ * - Границы шардов можно менять во время работы (см. sharded_map_split и
+ *   sharded_map_join)
+ * - Обход выполняется по всем шардам подряд в порядке возрастания ключей
+ * 
+ * Для работы с контейнером используйте предоставленное API
+ */
+typedef struct _sharded_map sharded_map;
+
+/**
+ * Итератор для обхода элементов контейнера sharded_map
+ * 
+ * ВАЖНО: Не пытайтесь напрямую работать с полями итератора. Итераторы можно
+ *        использовать только внутри читающей секции (см. sharded_map_read_lock)
+ */
+typedef struct sharded_map_iterator
+{
+    map_iterator    iter;
+    size_t          shard;
+} sharded_map_iterator;
+
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/**
+ * Выделяет ресурсы для контейнера sharded_map и возвращает указатель на него
+ * 
+ * Первые пять аргументов совпадают с аргументами map_create
+ * shards_count - количество шардов (не меньше 1), split_keys - массив из
+ * shards_count - 1 строго возрастающих ключей, разделяющих шарды (при
+ * shards_count == 1 может быть NULL)
+ */
+sharded_map *
+sharded_map_create
+(
+    uint16_t        key_size,
+    uint16_t        value_size,
+    int             (*compare_func)       (const void *f, const void *s),
+    void            (*key_destroyer)      (void *key),
+    void            (*value_destroyer)    (void *value),
+    size_t          shards_count,
+    const void *    split_keys
+);
+
+/**
+ * Освобождает ресурсы, занятые контейнером sharded_map
+ * 
+ * Принимает в качестве аргумента указатель на контейнер sharded_map
+ * На момент вызова контейнер не должен использоваться другими потоками
+ */
+void
+sharded_map_free
+(
+    sharded_map *smap
+);
+
+/**
+ * Возвращает количество элементов в контейнере
+ * 
+ * Принимает в качестве аргумента указатель на контейнер sharded_map
+ */
+size_t
+sharded_map_size
+(
+    sharded_map *smap
+);
+
+/**
+ * Возвращает количество шардов
+ * 
+ * Принимает в качестве аргумента указатель на контейнер sharded_map
+ */
+size_t
+sharded_map_shards_count
+(
+    sharded_map *smap
+);
+
+/**
+ * Добавляет пару ключ-значение в контейнер (см. map_insert)
+ * 
+ * Принимает в качестве аргументов указатель на контейнер sharded_map, ключ key
+ * и значение value
+ * key и value должны быть lvalue (иметь адрес)
+ */
+#define sharded_map_insert(smap,key,value) _sharded_map_insert(smap,&(key),&(value))
+
+void
+_sharded_map_insert
+(
+    sharded_map *    smap,
+    void *           key,
+    void *           value
+);
+
+/**
+ * Выполняет поиск элемента с ключом key и, если элемент найден, копирует его
+ * значение в value и возвращает true. В противном случае возвращает false
+ * 
+ * Принимает в качестве аргументов указатель на контейнер sharded_map, ключ key
+ * и переменную value, в которую будет скопировано значение
+ * key и value должны быть lvalue (иметь адрес)
+ */
+#define sharded_map_find(smap,key,value) _sharded_map_find(smap,&(key),&(value))
+
+bool
+_sharded_map_find
+(
+    sharded_map *    smap,
+    void *           key,
+    void *           value
+);
+
+/**
+ * Удаляет из контейнера элемент с ключом key с вызовом пользовательских
+ * удалителей (если они есть). Возвращает true, если элемент был удалён
+ * 
+ * Принимает в качестве аргументов указатель на контейнер sharded_map и ключ key
+ * key должен быть lvalue (иметь адрес)
+ */
+#define sharded_map_erase(smap,key) _sharded_map_erase(smap,&(key))
+
+bool
+_sharded_map_erase
+(
+    sharded_map *    smap,
+    void *           key
+);
+
+/**
+ * Разбивает шард, содержащий ключ key, на два: элементы с ключами, не меньшими
+ * key, переносятся в новый шард, который встаёт сразу за исходным
+ * 
+ * Принимает в качестве аргументов указатель на контейнер sharded_map и ключ key
+ * key должен быть lvalue (иметь адрес) и не должен совпадать с существующей
+ * границей шардов
+ * 
+ * На время разбиения блокируются операции с разбиваемым шардом и операции
+ * над всеми шардами сразу (sharded_map_size, читающие секции, другие 
+ * разбиения и объединения), операции с остальными шардами продолжаются
+ */
+#define sharded_map_split(smap,key) _sharded_map_split(smap,&(key))
+
+void
+_sharded_map_split
+(
+    sharded_map *    smap,
+    void *           key
+);
+
+/**
+ * Объединяет шард с индексом shard со следующим за ним шардом
+ * 
+ * Принимает в качестве аргументов указатель на контейнер sharded_map и индекс
+ * шарда (меньший, чем sharded_map_shards_count(smap) - 1)
+ * 
+ * На время объединения блокируются операции с объединяемыми шардами и
+ * операции над всеми шардами сразу (см. sharded_map_split). Память 
+ * исключённого шарда освобождается только в sharded_map_free
+ */
+void
+sharded_map_join
+(
+    sharded_map *    smap,
+    size_t           shard
+);
+
+/**
+ * Начинает читающую секцию, внутри которой можно обходить контейнер итераторами
+ * 
+ * Принимает в качестве аргумента указатель на контейнер sharded_map
+ * 
+ * Читающая секция блокирует изменения во всех шардах. Читающие секции разных
+ * потоков выполняются параллельно. Секция завершается вызовом sharded_map_read_unlock
+ */
+void
+sharded_map_read_lock
+(
+    sharded_map *smap
+);
+
+/**
+ * Завершает читающую секцию
+ * 
+ * Принимает в качестве аргумента указатель на контейнер sharded_map
+ */
+void
+sharded_map_read_unlock
+(
+    sharded_map *smap
+);
+
+/**
+ * Возвращает итератор на элемент с минимальным ключом или sharded_map_iterator_end,
+ * если контейнер пуст
+ * 
+ * Принимает в качестве аргумента указатель на контейнер sharded_map
+ */
+sharded_map_iterator
+sharded_map_iterator_first
+(
+    sharded_map *smap
+);
+
+/**
+ * Возвращает итератор, указывающий за последний элемент контейнера
+ * 
+ * Принимает в качестве аргумента указатель на контейнер sharded_map
+ */
+sharded_map_iterator
+sharded_map_iterator_end
+(
+    sharded_map *smap
+);
+
+/**
+ * Перемещает итератор на следующий элемент. Если элемент был последним в своём
+ * шарде, итератор переходит к первому элементу следующего непустого шарда
+ * 
+ * Принимает в качестве аргументов указатель на контейнер sharded_map и итератор
+ * iter должен быть lvalue (иметь адрес)
+ */
+#define sharded_map_iterator_next(smap,iter) _sharded_map_iterator_next(smap,&iter)
+
+void
+_sharded_map_iterator_next
+(
+    sharded_map *             smap,
+    sharded_map_iterator *    iter
+);
+
+/**
+ * Сравнивает два итератора. Возвращает 0, если они указывают на один и тот же
+ * элемент, и ненулевое значение в противном случае
+ */
+int
+sharded_map_iterator_compare
+(
+    sharded_map_iterator    f,
+    sharded_map_iterator    s
+);
+
+/**
+ * Возвращает ключ/значение элемента, на который указывает итератор
+ * (см. map_iterator_get_key и map_iterator_get_value)
+ */
+#define sharded_map_iterator_get_key(it,type) map_iterator_get_key((it).iter,type)
+#define sharded_map_iterator_get_value(it,type) map_iterator_get_value((it).iter,type)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,5 +1,12 @@
 #include <map.h>
+#include <concurrent_map.h>
+#include <concurrent_avl.h>
+#include <sharded_map.h>
+#include <map_define.h>
 #include <test.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 char *int_key_to_str(const void *key)
 {
@@ -59,12 +66,20 @@ typedef struct avl_node_test avl_node_test;
 
 struct avl_node_test
 {
-    avl_node_test *    parent;
-    avl_node_test *    left_child;
-    avl_node_test *    right_child;
+    /**
+     * Связи узла повторяют avl_link: указатели на link узла совпадают с 
+     * указателями на сам узел
+     */
+    struct
+    {
+        avl_node_test *    parent;
+        avl_node_test *    child[2];
+        int8_t             balance;
+    }                  link;
+    unsigned           refs;
     void *             key;
     void *             value;
-    int8_t             balance;
+    uint64_t           prefix;
 };
 
 typedef struct map_test map_test;
@@ -85,6 +100,22 @@ struct map_test
     void        (*value_destroyer)    (void *value);
 
     size_t      size;
+    size_t      version;
+
+    void        (*key_copier)         (void *dst, const void *src);
+    void        (*value_copier)       (void *dst, const void *src);
+    void *      tree_ref;
+    bool        stale_parents;
+    bool        read_only;
+    void *      rcu;
+    int         key_kind;
+    uint64_t    (*key_prefix)         (const void *key);
+    void *      btree;
+    void *      find_cache;
+    void *      bloom;
+    void *      hash_index;
+    void *      small_keys;
+    bool        small_active;
 };
 
 typedef struct map_iterator_impl_test map_iterator_impl_test;
@@ -120,17 +151,17 @@ C_TEST(insert_small_rotates_test)
      */
 
     avl_node_test *root = (((map_test *)mp)->header).root;
-    avl_node_test *left_child = root->left_child;
-    avl_node_test *right_child = root->right_child;
+    avl_node_test *left_child = root->link.child[0];
+    avl_node_test *right_child = root->link.child[1];
 
     ASSERT_EQ(*((int *)(root->key)), 50);
     ASSERT_EQ(*((int *)(left_child->key)), 25);
     ASSERT_EQ(*((int *)(right_child->key)), 75);
 
-    ASSERT_EQ(root->parent, NULL);
-    ASSERT_EQ(left_child->parent, root);
-    ASSERT_EQ(right_child->parent, root);
-    ASSERT_EQ(right_child->left_child, NULL);
+    ASSERT_EQ(root->link.parent, NULL);
+    ASSERT_EQ(left_child->link.parent, root);
+    ASSERT_EQ(right_child->link.parent, root);
+    ASSERT_EQ(right_child->link.child[0], NULL);
 
     map_clear(mp);
 
@@ -147,17 +178,17 @@ C_TEST(insert_small_rotates_test)
      */
 
     root = (((map_test *)mp)->header).root;
-    left_child = root->left_child;
-    right_child = root->right_child;
+    left_child = root->link.child[0];
+    right_child = root->link.child[1];
 
     ASSERT_EQ(*((int *)(root->key)), 50);
     ASSERT_EQ(*((int *)(left_child->key)), 25);
     ASSERT_EQ(*((int *)(right_child->key)), 75);
 
-    ASSERT_EQ(root->parent, NULL);
-    ASSERT_EQ(left_child->parent, root);
-    ASSERT_EQ(right_child->parent, root);
-    ASSERT_EQ(left_child->right_child, NULL);
+    ASSERT_EQ(root->link.parent, NULL);
+    ASSERT_EQ(left_child->link.parent, root);
+    ASSERT_EQ(right_child->link.parent, root);
+    ASSERT_EQ(left_child->link.child[1], NULL);
 
     /**
      * Заполним дерево элементами и продолжим тестировать вставку
@@ -186,28 +217,28 @@ C_TEST(insert_small_rotates_test)
      */
 
     root = (((map_test *)mp)->header).root;
-    left_child = root->left_child;
-    right_child = root->right_child;
+    left_child = root->link.child[0];
+    right_child = root->link.child[1];
     ASSERT_EQ(*((int *)(root->key)), 25);
     ASSERT_EQ(*((int *)(right_child->key)), 50);
-    ASSERT_EQ(*((int *)(right_child->right_child->key)), 75);
-    ASSERT_EQ(*((int *)(right_child->right_child->right_child->key)), 85);
-    ASSERT_EQ(*((int *)(right_child->right_child->left_child->key)), 65);
-    ASSERT_EQ(*((int *)(right_child->left_child->key)), 35);
-    ASSERT_EQ(*((int *)(right_child->left_child->left_child->key)), 30);
+    ASSERT_EQ(*((int *)(right_child->link.child[1]->key)), 75);
+    ASSERT_EQ(*((int *)(right_child->link.child[1]->link.child[1]->key)), 85);
+    ASSERT_EQ(*((int *)(right_child->link.child[1]->link.child[0]->key)), 65);
+    ASSERT_EQ(*((int *)(right_child->link.child[0]->key)), 35);
+    ASSERT_EQ(*((int *)(right_child->link.child[0]->link.child[0]->key)), 30);
     ASSERT_EQ(*((int *)(left_child->key)), 15);
-    ASSERT_EQ(*((int *)(left_child->right_child->key)), 20);
-    ASSERT_EQ(*((int *)(left_child->left_child->key)), 10);
-    ASSERT_EQ(*((int *)(left_child->left_child->left_child->key)), 5);
+    ASSERT_EQ(*((int *)(left_child->link.child[1]->key)), 20);
+    ASSERT_EQ(*((int *)(left_child->link.child[0]->key)), 10);
+    ASSERT_EQ(*((int *)(left_child->link.child[0]->link.child[0]->key)), 5);
 
-    ASSERT_EQ(root->parent, NULL);
-    ASSERT_EQ(left_child->parent, root);
-    ASSERT_EQ(right_child->parent, root);
+    ASSERT_EQ(root->link.parent, NULL);
+    ASSERT_EQ(left_child->link.parent, root);
+    ASSERT_EQ(right_child->link.parent, root);
     /** 
      * Обратим внимание на "слабый" узел, который до вставки был правым 
      * ребёнком узла с ключом 25, стал левым ребёнком узла с ключом 50
      */
-    ASSERT_EQ(root->right_child, root->right_child->left_child->parent); 
+    ASSERT_EQ(root->link.child[1], root->link.child[1]->link.child[0]->link.parent); 
 
     /**
      * Теперь посмотрим на то, как поведёт себя дерево, если поворот потребуется 
@@ -224,25 +255,25 @@ C_TEST(insert_small_rotates_test)
      * с ключом 15. Убедимся, что это действительно так
      */
 
-    avl_node_test *new_root_of_subtree = ((((map_test *)mp)->header).root)->left_child;
-    avl_node_test *nros_left_child = new_root_of_subtree->left_child;
-    avl_node_test *nros_right_child = new_root_of_subtree->right_child;
+    avl_node_test *new_root_of_subtree = ((((map_test *)mp)->header).root)->link.child[0];
+    avl_node_test *nros_left_child = new_root_of_subtree->link.child[0];
+    avl_node_test *nros_right_child = new_root_of_subtree->link.child[1];
 
     ASSERT_EQ(*(int *)(new_root_of_subtree->key), 10);
     ASSERT_EQ(*(int *)(nros_right_child->key), 15);
-    ASSERT_EQ(*(int *)(nros_right_child->right_child->key), 20);
-    ASSERT_EQ(*(int *)(nros_right_child->left_child->key), 12);
+    ASSERT_EQ(*(int *)(nros_right_child->link.child[1]->key), 20);
+    ASSERT_EQ(*(int *)(nros_right_child->link.child[0]->key), 12);
     ASSERT_EQ(*(int *)(nros_left_child->key), 5);
-    ASSERT_EQ(*(int *)(nros_left_child->left_child->key), 1);
+    ASSERT_EQ(*(int *)(nros_left_child->link.child[0]->key), 1);
 
-    // ASSERT_EQ(root->parent, NULL);
-    // ASSERT_EQ(left_child->parent, root);
-    // ASSERT_EQ(right_child->parent, root);
+    // ASSERT_EQ(root->link.parent, NULL);
+    // ASSERT_EQ(left_child->link.parent, root);
+    // ASSERT_EQ(right_child->link.parent, root);
     // /** 
     //  * Обратим внимание на "слабый" узел, который до вставки был правым 
     //  * ребёнком узла с ключом 25, стал левым ребёнком узла с ключом 50
     //  */
-    // ASSERT_EQ(root->right_child, root->right_child->left_child->parent); 
+    // ASSERT_EQ(root->link.child[1], root->link.child[1]->link.child[0]->link.parent); 
 
     map_free(mp);
 }
@@ -328,7 +359,2430 @@ C_TEST(iterator_test)
     ASSERT_NE_CMP(map_iterator_first(mp), map_iterator_end(mp), map_iterator_compare);
     ASSERT_NE_CMP(map_iterator_last(mp), map_iterator_end(mp), map_iterator_compare);
 
+    /* Удаление узла с двумя детьми, замена которого - наибольший элемент */
+    key = 50, value = 50;
+    map_insert(mp, key, value);
+    key = 200, value = 200;
+    map_insert(mp, key, value);
+
+    key = 100;
+    map_erase(mp, map_find(mp, key));
+
+    ASSERT_EQ(map_iterator_get_key(map_iterator_first(mp),int), 50);
+    ASSERT_EQ(map_iterator_get_key(map_iterator_last(mp),int), 200);
+
+    map_free(mp);
+}
+
+C_TEST(header_after_insert_test)
+{
+    map *mp = map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+
+    int key, value;
+
+    /**
+     * 7 уходит в правое поддерево 5, но наибольшим элементом не становится;
+     * то же для 3 в левом поддереве 5 и наименьшего элемента
+     */
+    key = 10, value = 10;
+    map_insert(mp, key, value);
+    key = 5, value = 5;
+    map_insert(mp, key, value);
+    key = 7, value = 7;
+    map_insert(mp, key, value);
+
+    ASSERT_EQ(map_iterator_get_key(map_iterator_first(mp),int), 5);
+    ASSERT_EQ(map_iterator_get_key(map_iterator_last(mp),int), 10);
+
+    key = 3, value = 3;
+    map_insert(mp, key, value);
+    key = 4, value = 4;
+    map_insert(mp, key, value);
+
+    ASSERT_EQ(map_iterator_get_key(map_iterator_first(mp),int), 3);
+    ASSERT_EQ(map_iterator_get_key(map_iterator_last(mp),int), 10);
+
+    map_clear(mp);
+
+    /* Вставка в произвольном порядке: наименьший и наибольший ключи */
+    srand(29);
+    int min = 0, max = 0;
+    for (int i = 0; i < 1000; ++i)
+    {
+        key = rand() % 100000, value = key;
+        map_insert(mp, key, value);
+
+        min = (i == 0 || key < min) ? key : min;
+        max = (i == 0 || key > max) ? key : max;
+
+        ASSERT_EQ(map_iterator_get_key(map_iterator_first(mp),int), min);
+        ASSERT_EQ(map_iterator_get_key(map_iterator_last(mp),int), max);
+    }
+
+    /* Обход должен пройти по всем элементам */
+    size_t count = 0;
+    for (map_iterator it = map_iterator_first(mp); 
+        map_iterator_compare(it, map_iterator_end(mp)) != 0; map_iterator_next(mp, it))
+    {
+        ++count;
+    }
+    ASSERT_EQ(count, map_size(mp));
+
+    map_free(mp);
+}
+
+C_TEST(scan_test)
+{
+    map *mp = map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+
+    int key, value;
+
+    for (int i = 0; i < 100; ++i)
+    {
+        key = i * 2, value = i * 20;
+        map_insert(mp, key, value);
+    }
+
+    /**
+     * Обойдём контейнер порциями по 7 элементов
+     */
+
+    int keys[7];
+    int values[7];
+    int expected = 0;
+    size_t count;
+    map_resume_token token = map_resume_token_init();
+
+    while ((count = map_scan(mp, NULL, 7, keys, values, &token)) > 0)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            ASSERT_EQ(keys[i], expected * 2);
+            ASSERT_EQ(values[i], expected * 20);
+            expected++;
+        }
+    }
+    ASSERT_EQ(expected, 100);
+
+    /**
+     * Начало обхода с ключа, которого нет в контейнере, и копирование
+     * только ключей
+     */
+
+    int start_key = 51;
+    token = map_resume_token_init();
+
+    count = map_scan(mp, &start_key, 7, keys, NULL, &token);
+    ASSERT_EQ(count, 7);
+    ASSERT_EQ(keys[0], 52);
+    ASSERT_EQ(keys[6], 64);
+
+    start_key = 1000;
+    token = map_resume_token_init();
+    ASSERT_EQ(map_scan(mp, &start_key, 7, keys, values, &token), 0);
+
+    map_free(mp);
+}
+
+/**
+ * Возвращает true, если поддеревья f и s совпадают по форме, ключам, 
+ * значениям и балансам, но не разделяют ни одного узла
+ */
+bool same_shape(avl_node_test *f, avl_node_test *s)
+{
+    if (f == NULL || s == NULL) {
+        return f == s;
+    }
+
+    return f != s && f->key != s->key && f->value != s->value
+        && *(int *)f->key == *(int *)s->key
+        && *(int *)f->value == *(int *)s->value
+        && f->link.balance == s->link.balance
+        && same_shape(f->link.child[0], s->link.child[0])
+        && same_shape(f->link.child[1], s->link.child[1]);
+}
+
+C_TEST(clone_test)
+{
+    map *mp = map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+
+    map *clone = map_clone(mp, NULL, NULL);
+    ASSERT_TRUE(map_empty(clone));
+    map_free(clone);
+
+    int key, value;
+
+    for (int i = 0; i < 50; ++i)
+    {
+        key = (i * 37) % 101, value = i;
+        map_insert(mp, key, value);
+    }
+
+    clone = map_clone(mp, NULL, NULL);
+
+    ASSERT_EQ(map_size(clone), map_size(mp));
+    ASSERT_TRUE(same_shape(((map_test *)mp)->header.root, ((map_test *)clone)->header.root));
+    ASSERT_EQ(map_iterator_get_key(map_iterator_first(clone), int), 0);
+    ASSERT_EQ(map_iterator_get_key(map_iterator_last(clone), int), 100);
+    ASSERT_EQ((((map_test *)clone)->header).root->link.parent, NULL);
+
+    /**
+     * Копия, построенная несколькими потоками, совпадает с последовательной
+     */
+
+    map *parallel_clone = map_clone_parallel(mp, NULL, NULL, 4);
+    ASSERT_TRUE(same_shape(((map_test *)mp)->header.root, ((map_test *)parallel_clone)->header.root));
+    int count = 0;
+    for (map_iterator it = map_iterator_first(parallel_clone); 
+        map_iterator_compare(it, map_iterator_end(parallel_clone)) != 0; map_iterator_next(parallel_clone, it)) 
+    {
+        count++;
+    }
+    ASSERT_EQ(count, 50);
+    map_free(parallel_clone);
+
+    /**
+     * Изменения оригинала не должны затрагивать копию
+     */
+
+    map_clear(mp);
+    ASSERT_EQ(map_size(clone), 50);
+
+    key = 37, value = 0;
+    map_iterator it = map_find(clone, key);
+    ASSERT_NE_CMP(it, map_iterator_end(clone), map_iterator_compare);
+    ASSERT_EQ(map_iterator_get_value(it, int), 1);
+
+    map_erase(clone, it);
+    ASSERT_EQ_CMP(map_find(clone, key), map_iterator_end(clone), map_iterator_compare);
+
+    map_free(clone);
+    map_free(mp);
+}
+
+C_TEST(snapshot_test)
+{
+    map *mp = map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+
+    int key, value;
+
+    for (int i = 0; i < 20; ++i)
+    {
+        key = i, value = i;
+        map_insert(mp, key, value);
+    }
+
+    map *snapshot = map_snapshot(mp);
+
+    /**
+     * Пока контейнер не изменялся, снимок разделяет с ним узлы
+     */
+    ASSERT_EQ(((map_test *)snapshot)->header.root, ((map_test *)mp)->header.root);
+    ASSERT_EQ(map_size(snapshot), 20);
+
+    key = 5, value = 500;
+    map_insert(mp, key, value);
+    key = 100, value = 100;
+    map_insert(mp, key, value);
+    key = 0;
+    map_erase(mp, map_find(mp, key));
+
+    ASSERT_NE(((map_test *)snapshot)->header.root, ((map_test *)mp)->header.root);
+    ASSERT_EQ(map_size(mp), 20);
+    ASSERT_EQ(map_iterator_get_key(map_iterator_first(mp), int), 1);
+    ASSERT_EQ(map_iterator_get_key(map_iterator_last(mp), int), 100);
+
+    /**
+     * Снимок видит состояние на момент своего создания
+     */
+    ASSERT_EQ(map_size(snapshot), 20);
+    ASSERT_EQ(map_iterator_get_key(map_iterator_first(snapshot), int), 0);
+    ASSERT_EQ(map_iterator_get_key(map_iterator_last(snapshot), int), 19);
+
+    key = 5;
+    ASSERT_EQ(map_iterator_get_value(map_find(snapshot, key), int), 5);
+    ASSERT_EQ(map_iterator_get_value(map_find(mp, key), int), 500);
+
+    int expected = 0;
+    map_iterator it = map_iterator_first(snapshot);
+    for (; map_iterator_compare(it, map_iterator_end(snapshot)) != 0; map_iterator_next(snapshot, it)) 
+    {
+        ASSERT_EQ(map_iterator_get_key(it, int), expected);
+        expected++;
+    }
+    ASSERT_EQ(expected, 20);
+
+    /**
+     * Снимок снимка и освобождение в произвольном порядке
+     */
+    map *second_snapshot = map_snapshot(snapshot);
+    map_free(snapshot);
+    map_free(mp);
+
+    ASSERT_EQ(map_size(second_snapshot), 20);
+    key = 19;
+    ASSERT_NE_CMP(map_find(second_snapshot, key), map_iterator_end(second_snapshot), map_iterator_compare);
+
+    map_free(second_snapshot);
+}
+
+/**
+ * Проверяет балансы и указатели на родителей поддерева с корнем node.
+ * Возвращает высоту поддерева или -1, если свойства AVL-дерева нарушены
+ */
+int checked_height(avl_node_test *node)
+{
+    if (node == NULL) {
+        return 0;
+    }
+
+    int left = checked_height(node->link.child[0]);
+    int right = checked_height(node->link.child[1]);
+    if (left < 0 || right < 0 || left - right != node->link.balance || abs(node->link.balance) > 1) {
+        return -1;
+    }
+    if ((node->link.child[0] && node->link.child[0]->link.parent != node) 
+        || (node->link.child[1] && node->link.child[1]->link.parent != node)) 
+    {
+        return -1;
+    }
+
+    return (left > right ? left : right) + 1;
+}
+
+static size_t copied_keys = 0;
+static size_t destroyed_keys = 0;
+
+void counting_int_copier(void *dst, const void *src)
+{
+    ++copied_keys;
+    memcpy(dst, src, sizeof(int));
+}
+
+void counting_int_destroyer(void *key)
+{
+    ++destroyed_keys;
+}
+
+/**
+ * Сравнивает содержимое контейнера с эталоном (ref[key] == -1 - ключа нет),
+ * обходя контейнер в обоих направлениях
+ */
+bool matches_reference(map *mp, const int *ref, int keys)
+{
+    size_t size = 0;
+    int key = -1;
+    map_iterator it = map_iterator_first(mp);
+    for (; map_iterator_compare(it, map_iterator_end(mp)) != 0; map_iterator_next(mp, it))
+    {
+        int next = map_iterator_get_key(it, int);
+        if (next <= key || next >= keys || ref[next] != map_iterator_get_value(it, int)) {
+            return false;
+        }
+        key = next;
+        size++;
+    }
+
+    key = keys;
+    it = map_iterator_end(mp);
+    for (size_t i = 0; i < size; ++i)
+    {
+        map_iterator_prev(mp, it);
+        int prev = map_iterator_get_key(it, int);
+        if (prev >= key || ref[prev] == -1) {
+            return false;
+        }
+        key = prev;
+    }
+
+    for (key = 0; key < keys; ++key)
+    {
+        if ((ref[key] != -1) != (map_iterator_compare(map_find(mp, key), map_iterator_end(mp)) != 0)) {
+            return false;
+        }
+    }
+
+    return size == map_size(mp);
+}
+
+C_TEST(snapshot_path_copy_test)
+{
+    enum { N = 1 << 15, KEYS = 512, SNAPSHOTS = 4 };
+    copied_keys = 0;
+    destroyed_keys = 0;
+
+    map *mp = map_create(sizeof(int), sizeof(int), int_compare_func, counting_int_destroyer, NULL);
+    map_set_copiers(mp, counting_int_copier, NULL);
+    for (int key = 0; key < 2 * N; key += 2) {
+        map_insert(mp, key, key);
+    }
+    int height = checked_height(((map_test *)mp)->header.root);
+    ASSERT_NE(height, -1);
+
+    /**
+     * Запись после снимка копирует путь от корня и узлы, затронутые 
+     * поворотами, а не всё дерево
+     */
+    map *snapshot = map_snapshot(mp);
+    int key = 2 * N + 1;
+    map_insert(mp, key, key);
+    ASSERT_TRUE(copied_keys <= (size_t)height + 3);
+
+    copied_keys = 0;
+    key = N;
+    map_erase(mp, map_find(mp, key));
+    ASSERT_TRUE(copied_keys <= 3 * (size_t)height);
+
+    ASSERT_EQ(map_size(snapshot), N);
+    ASSERT_EQ(map_size(mp), N);
+    ASSERT_EQ(map_iterator_get_value(map_find(snapshot, key), int), N);
+    ASSERT_EQ(map_iterator_compare(map_find(mp, key), map_iterator_end(mp)), 0);
+    ASSERT_EQ(map_iterator_get_key(map_iterator_last(snapshot), int), 2 * N - 2);
+    ASSERT_EQ(map_iterator_get_key(map_iterator_last(mp), int), 2 * N + 1);
+
+    map_free(snapshot);
+    map_free(mp);
+
+    /**
+     * Пересекающиеся снимки при случайных вставках и удалениях, освобождение
+     * снимков вперемешку с записями
+     */
+    copied_keys = 0;
+    destroyed_keys = 0;
+    size_t created_keys = 0;
+
+    static int ref[KEYS];
+    static int saved[SNAPSHOTS][KEYS];
+    map *snapshots[SNAPSHOTS];
+    for (int i = 0; i < KEYS; ++i) {
+        ref[i] = -1;
+    }
+
+    mp = map_create(sizeof(int), sizeof(int), int_compare_func, counting_int_destroyer, NULL);
+    map_set_copiers(mp, counting_int_copier, NULL);
+
+    uint32_t state = 2463534242u;
+    for (int s = 0; s < SNAPSHOTS; ++s)
+    {
+        for (int i = 0; i < 400; ++i)
+        {
+            /* xorshift32 */
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            key = (int)(state % KEYS);
+
+            if ((state >> 20) % 3 != 0)
+            {
+                created_keys += (ref[key] == -1);
+                ref[key] = i;
+                map_insert(mp, key, i);
+            }
+            else if (ref[key] != -1)
+            {
+                ref[key] = -1;
+                map_erase(mp, map_find(mp, key));
+            }
+        }
+
+        snapshots[s] = map_snapshot(mp);
+        memcpy(saved[s], ref, sizeof(ref));
+    }
+
+    /* Освобождаем снимки в порядке 2, 0, 3, 1, изменяя контейнер между ними */
+    const int order[SNAPSHOTS] = {2, 0, 3, 1};
+    for (int i = 0; i < SNAPSHOTS; ++i)
+    {
+        for (int s = 0; s < SNAPSHOTS; ++s)
+        {
+            if (snapshots[s] != NULL) {
+                ASSERT_TRUE(matches_reference(snapshots[s], saved[s], KEYS));
+            }
+        }
+        ASSERT_TRUE(matches_reference(mp, ref, KEYS));
+
+        map_free(snapshots[order[i]]);
+        snapshots[order[i]] = NULL;
+
+        key = order[i];
+        int value = KEYS + i;
+        created_keys += (ref[key] == -1);
+        ref[key] = value;
+        map_insert(mp, key, value);
+    }
+
+    /* Снимков не осталось - указатели на родителей снова верны */
+    ASSERT_TRUE(matches_reference(mp, ref, KEYS));
+    ASSERT_NE(checked_height(((map_test *)mp)->header.root), -1);
+    ASSERT_FALSE(((map_test *)mp)->stale_parents);
+    ASSERT_EQ(((map_test *)mp)->tree_ref, NULL);
+
+    /* Каждый ключ - вставленный или скопированный - освобождён ровно один раз */
     map_free(mp);
+    ASSERT_EQ(destroyed_keys, created_keys + copied_keys);
+}
+
+typedef struct concurrent_writer_args
+{
+    concurrent_map *    cmap;
+    int                 first_key;
+} concurrent_writer_args;
+
+void *concurrent_writer(void *arg)
+{
+    concurrent_writer_args *args = (concurrent_writer_args *)arg;
+
+    for (int key = args->first_key; key < args->first_key + 1000; ++key) 
+    {
+        int value = key * 2;
+        concurrent_map_insert(args->cmap, key, value);
+    }
+
+    return NULL;
+}
+
+C_TEST(concurrent_map_test)
+{
+    concurrent_map *cmap = concurrent_map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+
+    pthread_t threads[4];
+    concurrent_writer_args args[4];
+
+    for (int i = 0; i < 4; ++i)
+    {
+        args[i] = (concurrent_writer_args){.cmap = cmap, .first_key = i * 1000};
+        pthread_create(&threads[i], NULL, concurrent_writer, &args[i]);
+    }
+    for (int i = 0; i < 4; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    ASSERT_EQ(concurrent_map_size(cmap), 4000);
+
+    int key = 3999, value = 0;
+    ASSERT_TRUE(concurrent_map_find(cmap, key, value));
+    ASSERT_EQ(value, 7998);
+
+    ASSERT_TRUE(concurrent_map_erase(cmap, key));
+    ASSERT_FALSE(concurrent_map_erase(cmap, key));
+    ASSERT_FALSE(concurrent_map_find(cmap, key, value));
+
+    /**
+     * Обход внутри читающей секции
+     */
+
+    map *mp = concurrent_map_read_lock(cmap);
+    int expected = 0;
+    map_iterator it = map_iterator_first(mp);
+    for (; map_iterator_compare(it, map_iterator_end(mp)) != 0; map_iterator_next(mp, it)) 
+    {
+        if (map_iterator_get_key(it, int) != expected) {
+            break;
+        }
+        expected++;
+    }
+    concurrent_map_read_unlock(cmap);
+
+    ASSERT_EQ(expected, 3999);
+
+    concurrent_map_free(cmap);
+}
+
+typedef struct concurrent_avl_worker_args
+{
+    concurrent_avl *    cavl;
+    int                 first_key;
+    uint32_t            seed;
+    bool                present[500];
+} concurrent_avl_worker_args;
+
+void *concurrent_avl_worker(void *arg)
+{
+    concurrent_avl_worker_args *args = (concurrent_avl_worker_args *)arg;
+    uint32_t state = args->seed;
+
+    for (int i = 0; i < 20000; ++i)
+    {
+        /* xorshift32 */
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        int index = (int)(state % 500);
+        int key = args->first_key + index * 4;
+        int value = key * 3;
+
+        if ((state >> 16) % 3 == 0)
+        {
+            bool erased = concurrent_avl_erase(args->cavl, key);
+            if (erased != args->present[index]) {
+                return arg;
+            }
+            args->present[index] = false;
+        }
+        else if ((state >> 16) % 3 == 1)
+        {
+            concurrent_avl_insert(args->cavl, key, value);
+            args->present[index] = true;
+        }
+        else
+        {
+            int found_value = 0;
+            bool found = concurrent_avl_find(args->cavl, key, found_value);
+            if (found != args->present[index] || (found && found_value != value)) {
+                return arg;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+C_TEST(concurrent_avl_test)
+{
+    concurrent_avl *cavl = concurrent_avl_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+
+    pthread_t threads[4];
+    concurrent_avl_worker_args args[4] = {0};
+
+    /**
+     * Каждый поток работает со своими ключами, но ключи потоков 
+     * перемежаются, так что потоки постоянно поворачивают общие поддеревья
+     */
+    for (int i = 0; i < 4; ++i)
+    {
+        args[i].cavl = cavl;
+        args[i].first_key = i;
+        args[i].seed = 2463534242u + i;
+        pthread_create(&threads[i], NULL, concurrent_avl_worker, &args[i]);
+    }
+
+    void *results[4];
+    for (int i = 0; i < 4; ++i) {
+        pthread_join(threads[i], &results[i]);
+    }
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_EQ(results[i], NULL);
+    }
+
+    size_t expected_size = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        for (int index = 0; index < 500; ++index)
+        {
+            int key = args[i].first_key + index * 4;
+            int value = 0;
+            ASSERT_EQ(concurrent_avl_find(cavl, key, value), args[i].present[index]);
+            expected_size += args[i].present[index];
+        }
+    }
+    ASSERT_EQ(concurrent_avl_size(cavl), expected_size);
+
+    concurrent_avl_collect(cavl);
+
+    int key = -1, value = 0;
+    ASSERT_FALSE(concurrent_avl_find(cavl, key, value));
+    ASSERT_FALSE(concurrent_avl_erase(cavl, key));
+
+    concurrent_avl_free(cavl);
+}
+
+typedef struct rcu_reader_args
+{
+    map *          mp;
+    atomic_bool *  stop;
+} rcu_reader_args;
+
+void *rcu_reader(void *arg)
+{
+    rcu_reader_args *args = (rcu_reader_args *)arg;
+    map_rcu_reader *reader = map_rcu_register(args->mp);
+    void *result = NULL;
+
+    while (!atomic_load(args->stop) && result == NULL)
+    {
+        for (int key = 0; key < 1000; ++key)
+        {
+            int value = 0;
+            bool found = map_rcu_find(args->mp, reader, key, value);
+
+            /* Чётные ключи писатель не удаляет */
+            if ((key % 2 == 0 && !found) || (found && value != key * 2)) {
+                result = arg;
+            }
+        }
+
+        int key = 5000, value = 0;
+        if (map_rcu_find(args->mp, reader, key, value)) {
+            result = arg;
+        }
+    }
+
+    map_rcu_unregister(args->mp, reader);
+    return result;
+}
+
+C_TEST(rcu_test)
+{
+    map *mp = map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+    map_rcu_enable(mp);
+
+    for (int key = 0; key < 1000; key += 2) 
+    {
+        int value = key * 2;
+        map_insert(mp, key, value);
+    }
+
+    atomic_bool stop;
+    atomic_init(&stop, false);
+
+    pthread_t threads[3];
+    rcu_reader_args args[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        args[i] = (rcu_reader_args){.mp = mp, .stop = &stop};
+        pthread_create(&threads[i], NULL, rcu_reader, &args[i]);
+    }
+
+    /**
+     * Писатель вставляет и удаляет нечётные ключи и перезаписывает значения
+     * чётных, вызывая повороты и замену буферов значений
+     */
+    uint32_t state = 2463534242u;
+    for (int i = 0; i < 20000; ++i)
+    {
+        /* xorshift32 */
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        int key = (int)(state % 1000);
+        int value = key * 2;
+        map_iterator it = map_find(mp, key);
+
+        if (key % 2 == 1 && map_iterator_compare(it, map_iterator_end(mp)) != 0) {
+            map_erase(mp, it);
+        }
+        else {
+            map_insert(mp, key, value);
+        }
+    }
+
+    atomic_store(&stop, true);
+
+    void *results[3];
+    for (int i = 0; i < 3; ++i) {
+        pthread_join(threads[i], &results[i]);
+    }
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_EQ(results[i], NULL);
+    }
+
+    map_rcu_synchronize(mp);
+
+    map_rcu_reader *reader = map_rcu_register(mp);
+    int key = 998, value = 0;
+    ASSERT_TRUE(map_rcu_find(mp, reader, key, value));
+    ASSERT_EQ(value, 1996);
+
+    map_clear(mp);
+    ASSERT_FALSE(map_rcu_find(mp, reader, key, value));
+    map_rcu_unregister(mp, reader);
+
+    map_free(mp);
+}
+
+typedef struct sharded_writer_args
+{
+    sharded_map *    smap;
+    int              first_key;
+} sharded_writer_args;
+
+void *sharded_writer(void *arg)
+{
+    sharded_writer_args *args = (sharded_writer_args *)arg;
+
+    for (int key = args->first_key; key < args->first_key + 250; ++key) 
+    {
+        int value = key * 2;
+        sharded_map_insert(args->smap, key, value);
+    }
+
+    return NULL;
+}
+
+C_TEST(sharded_map_test)
+{
+    int split_keys[] = {250, 500, 750};
+    sharded_map *smap = sharded_map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL, 4, split_keys);
+
+    pthread_t threads[4];
+    sharded_writer_args args[4];
+
+    /* Каждый поток пишет в свой шард */
+    for (int i = 0; i < 4; ++i)
+    {
+        args[i] = (sharded_writer_args){.smap = smap, .first_key = i * 250};
+        pthread_create(&threads[i], NULL, sharded_writer, &args[i]);
+    }
+    for (int i = 0; i < 4; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    ASSERT_EQ(sharded_map_size(smap), 1000);
+
+    int key = 500, value = 0;
+    ASSERT_TRUE(sharded_map_find(smap, key, value));
+    ASSERT_EQ(value, 1000);
+    ASSERT_TRUE(sharded_map_erase(smap, key));
+    ASSERT_FALSE(sharded_map_find(smap, key, value));
+
+    /**
+     * Разбиение и объединение шардов
+     */
+
+    key = 100;
+    sharded_map_split(smap, key);
+    ASSERT_EQ(sharded_map_shards_count(smap), 5);
+    ASSERT_EQ(sharded_map_size(smap), 999);
+
+    sharded_map_join(smap, 2);
+    sharded_map_join(smap, 2);
+    ASSERT_EQ(sharded_map_shards_count(smap), 3);
+    ASSERT_EQ(sharded_map_size(smap), 999);
+
+    key = 600;
+    ASSERT_TRUE(sharded_map_find(smap, key, value));
+    ASSERT_EQ(value, 1200);
+    key = 99;
+    ASSERT_TRUE(sharded_map_find(smap, key, value));
+    ASSERT_EQ(value, 198);
+
+    /**
+     * Обход всех шардов по порядку
+     */
+
+    sharded_map_read_lock(smap);
+    int expected = 0, count = 0;
+    sharded_map_iterator it = sharded_map_iterator_first(smap);
+    for (; sharded_map_iterator_compare(it, sharded_map_iterator_end(smap)) != 0; sharded_map_iterator_next(smap, it)) 
+    {
+        if (expected == 500) {
+            expected++;
+        }
+        if (sharded_map_iterator_get_key(it, int) != expected || sharded_map_iterator_get_value(it, int) != expected * 2) {
+            break;
+        }
+        expected++;
+        count++;
+    }
+    sharded_map_read_unlock(smap);
+
+    ASSERT_EQ(count, 999);
+
+    /**
+     * Разбиение и объединение шардов во время записи в них
+     */
+
+    for (int i = 0; i < 4; ++i)
+    {
+        args[i] = (sharded_writer_args){.smap = smap, .first_key = 1000 + i * 250};
+        pthread_create(&threads[i], NULL, sharded_writer, &args[i]);
+    }
+    for (key = 1100; key < 2000; key += 200) {
+        sharded_map_split(smap, key);
+    }
+    for (int i = 0; i < 3; ++i) {
+        sharded_map_join(smap, 3);
+    }
+    for (int i = 0; i < 4; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    ASSERT_EQ(sharded_map_shards_count(smap), 5);
+    ASSERT_EQ(sharded_map_size(smap), 1999);
+    for (key = 1000; key < 2000; ++key)
+    {
+        if (!sharded_map_find(smap, key, value) || value != key * 2) {
+            break;
+        }
+    }
+    ASSERT_EQ(key, 2000);
+
+    sharded_map_free(smap);
+}
+
+C_TEST(build_parallel_test)
+{
+    enum { N = 10000 };
+    static int keys[N], values[N];
+
+    uint32_t state = 2463534242u;
+    for (int i = 0; i < N; ++i)
+    {
+        /* xorshift32 */
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        keys[i] = (int)(state % 5000);
+        values[i] = i;
+    }
+
+    map *expected = map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+    for (int i = 0; i < N; ++i) {
+        map_insert(expected, keys[i], values[i]);
+    }
+
+    for (size_t threads = 1; threads <= 8; threads *= 2)
+    {
+        map *mp = map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+        map_build_parallel(mp, keys, values, N, threads);
+
+        ASSERT_EQ(map_size(mp), map_size(expected));
+        ASSERT_NE(checked_height(((map_test *)mp)->header.root), -1);
+
+        /* Повторяющиеся ключи: остаётся значение, встретившееся последним */
+        map_iterator it = map_iterator_first(mp);
+        map_iterator expected_it = map_iterator_first(expected);
+        for (; map_iterator_compare(it, map_iterator_end(mp)) != 0; map_iterator_next(mp, it))
+        {
+            if (map_iterator_get_key(it, int) != map_iterator_get_key(expected_it, int)
+                || map_iterator_get_value(it, int) != map_iterator_get_value(expected_it, int))
+            {
+                break;
+            }
+            map_iterator_next(expected, expected_it);
+        }
+        ASSERT_EQ_CMP(expected_it, map_iterator_end(expected), map_iterator_compare);
+        ASSERT_EQ(map_iterator_get_key(map_iterator_last(mp), int), map_iterator_get_key(map_iterator_last(expected), int));
+
+        /* Построенное дерево остаётся обычным контейнером */
+        int key = 5000, value = 1;
+        map_insert(mp, key, value);
+        ASSERT_EQ(map_iterator_get_key(map_iterator_last(mp), int), 5000);
+        map_erase(mp, map_iterator_first(mp));
+        ASSERT_NE(checked_height(((map_test *)mp)->header.root), -1);
+
+        map_free(mp);
+    }
+
+    /* В непустой контейнер элементы вставляются по одному */
+    int key = 7, value = 7;
+    map *mp = map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+    map_insert(mp, key, value);
+    map_build_parallel(mp, keys, values, N, 4);
+    bool key_in_input = map_iterator_compare(map_find(expected, key), map_iterator_end(expected)) != 0;
+    ASSERT_EQ(map_size(mp), map_size(expected) + (key_in_input ? 0 : 1));
+
+    map_free(mp);
+    map_free(expected);
+}
+
+void double_value(const void *key, void *value, void *ctx)
+{
+    *(int *)value *= 2;
+}
+
+void sum_value(const void *key, const void *value, void *acc, void *ctx)
+{
+    *(long long *)acc += *(const int *)value;
+}
+
+void sum_combine(void *acc, const void *other, void *ctx)
+{
+    *(long long *)acc += *(const long long *)other;
+}
+
+/**
+ * Аккумулятор для проверки порядка: отрезок подряд идущих ключей [first, last]
+ */
+typedef struct run_acc
+{
+    int     first;
+    int     last;
+    bool    empty;
+    bool    ordered;
+} run_acc;
+
+void run_append(const void *key, const void *value, void *acc, void *ctx)
+{
+    run_acc *run = acc;
+    int k = *(const int *)key;
+    if (run->empty) {
+        run->first = k;
+    }
+    else if (k != run->last + 1) {
+        run->ordered = false;
+    }
+    run->last = k;
+    run->empty = false;
+}
+
+void run_combine(void *acc, const void *other, void *ctx)
+{
+    run_acc *run = acc;
+    const run_acc *other_run = other;
+    if (other_run->empty) {
+        return;
+    }
+    if (!other_run->ordered || (!run->empty && other_run->first != run->last + 1)) {
+        run->ordered = false;
+    }
+    if (run->empty) {
+        run->first = other_run->first;
+    }
+    run->last = other_run->last;
+    run->empty = false;
+}
+
+C_TEST(parallel_test)
+{
+    map *mp = map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+
+    long long sum = -1, zero = 0;
+    map_parallel_reduce(mp, sum_value, sum_combine, &zero, sizeof(long long), &sum, NULL, 4);
+    ASSERT_EQ(sum, 0);
+
+    for (int i = 0; i < 10000; ++i) {
+        map_insert(mp, i, i);
+    }
+
+    for (size_t threads = 1; threads <= 8; threads *= 2)
+    {
+        map_parallel_for(mp, double_value, NULL, threads);
+
+        map_parallel_reduce(mp, sum_value, sum_combine, &zero, sizeof(long long), &sum, NULL, threads);
+        ASSERT_EQ(sum, (long long)9999 * 10000 / 2 * 2);
+
+        map_parallel_for(mp, double_value, NULL, 1);
+        map_parallel_for(mp, double_value, NULL, 1);
+        map_parallel_for_range(mp, NULL, NULL, double_value, NULL, threads);
+        map_parallel_reduce(mp, sum_value, sum_combine, &zero, sizeof(long long), &sum, NULL, threads);
+        ASSERT_EQ(sum, (long long)9999 * 10000 / 2 * 16);
+
+        /* Возвращаем исходные значения */
+        for (int i = 0; i < 10000; ++i) {
+            map_insert(mp, i, i);
+        }
+
+        /* Аккумуляторы объединяются в порядке возрастания ключей */
+        run_acc run, empty_run = {.empty = true, .ordered = true};
+        map_parallel_reduce(mp, run_append, run_combine, &empty_run, sizeof(run_acc), &run, NULL, threads);
+        ASSERT_TRUE(run.ordered);
+        ASSERT_EQ(run.first, 0);
+        ASSERT_EQ(run.last, 9999);
+
+        int lo = 100, hi = 200;
+        map_parallel_reduce_range(mp, &lo, &hi, run_append, run_combine, &empty_run, sizeof(run_acc), &run, NULL, threads);
+        ASSERT_TRUE(run.ordered);
+        ASSERT_EQ(run.first, 100);
+        ASSERT_EQ(run.last, 199);
+
+        map_parallel_reduce_range(mp, NULL, &hi, sum_value, sum_combine, &zero, sizeof(long long), &sum, NULL, threads);
+        ASSERT_EQ(sum, (long long)199 * 200 / 2);
+
+        map_parallel_for_range(mp, &hi, NULL, double_value, NULL, threads);
+        map_parallel_reduce_range(mp, &lo, NULL, sum_value, sum_combine, &zero, sizeof(long long), &sum, NULL, threads);
+        ASSERT_EQ(sum, (long long)199 * 200 / 2 - (long long)99 * 100 / 2 + ((long long)9999 * 10000 / 2 - (long long)199 * 200 / 2) * 2);
+
+        for (int i = 0; i < 10000; ++i) {
+            map_insert(mp, i, i);
+        }
+    }
+
+    map_free(mp);
+}
+
+MAP_DEFINE(int_map, int, int, MAP_CMP_NUMBER)
+
+C_TEST(map_define_test)
+{
+    int_map tm;
+    int_map_init(&tm);
+    map *mp = map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+
+    ASSERT_TRUE(int_map_first(&tm) == NULL);
+    ASSERT_TRUE(int_map_find(&tm, 1) == NULL);
+    ASSERT_FALSE(int_map_erase(&tm, 1));
+
+    uint32_t state = 2463534242u;
+    for (int i = 0; i < 20000; ++i)
+    {
+        /* xorshift32 */
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        int key = (int)(state % 2000);
+        if (state >> 31)
+        {
+            bool is_new = map_iterator_compare(map_find(mp, key), map_iterator_end(mp)) == 0;
+            ASSERT_EQ(int_map_insert(&tm, key, i), is_new);
+            map_insert(mp, key, i);
+        }
+        else
+        {
+            bool found = map_iterator_compare(map_find(mp, key), map_iterator_end(mp)) != 0;
+            ASSERT_EQ(int_map_erase(&tm, key), found);
+            if (found) {
+                map_erase(mp, map_find(mp, key));
+            }
+        }
+    }
+
+    ASSERT_EQ(int_map_size(&tm), map_size(mp));
+    ASSERT_NE(checked_height((avl_node_test *)tm.root), -1);
+    ASSERT_NE(checked_height(((map_test *)mp)->header.root), -1);
+
+    int_map_node *node = int_map_first(&tm);
+    for (map_iterator it = map_iterator_first(mp); map_iterator_compare(it, map_iterator_end(mp)) != 0; 
+        map_iterator_next(mp, it))
+    {
+        ASSERT_EQ(node->key, map_iterator_get_key(it, int));
+        ASSERT_EQ(node->value, map_iterator_get_value(it, int));
+        ASSERT_EQ(*int_map_find(&tm, node->key), node->value);
+        node = int_map_next(node);
+    }
+    ASSERT_TRUE(node == NULL);
+
+    node = int_map_last(&tm);
+    ASSERT_EQ(node->key, map_iterator_get_key(map_iterator_last(mp), int));
+    ASSERT_TRUE(int_map_prev(int_map_next(int_map_first(&tm))) == int_map_first(&tm));
+
+    map_free(mp);
+    int_map_free(&tm);
+    ASSERT_EQ(int_map_size(&tm), 0);
+
+    /* Удаление узла с двумя детьми не перемещает элементы других узлов */
+    mp = map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+    int keys[] = {100, 50, 200, 150};
+    for (int i = 0; i < 4; ++i) {
+        map_insert(mp, keys[i], keys[i]);
+    }
+    map_iterator it = map_find(mp, keys[3]);
+    map_erase(mp, map_find(mp, keys[0]));
+    ASSERT_EQ(map_iterator_get_key(it, int), 150);
+    ASSERT_EQ(map_iterator_get_value(it, int), 150);
+    ASSERT_NE(checked_height(((map_test *)mp)->header.root), -1);
+    map_free(mp);
+}
+
+C_TEST(key_kind_test)
+{
+    map *i32 = map_create(sizeof(int32_t), sizeof(int), MAP_KEY_I32, NULL, NULL);
+    map *u64 = map_create(sizeof(uint64_t), sizeof(int), MAP_KEY_U64, NULL, NULL);
+    map *bytes = map_create(3, sizeof(int), MAP_KEY_BYTES, NULL, NULL);
+    map *custom = map_create(sizeof(int), sizeof(int), int_compare_func, NULL, NULL);
+
+    uint32_t state = 2463534242u;
+    for (int i = 0; i < 5000; ++i)
+    {
+        /* xorshift32 */
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        int32_t key = (int32_t)(state % 1000) - 500;
+        uint64_t key_u64 = (uint64_t)key;
+        /* Старший байт первым - побайтовый порядок совпадает с числовым */
+        uint8_t key_bytes[3] = {(uint8_t)((key + 500) >> 8), (uint8_t)(key + 500), 0};
+
+        if (state >> 31)
+        {
+            map_insert(i32, key, i);
+            map_insert(u64, key_u64, i);
+            map_insert(bytes, key_bytes, i);
+            map_insert(custom, key, i);
+        }
+        else if (map_iterator_compare(map_find(custom, key), map_iterator_end(custom)) != 0)
+        {
+            map_erase(i32, map_find(i32, key));
+            map_erase(u64, map_find(u64, key_u64));
+            map_erase(bytes, map_find(bytes, key_bytes));
+            map_erase(custom, map_find(custom, key));
+        }
+        else
+        {
+            ASSERT_EQ(map_iterator_compare(map_find(i32, key), map_iterator_end(i32)), 0);
+            ASSERT_EQ(map_iterator_compare(map_find(bytes, key_bytes), map_iterator_end(bytes)), 0);
+        }
+    }
+
+    ASSERT_EQ(map_size(i32), map_size(custom));
+    ASSERT_EQ(map_size(u64), map_size(custom));
+    ASSERT_EQ(map_size(bytes), map_size(custom));
+    ASSERT_NE(checked_height(((map_test *)i32)->header.root), -1);
+
+    map_iterator it = map_iterator_first(i32);
+    map_iterator it_bytes = map_iterator_first(bytes);
+    for (map_iterator c = map_iterator_first(custom); map_iterator_compare(c, map_iterator_end(custom)) != 0; 
+        map_iterator_next(custom, c))
+    {
+        int key = map_iterator_get_key(c, int);
+        ASSERT_EQ(map_iterator_get_key(it, int32_t), key);
+        ASSERT_EQ(map_iterator_get_value(it, int), map_iterator_get_value(c, int));
+        ASSERT_EQ(map_iterator_get_value(it_bytes, int), map_iterator_get_value(c, int));
+
+        uint64_t key_u64 = (uint64_t)key;
+        ASSERT_EQ(map_iterator_get_value(map_find(u64, key_u64), int), map_iterator_get_value(c, int));
+
+        map_iterator_next(i32, it);
+        map_iterator_next(bytes, it_bytes);
+    }
+
+    /* Отрицательные ключи как uint64_t больше положительных */
+    ASSERT_TRUE(map_iterator_get_key(map_iterator_first(u64), uint64_t) < (uint64_t)1 << 63);
+
+    map_free(i32);
+    map_free(u64);
+    map_free(bytes);
+    map_free(custom);
+
+    map *strings = map_create(sizeof(char *), sizeof(int), MAP_KEY_CSTR, NULL, NULL);
+    char *words[] = {"pear", "apple", "plum", "fig", "apricot"};
+    for (int i = 0; i < 5; ++i) {
+        map_insert(strings, words[i], i);
+    }
+
+    char query[] = "plum";
+    char *query_ptr = query;
+    ASSERT_EQ(map_iterator_get_value(map_find(strings, query_ptr), int), 2);
+    ASSERT_EQ(strcmp(map_iterator_get_key(map_iterator_first(strings), char *), "apple"), 0);
+    ASSERT_EQ(strcmp(map_iterator_get_key(map_iterator_last(strings), char *), "plum"), 0);
+
+    map_erase(strings, map_find(strings, query_ptr));
+    ASSERT_EQ(map_iterator_compare(map_find(strings, query_ptr), map_iterator_end(strings)), 0);
+    ASSERT_EQ(map_size(strings), 4);
+    map_free(strings);
+}
+
+int string_compare_func(const void *f, const void *s)
+{
+    return strcmp(*(const char **)f, *(const char **)s);
+}
+
+C_TEST(bytes_key_wrappers_test)
+{
+    concurrent_avl *cavl = concurrent_avl_create(8, sizeof(int), MAP_KEY_BYTES, NULL, NULL);
+
+    /* Ключи отличаются только в старших разрядах - первый байт у всех нулевой */
+    uint8_t split_keys[3][12] = {{0}};
+    for (int i = 0; i < 3; ++i)
+    {
+        split_keys[i][10] = (uint8_t)((i + 1) * 500 >> 8);
+        split_keys[i][11] = (uint8_t)((i + 1) * 500);
+    }
+    sharded_map *smap = sharded_map_create(12, sizeof(int), MAP_KEY_BYTES, NULL, NULL, 4, split_keys);
+
+    for (int i = 0; i < 2000; ++i)
+    {
+        uint8_t key[8] = {0, 0, 0, 0, 0, 0, (uint8_t)(i >> 8), (uint8_t)i};
+        uint8_t wide_key[12] = {0};
+        wide_key[10] = (uint8_t)(i >> 8);
+        wide_key[11] = (uint8_t)i;
+
+        concurrent_avl_insert(cavl, key, i);
+        sharded_map_insert(smap, wide_key, i);
+    }
+
+    ASSERT_EQ(concurrent_avl_size(cavl), 2000);
+    ASSERT_EQ(sharded_map_size(smap), 2000);
+
+    for (int i = 0; i < 2000; ++i)
+    {
+        uint8_t key[8] = {0, 0, 0, 0, 0, 0, (uint8_t)(i >> 8), (uint8_t)i};
+        uint8_t wide_key[12] = {0};
+        wide_key[10] = (uint8_t)(i >> 8);
+        wide_key[11] = (uint8_t)i;
+
+        int value = -1;
+        ASSERT_TRUE(concurrent_avl_find(cavl, key, value));
+        ASSERT_EQ(value, i);
+        value = -1;
+        ASSERT_TRUE(sharded_map_find(smap, wide_key, value));
+        ASSERT_EQ(value, i);
+    }
+
+    /* Разбиение шарда по ключу, отличающемуся от границ только младшим байтом */
+    uint8_t split_key[12] = {0};
+    split_key[10] = (uint8_t)(750 >> 8);
+    split_key[11] = (uint8_t)750;
+    sharded_map_split(smap, split_key);
+    ASSERT_EQ(sharded_map_shards_count(smap), 5);
+    ASSERT_EQ(sharded_map_size(smap), 2000);
+
+    uint8_t key[8] = {0, 0, 0, 0, 0, 0, (uint8_t)(1000 >> 8), (uint8_t)1000};
+    ASSERT_TRUE(concurrent_avl_erase(cavl, key));
+    ASSERT_FALSE(concurrent_avl_erase(cavl, key));
+    ASSERT_EQ(concurrent_avl_size(cavl), 1999);
+
+    concurrent_avl_free(cavl);
+    sharded_map_free(smap);
+}
+
+C_TEST(key_prefix_test)
+{
+    enum { N = 3000 };
+    static char buffers[N][32];
+    static char *strings[N];
+    for (int i = 0; i < N; ++i)
+    {
+        /* Длинные строки с общим префиксом, короткие строки и строки с байтами > 127 */
+        switch (i % 3)
+        {
+            case 0: sprintf(buffers[i], "common_prefix_%d", i * 7919 % N); break;
+            case 1: sprintf(buffers[i], "%d", i * 7919 % N); break;
+            default: sprintf(buffers[i], "\xc3\xa9%d", i * 7919 % N); break;
+        }
+        strings[i] = buffers[i];
+    }
+
+    map *plain = map_create(sizeof(char *), sizeof(int), MAP_KEY_CSTR, NULL, NULL);
+    map *prefixed = map_create(sizeof(char *), sizeof(int), string_compare_func, NULL, NULL);
+
+    for (int i = 0; i < N / 2; ++i)
+    {
+        map_insert(plain, strings[i], i);
+        map_insert(prefixed, strings[i], i);
+    }
+    /* Префиксы уже добавленных элементов вычисляются при включении */
+    map_set_key_prefix(prefixed, MAP_KEY_PREFIX_CSTR);
+    for (int i = N / 2; i < N; ++i)
+    {
+        map_insert(plain, strings[i], i);
+        map_insert(prefixed, strings[i], i);
+    }
+    for (int i = 0; i < N; i += 5)
+    {
+        map_erase(plain, map_find(plain, strings[i]));
+        map_erase(prefixed, map_find(prefixed, strings[i]));
+    }
+
+    ASSERT_EQ(map_size(prefixed), map_size(plain));
+    ASSERT_NE(checked_height(((map_test *)prefixed)->header.root), -1);
+
+    map_iterator it = map_iterator_first(prefixed);
+    for (map_iterator p = map_iterator_first(plain); map_iterator_compare(p, map_iterator_end(plain)) != 0; 
+        map_iterator_next(plain, p))
+    {
+        ASSERT_EQ(map_iterator_get_key(it, char *), map_iterator_get_key(p, char *));
+        map_iterator_next(prefixed, it);
+    }
+
+    for (int i = 0; i < N; ++i)
+    {
+        char copy[32];
+        strcpy(copy, strings[i]);
+        char *query = copy;
+        bool expected = map_iterator_compare(map_find(plain, query), map_iterator_end(plain)) != 0;
+        ASSERT_EQ(map_iterator_compare(map_find(prefixed, query), map_iterator_end(prefixed)) != 0, expected);
+        ASSERT_EQ(expected, i % 5 != 0);
+    }
+
+    /* Префиксы согласованы с порядком строк */
+    char *a = "abc", *b = "abcdefgh_tail", *c = "abd", *empty = "";
+    ASSERT_TRUE(map_key_prefix_cstr(&empty) < map_key_prefix_cstr(&a));
+    ASSERT_TRUE(map_key_prefix_cstr(&a) < map_key_prefix_cstr(&b));
+    ASSERT_TRUE(map_key_prefix_cstr(&b) < map_key_prefix_cstr(&c));
+
+    map_set_key_prefix(prefixed, NULL);
+    ASSERT_EQ(map_iterator_get_value(map_find(prefixed, strings[1]), int), 1);
+
+    map_free(plain);
+    map_free(prefixed);
+}
+
+typedef struct composite_key
+{
+    int32_t     id;
+    char        name[8];
+    double      weight;
+} composite_key;
+
+int composite_compare_func(const void *f, const void *s)
+{
+    const composite_key *kf = (const composite_key *)f;
+    const composite_key *ks = (const composite_key *)s;
+    if (kf->id != ks->id) {
+        return (kf->id > ks->id) - (kf->id < ks->id);
+    }
+    int name_cmp = strncmp(kf->name, ks->name, sizeof(kf->name));
+    if (name_cmp != 0) {
+        return name_cmp;
+    }
+    return (kf->weight > ks->weight) - (kf->weight < ks->weight);
+}
+
+void encode_composite(const composite_key *key, uint8_t out[20])
+{
+    map_key_encoder enc;
+    map_key_encoder_init(&enc, out, 20);
+    map_key_encode_i32(&enc, key->id);
+    map_key_encode_str(&enc, key->name, sizeof(key->name));
+    map_key_encode_f64(&enc, key->weight);
+}
+
+C_TEST(normalized_key_test)
+{
+    map *custom = map_create(sizeof(composite_key), sizeof(int), composite_compare_func, NULL, NULL);
+    map *normalized = map_create(20, sizeof(int), MAP_KEY_NORMALIZED, NULL, NULL);
+    /* 16-байтовые ключи сравниваются словами */
+    map *pairs = map_create(16, sizeof(int), MAP_KEY_NORMALIZED, NULL, NULL);
+
+    const char *names[] = {"", "a", "ab", "b", "\xff", "abcdefgh"};
+    const double weights[] = {-1e300, -2.5, -0.0, 0.0, 1e-300, 3.0};
+
+    uint32_t state = 2463534242u;
+    for (int i = 0; i < 3000; ++i)
+    {
+        /* xorshift32 */
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        composite_key key = {.id = (int32_t)(state % 7) - 3};
+        strncpy(key.name, names[(state >> 8) % 6], sizeof(key.name));
+        key.weight = weights[(state >> 16) % 6];
+
+        uint8_t encoded[20];
+        encode_composite(&key, encoded);
+        map_insert(custom, key, i);
+        map_insert(normalized, encoded, i);
+
+        uint8_t pair[16];
+        map_key_encoder enc;
+        map_key_encoder_init(&enc, pair, sizeof(pair));
+        map_key_encode_i64(&enc, key.id);
+        map_key_encode_u64(&enc, state >> 28);
+        map_insert(pairs, pair, i);
+    }
+
+    ASSERT_EQ(map_size(normalized), map_size(custom));
+    ASSERT_EQ(map_size(pairs), 7 * 16);
+
+    map_iterator it = map_iterator_first(normalized);
+    for (map_iterator c = map_iterator_first(custom); map_iterator_compare(c, map_iterator_end(custom)) != 0; 
+        map_iterator_next(custom, c))
+    {
+        composite_key key = map_iterator_get_key(c, composite_key);
+        uint8_t encoded[20];
+        encode_composite(&key, encoded);
+
+        ASSERT_EQ(memcmp(&map_iterator_get_key(it, uint8_t), encoded, sizeof(encoded)), 0);
+        ASSERT_EQ(map_iterator_get_value(it, int), map_iterator_get_value(c, int));
+        map_iterator_next(normalized, it);
+    }
+
+    int64_t previous_id = INT64_MIN;
+    uint64_t previous_low = 0;
+    for (map_iterator p = map_iterator_first(pairs); map_iterator_compare(p, map_iterator_end(pairs)) != 0; 
+        map_iterator_next(pairs, p))
+    {
+        const uint8_t *bytes = &map_iterator_get_key(p, uint8_t);
+        uint64_t high = 0;
+        for (int i = 0; i < 8; ++i) {
+            high = (high << 8) | bytes[i];
+        }
+        int64_t id = (int64_t)(high ^ ((uint64_t)1 << 63));
+        uint64_t low = bytes[15];
+        ASSERT_TRUE(id > previous_id || (id == previous_id && low > previous_low));
+        previous_id = id;
+        previous_low = low;
+    }
+
+    /* NaN больше бесконечности */
+    uint8_t inf[8], nan[8];
+    map_key_encoder enc;
+    map_key_encoder_init(&enc, inf, sizeof(inf));
+    map_key_encode_f64(&enc, 1.0 / 0.0);
+    map_key_encoder_init(&enc, nan, sizeof(nan));
+    map_key_encode_f64(&enc, -(0.0 / 0.0));
+    ASSERT_TRUE(memcmp(inf, nan, sizeof(inf)) < 0);
+
+    map_free(custom);
+    map_free(normalized);
+    map_free(pairs);
+}
+
+C_TEST(normalized_key_wrappers_test)
+{
+    map *custom = map_create(sizeof(composite_key), sizeof(int), composite_compare_func, NULL, NULL);
+    concurrent_avl *cavl = concurrent_avl_create(20, sizeof(int), MAP_KEY_NORMALIZED, NULL, NULL);
+
+    /* Границы шардов - пары (id, 0) для id = -1, 0, 1 */
+    uint8_t split_keys[3][16];
+    for (int i = 0; i < 3; ++i)
+    {
+        map_key_encoder enc;
+        map_key_encoder_init(&enc, split_keys[i], sizeof(split_keys[i]));
+        map_key_encode_i64(&enc, i - 1);
+        map_key_encode_u64(&enc, 0);
+    }
+    sharded_map *smap = sharded_map_create(16, sizeof(int), MAP_KEY_NORMALIZED, NULL, NULL, 4, split_keys);
+
+    const char *names[] = {"", "a", "ab", "b", "\xff", "abcdefgh"};
+    const double weights[] = {-1e300, -2.5, -0.0, 0.0, 1e-300, 3.0};
+
+    uint32_t state = 2463534242u;
+    for (int i = 0; i < 3000; ++i)
+    {
+        /* xorshift32 */
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        composite_key key = {.id = (int32_t)(state % 7) - 3};
+        strncpy(key.name, names[(state >> 8) % 6], sizeof(key.name));
+        key.weight = weights[(state >> 16) % 6];
+
+        uint8_t encoded[20];
+        encode_composite(&key, encoded);
+        map_insert(custom, key, i);
+        concurrent_avl_insert(cavl, encoded, i);
+
+        uint8_t pair[16];
+        map_key_encoder enc;
+        map_key_encoder_init(&enc, pair, sizeof(pair));
+        map_key_encode_i64(&enc, key.id);
+        map_key_encode_u64(&enc, state >> 28);
+        sharded_map_insert(smap, pair, i);
+    }
+
+    ASSERT_EQ(concurrent_avl_size(cavl), map_size(custom));
+    ASSERT_EQ(sharded_map_size(smap), 7 * 16);
+
+    for (map_iterator c = map_iterator_first(custom); map_iterator_compare(c, map_iterator_end(custom)) != 0; 
+        map_iterator_next(custom, c))
+    {
+        composite_key key = map_iterator_get_key(c, composite_key);
+        uint8_t encoded[20];
+        encode_composite(&key, encoded);
+
+        int value = -1;
+        ASSERT_TRUE(concurrent_avl_find(cavl, encoded, value));
+        ASSERT_EQ(value, map_iterator_get_value(c, int));
+    }
+
+    /* Обход шардов идёт в порядке memcmp */
+    sharded_map_read_lock(smap);
+    uint8_t previous[16] = {0};
+    size_t count = 0;
+    for (sharded_map_iterator it = sharded_map_iterator_first(smap); 
+        sharded_map_iterator_compare(it, sharded_map_iterator_end(smap)) != 0; sharded_map_iterator_next(smap, it))
+    {
+        const uint8_t *bytes = &sharded_map_iterator_get_key(it, uint8_t);
+        ASSERT_TRUE(count == 0 || memcmp(previous, bytes, sizeof(previous)) < 0);
+        memcpy(previous, bytes, sizeof(previous));
+        ++count;
+    }
+    sharded_map_read_unlock(smap);
+    ASSERT_EQ(count, 7 * 16);
+
+    map_free(custom);
+    concurrent_avl_free(cavl);
+    sharded_map_free(smap);
+}
+
+/**
+ * Проба - подстрока без завершающего нуля
+ */
+typedef struct string_slice
+{
+    const char *    data;
+    size_t          length;
+} string_slice;
+
+int slice_compare_func(const void *node_key, const void *probe)
+{
+    const char *key = *(const char **)node_key;
+    const string_slice *slice = (const string_slice *)probe;
+
+    int cmp = strncmp(key, slice->data, slice->length);
+    if (cmp != 0) {
+        return cmp;
+    }
+    /* Ключ длиннее подстроки - он больше */
+    return key[slice->length] != '\0';
+}
+
+C_TEST(find_with_test)
+{
+    map *mp = map_create(sizeof(char *), sizeof(int), MAP_KEY_CSTR, NULL, NULL);
+    char *words[] = {"apple", "apricot", "banana", "cherry", "fig"};
+    for (int i = 0; i < 5; ++i) {
+        map_insert(mp, words[i], i);
+    }
+
+    const char *buffer = "apricotbananafigs";
+    string_slice apricot = {buffer, 7}, banana = {buffer + 7, 6}, fig = {buffer + 13, 3};
+    string_slice figs = {buffer + 13, 4}, apr = {buffer, 3}, empty = {buffer, 0};
+
+    ASSERT_EQ(map_iterator_get_value(map_find_with(mp, &apricot, slice_compare_func), int), 1);
+    ASSERT_EQ(map_iterator_get_value(map_find_with(mp, &banana, slice_compare_func), int), 2);
+    ASSERT_EQ(map_iterator_get_value(map_find_with(mp, &fig, slice_compare_func), int), 4);
+    ASSERT_EQ(map_iterator_compare(map_find_with(mp, &figs, slice_compare_func), map_iterator_end(mp)), 0);
+    ASSERT_EQ(map_iterator_compare(map_find_with(mp, &apr, slice_compare_func), map_iterator_end(mp)), 0);
+
+    ASSERT_EQ(map_iterator_get_value(map_lower_bound_with(mp, &apr, slice_compare_func), int), 1);
+    ASSERT_EQ(map_iterator_get_value(map_upper_bound_with(mp, &apr, slice_compare_func), int), 1);
+    ASSERT_EQ(map_iterator_get_value(map_lower_bound_with(mp, &banana, slice_compare_func), int), 2);
+    ASSERT_EQ(map_iterator_get_value(map_upper_bound_with(mp, &banana, slice_compare_func), int), 3);
+    ASSERT_EQ(map_iterator_get_value(map_lower_bound_with(mp, &empty, slice_compare_func), int), 0);
+    ASSERT_EQ(map_iterator_compare(map_lower_bound_with(mp, &figs, slice_compare_func), map_iterator_end(mp)), 0);
+    ASSERT_EQ(map_iterator_compare(map_upper_bound_with(mp, &fig, slice_compare_func), map_iterator_end(mp)), 0);
+
+    map_free(mp);
+}
+
+/**
+ * Тест хранилища MAP_BACKEND_BTREE: случайные вставки и удаления сверяются
+ * с массивом-эталоном, а затем проверяется обход в обе стороны. Ключей
+ * достаточно, чтобы дерево имело несколько уровней и при удалениях 
+ * происходили заимствования и слияния узлов
+ */
+
+#define BTREE_TEST_KEYS 20000
+
+atomic_int btree_destroyed;
+
+void count_destroyed(void *value)
+{
+    atomic_fetch_add(&btree_destroyed, 1);
+}
+
+C_TEST(btree_test)
+{
+    int (*compare_funcs[])(const void *, const void *) = {int_compare_func, MAP_KEY_I32};
+
+    for (int f = 0; f < 2; ++f)
+    {
+        map *mp = map_create_backend(sizeof(int), sizeof(int), compare_funcs[f], NULL, NULL, MAP_BACKEND_BTREE);
+        int *expected = malloc(BTREE_TEST_KEYS * sizeof(int));
+        ASSERT_TRUE(expected != NULL);
+        for (int i = 0; i < BTREE_TEST_KEYS; ++i) {
+            expected[i] = -1;
+        }
+
+        size_t size = 0;
+        uint32_t state = 2463534242u;
+        for (int i = 0; i < 200000; ++i)
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            int key = (int)(state % BTREE_TEST_KEYS);
+
+            /* Сначала заполняем контейнер, затем в основном удаляем */
+            if ((state >> 20) % 4 < (i < 100000 ? 3 : 1))
+            {
+                size += (expected[key] == -1);
+                expected[key] = i;
+                map_insert(mp, key, i);
+            }
+            else
+            {
+                map_iterator it = map_find(mp, key);
+                if (expected[key] == -1) {
+                    ASSERT_EQ(map_iterator_compare(it, map_iterator_end(mp)), 0);
+                }
+                else
+                {
+                    ASSERT_EQ(map_iterator_get_value(it, int), expected[key]);
+                    map_erase(mp, it);
+                    expected[key] = -1;
+                    size--;
+                }
+            }
+            ASSERT_EQ(map_size(mp), size);
+        }
+
+        size_t count = 0;
+        int previous = -1;
+        for (map_iterator it = map_iterator_first(mp); map_iterator_compare(it, map_iterator_end(mp)) != 0;
+            map_iterator_next(mp, it))
+        {
+            int key = map_iterator_get_key(it, int);
+            ASSERT_TRUE(key > previous);
+            ASSERT_EQ(map_iterator_get_value(it, int), expected[key]);
+            previous = key;
+            count++;
+        }
+        ASSERT_EQ(count, size);
+
+        count = 0;
+        map_iterator it = map_iterator_end(mp);
+        for (int key = BTREE_TEST_KEYS - 1; key >= 0; --key)
+        {
+            if (expected[key] == -1) {
+                continue;
+            }
+            map_iterator_prev(mp, it);
+            ASSERT_EQ(map_iterator_get_key(it, int), key);
+            count++;
+        }
+        ASSERT_EQ(count, size);
+        ASSERT_EQ(map_iterator_compare(it, map_iterator_first(mp)), 0);
+
+        /* Удаляем всё через итератор первого элемента - дерево сжимается до пустого */
+        while (!map_empty(mp)) {
+            map_erase(mp, map_iterator_first(mp));
+        }
+        ASSERT_EQ(map_iterator_compare(map_iterator_first(mp), map_iterator_end(mp)), 0);
+
+        map_free(mp);
+        free(expected);
+    }
+
+    /* Удалители вызываются при удалении, очистке и освобождении, но не при map_steal */
+    atomic_store(&btree_destroyed, 0);
+    map *mp = map_create_backend(sizeof(int), sizeof(int), MAP_KEY_I32, NULL, count_destroyed, MAP_BACKEND_BTREE);
+    for (int i = 0; i < 1000; ++i) {
+        map_insert(mp, i, i);
+    }
+    int key = 10;
+    map_erase(mp, map_find(mp, key));
+    key = 11;
+    map_steal(mp, map_find(mp, key));
+    ASSERT_EQ(atomic_load(&btree_destroyed), 1);
+    map_clear(mp);
+    ASSERT_EQ(atomic_load(&btree_destroyed), 999);
+    ASSERT_TRUE(map_empty(mp));
+
+    for (int i = 0; i < 100; ++i) {
+        map_insert(mp, i, i);
+    }
+    map_free(mp);
+    ASSERT_EQ(atomic_load(&btree_destroyed), 1099);
+
+    /* Поиск по пробе */
+    mp = map_create_backend(sizeof(char *), sizeof(int), MAP_KEY_CSTR, NULL, NULL, MAP_BACKEND_BTREE);
+    char *words[] = {"apple", "apricot", "banana", "cherry", "fig"};
+    for (int i = 0; i < 5; ++i) {
+        map_insert(mp, words[i], i);
+    }
+
+    const char *buffer = "apricotbananafigs";
+    string_slice banana = {buffer + 7, 6}, figs = {buffer + 13, 4}, apr = {buffer, 3};
+
+    ASSERT_EQ(map_iterator_get_value(map_find_with(mp, &banana, slice_compare_func), int), 2);
+    ASSERT_EQ(map_iterator_compare(map_find_with(mp, &apr, slice_compare_func), map_iterator_end(mp)), 0);
+    ASSERT_EQ(map_iterator_get_value(map_lower_bound_with(mp, &apr, slice_compare_func), int), 1);
+    ASSERT_EQ(map_iterator_get_value(map_upper_bound_with(mp, &banana, slice_compare_func), int), 3);
+    ASSERT_EQ(map_iterator_compare(map_lower_bound_with(mp, &figs, slice_compare_func), map_iterator_end(mp)), 0);
+
+    map_free(mp);
+}
+
+/**
+ * Тест frozen_map: для контейнеров разного размера (в том числе неполных
+ * деревьев Эйтцингера) поиск и границы сверяются с map, а обход должен
+ * проходить ключи в порядке возрастания
+ */
+C_TEST(frozen_map_test)
+{
+    int (*compare_funcs[])(const void *, const void *) = {int_compare_func, MAP_KEY_I32};
+    int sizes[] = {0, 1, 2, 3, 7, 8, 9, 100, 1000};
+
+    for (int f = 0; f < 2; ++f)
+    {
+        for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); ++s)
+        {
+            map *mp = map_create_backend(sizeof(int), sizeof(int), compare_funcs[f], NULL, NULL, 
+                f == 0 ? MAP_BACKEND_AVL : MAP_BACKEND_BTREE);
+            /* Чётные ключи, чтобы между ними были отсутствующие */
+            for (int i = 0; i < sizes[s]; ++i)
+            {
+                int key = 2 * i, value = -i;
+                map_insert(mp, key, value);
+            }
+
+            frozen_map *fm = map_freeze(mp);
+            ASSERT_EQ(frozen_map_size(fm), (size_t)sizes[s]);
+
+            int expected = 0;
+            for (size_t pos = frozen_map_first(fm); pos != FROZEN_MAP_END; pos = frozen_map_next(fm, pos))
+            {
+                ASSERT_EQ(frozen_map_get_key(fm, pos, int), 2 * expected);
+                ASSERT_EQ(frozen_map_get_value(fm, pos, int), -expected);
+                expected++;
+            }
+            ASSERT_EQ(expected, sizes[s]);
+
+            for (int key = -1; key <= 2 * sizes[s] + 1; ++key)
+            {
+                size_t pos = frozen_map_find(fm, key);
+                if (key >= 0 && key % 2 == 0 && key < 2 * sizes[s]) {
+                    ASSERT_EQ(frozen_map_get_value(fm, pos, int), -key / 2);
+                }
+                else {
+                    ASSERT_EQ(pos, FROZEN_MAP_END);
+                }
+
+                /* Ожидаемые нижняя и верхняя границы - ближайшие чётные ключи */
+                int lower = (key < 0) ? 0 : (key + 1) / 2 * 2;
+                int upper = (key < 0) ? 0 : key / 2 * 2 + 2;
+                pos = frozen_map_lower_bound(fm, key);
+                if (lower < 2 * sizes[s]) {
+                    ASSERT_EQ(frozen_map_get_key(fm, pos, int), lower);
+                }
+                else {
+                    ASSERT_EQ(pos, FROZEN_MAP_END);
+                }
+                pos = frozen_map_upper_bound(fm, key);
+                if (upper < 2 * sizes[s]) {
+                    ASSERT_EQ(frozen_map_get_key(fm, pos, int), upper);
+                }
+                else {
+                    ASSERT_EQ(pos, FROZEN_MAP_END);
+                }
+            }
+
+            frozen_map_free(fm);
+            map_free(mp);
+        }
+    }
+}
+
+/**
+ * Тест блочного индекса frozen_map для ключей MAP_KEY_U64: индекс из 
+ * нескольких уровней, граничные значения ключей и сверка с map
+ */
+C_TEST(frozen_map_blocks_test)
+{
+    map *mp = map_create(sizeof(uint64_t), sizeof(uint64_t), MAP_KEY_U64, NULL, NULL);
+    uint64_t state = 88172645463325252ull;
+    for (int i = 0; i < 6000; ++i)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        /* Малые ключи, чтобы часть проб совпадала с ключами контейнера */
+        uint64_t key = state % 20000, value = ~key;
+        map_insert(mp, key, value);
+    }
+    uint64_t edge_keys[] = {0, UINT64_MAX, UINT64_MAX - 1, (uint64_t)1 << 63};
+    for (int i = 0; i < 4; ++i)
+    {
+        uint64_t value = ~edge_keys[i];
+        map_insert(mp, edge_keys[i], value);
+    }
+
+    frozen_map *fm = map_freeze(mp);
+    ASSERT_EQ(frozen_map_size(fm), map_size(mp));
+
+    map_iterator it = map_iterator_first(mp);
+    for (size_t pos = frozen_map_first(fm); pos != FROZEN_MAP_END; pos = frozen_map_next(fm, pos))
+    {
+        ASSERT_EQ(frozen_map_get_key(fm, pos, uint64_t), map_iterator_get_key(it, uint64_t));
+        map_iterator_next(mp, it);
+    }
+    ASSERT_EQ(map_iterator_compare(it, map_iterator_end(mp)), 0);
+
+    for (uint64_t key = 0; key < 20100; ++key)
+    {
+        size_t pos = frozen_map_find(fm, key);
+        if (map_iterator_compare(map_find(mp, key), map_iterator_end(mp)) != 0) {
+            ASSERT_EQ(frozen_map_get_value(fm, pos, uint64_t), ~key);
+        }
+        else {
+            ASSERT_EQ(pos, FROZEN_MAP_END);
+        }
+
+        pos = frozen_map_upper_bound(fm, key);
+        ASSERT_TRUE(frozen_map_get_key(fm, pos, uint64_t) > key);
+        ASSERT_TRUE(key == 0 || frozen_map_get_key(fm, frozen_map_lower_bound(fm, key), uint64_t) >= key);
+    }
+
+    uint64_t probe = UINT64_MAX;
+    ASSERT_EQ(frozen_map_get_key(fm, frozen_map_find(fm, probe), uint64_t), UINT64_MAX);
+    ASSERT_EQ(frozen_map_upper_bound(fm, probe), FROZEN_MAP_END);
+    probe = UINT64_MAX - 2;
+    ASSERT_EQ(frozen_map_get_key(fm, frozen_map_upper_bound(fm, probe), uint64_t), UINT64_MAX - 1);
+    probe = ((uint64_t)1 << 63) - 1;
+    ASSERT_EQ(frozen_map_get_key(fm, frozen_map_lower_bound(fm, probe), uint64_t), (uint64_t)1 << 63);
+
+    frozen_map_free(fm);
+    map_free(mp);
+}
+
+C_TEST(find_cache_test)
+{
+    map *mp = map_create(sizeof(uint64_t), sizeof(uint64_t), MAP_KEY_U64, NULL, NULL);
+    map *reference = map_create(sizeof(uint64_t), sizeof(uint64_t), MAP_KEY_U64, NULL, NULL);
+    /* Маленький кэш, чтобы записи вытесняли друг друга */
+    map_set_find_cache(mp, 16, MAP_KEY_HASH_U64);
+
+    uint64_t state = 88172645463325252ull;
+    for (int i = 0; i < 20000; ++i)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        /* Большая часть операций приходится на 8 горячих ключей */
+        uint64_t key = (state % 4 != 0) ? state % 8 : state % 512, value = state;
+
+        if (state % 5 == 0)
+        {
+            map_iterator it = map_find(mp, key);
+            ASSERT_EQ(map_iterator_compare(it, map_iterator_end(mp)) == 0,
+                map_iterator_compare(map_find(reference, key), map_iterator_end(reference)) == 0);
+            if (map_iterator_compare(it, map_iterator_end(mp)) != 0)
+            {
+                map_erase(mp, it);
+                map_erase(reference, map_find(reference, key));
+            }
+        }
+        else if (state % 5 == 1)
+        {
+            map_insert(mp, key, value);
+            map_insert(reference, key, value);
+        }
+        else
+        {
+            map_iterator it = map_find(mp, key), ref = map_find(reference, key);
+            if (map_iterator_compare(ref, map_iterator_end(reference)) == 0) {
+                ASSERT_EQ(map_iterator_compare(it, map_iterator_end(mp)), 0);
+            }
+            else
+            {
+                ASSERT_EQ(map_iterator_get_key(it, uint64_t), key);
+                ASSERT_EQ(map_iterator_get_value(it, uint64_t), map_iterator_get_value(ref, uint64_t));
+            }
+        }
+    }
+
+    /* Повторные поиски горячих ключей попадают в кэш */
+    for (uint64_t key = 0; key < 8; ++key) {
+        map_insert(mp, key, key);
+    }
+    map_find_cache_stats before = map_get_find_cache_stats(mp);
+    for (int i = 0; i < 1000; ++i)
+    {
+        uint64_t key = i % 8;
+        ASSERT_EQ(map_iterator_get_value(map_find(mp, key), uint64_t), key);
+    }
+    map_find_cache_stats stats = map_get_find_cache_stats(mp);
+    ASSERT_TRUE(stats.hits - before.hits >= 1000 - 8);
+    ASSERT_TRUE(stats.misses - before.misses <= 8);
+
+    /* Отделение дерева от снимка заменяет узлы копиями - кэш не должен их вернуть */
+    uint64_t key = 3, value = 33;
+    map_insert(mp, key, value);
+    map_find(mp, key);
+    map *snapshot = map_snapshot(mp);
+    value = 34;
+    map_insert(mp, key, value);
+    ASSERT_EQ(map_iterator_get_value(map_find(mp, key), uint64_t), 34);
+    ASSERT_EQ(map_iterator_get_value(map_find(snapshot, key), uint64_t), 33);
+    map_free(snapshot);
+
+    map_clear(mp);
+    ASSERT_EQ(map_iterator_compare(map_find(mp, key), map_iterator_end(mp)), 0);
+
+    map_set_find_cache(mp, 0, NULL);
+    stats = map_get_find_cache_stats(mp);
+    ASSERT_EQ(stats.hits + stats.misses, 0);
+
+    map_free(reference);
+    map_free(mp);
+}
+
+C_TEST(cursor_test)
+{
+    map *mp = map_create(sizeof(int), sizeof(int), MAP_KEY_I32, NULL, NULL);
+    /* Чётные ключи 0..1998, lower bound ключа k - k, округлённый вверх до чётного */
+    for (int i = 0; i < 1000; ++i)
+    {
+        int key = 2 * i, value = -key;
+        map_insert(mp, key, value);
+    }
+
+    map_cursor cursor = map_cursor_init(mp);
+    for (int key = -5; key < 2005; ++key)
+    {
+        map_iterator it = map_cursor_seek(cursor, key);
+        if (key > 1998) {
+            ASSERT_EQ(map_iterator_compare(it, map_iterator_end(mp)), 0);
+        }
+        else {
+            ASSERT_EQ(map_iterator_get_key(it, int), (key <= 0) ? 0 : key + (key & 1));
+        }
+    }
+    for (int key = 2005; key > -5; key -= 3)
+    {
+        map_iterator it = map_cursor_seek(cursor, key);
+        if (key > 1998) {
+            ASSERT_EQ(map_iterator_compare(it, map_iterator_end(mp)), 0);
+        }
+        else {
+            ASSERT_EQ(map_iterator_get_key(it, int), (key <= 0) ? 0 : key + (key & 1));
+        }
+    }
+
+    /* Случайные переходы вперемешку с вставками и удалениями */
+    uint64_t state = 88172645463325252ull;
+    for (int i = 0; i < 20000; ++i)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        int key = (int)(state % 2100) - 50;
+
+        if (state % 64 == 0)
+        {
+            map_iterator it = map_find(mp, key);
+            if (map_iterator_compare(it, map_iterator_end(mp)) != 0) {
+                map_erase(mp, it);
+            }
+            else {
+                map_insert(mp, key, key);
+            }
+            continue;
+        }
+
+        map_iterator expected = map_lower_bound_with(mp, &key, map_key_compare_i32);
+        ASSERT_EQ(map_iterator_compare(map_cursor_seek(cursor, key), expected), 0);
+    }
+
+    map_free(mp);
+}
+
+static size_t counted_compares = 0;
+
+int counting_u64_compare_func(const void *f, const void *s)
+{
+    ++counted_compares;
+    return map_key_compare_u64(f, s);
+}
+
+C_TEST(bloom_filter_test)
+{
+    map *backends[2] = 
+    {
+        map_create(sizeof(uint64_t), sizeof(uint64_t), counting_u64_compare_func, NULL, NULL),
+        map_create_backend(sizeof(uint64_t), sizeof(uint64_t), counting_u64_compare_func, NULL, NULL, 
+            MAP_BACKEND_BTREE)
+    };
+
+    for (int b = 0; b < 2; ++b)
+    {
+        map *mp = backends[b];
+        /* Фильтр включается до вставок и растёт вместе с контейнером */
+        map_set_bloom_filter(mp, MAP_KEY_HASH_U64);
+
+        /* Чётные ключи вставляются, часть из них затем удаляется, нечётные - промахи */
+        for (uint64_t key = 0; key < 20000; key += 2) {
+            map_insert(mp, key, key);
+        }
+        for (uint64_t key = 0; key < 20000; key += 8) {
+            map_erase(mp, map_find(mp, key));
+        }
+        ASSERT_EQ(map_size(mp), 7500);
+
+        for (uint64_t key = 0; key < 20000; ++key)
+        {
+            bool present = key % 2 == 0 && key % 8 != 0;
+            ASSERT_EQ(map_iterator_compare(map_find(mp, key), map_iterator_end(mp)) != 0, present);
+        }
+
+        /* Большая часть промахов отсекается фильтром без единого сравнения */
+        counted_compares = 0;
+        for (uint64_t key = 1; key < 20000; key += 2) {
+            ASSERT_EQ(map_iterator_compare(map_find(mp, key), map_iterator_end(mp)), 0);
+        }
+        ASSERT_TRUE(counted_compares < 10000);
+
+        map_clear(mp);
+        uint64_t key = 2, value = 2;
+        ASSERT_EQ(map_iterator_compare(map_find(mp, key), map_iterator_end(mp)), 0);
+        map_insert(mp, key, value);
+        ASSERT_EQ(map_iterator_get_value(map_find(mp, key), uint64_t), 2);
+
+        map_free(mp);
+    }
+}
+
+C_TEST(hash_index_test)
+{
+    map *mp = map_create(sizeof(int), sizeof(int), MAP_KEY_I32, NULL, NULL);
+    map *reference = map_create(sizeof(int), sizeof(int), MAP_KEY_I32, NULL, NULL);
+
+    /* Индекс включается на непустом контейнере и строится по его элементам */
+    for (int key = 0; key < 100; ++key)
+    {
+        map_insert(mp, key, key);
+        map_insert(reference, key, key);
+    }
+    map_set_hash_index(mp, MAP_KEY_HASH_I32);
+
+    uint64_t state = 88172645463325252ull;
+    for (int i = 0; i < 30000; ++i)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        int key = (int)(state % 3000), value = (int)(state >> 40);
+
+        if (state % 3 == 0)
+        {
+            map_iterator it = map_find(mp, key);
+            if (map_iterator_compare(it, map_iterator_end(mp)) != 0)
+            {
+                map_erase(mp, it);
+                map_erase(reference, map_find(reference, key));
+            }
+        }
+        else
+        {
+            map_insert(mp, key, value);
+            map_insert(reference, key, value);
+        }
+
+        if (i == 15000)
+        /* Отделение дерева от снимка заменяет все узлы - индекс должен последовать */
+        {
+            map *snapshot = map_snapshot(mp);
+            map_insert(mp, key, value);
+            map_insert(reference, key, value);
+            map_free(snapshot);
+        }
+    }
+
+    ASSERT_EQ(map_size(mp), map_size(reference));
+    for (int key = -10; key < 3010; ++key)
+    {
+        map_iterator it = map_find(mp, key), ref = map_find(reference, key);
+        if (map_iterator_compare(ref, map_iterator_end(reference)) == 0) {
+            ASSERT_EQ(map_iterator_compare(it, map_iterator_end(mp)), 0);
+        }
+        else
+        {
+            ASSERT_EQ(map_iterator_get_key(it, int), key);
+            ASSERT_EQ(map_iterator_get_value(it, int), map_iterator_get_value(ref, int));
+        }
+
+        /* Упорядоченный доступ по-прежнему идёт по дереву */
+        it = map_lower_bound_with(mp, &key, map_key_compare_i32);
+        ref = map_lower_bound_with(reference, &key, map_key_compare_i32);
+        if (map_iterator_compare(ref, map_iterator_end(reference)) == 0) {
+            ASSERT_EQ(map_iterator_compare(it, map_iterator_end(mp)), 0);
+        }
+        else {
+            ASSERT_EQ(map_iterator_get_key(it, int), map_iterator_get_key(ref, int));
+        }
+    }
+
+    map_clear(mp);
+    int key = 5;
+    ASSERT_EQ(map_iterator_compare(map_find(mp, key), map_iterator_end(mp)), 0);
+
+    int keys[1000], values[1000];
+    for (int i = 0; i < 1000; ++i)
+    {
+        keys[i] = 999 - i;
+        values[i] = i;
+    }
+    map_build_parallel(mp, keys, values, 1000, 2);
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_EQ(map_iterator_get_value(map_find(mp, keys[i]), int), i);
+    }
+
+    map_free(reference);
+    map_free(mp);
+}
+
+C_TEST(small_map_test)
+{
+    enum { KEYS = 40 };
+    atomic_store(&btree_destroyed, 0);
+    map *mp = map_create_backend(sizeof(int), sizeof(int), MAP_KEY_I32, NULL, count_destroyed, MAP_BACKEND_SMALL);
+    int expected[KEYS];
+    for (int i = 0; i < KEYS; ++i) {
+        expected[i] = -1;
+    }
+
+    /* Размер колеблется вокруг порогов перехода между массивом и деревом */
+    size_t size = 0, destroyed = 0, promotions = 0, demotions = 0;
+    uint32_t state = 2463534242u;
+    for (int i = 0; i < 20000; ++i)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        int key = (int)(state % KEYS);
+        bool grow = (i / 250) % 2 == 0;
+        bool small_active = ((map_test *)mp)->small_active;
+
+        if ((state >> 20) % 4 < (grow ? 3 : 1))
+        {
+            size += (expected[key] == -1);
+            expected[key] = i;
+            map_insert(mp, key, i);
+        }
+        else
+        {
+            map_iterator it = map_find(mp, key);
+            if (expected[key] == -1) {
+                ASSERT_EQ(map_iterator_compare(it, map_iterator_end(mp)), 0);
+            }
+            else
+            {
+                ASSERT_EQ(map_iterator_get_value(it, int), expected[key]);
+                map_erase(mp, it);
+                expected[key] = -1;
+                size--;
+                destroyed++;
+            }
+        }
+        ASSERT_EQ(map_size(mp), size);
+        ASSERT_EQ(((map_test *)mp)->small_active, size <= 16 && (small_active || size <= 8));
+        promotions += small_active && !((map_test *)mp)->small_active;
+        demotions += !small_active && ((map_test *)mp)->small_active;
+
+        if (small_active && !((map_test *)mp)->small_active)
+        /* Дерево из 16 элементов массива строится сразу сбалансированным: 17 узлов - 5 уровней */
+        {
+            ASSERT_EQ(checked_height(((map_test *)mp)->header.root), 5);
+            int min = 0, max = KEYS - 1;
+            while (expected[min] == -1) {
+                min++;
+            }
+            while (expected[max] == -1) {
+                max--;
+            }
+            ASSERT_EQ(map_iterator_get_key(map_iterator_first(mp), int), min);
+            ASSERT_EQ(map_iterator_get_key(map_iterator_last(mp), int), max);
+        }
+
+        if (i % 97 == 0)
+        /* Обход в обе стороны и поиск границ в текущем режиме */
+        {
+            int prev = -1;
+            for (map_iterator it = map_iterator_first(mp); map_iterator_compare(it, map_iterator_end(mp)) != 0;
+                map_iterator_next(mp, it))
+            {
+                int k = map_iterator_get_key(it, int);
+                ASSERT_TRUE(k > prev && expected[k] == map_iterator_get_value(it, int));
+                prev = k;
+            }
+
+            size_t count = 0;
+            map_iterator it = map_iterator_end(mp);
+            while (count < size)
+            {
+                map_iterator_prev(mp, it);
+                ASSERT_TRUE(expected[map_iterator_get_key(it, int)] != -1);
+                count++;
+            }
+            ASSERT_EQ(map_iterator_compare(it, map_iterator_first(mp)), 0);
+
+            int probe = KEYS / 2;
+            it = map_upper_bound_with(mp, &probe, map_key_compare_i32);
+            int next = probe + 1;
+            while (next < KEYS && expected[next] == -1) {
+                next++;
+            }
+            if (next == KEYS) {
+                ASSERT_EQ(map_iterator_compare(it, map_iterator_end(mp)), 0);
+            }
+            else {
+                ASSERT_EQ(map_iterator_get_key(it, int), next);
+            }
+        }
+    }
+    ASSERT_EQ((size_t)atomic_load(&btree_destroyed), destroyed);
+    ASSERT_TRUE(promotions > 5 && demotions > 5);
+
+    map_clear(mp);
+    ASSERT_EQ((size_t)atomic_load(&btree_destroyed), destroyed + size);
+    int key = 7, value = 70;
+    map_insert(mp, key, value);
+    ASSERT_EQ(map_iterator_get_value(map_find(mp, key), int), 70);
+    map_free(mp);
+    ASSERT_EQ((size_t)atomic_load(&btree_destroyed), destroyed + size + 1);
+}
+
+C_TEST(small_map_tree_only_test)
+{
+    map *mp = map_create_backend(sizeof(int), sizeof(int), MAP_KEY_I32, NULL, NULL, MAP_BACKEND_SMALL);
+    for (int key = 0; key < 20; ++key) {
+        map_insert(mp, key, key);
+    }
+    ASSERT_FALSE(((map_test *)mp)->small_active);
+
+    map *clone = map_clone(mp, NULL, NULL);
+    map *snapshot = map_snapshot(mp);
+    map_set_hash_index(mp, MAP_KEY_HASH_I32);
+
+    /* После удалений контейнер остаётся деревом - к массиву он не возвращается */
+    for (int key = 0; key < 17; ++key) {
+        map_erase(mp, map_find(mp, key));
+    }
+    ASSERT_EQ(map_size(mp), 3);
+    ASSERT_FALSE(((map_test *)mp)->small_active);
+    ASSERT_NE(((map_test *)mp)->header.root, NULL);
+
+    for (int key = 0; key < 20; ++key)
+    {
+        map_iterator it = map_find(mp, key);
+        if (key < 17) {
+            ASSERT_EQ(map_iterator_compare(it, map_iterator_end(mp)), 0);
+        }
+        else {
+            ASSERT_EQ(map_iterator_get_value(it, int), key);
+        }
+        ASSERT_EQ(map_iterator_get_value(map_find(clone, key), int), key);
+        ASSERT_EQ(map_iterator_get_value(map_find(snapshot, key), int), key);
+    }
+    ASSERT_EQ(map_size(clone), 20);
+    ASSERT_EQ(map_size(snapshot), 20);
+
+    /* Пока массив активен, функции настройки дерева переводят контейнер на дерево */
+    map *small = map_create_backend(sizeof(int), sizeof(int), MAP_KEY_I32, NULL, NULL, MAP_BACKEND_SMALL);
+    for (int key = 0; key < 5; ++key) {
+        map_insert(small, key, key);
+    }
+    map_set_find_cache(small, 4, MAP_KEY_HASH_I32);
+    ASSERT_FALSE(((map_test *)small)->small_active);
+    map *small_snapshot = map_snapshot(small);
+    int key = 2;
+    map_erase(small, map_find(small, key));
+    ASSERT_EQ(map_size(small), 4);
+    ASSERT_EQ(map_size(small_snapshot), 5);
+    ASSERT_EQ(map_iterator_get_value(map_find(small_snapshot, key), int), 2);
+
+    map_free(small_snapshot);
+    map_free(small);
+    map_free(snapshot);
+    map_free(clone);
+    map_free(mp);
+}
+
+C_TEST(small_map_read_only_test)
+{
+    map *mp = map_create_backend(sizeof(int), sizeof(int), MAP_KEY_I32, NULL, NULL, MAP_BACKEND_SMALL);
+    for (int key = 0; key < 5; ++key)
+    {
+        int value = key * 10;
+        map_insert(mp, key, value);
+    }
+    int key = 3;
+    map_iterator it = map_find(mp, key);
+    size_t version = ((map_test *)mp)->version;
+
+    /* Функции, которые только читают контейнер, работают с массивом и не меняют его */
+    int keys[8], values[8];
+    map_resume_token token = map_resume_token_init();
+    ASSERT_EQ(map_scan(mp, NULL, 2, keys, values, &token), 2);
+    ASSERT_TRUE(keys[0] == 0 && keys[1] == 1 && values[1] == 10);
+    ASSERT_EQ(map_scan(mp, NULL, 8, keys, values, &token), 3);
+    ASSERT_TRUE(keys[0] == 2 && keys[2] == 4 && values[2] == 40);
+    ASSERT_EQ(map_scan(mp, NULL, 8, keys, values, &token), 0);
+    map_resume_token from_token = map_resume_token_init();
+    int start = 4;
+    ASSERT_EQ(map_scan(mp, &start, 8, keys, NULL, &from_token), 1);
+    ASSERT_EQ(keys[0], 4);
+
+    map_cursor cursor = map_cursor_init(mp);
+    ASSERT_EQ(map_iterator_get_value(map_cursor_seek(cursor, key), int), 30);
+    start = 9;
+    ASSERT_EQ(map_iterator_compare(map_cursor_seek(cursor, start), map_iterator_end(mp)), 0);
+
+    map *clone = map_clone(mp, NULL, NULL);
+    map *snapshot = map_snapshot(mp);
+    ASSERT_TRUE(((map_test *)clone)->small_active);
+    ASSERT_EQ(map_size(snapshot), 5);
+
+    long long zero = 0, sum = 0;
+    int lo = 1, hi = 4;
+    map_parallel_reduce(mp, sum_value, sum_combine, &zero, sizeof(long long), &sum, NULL, 4);
+    ASSERT_EQ(sum, 100);
+    map_parallel_reduce_range(mp, &lo, &hi, sum_value, sum_combine, &zero, sizeof(long long), &sum, NULL, 4);
+    ASSERT_EQ(sum, 60);
+
+    ASSERT_TRUE(((map_test *)mp)->small_active);
+    ASSERT_EQ(((map_test *)mp)->version, version);
+    ASSERT_EQ(map_iterator_get_value(it, int), 30);
+
+    /* Параллельный обход может менять значения, но не сам контейнер */
+    map_parallel_for_range(mp, &lo, &hi, double_value, NULL, 4);
+    ASSERT_EQ(map_iterator_get_value(it, int), 60);
+    ASSERT_EQ(map_iterator_get_value(map_find(clone, key), int), 30);
+    ASSERT_EQ(map_iterator_get_value(map_find(snapshot, key), int), 30);
+
+    /* Копии независимы от исходного контейнера */
+    map_erase(mp, it);
+    start = 0;
+    map_erase(clone, map_find(clone, start));
+    ASSERT_EQ(map_size(mp), 4);
+    ASSERT_EQ(map_size(clone), 4);
+    ASSERT_EQ(map_size(snapshot), 5);
+    ASSERT_EQ(map_iterator_get_value(map_find(snapshot, key), int), 30);
+
+    map_free(snapshot);
+    map_free(clone);
+    map_free(mp);
+}
+
+C_TEST(set_test)
+{
+    map *sets[3] = 
+    {
+        map_create_set(sizeof(int), MAP_KEY_I32, NULL),
+        map_create_backend(sizeof(int), 0, MAP_KEY_I32, NULL, NULL, MAP_BACKEND_BTREE),
+        map_create_backend(sizeof(int), 0, MAP_KEY_I32, NULL, NULL, MAP_BACKEND_SMALL)
+    };
+
+    for (int b = 0; b < 3; ++b)
+    {
+        map *st = sets[b];
+        /* Каждый ключ вставляется дважды */
+        for (int i = 0; i < 2000; ++i)
+        {
+            int key = (i * 7919) % 1000;
+            map_insert_key(st, key);
+        }
+        ASSERT_EQ(map_size(st), 1000);
+
+        int expected = 0;
+        for (map_iterator it = map_iterator_first(st); map_iterator_compare(it, map_iterator_end(st)) != 0;
+            map_iterator_next(st, it))
+        {
+            ASSERT_EQ(map_iterator_get_key(it, int), expected++);
+        }
+        ASSERT_EQ(expected, 1000);
+
+        for (int key = 0; key < 1000; key += 2) {
+            map_erase(st, map_find(st, key));
+        }
+        for (int key = 0; key < 1000; ++key) {
+            ASSERT_EQ(map_iterator_compare(map_find(st, key), map_iterator_end(st)) != 0, key % 2 == 1);
+        }
+
+        map_clear(st);
+        ASSERT_EQ(map_size(st), 0);
+        map_free(st);
+    }
+
+    /* Построение из массива ключей без значений и отделение дерева от снимка */
+    int keys[500];
+    for (int i = 0; i < 500; ++i) {
+        keys[i] = 499 - i;
+    }
+    map *st = map_create_set(sizeof(int), MAP_KEY_I32, NULL);
+    map_build_parallel(st, keys, NULL, 500, 2);
+    ASSERT_EQ(map_size(st), 500);
+
+    map *snapshot = map_snapshot(st);
+    int key = 1000;
+    map_insert_key(st, key);
+    ASSERT_EQ(map_size(st), 501);
+    ASSERT_EQ(map_size(snapshot), 500);
+    ASSERT_EQ(map_iterator_get_key(map_iterator_last(st), int), 1000);
+
+    map_free(snapshot);
+    map_free(st);
 }
 
 /*****************************************************************************/
@@ -337,6 +2791,35 @@ C_TEST_SUITE(all_tests)
 {
     C_RUN_TEST(insert_small_rotates_test);
     C_RUN_TEST(iterator_test);  
+    C_RUN_TEST(header_after_insert_test);
+    C_RUN_TEST(scan_test);
+    C_RUN_TEST(clone_test);
+    C_RUN_TEST(snapshot_test);
+    C_RUN_TEST(snapshot_path_copy_test);
+    C_RUN_TEST(concurrent_map_test);
+    C_RUN_TEST(concurrent_avl_test);
+    C_RUN_TEST(rcu_test);
+    C_RUN_TEST(sharded_map_test);
+    C_RUN_TEST(build_parallel_test);
+    C_RUN_TEST(parallel_test);
+    C_RUN_TEST(map_define_test);
+    C_RUN_TEST(key_kind_test);
+    C_RUN_TEST(bytes_key_wrappers_test);
+    C_RUN_TEST(key_prefix_test);
+    C_RUN_TEST(normalized_key_test);
+    C_RUN_TEST(normalized_key_wrappers_test);
+    C_RUN_TEST(find_with_test);
+    C_RUN_TEST(btree_test);
+    C_RUN_TEST(frozen_map_test);
+    C_RUN_TEST(frozen_map_blocks_test);
+    C_RUN_TEST(find_cache_test);
+    C_RUN_TEST(cursor_test);
+    C_RUN_TEST(bloom_filter_test);
+    C_RUN_TEST(hash_index_test);
+    C_RUN_TEST(small_map_test);
+    C_RUN_TEST(small_map_tree_only_test);
+    C_RUN_TEST(small_map_read_only_test);
+    C_RUN_TEST(set_test);
 }
 
 int main(int argc, char *argv[])
@@ -0,0 +1,480 @@
+#include <avl_link.h>
+#include <stdlib.h>
+
+/**
+ * Запись указателя, который могут читать RCU-читатели контейнера map
+ * (см. MAP_PUBLISH в map.c)
+ */
+#define AVL_PUBLISH(field,new_value) __atomic_store_n(&(field), (new_value), __ATOMIC_RELEASE)
+
+
+/**
+ * Прототипы вспомогательных функций (начало)
+ */
+
+
+/**
+ * Функция восстанавливает свойства дерева и при необходимости
+ * выполняет перебалансировку после вставки элемента
+ * 
+ * В качестве аргументов принимает указатель на корень дерева и только что
+ * вставленный узел
+ */
+static void
+avl_link_restore_properties_after_insert
+(
+    avl_link **              root,
+    avl_link *               node,
+    const avl_link_owner *   owner
+);
+
+/**
+ * Функция восстанавливает свойства дерева и при необходимости
+ * выполняет перебалансировку после удаления элемента
+ * 
+ * В качестве аргументов принимает указатель на корень дерева и отца удаленного
+ * элемента (его баланс уже должен быть исправлен)
+ */
+static void
+avl_link_restore_properties_after_erase
+(
+    avl_link **              root,
+    avl_link *               node,
+    const avl_link_owner *   owner
+);
+
+/**
+ * Заменяет в родителе parent ребёнка old_child на new_child (если parent == NULL,
+ * заменяется корень) и устанавливает new_child нового родителя
+ */
+static void
+avl_link_replace_child
+(
+    avl_link **    root,
+    avl_link *     parent,
+    avl_link *     old_child,
+    avl_link *     new_child
+);
+
+/**
+ * Малый поворот + смена балансов. Поднимает ребёнка node->child[dir] на место
+ * node. Для dir == 0 (малый правый поворот):
+ * 
+ *                  X                  Y
+ *                /   \              /   \
+ *              Y       R   ===>   L       X
+ *            /   \                      /   \
+ *          L       W                  W       R
+ * 
+ * Для dir == 1 (малый левый поворот) - зеркально
+ * 
+ * Принимает в качестве аргументов указатель на корень дерева, узел X, 
+ * сторону поворота dir и владельца узлов (NULL - разделяемых узлов нет).
+ * Узлы Y и W перед поворотом передаются владельцу
+ * Возвращает узел Y
+ */
+static avl_link *
+avl_link_rotate
+(
+    avl_link **              root,
+    avl_link *               node,
+    int                      dir,
+    const avl_link_owner *   owner
+);
+
+/**
+ * Большой поворот + смена балансов. Поднимает на место node внука
+ * node->child[dir]->child[!dir]. Для dir == 0 (большой правый поворот):
+ * 
+ *                     X                            Z
+ *                 /       \                    /       \
+ *               Y           c1   ===>        Y           X
+ *             /   \                        /   \       /   \
+ *          c2       Z                   c2       c3 c4       c1
+ *                 /   \
+ *              c3       c4
+ * 
+ * Для dir == 1 (большой левый поворот) - зеркально
+ * 
+ * Принимает в качестве аргументов указатель на корень дерева, узел X, 
+ * сторону поворота dir и владельца узлов (см. avl_link_rotate)
+ * Возвращает узел Z
+ */
+static avl_link *
+avl_link_double_rotate
+(
+    avl_link **              root,
+    avl_link *               node,
+    int                      dir,
+    const avl_link_owner *   owner
+);
+
+/**
+ * Прототипы вспомогательных функций (конец)
+ */
+
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/**
+ * Определения основных функций (API) (начало)
+ */
+
+
+void
+avl_link_insert
+(
+    avl_link **    root,
+    avl_link *     parent,
+    bool           left,
+    avl_link *     node
+)
+{
+    avl_link_insert_owned(root, parent, left, node, NULL);
+}
+
+void
+avl_link_insert_owned
+(
+    avl_link **              root,
+    avl_link *               parent,
+    bool                     left,
+    avl_link *               node,
+    const avl_link_owner *   owner
+)
+{
+    node->parent = parent;
+    node->child[0] = NULL;
+    node->child[1] = NULL;
+    node->balance = 0;
+
+    if (parent == NULL) {
+        AVL_PUBLISH(*root, node);
+    }
+    else {
+        AVL_PUBLISH(parent->child[!left], node);
+    }
+
+    avl_link_restore_properties_after_insert(root, node, owner);
+}
+
+void
+avl_link_erase
+(
+    avl_link **    root,
+    avl_link *     node
+)
+{
+    avl_link_erase_owned(root, node, NULL);
+}
+
+void
+avl_link_erase_owned
+(
+    avl_link **              root,
+    avl_link *               node,
+    const avl_link_owner *   owner
+)
+{
+    /**
+     * Узел, с которого начинается восстановление свойств дерева
+     */
+    avl_link *parent;
+
+    if (owner != NULL)
+    /* Меняются дети узла и путь к следующему за ним узлу */
+    {
+        for (int dir = 0; dir < 2; ++dir) {
+            owner->own(node, dir, owner->ctx);
+        }
+        if (node->child[0] != NULL && node->child[1] != NULL)
+        {
+            avl_link *link = node->child[1];
+            for (; link->child[0] != NULL; link = link->child[0]) {
+                owner->own(link, 0, owner->ctx);
+            }
+            owner->own(link, 1, owner->ctx);
+        }
+    }
+
+    if (node->child[0] == NULL || node->child[1] == NULL)
+    /* Не больше одного ребёнка - ребёнок занимает место узла */
+    {
+        avl_link *child = node->child[node->child[0] == NULL];
+        parent = node->parent;
+
+        if (parent != NULL) {
+            parent->balance += (parent->child[1] == node) ? 1 : -1;
+        }
+        avl_link_replace_child(root, parent, node, child);
+    }
+    else
+    /**
+     * Два ребёнка - место узла занимает следующий за ним узел (самый левый
+     * в правом поддереве), у которого левого ребёнка нет
+     */
+    {
+        avl_link *replacement = avl_link_first(node->child[1]);
+
+        if (replacement == node->child[1])
+        /* Правое поддерево узла укорачивается на единицу */
+        {
+            replacement->balance = node->balance + 1;
+            parent = replacement;
+        }
+        else
+        {
+            parent = replacement->parent;
+            parent->balance--;
+            avl_link_replace_child(root, parent, replacement, replacement->child[1]);
+
+            replacement->balance = node->balance;
+            AVL_PUBLISH(replacement->child[1], node->child[1]);
+            replacement->child[1]->parent = replacement;
+        }
+
+        AVL_PUBLISH(replacement->child[0], node->child[0]);
+        replacement->child[0]->parent = replacement;
+        avl_link_replace_child(root, node->parent, node, replacement);
+    }
+
+    avl_link_restore_properties_after_erase(root, parent, owner);
+}
+
+avl_link *
+avl_link_first
+(
+    avl_link *root
+)
+{
+    if (root == NULL) {
+        return NULL;
+    }
+    while (root->child[0]) {
+        root = root->child[0];
+    }
+    return root;
+}
+
+avl_link *
+avl_link_last
+(
+    avl_link *root
+)
+{
+    if (root == NULL) {
+        return NULL;
+    }
+    while (root->child[1]) {
+        root = root->child[1];
+    }
+    return root;
+}
+
+avl_link *
+avl_link_next
+(
+    avl_link *node
+)
+{
+    if (node->child[1] != NULL) {
+        return avl_link_first(node->child[1]);
+    }
+
+    while (node->parent && node->parent->child[0] != node) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+avl_link *
+avl_link_prev
+(
+    avl_link *node
+)
+{
+    if (node->child[0] != NULL) {
+        return avl_link_last(node->child[0]);
+    }
+
+    while (node->parent && node->parent->child[1] != node) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+/**
+ * Определения основных функций (API) (конец)
+ */
+
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/**
+ * Вспомогательные функции (начало)
+ */
+
+
+static void
+avl_link_restore_properties_after_insert
+(
+    avl_link **              root,
+    avl_link *               node,
+    const avl_link_owner *   owner
+)
+{
+    while (node->parent != NULL)
+    {
+        avl_link *parent = node->parent;
+
+        parent->balance += (parent->child[0] == node) ?  1 : -1;
+
+        if (parent->balance == 0)
+        /* Восстановление свойств окончено */
+        {
+            break;
+        }
+        else if (abs(parent->balance) == 2)
+        {
+            /**
+             * Перевешивает поддерево node, стоящее со стороны dir. sign - 
+             * знак баланса, при котором node перевешивает в ту же сторону
+             */
+            int dir = parent->balance < 0;
+            int sign = dir ? -1 : 1;
+
+            if (node->balance == sign)
+            /* Малый поворот */
+            {
+                node = avl_link_rotate(root, parent, dir, owner);
+                break;
+            }
+
+            /* Большой поворот */
+            node = avl_link_double_rotate(root, parent, dir, owner);
+            if (node->balance == 0) {
+                break;
+            }
+        }
+
+        node = node->parent;
+    }
+}
+
+static void
+avl_link_restore_properties_after_erase
+(
+    avl_link **              root,
+    avl_link *               node,
+    const avl_link_owner *   owner
+)
+{
+    while (node != NULL)
+    {
+        if (abs(node->balance) == 2)
+        {
+            int dir = node->balance < 0;
+            int sign = dir ? -1 : 1;
+
+            if (node->child[dir]->balance * sign >= 0) {
+                node = avl_link_rotate(root, node, dir, owner);
+            }
+            else {
+                node = avl_link_double_rotate(root, node, dir, owner);
+            }
+        }
+
+        if (abs(node->balance) == 1) {
+            break;
+        }
+
+        if (node->parent != NULL) {
+            node->parent->balance += (node->parent->child[1] == node) ? 1 : -1;
+        }
+
+        node = node->parent;
+    }
+}
+
+static void
+avl_link_replace_child
+(
+    avl_link **    root,
+    avl_link *     parent,
+    avl_link *     old_child,
+    avl_link *     new_child
+)
+{
+    if (parent == NULL) {
+        AVL_PUBLISH(*root, new_child);
+    }
+    else {
+        AVL_PUBLISH(parent->child[parent->child[1] == old_child], new_child);
+    }
+
+    if (new_child != NULL) {
+        new_child->parent = parent;
+    }
+}
+
+static avl_link *
+avl_link_rotate
+(
+    avl_link **              root,
+    avl_link *               node,
+    int                      dir,
+    const avl_link_owner *   owner
+)
+{
+    if (owner != NULL)
+    {
+        owner->own(node, dir, owner->ctx);
+        owner->own(node->child[dir], !dir, owner->ctx);
+    }
+
+    avl_link *new_parent = node->child[dir];
+    avl_link *weak_node = new_parent->child[!dir];
+
+    /**
+     * Балансы пересчитываются в системе координат правого поворота: для 
+     * левого поворота знаки балансов меняются на противоположные
+     */
+    int sign = dir ? -1 : 1;
+    int old_node_balance = sign * node->balance;
+    int old_new_parent_balance = sign * new_parent->balance;
+
+    avl_link_replace_child(root, node->parent, node, new_parent);
+
+    AVL_PUBLISH(new_parent->child[!dir], node);
+    node->parent = new_parent;
+
+    AVL_PUBLISH(node->child[dir], weak_node);
+    if (weak_node) {
+        weak_node->parent = node;
+    }
+
+    int node_balance = old_node_balance - 1 - (old_new_parent_balance > 0 ? old_new_parent_balance : 0);
+    int new_parent_balance = old_new_parent_balance - 1 + (node_balance < 0 ? node_balance : 0);
+    node->balance = (int8_t)(sign * node_balance);
+    new_parent->balance = (int8_t)(sign * new_parent_balance);
+
+    return new_parent;
+}
+
+static avl_link *
+avl_link_double_rotate
+(
+    avl_link **              root,
+    avl_link *               node,
+    int                      dir,
+    const avl_link_owner *   owner
+)
+{
+    if (owner != NULL) {
+        owner->own(node, dir, owner->ctx);
+    }
+    avl_link_rotate(root, node->child[dir], !dir, owner);
+    return avl_link_rotate(root, node, dir, owner);
+}
+
+/**
+ * Вспомогательные функции (конец)
+ */
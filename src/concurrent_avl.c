@@ -0,0 +1,1873 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <concurrent_avl.h>
+#include <map.h>
+#include <memory.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+typedef struct _concurrent_avl_node concurrent_avl_node;
+typedef struct _concurrent_avl_value concurrent_avl_value;
+
+/**
+ * Значение хранится в отдельном неизменяемом буфере, чтобы читатель мог
+ * атомарно получить указатель на него и скопировать значение без блокировок
+ */
+struct _concurrent_avl_value
+{
+    concurrent_avl_value *    retired_next;
+    /**
+     * true - значение удалено вместе с элементом (при освобождении нужно
+     * вызвать удалитель), false - значение было заменено новым
+     */
+    bool                      erased;
+    void *                    data;
+};
+
+struct _concurrent_avl_node
+{
+    _Atomic(concurrent_avl_node *)     parent;
+    _Atomic(concurrent_avl_node *)     left_child;
+    _Atomic(concurrent_avl_node *)     right_child;
+    /**
+     * NULL - узел-маршрутизатор (элемент удалён, но узел ещё нужен для поиска)
+     */
+    _Atomic(concurrent_avl_value *)    value;
+    atomic_int                         height;
+    /**
+     * Версия узла (см. CONCURRENT_AVL_* ниже). Меняется при каждом повороте,
+     * в котором участвует узел
+     */
+    _Atomic(uint64_t)                  version;
+    pthread_mutex_t                    lock;
+    void *                             key;
+    concurrent_avl_node *              retired_next;
+};
+
+struct _concurrent_avl
+{
+    /**
+     * Фиктивный узел, правый ребёнок которого - корень дерева
+     */
+    concurrent_avl_node *    root_holder;
+
+    uint16_t    key_size;
+    uint16_t    value_size;
+    int         (*compare_func)       (const void *f, const void *s);
+    void        (*key_destroyer)      (void *key);
+    void        (*value_destroyer)    (void *value);
+
+    atomic_size_t    size;
+
+    /**
+     * Стеки узлов и значений, освобождение которых отложено
+     */
+    _Atomic(concurrent_avl_node *)     retired_nodes;
+    _Atomic(concurrent_avl_value *)    retired_values;
+};
+
+/**
+ * Биты версии узла
+ *
+ * UNLINKED      - узел вырезан из дерева
+ * GROW_LOCK     - узел поднимается поворотом (его поддерево растёт)
+ * SHRINK_LOCK   - узел опускается поворотом (его поддерево уменьшается)
+ *
+ * Старшие биты - счётчики завершённых подъёмов и опусканий
+ */
+#define CONCURRENT_AVL_UNLINKED             1ull
+#define CONCURRENT_AVL_GROW_LOCK            2ull
+#define CONCURRENT_AVL_SHRINK_LOCK          4ull
+#define CONCURRENT_AVL_GROW_COUNT_SHIFT     3
+#define CONCURRENT_AVL_GROW_COUNT_MASK      (0xffull << CONCURRENT_AVL_GROW_COUNT_SHIFT)
+#define CONCURRENT_AVL_SHRINK_COUNT_SHIFT   11
+
+/**
+ * Результаты внутренних операций
+ */
+#define CONCURRENT_AVL_RETRY       (-1)
+#define CONCURRENT_AVL_ABSENT      0
+#define CONCURRENT_AVL_PRESENT     1
+
+/**
+ * Состояния узла, возвращаемые concurrent_avl_node_condition
+ * (неотрицательное значение - новая высота узла)
+ */
+#define CONCURRENT_AVL_UNLINK_REQUIRED      (-1)
+#define CONCURRENT_AVL_REBALANCE_REQUIRED   (-2)
+#define CONCURRENT_AVL_NOTHING_REQUIRED     (-3)
+
+#define CONCURRENT_AVL_SPIN_COUNT     100
+#define CONCURRENT_AVL_YIELD_COUNT    10
+
+
+/**
+ * Прототипы вспомогательных функций (начало)
+ */
+
+
+/**
+ * Создаёт новый узел и возвращает на него указатель
+ *
+ * Принимает в качестве аргументов указатель на контейнер, ключ (может быть NULL
+ * для фиктивного узла), значение, высоту и родителя узла
+ */
+static concurrent_avl_node *
+concurrent_avl_create_node
+(
+    concurrent_avl *            cavl,
+    void *                      key,
+    concurrent_avl_value *      value,
+    int                         height,
+    concurrent_avl_node *       parent
+);
+
+/**
+ * Создаёт буфер для значения value и возвращает указатель на него
+ */
+static concurrent_avl_value *
+concurrent_avl_create_value
+(
+    concurrent_avl *    cavl,
+    void *              value
+);
+
+/**
+ * Откладывает освобождение вырезанного из дерева узла
+ */
+static void
+concurrent_avl_retire_node
+(
+    concurrent_avl *         cavl,
+    concurrent_avl_node *    node
+);
+
+/**
+ * Откладывает освобождение значения, которое больше не достижимо из дерева
+ */
+static void
+concurrent_avl_retire_value
+(
+    concurrent_avl *          cavl,
+    concurrent_avl_value *    value,
+    bool                      erased
+);
+
+/**
+ * Освобождает узел (и его значение, если оно есть) с вызовом удалителей
+ */
+static void
+concurrent_avl_free_node
+(
+    concurrent_avl *         cavl,
+    concurrent_avl_node *    node
+);
+
+/**
+ * Рекурсивно освобождает поддерево с корнем node
+ */
+static void
+concurrent_avl_free_helper
+(
+    concurrent_avl *         cavl,
+    concurrent_avl_node *    node
+);
+
+/**
+ * Возвращает левого ребёнка узла, если dir < 0, и правого в противном случае
+ */
+static concurrent_avl_node *
+concurrent_avl_child
+(
+    concurrent_avl_node *    node,
+    int                      dir
+);
+
+/**
+ * Делает child левым ребёнком узла, если dir < 0, и правым в противном случае
+ */
+static void
+concurrent_avl_set_child
+(
+    concurrent_avl_node *    node,
+    int                      dir,
+    concurrent_avl_node *    child
+);
+
+/**
+ * Возвращает высоту узла (0 для NULL)
+ */
+static int
+concurrent_avl_height
+(
+    concurrent_avl_node *node
+);
+
+static void concurrent_avl_lock(concurrent_avl_node *node);
+static void concurrent_avl_unlock(concurrent_avl_node *node);
+
+/**
+ * Если узел опускается поворотом, ожидает завершения поворота
+ *
+ * Принимает в качестве аргументов узел и прочитанную ранее версию узла
+ */
+static void
+concurrent_avl_wait_until_shrink_completed
+(
+    concurrent_avl_node *    node,
+    uint64_t                 version
+);
+
+/**
+ * Рекурсивный спуск для поиска. Возвращает CONCURRENT_AVL_RETRY, если спуск
+ * к node был инвалидирован поворотом и его нужно повторить с родителя node
+ *
+ * Принимает в качестве аргументов указатель на контейнер, ключ, узел,
+ * направление к следующему узлу, версию node на момент перехода к нему и
+ * буфер для найденного значения
+ */
+static int
+concurrent_avl_attempt_get
+(
+    concurrent_avl *         cavl,
+    void *                   key,
+    concurrent_avl_node *    node,
+    int                      dir,
+    uint64_t                 node_version,
+    void *                   value
+);
+
+/**
+ * Вставка (value != NULL) или удаление (value == NULL) элемента с ключом key
+ *
+ * Возвращает CONCURRENT_AVL_PRESENT, если до операции элемент был в контейнере,
+ * и CONCURRENT_AVL_ABSENT в противном случае
+ */
+static int
+concurrent_avl_update
+(
+    concurrent_avl *          cavl,
+    void *                    key,
+    concurrent_avl_value *    value
+);
+
+/**
+ * Создаёт корень пустого дерева. Возвращает false, если дерево уже не пусто
+ */
+static bool
+concurrent_avl_attempt_insert_into_empty
+(
+    concurrent_avl *          cavl,
+    void *                    key,
+    concurrent_avl_value *    value
+);
+
+/**
+ * Рекурсивный спуск для вставки и удаления (аналог concurrent_avl_attempt_get)
+ */
+static int
+concurrent_avl_attempt_update
+(
+    concurrent_avl *          cavl,
+    void *                    key,
+    concurrent_avl_value *    value,
+    concurrent_avl_node *     parent,
+    concurrent_avl_node *     node,
+    uint64_t                  node_version
+);
+
+/**
+ * Изменяет значение найденного узла node или вырезает его из дерева
+ */
+static int
+concurrent_avl_attempt_node_update
+(
+    concurrent_avl *          cavl,
+    concurrent_avl_value *    value,
+    concurrent_avl_node *     parent,
+    concurrent_avl_node *     node
+);
+
+/**
+ * Вырезает из дерева узел node, у которого не больше одного ребёнка
+ * Узлы parent и node должны быть заблокированы
+ * Возвращает false, если за время без блокировок дерево изменилось
+ */
+static bool
+concurrent_avl_attempt_unlink_nl
+(
+    concurrent_avl *         cavl,
+    concurrent_avl_node *    parent,
+    concurrent_avl_node *    node
+);
+
+/**
+ * Определяет, что нужно сделать с узлом: вырезать, перебалансировать,
+ * исправить высоту (возвращается новая высота) или ничего
+ */
+static int
+concurrent_avl_node_condition
+(
+    concurrent_avl_node *node
+);
+
+/**
+ * Исправляет высоты и балансы, начиная с узла node и вверх по дереву
+ */
+static void
+concurrent_avl_fix_height_and_rebalance
+(
+    concurrent_avl *         cavl,
+    concurrent_avl_node *    node
+);
+
+/**
+ * Возвращает первый узел на пути от node к корню, который требует
+ * исправления, или NULL, если таких узлов нет
+ */
+static concurrent_avl_node *
+concurrent_avl_find_damaged_ancestor
+(
+    concurrent_avl_node *node
+);
+
+/**
+ * Пытается исправить высоту заблокированного узла node
+ * Возвращает самый нижний узел, который всё ещё требует исправления, или NULL
+ */
+static concurrent_avl_node *
+concurrent_avl_fix_height_nl
+(
+    concurrent_avl_node *node
+);
+
+/**
+ * Перебалансирует заблокированный узел n с заблокированным родителем n_parent
+ * Возвращает узел, который всё ещё требует исправления, или NULL
+ */
+static concurrent_avl_node *
+concurrent_avl_rebalance_nl
+(
+    concurrent_avl *         cavl,
+    concurrent_avl_node *    n_parent,
+    concurrent_avl_node *    n
+);
+
+/**
+ * Перебалансировка, когда левое поддерево узла n слишком высокое
+ */
+static concurrent_avl_node *
+concurrent_avl_rebalance_to_right_nl
+(
+    concurrent_avl_node *    n_parent,
+    concurrent_avl_node *    n,
+    concurrent_avl_node *    n_left,
+    int                      h_right0
+);
+
+/**
+ * Перебалансировка, когда правое поддерево узла n слишком высокое
+ */
+static concurrent_avl_node *
+concurrent_avl_rebalance_to_left_nl
+(
+    concurrent_avl_node *    n_parent,
+    concurrent_avl_node *    n,
+    concurrent_avl_node *    n_right,
+    int                      h_left0
+);
+
+/**
+ * Малый правый поворот узла n (все участвующие узлы заблокированы)
+ */
+static concurrent_avl_node *
+concurrent_avl_rotate_right_nl
+(
+    concurrent_avl_node *    n_parent,
+    concurrent_avl_node *    n,
+    concurrent_avl_node *    n_left,
+    int                      h_right,
+    int                      h_left_left,
+    concurrent_avl_node *    n_left_right,
+    int                      h_left_right
+);
+
+/**
+ * Малый левый поворот узла n (все участвующие узлы заблокированы)
+ */
+static concurrent_avl_node *
+concurrent_avl_rotate_left_nl
+(
+    concurrent_avl_node *    n_parent,
+    concurrent_avl_node *    n,
+    int                      h_left,
+    concurrent_avl_node *    n_right,
+    concurrent_avl_node *    n_right_left,
+    int                      h_right_left,
+    int                      h_right_right
+);
+
+/**
+ * Большой правый поворот узла n (все участвующие узлы заблокированы)
+ */
+static concurrent_avl_node *
+concurrent_avl_rotate_right_over_left_nl
+(
+    concurrent_avl_node *    n_parent,
+    concurrent_avl_node *    n,
+    concurrent_avl_node *    n_left,
+    int                      h_right,
+    int                      h_left_left,
+    concurrent_avl_node *    n_left_right,
+    int                      h_left_right_left
+);
+
+/**
+ * Большой левый поворот узла n (все участвующие узлы заблокированы)
+ */
+static concurrent_avl_node *
+concurrent_avl_rotate_left_over_right_nl
+(
+    concurrent_avl_node *    n_parent,
+    concurrent_avl_node *    n,
+    int                      h_left,
+    concurrent_avl_node *    n_right,
+    concurrent_avl_node *    n_right_left,
+    int                      h_right_right,
+    int                      h_right_left_right
+);
+
+
+/**
+ * Прототипы вспомогательных функций (конец)
+ */
+
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/**
+ * Операции над версиями узлов
+ */
+
+static inline bool
+concurrent_avl_is_unlinked(uint64_t version)
+{
+    return version == CONCURRENT_AVL_UNLINKED;
+}
+
+static inline bool
+concurrent_avl_is_shrinking_or_unlinked(uint64_t version)
+{
+    return (version & (CONCURRENT_AVL_SHRINK_LOCK | CONCURRENT_AVL_UNLINKED)) != 0;
+}
+
+/**
+ * Подъём узла не сужает диапазон ключей его поддерева, поэтому не
+ * инвалидирует спуск через этот узел
+ */
+static inline bool
+concurrent_avl_has_shrunk_or_unlinked(uint64_t original, uint64_t current)
+{
+    return ((original ^ current) & ~(CONCURRENT_AVL_GROW_LOCK | CONCURRENT_AVL_GROW_COUNT_MASK)) != 0;
+}
+
+static inline uint64_t
+concurrent_avl_begin_grow(uint64_t version)
+{
+    return version | CONCURRENT_AVL_GROW_LOCK;
+}
+
+static inline uint64_t
+concurrent_avl_end_grow(uint64_t version)
+{
+    return version + (1ull << CONCURRENT_AVL_GROW_COUNT_SHIFT);
+}
+
+static inline uint64_t
+concurrent_avl_begin_shrink(uint64_t version)
+{
+    return version | CONCURRENT_AVL_SHRINK_LOCK;
+}
+
+static inline uint64_t
+concurrent_avl_end_shrink(uint64_t version)
+{
+    return version + (1ull << CONCURRENT_AVL_SHRINK_COUNT_SHIFT);
+}
+
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/**
+ * Определения основных функций (API) (начало)
+ */
+
+
+concurrent_avl *
+concurrent_avl_create
+(
+    uint16_t    key_size,
+    uint16_t    value_size,
+    int         (*compare_func)       (const void *f, const void *s),
+    void        (*key_destroyer)      (void *key),
+    void        (*value_destroyer)    (void *value)
+)
+{
+    if (compare_func == NULL)
+    {
+        fprintf(stderr, "concurrent_avl_create: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    concurrent_avl *cavl = (concurrent_avl *)malloc(sizeof(concurrent_avl));
+    if (cavl == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    cavl->key_size = key_size;
+    cavl->value_size = value_size;
+    cavl->compare_func = compare_func;
+    cavl->key_destroyer = key_destroyer;
+    cavl->value_destroyer = value_destroyer;
+    atomic_init(&(cavl->size), 0);
+    atomic_init(&(cavl->retired_nodes), NULL);
+    atomic_init(&(cavl->retired_values), NULL);
+
+    cavl->root_holder = concurrent_avl_create_node(cavl, NULL, NULL, 1, NULL);
+
+    return cavl;
+}
+
+void
+concurrent_avl_free
+(
+    concurrent_avl *cavl
+)
+{
+    if (cavl == NULL)
+    {
+        fprintf(stderr, "concurrent_avl_free: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    concurrent_avl_node *root = atomic_load(&(cavl->root_holder->right_child));
+    if (root != NULL) {
+        concurrent_avl_free_helper(cavl, root);
+    }
+    concurrent_avl_free_node(cavl, cavl->root_holder);
+
+    concurrent_avl_collect(cavl);
+
+    free(cavl);
+}
+
+void
+concurrent_avl_collect
+(
+    concurrent_avl *cavl
+)
+{
+    if (cavl == NULL)
+    {
+        fprintf(stderr, "concurrent_avl_collect: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    concurrent_avl_node *node = atomic_exchange(&(cavl->retired_nodes), NULL);
+    while (node != NULL)
+    {
+        concurrent_avl_node *next = node->retired_next;
+        concurrent_avl_free_node(cavl, node);
+        node = next;
+    }
+
+    concurrent_avl_value *value = atomic_exchange(&(cavl->retired_values), NULL);
+    while (value != NULL)
+    {
+        concurrent_avl_value *next = value->retired_next;
+        if (value->erased && cavl->value_destroyer != NULL) {
+            cavl->value_destroyer(value->data);
+        }
+        free(value->data);
+        free(value);
+        value = next;
+    }
+}
+
+size_t
+concurrent_avl_size
+(
+    concurrent_avl *cavl
+)
+{
+    if (cavl == NULL)
+    {
+        fprintf(stderr, "concurrent_avl_size: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return atomic_load(&(cavl->size));
+}
+
+void
+_concurrent_avl_insert
+(
+    concurrent_avl *    cavl,
+    void *              key,
+    void *              value
+)
+{
+    if (cavl == NULL || key == NULL || value == NULL)
+    {
+        fprintf(stderr, "concurrent_avl_insert: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    concurrent_avl_value *value_buffer = concurrent_avl_create_value(cavl, value);
+
+    if (concurrent_avl_update(cavl, key, value_buffer) == CONCURRENT_AVL_ABSENT) {
+        atomic_fetch_add(&(cavl->size), 1);
+    }
+}
+
+bool
+_concurrent_avl_find
+(
+    concurrent_avl *    cavl,
+    void *              key,
+    void *              value
+)
+{
+    if (cavl == NULL || key == NULL || value == NULL)
+    {
+        fprintf(stderr, "concurrent_avl_find: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    concurrent_avl_node *root_holder = cavl->root_holder;
+
+    while (true)
+    {
+        int result = concurrent_avl_attempt_get(cavl, key, root_holder, 1,
+            atomic_load(&(root_holder->version)), value);
+        if (result != CONCURRENT_AVL_RETRY) {
+            return result == CONCURRENT_AVL_PRESENT;
+        }
+    }
+}
+
+bool
+_concurrent_avl_erase
+(
+    concurrent_avl *    cavl,
+    void *              key
+)
+{
+    if (cavl == NULL || key == NULL)
+    {
+        fprintf(stderr, "concurrent_avl_erase: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (concurrent_avl_update(cavl, key, NULL) == CONCURRENT_AVL_PRESENT)
+    {
+        atomic_fetch_sub(&(cavl->size), 1);
+        return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * Определения основных функций (API) (конец)
+ */
+
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/**
+ * Вспомогательные функции (начало)
+ */
+
+
+static concurrent_avl_node *
+concurrent_avl_create_node
+(
+    concurrent_avl *            cavl,
+    void *                      key,
+    concurrent_avl_value *      value,
+    int                         height,
+    concurrent_avl_node *       parent
+)
+{
+    concurrent_avl_node *node = (concurrent_avl_node *)malloc(sizeof(concurrent_avl_node));
+    if (node == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    atomic_init(&(node->parent), parent);
+    atomic_init(&(node->left_child), NULL);
+    atomic_init(&(node->right_child), NULL);
+    atomic_init(&(node->value), value);
+    atomic_init(&(node->height), height);
+    atomic_init(&(node->version), 0);
+    node->key = NULL;
+    node->retired_next = NULL;
+
+    if (pthread_mutex_init(&(node->lock), NULL) != 0)
+    {
+        fprintf(stderr, "concurrent_avl: не удалось инициализировать блокировку\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (key != NULL)
+    {
+        node->key = malloc(cavl->key_size);
+        if (node->key == NULL)
+        {
+            perror("");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(node->key, key, cavl->key_size);
+    }
+
+    return node;
+}
+
+static concurrent_avl_value *
+concurrent_avl_create_value
+(
+    concurrent_avl *    cavl,
+    void *              value
+)
+{
+    concurrent_avl_value *value_buffer = (concurrent_avl_value *)malloc(sizeof(concurrent_avl_value));
+    if (value_buffer == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    value_buffer->retired_next = NULL;
+    value_buffer->erased = false;
+    value_buffer->data = malloc(cavl->value_size);
+    if (value_buffer->data == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(value_buffer->data, value, cavl->value_size);
+
+    return value_buffer;
+}
+
+static void
+concurrent_avl_retire_node
+(
+    concurrent_avl *         cavl,
+    concurrent_avl_node *    node
+)
+{
+    concurrent_avl_node *head = atomic_load(&(cavl->retired_nodes));
+    do {
+        node->retired_next = head;
+    } while (!atomic_compare_exchange_weak(&(cavl->retired_nodes), &head, node));
+}
+
+static void
+concurrent_avl_retire_value
+(
+    concurrent_avl *          cavl,
+    concurrent_avl_value *    value,
+    bool                      erased
+)
+{
+    value->erased = erased;
+
+    concurrent_avl_value *head = atomic_load(&(cavl->retired_values));
+    do {
+        value->retired_next = head;
+    } while (!atomic_compare_exchange_weak(&(cavl->retired_values), &head, value));
+}
+
+static void
+concurrent_avl_free_node
+(
+    concurrent_avl *         cavl,
+    concurrent_avl_node *    node
+)
+{
+    concurrent_avl_value *value = atomic_load(&(node->value));
+    if (value != NULL)
+    {
+        if (cavl->value_destroyer != NULL) {
+            cavl->value_destroyer(value->data);
+        }
+        free(value->data);
+        free(value);
+    }
+
+    if (node->key != NULL)
+    {
+        if (cavl->key_destroyer != NULL) {
+            cavl->key_destroyer(node->key);
+        }
+        free(node->key);
+    }
+
+    pthread_mutex_destroy(&(node->lock));
+    free(node);
+}
+
+static void
+concurrent_avl_free_helper
+(
+    concurrent_avl *         cavl,
+    concurrent_avl_node *    node
+)
+{
+    concurrent_avl_node *left = atomic_load(&(node->left_child));
+    concurrent_avl_node *right = atomic_load(&(node->right_child));
+
+    if (left != NULL) {
+        concurrent_avl_free_helper(cavl, left);
+    }
+    if (right != NULL) {
+        concurrent_avl_free_helper(cavl, right);
+    }
+
+    concurrent_avl_free_node(cavl, node);
+}
+
+static concurrent_avl_node *
+concurrent_avl_child
+(
+    concurrent_avl_node *    node,
+    int                      dir
+)
+{
+    return dir < 0 ? atomic_load(&(node->left_child)) : atomic_load(&(node->right_child));
+}
+
+static void
+concurrent_avl_set_child
+(
+    concurrent_avl_node *    node,
+    int                      dir,
+    concurrent_avl_node *    child
+)
+{
+    if (dir < 0) {
+        atomic_store(&(node->left_child), child);
+    }
+    else {
+        atomic_store(&(node->right_child), child);
+    }
+}
+
+static int
+concurrent_avl_height
+(
+    concurrent_avl_node *node
+)
+{
+    return node == NULL ? 0 : atomic_load(&(node->height));
+}
+
+static void
+concurrent_avl_lock
+(
+    concurrent_avl_node *node
+)
+{
+    if (pthread_mutex_lock(&(node->lock)) != 0)
+    {
+        fprintf(stderr, "concurrent_avl: не удалось захватить блокировку\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+concurrent_avl_unlock
+(
+    concurrent_avl_node *node
+)
+{
+    if (pthread_mutex_unlock(&(node->lock)) != 0)
+    {
+        fprintf(stderr, "concurrent_avl: не удалось освободить блокировку\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+concurrent_avl_wait_until_shrink_completed
+(
+    concurrent_avl_node *    node,
+    uint64_t                 version
+)
+{
+    if ((version & CONCURRENT_AVL_SHRINK_LOCK) == 0) {
+        return;
+    }
+
+    for (int i = 0; i < CONCURRENT_AVL_SPIN_COUNT; ++i)
+    {
+        if (atomic_load(&(node->version)) != version) {
+            return;
+        }
+    }
+
+    for (int i = 0; i < CONCURRENT_AVL_YIELD_COUNT; ++i)
+    {
+        sched_yield();
+        if (atomic_load(&(node->version)) != version) {
+            return;
+        }
+    }
+
+    /* Поворот выполняется под блокировкой узла - дождёмся её освобождения */
+    concurrent_avl_lock(node);
+    concurrent_avl_unlock(node);
+}
+
+static int
+concurrent_avl_attempt_get
+(
+    concurrent_avl *         cavl,
+    void *                   key,
+    concurrent_avl_node *    node,
+    int                      dir,
+    uint64_t                 node_version,
+    void *                   value
+)
+{
+    while (true)
+    {
+        concurrent_avl_node *child = concurrent_avl_child(node, dir);
+
+        if (child == NULL)
+        {
+            if (concurrent_avl_has_shrunk_or_unlinked(node_version, atomic_load(&(node->version)))) {
+                return CONCURRENT_AVL_RETRY;
+            }
+            return CONCURRENT_AVL_ABSENT;
+        }
+
+        int child_cmp = map_key_compare_sized(cavl->compare_func, cavl->key_size, key, child->key);
+        if (child_cmp == 0)
+        /* Ключ узла никогда не меняется, поэтому проверка версий не нужна */
+        {
+            concurrent_avl_value *value_buffer = atomic_load(&(child->value));
+            if (value_buffer == NULL) {
+                return CONCURRENT_AVL_ABSENT;
+            }
+            memcpy(value, value_buffer->data, cavl->value_size);
+            return CONCURRENT_AVL_PRESENT;
+        }
+
+        uint64_t child_version = atomic_load(&(child->version));
+
+        if (concurrent_avl_is_shrinking_or_unlinked(child_version))
+        {
+            concurrent_avl_wait_until_shrink_completed(child, child_version);
+            if (concurrent_avl_has_shrunk_or_unlinked(node_version, atomic_load(&(node->version)))) {
+                return CONCURRENT_AVL_RETRY;
+            }
+        }
+        else if (child != concurrent_avl_child(node, dir))
+        {
+            if (concurrent_avl_has_shrunk_or_unlinked(node_version, atomic_load(&(node->version)))) {
+                return CONCURRENT_AVL_RETRY;
+            }
+        }
+        else
+        {
+            /**
+             * Переход от node к child был корректен, пока версия node не
+             * изменилась. Дальше корректность спуска проверяется по версии child
+             */
+            if (concurrent_avl_has_shrunk_or_unlinked(node_version, atomic_load(&(node->version)))) {
+                return CONCURRENT_AVL_RETRY;
+            }
+
+            int result = concurrent_avl_attempt_get(cavl, key, child, child_cmp, child_version, value);
+            if (result != CONCURRENT_AVL_RETRY) {
+                return result;
+            }
+        }
+    }
+}
+
+static int
+concurrent_avl_update
+(
+    concurrent_avl *          cavl,
+    void *                    key,
+    concurrent_avl_value *    value
+)
+{
+    concurrent_avl_node *root_holder = cavl->root_holder;
+
+    while (true)
+    {
+        concurrent_avl_node *root = atomic_load(&(root_holder->right_child));
+
+        if (root == NULL)
+        {
+            if (value == NULL || concurrent_avl_attempt_insert_into_empty(cavl, key, value)) {
+                return CONCURRENT_AVL_ABSENT;
+            }
+        }
+        else
+        {
+            uint64_t root_version = atomic_load(&(root->version));
+
+            if (concurrent_avl_is_shrinking_or_unlinked(root_version)) {
+                concurrent_avl_wait_until_shrink_completed(root, root_version);
+            }
+            else if (root == atomic_load(&(root_holder->right_child)))
+            {
+                int result = concurrent_avl_attempt_update(cavl, key, value, root_holder, root, root_version);
+                if (result != CONCURRENT_AVL_RETRY) {
+                    return result;
+                }
+            }
+        }
+    }
+}
+
+static bool
+concurrent_avl_attempt_insert_into_empty
+(
+    concurrent_avl *          cavl,
+    void *                    key,
+    concurrent_avl_value *    value
+)
+{
+    concurrent_avl_node *root_holder = cavl->root_holder;
+    bool inserted = false;
+
+    concurrent_avl_lock(root_holder);
+    if (atomic_load(&(root_holder->right_child)) == NULL)
+    {
+        atomic_store(&(root_holder->right_child),
+            concurrent_avl_create_node(cavl, key, value, 1, root_holder));
+        atomic_store(&(root_holder->height), 2);
+        inserted = true;
+    }
+    concurrent_avl_unlock(root_holder);
+
+    return inserted;
+}
+
+static int
+concurrent_avl_attempt_update
+(
+    concurrent_avl *          cavl,
+    void *                    key,
+    concurrent_avl_value *    value,
+    concurrent_avl_node *     parent,
+    concurrent_avl_node *     node,
+    uint64_t                  node_version
+)
+{
+    int cmp = map_key_compare_sized(cavl->compare_func, cavl->key_size, key, node->key);
+    if (cmp == 0) {
+        return concurrent_avl_attempt_node_update(cavl, value, parent, node);
+    }
+
+    while (true)
+    {
+        concurrent_avl_node *child = concurrent_avl_child(node, cmp);
+
+        if (concurrent_avl_has_shrunk_or_unlinked(node_version, atomic_load(&(node->version)))) {
+            return CONCURRENT_AVL_RETRY;
+        }
+
+        if (child == NULL)
+        /* Ключа в дереве нет */
+        {
+            if (value == NULL) {
+                return CONCURRENT_AVL_ABSENT;
+            }
+
+            bool inserted = false;
+            concurrent_avl_node *damaged = NULL;
+
+            concurrent_avl_lock(node);
+
+            /**
+             * Узел заблокирован, поэтому новые повороты невозможны. Осталось
+             * проверить, что их не было с момента перехода к node
+             */
+            if (concurrent_avl_has_shrunk_or_unlinked(node_version, atomic_load(&(node->version))))
+            {
+                concurrent_avl_unlock(node);
+                return CONCURRENT_AVL_RETRY;
+            }
+
+            if (concurrent_avl_child(node, cmp) == NULL)
+            /* Иначе параллельная вставка нас опередила - повторим с node */
+            {
+                concurrent_avl_set_child(node, cmp, concurrent_avl_create_node(cavl, key, value, 1, node));
+                inserted = true;
+                damaged = concurrent_avl_fix_height_nl(node);
+            }
+
+            concurrent_avl_unlock(node);
+
+            if (inserted)
+            {
+                concurrent_avl_fix_height_and_rebalance(cavl, damaged);
+                return CONCURRENT_AVL_ABSENT;
+            }
+        }
+        else
+        {
+            uint64_t child_version = atomic_load(&(child->version));
+
+            if (concurrent_avl_is_shrinking_or_unlinked(child_version)) {
+                concurrent_avl_wait_until_shrink_completed(child, child_version);
+            }
+            else if (child == concurrent_avl_child(node, cmp))
+            {
+                if (concurrent_avl_has_shrunk_or_unlinked(node_version, atomic_load(&(node->version)))) {
+                    return CONCURRENT_AVL_RETRY;
+                }
+
+                int result = concurrent_avl_attempt_update(cavl, key, value, node, child, child_version);
+                if (result != CONCURRENT_AVL_RETRY) {
+                    return result;
+                }
+            }
+        }
+    }
+}
+
+static int
+concurrent_avl_attempt_node_update
+(
+    concurrent_avl *          cavl,
+    concurrent_avl_value *    value,
+    concurrent_avl_node *     parent,
+    concurrent_avl_node *     node
+)
+{
+    if (value == NULL && atomic_load(&(node->value)) == NULL) {
+        return CONCURRENT_AVL_ABSENT;
+    }
+
+    if (value == NULL && (atomic_load(&(node->left_child)) == NULL
+        || atomic_load(&(node->right_child)) == NULL))
+    /* Удаление узла, который можно вырезать - нужна блокировка родителя */
+    {
+        concurrent_avl_lock(parent);
+
+        if (concurrent_avl_is_unlinked(atomic_load(&(parent->version)))
+            || atomic_load(&(node->parent)) != parent)
+        {
+            concurrent_avl_unlock(parent);
+            return CONCURRENT_AVL_RETRY;
+        }
+
+        concurrent_avl_lock(node);
+
+        concurrent_avl_value *previous = atomic_load(&(node->value));
+        if (previous == NULL)
+        {
+            concurrent_avl_unlock(node);
+            concurrent_avl_unlock(parent);
+            return CONCURRENT_AVL_ABSENT;
+        }
+        if (!concurrent_avl_attempt_unlink_nl(cavl, parent, node))
+        {
+            concurrent_avl_unlock(node);
+            concurrent_avl_unlock(parent);
+            return CONCURRENT_AVL_RETRY;
+        }
+
+        concurrent_avl_unlock(node);
+
+        concurrent_avl_node *damaged = concurrent_avl_fix_height_nl(parent);
+
+        concurrent_avl_unlock(parent);
+
+        concurrent_avl_retire_value(cavl, previous, true);
+        concurrent_avl_fix_height_and_rebalance(cavl, damaged);
+
+        return CONCURRENT_AVL_PRESENT;
+    }
+
+    /* Замена значения (или превращение узла в маршрутизатор) */
+
+    concurrent_avl_lock(node);
+
+    if (concurrent_avl_is_unlinked(atomic_load(&(node->version))))
+    {
+        concurrent_avl_unlock(node);
+        return CONCURRENT_AVL_RETRY;
+    }
+
+    if (value == NULL && (atomic_load(&(node->left_child)) == NULL
+        || atomic_load(&(node->right_child)) == NULL))
+    /* Пока мы ждали блокировку, узел стало возможно вырезать */
+    {
+        concurrent_avl_unlock(node);
+        return CONCURRENT_AVL_RETRY;
+    }
+
+    concurrent_avl_value *previous = atomic_load(&(node->value));
+    atomic_store(&(node->value), value);
+
+    concurrent_avl_unlock(node);
+
+    if (previous != NULL) {
+        concurrent_avl_retire_value(cavl, previous, value == NULL);
+    }
+
+    return previous != NULL ? CONCURRENT_AVL_PRESENT : CONCURRENT_AVL_ABSENT;
+}
+
+static bool
+concurrent_avl_attempt_unlink_nl
+(
+    concurrent_avl *         cavl,
+    concurrent_avl_node *    parent,
+    concurrent_avl_node *    node
+)
+{
+    concurrent_avl_node *parent_left = atomic_load(&(parent->left_child));
+    concurrent_avl_node *parent_right = atomic_load(&(parent->right_child));
+    if (parent_left != node && parent_right != node) {
+        return false;
+    }
+
+    concurrent_avl_node *left = atomic_load(&(node->left_child));
+    concurrent_avl_node *right = atomic_load(&(node->right_child));
+    if (left != NULL && right != NULL) {
+        return false;
+    }
+
+    concurrent_avl_node *splice = left != NULL ? left : right;
+
+    if (parent_left == node) {
+        atomic_store(&(parent->left_child), splice);
+    }
+    else {
+        atomic_store(&(parent->right_child), splice);
+    }
+    if (splice != NULL) {
+        atomic_store(&(splice->parent), parent);
+    }
+
+    atomic_store(&(node->version), CONCURRENT_AVL_UNLINKED);
+    atomic_store(&(node->value), NULL);
+
+    concurrent_avl_retire_node(cavl, node);
+
+    return true;
+}
+
+static int
+concurrent_avl_node_condition
+(
+    concurrent_avl_node *node
+)
+{
+    concurrent_avl_node *left = atomic_load(&(node->left_child));
+    concurrent_avl_node *right = atomic_load(&(node->right_child));
+
+    if ((left == NULL || right == NULL) && atomic_load(&(node->value)) == NULL) {
+        return CONCURRENT_AVL_UNLINK_REQUIRED;
+    }
+
+    int height = atomic_load(&(node->height));
+    int left_height = concurrent_avl_height(left);
+    int right_height = concurrent_avl_height(right);
+
+    /**
+     * Чтение не атомарно, но любой поток, изменивший узел, обязуется его
+     * исправить, поэтому либо вывод верен, либо ответственность на другом потоке
+     */
+    int new_height = 1 + (left_height > right_height ? left_height : right_height);
+    int balance = left_height - right_height;
+
+    if (balance < -1 || balance > 1) {
+        return CONCURRENT_AVL_REBALANCE_REQUIRED;
+    }
+
+    return height != new_height ? new_height : CONCURRENT_AVL_NOTHING_REQUIRED;
+}
+
+static void
+concurrent_avl_fix_height_and_rebalance
+(
+    concurrent_avl *         cavl,
+    concurrent_avl_node *    node
+)
+{
+    /**
+     * Поворот возвращает самый нижний повреждённый узел, а родитель повёрнутого
+     * поддерева исправляется только если цепочка исправлений до него дойдёт.
+     * Если цепочка оборвётся раньше, проверим предков, начиная с этого родителя
+     */
+    concurrent_avl_node *sweep_from = NULL;
+
+    while (true)
+    {
+        if (node == NULL || atomic_load(&(node->parent)) == NULL)
+        {
+            if (sweep_from == NULL) {
+                return;
+            }
+            node = concurrent_avl_find_damaged_ancestor(sweep_from);
+            sweep_from = NULL;
+            continue;
+        }
+
+        int condition = concurrent_avl_node_condition(node);
+        if (condition == CONCURRENT_AVL_NOTHING_REQUIRED
+            || concurrent_avl_is_unlinked(atomic_load(&(node->version))))
+        {
+            node = NULL;
+            continue;
+        }
+
+        if (condition != CONCURRENT_AVL_UNLINK_REQUIRED && condition != CONCURRENT_AVL_REBALANCE_REQUIRED)
+        {
+            concurrent_avl_lock(node);
+            concurrent_avl_node *next = concurrent_avl_fix_height_nl(node);
+            concurrent_avl_unlock(node);
+            node = next;
+        }
+        else
+        {
+            concurrent_avl_node *n_parent = atomic_load(&(node->parent));
+
+            concurrent_avl_lock(n_parent);
+            if (!concurrent_avl_is_unlinked(atomic_load(&(n_parent->version)))
+                && atomic_load(&(node->parent)) == n_parent)
+            {
+                concurrent_avl_lock(node);
+                concurrent_avl_node *next = concurrent_avl_rebalance_nl(cavl, n_parent, node);
+                concurrent_avl_unlock(node);
+                node = next;
+                sweep_from = n_parent;
+            }
+            concurrent_avl_unlock(n_parent);
+        }
+    }
+}
+
+static concurrent_avl_node *
+concurrent_avl_find_damaged_ancestor
+(
+    concurrent_avl_node *node
+)
+{
+    while (node != NULL && atomic_load(&(node->parent)) != NULL)
+    {
+        if (concurrent_avl_is_unlinked(atomic_load(&(node->version)))) {
+            return NULL;
+        }
+        if (concurrent_avl_node_condition(node) != CONCURRENT_AVL_NOTHING_REQUIRED) {
+            return node;
+        }
+        node = atomic_load(&(node->parent));
+    }
+
+    return NULL;
+}
+
+static concurrent_avl_node *
+concurrent_avl_fix_height_nl
+(
+    concurrent_avl_node *node
+)
+{
+    int condition = concurrent_avl_node_condition(node);
+
+    switch (condition)
+    {
+        case CONCURRENT_AVL_REBALANCE_REQUIRED:
+        case CONCURRENT_AVL_UNLINK_REQUIRED:
+            /* Исправить только высотой нельзя */
+            return node;
+        case CONCURRENT_AVL_NOTHING_REQUIRED:
+            return NULL;
+        default:
+            atomic_store(&(node->height), condition);
+            /* Высота родителя могла стать неверной */
+            return atomic_load(&(node->parent));
+    }
+}
+
+static concurrent_avl_node *
+concurrent_avl_rebalance_nl
+(
+    concurrent_avl *         cavl,
+    concurrent_avl_node *    n_parent,
+    concurrent_avl_node *    n
+)
+{
+    concurrent_avl_node *n_left = atomic_load(&(n->left_child));
+    concurrent_avl_node *n_right = atomic_load(&(n->right_child));
+
+    if ((n_left == NULL || n_right == NULL) && atomic_load(&(n->value)) == NULL)
+    {
+        if (concurrent_avl_attempt_unlink_nl(cavl, n_parent, n)) {
+            return concurrent_avl_fix_height_nl(n_parent);
+        }
+        return n;
+    }
+
+    int height = atomic_load(&(n->height));
+    int left_height = concurrent_avl_height(n_left);
+    int right_height = concurrent_avl_height(n_right);
+    int new_height = 1 + (left_height > right_height ? left_height : right_height);
+    int balance = left_height - right_height;
+
+    if (balance > 1) {
+        return concurrent_avl_rebalance_to_right_nl(n_parent, n, n_left, right_height);
+    }
+    else if (balance < -1) {
+        return concurrent_avl_rebalance_to_left_nl(n_parent, n, n_right, left_height);
+    }
+    else if (new_height != height)
+    {
+        atomic_store(&(n->height), new_height);
+        return concurrent_avl_fix_height_nl(n_parent);
+    }
+
+    return NULL;
+}
+
+static concurrent_avl_node *
+concurrent_avl_rebalance_to_right_nl
+(
+    concurrent_avl_node *    n_parent,
+    concurrent_avl_node *    n,
+    concurrent_avl_node *    n_left,
+    int                      h_right0
+)
+{
+    concurrent_avl_node *result;
+
+    concurrent_avl_lock(n_left);
+
+    int h_left = atomic_load(&(n_left->height));
+    if (h_left - h_right0 <= 1)
+    /* Повторим попытку */
+    {
+        result = n;
+    }
+    else
+    {
+        concurrent_avl_node *n_left_right = atomic_load(&(n_left->right_child));
+        int h_left_left0 = concurrent_avl_height(atomic_load(&(n_left->left_child)));
+        int h_left_right0 = concurrent_avl_height(n_left_right);
+
+        if (h_left_left0 >= h_left_right0)
+        {
+            result = concurrent_avl_rotate_right_nl(n_parent, n, n_left, h_right0,
+                h_left_left0, n_left_right, h_left_right0);
+        }
+        else
+        {
+            bool rotated = false;
+
+            concurrent_avl_lock(n_left_right);
+
+            int h_left_right = atomic_load(&(n_left_right->height));
+            if (h_left_left0 >= h_left_right)
+            {
+                result = concurrent_avl_rotate_right_nl(n_parent, n, n_left, h_right0,
+                    h_left_left0, n_left_right, h_left_right);
+                rotated = true;
+            }
+            else
+            {
+                int h_left_right_left = concurrent_avl_height(atomic_load(&(n_left_right->left_child)));
+                int balance = h_left_left0 - h_left_right_left;
+                if (balance >= -1 && balance <= 1)
+                {
+                    result = concurrent_avl_rotate_right_over_left_nl(n_parent, n, n_left, h_right0,
+                        h_left_left0, n_left_right, h_left_right_left);
+                    rotated = true;
+                }
+            }
+
+            concurrent_avl_unlock(n_left_right);
+
+            if (!rotated)
+            /* Сначала перебалансируем n_left, n будет перебалансирован позже */
+            {
+                result = concurrent_avl_rebalance_to_left_nl(n, n_left, n_left_right, h_left_left0);
+            }
+        }
+    }
+
+    concurrent_avl_unlock(n_left);
+
+    return result;
+}
+
+static concurrent_avl_node *
+concurrent_avl_rebalance_to_left_nl
+(
+    concurrent_avl_node *    n_parent,
+    concurrent_avl_node *    n,
+    concurrent_avl_node *    n_right,
+    int                      h_left0
+)
+{
+    concurrent_avl_node *result;
+
+    concurrent_avl_lock(n_right);
+
+    int h_right = atomic_load(&(n_right->height));
+    if (h_left0 - h_right >= -1)
+    /* Повторим попытку */
+    {
+        result = n;
+    }
+    else
+    {
+        concurrent_avl_node *n_right_left = atomic_load(&(n_right->left_child));
+        int h_right_left0 = concurrent_avl_height(n_right_left);
+        int h_right_right0 = concurrent_avl_height(atomic_load(&(n_right->right_child)));
+
+        if (h_right_right0 >= h_right_left0)
+        {
+            result = concurrent_avl_rotate_left_nl(n_parent, n, h_left0, n_right,
+                n_right_left, h_right_left0, h_right_right0);
+        }
+        else
+        {
+            bool rotated = false;
+
+            concurrent_avl_lock(n_right_left);
+
+            int h_right_left = atomic_load(&(n_right_left->height));
+            if (h_right_right0 >= h_right_left)
+            {
+                result = concurrent_avl_rotate_left_nl(n_parent, n, h_left0, n_right,
+                    n_right_left, h_right_left, h_right_right0);
+                rotated = true;
+            }
+            else
+            {
+                int h_right_left_right = concurrent_avl_height(atomic_load(&(n_right_left->right_child)));
+                int balance = h_right_right0 - h_right_left_right;
+                if (balance >= -1 && balance <= 1)
+                {
+                    result = concurrent_avl_rotate_left_over_right_nl(n_parent, n, h_left0, n_right,
+                        n_right_left, h_right_right0, h_right_left_right);
+                    rotated = true;
+                }
+            }
+
+            concurrent_avl_unlock(n_right_left);
+
+            if (!rotated)
+            /* Сначала перебалансируем n_right, n будет перебалансирован позже */
+            {
+                result = concurrent_avl_rebalance_to_right_nl(n, n_right, n_right_left, h_right_right0);
+            }
+        }
+    }
+
+    concurrent_avl_unlock(n_right);
+
+    return result;
+}
+
+static concurrent_avl_node *
+concurrent_avl_rotate_right_nl
+(
+    concurrent_avl_node *    n_parent,
+    concurrent_avl_node *    n,
+    concurrent_avl_node *    n_left,
+    int                      h_right,
+    int                      h_left_left,
+    concurrent_avl_node *    n_left_right,
+    int                      h_left_right
+)
+{
+    uint64_t node_version = atomic_load(&(n->version));
+    uint64_t left_version = atomic_load(&(n_left->version));
+
+    concurrent_avl_node *n_parent_left = atomic_load(&(n_parent->left_child));
+
+    atomic_store(&(n->version), concurrent_avl_begin_shrink(node_version));
+    atomic_store(&(n_left->version), concurrent_avl_begin_grow(left_version));
+
+    /**
+     * Ссылки вниз на опускающиеся узлы меняются последними, иначе поиск может
+     * миновать версию, сигнализирующую о повороте
+     */
+    atomic_store(&(n->left_child), n_left_right);
+    atomic_store(&(n_left->right_child), n);
+    if (n_parent_left == n) {
+        atomic_store(&(n_parent->left_child), n_left);
+    }
+    else {
+        atomic_store(&(n_parent->right_child), n_left);
+    }
+
+    atomic_store(&(n_left->parent), n_parent);
+    atomic_store(&(n->parent), n_left);
+    if (n_left_right != NULL) {
+        atomic_store(&(n_left_right->parent), n);
+    }
+
+    int h_node_new = 1 + (h_left_right > h_right ? h_left_right : h_right);
+    atomic_store(&(n->height), h_node_new);
+    atomic_store(&(n_left->height), 1 + (h_left_left > h_node_new ? h_left_left : h_node_new));
+
+    atomic_store(&(n_left->version), concurrent_avl_end_grow(left_version));
+    atomic_store(&(n->version), concurrent_avl_end_shrink(node_version));
+
+    /**
+     * Повреждены n_parent, n и n_left. Исправим всё, что можно исправить
+     * с уже захваченными блокировками
+     */
+
+    int balance_node = h_left_right - h_right;
+    if (balance_node < -1 || balance_node > 1) {
+        return n;
+    }
+
+    if ((n_left_right == NULL || h_right == 0) && atomic_load(&(n->value)) == NULL) {
+        return n;
+    }
+
+    int balance_left = h_left_left - h_node_new;
+    if (balance_left < -1 || balance_left > 1) {
+        return n_left;
+    }
+
+    if (h_left_left == 0 && atomic_load(&(n_left->value)) == NULL) {
+        return n_left;
+    }
+
+    return concurrent_avl_fix_height_nl(n_parent);
+}
+
+static concurrent_avl_node *
+concurrent_avl_rotate_left_nl
+(
+    concurrent_avl_node *    n_parent,
+    concurrent_avl_node *    n,
+    int                      h_left,
+    concurrent_avl_node *    n_right,
+    concurrent_avl_node *    n_right_left,
+    int                      h_right_left,
+    int                      h_right_right
+)
+{
+    uint64_t node_version = atomic_load(&(n->version));
+    uint64_t right_version = atomic_load(&(n_right->version));
+
+    concurrent_avl_node *n_parent_left = atomic_load(&(n_parent->left_child));
+
+    atomic_store(&(n->version), concurrent_avl_begin_shrink(node_version));
+    atomic_store(&(n_right->version), concurrent_avl_begin_grow(right_version));
+
+    atomic_store(&(n->right_child), n_right_left);
+    atomic_store(&(n_right->left_child), n);
+    if (n_parent_left == n) {
+        atomic_store(&(n_parent->left_child), n_right);
+    }
+    else {
+        atomic_store(&(n_parent->right_child), n_right);
+    }
+
+    atomic_store(&(n_right->parent), n_parent);
+    atomic_store(&(n->parent), n_right);
+    if (n_right_left != NULL) {
+        atomic_store(&(n_right_left->parent), n);
+    }
+
+    int h_node_new = 1 + (h_left > h_right_left ? h_left : h_right_left);
+    atomic_store(&(n->height), h_node_new);
+    atomic_store(&(n_right->height), 1 + (h_node_new > h_right_right ? h_node_new : h_right_right));
+
+    atomic_store(&(n_right->version), concurrent_avl_end_grow(right_version));
+    atomic_store(&(n->version), concurrent_avl_end_shrink(node_version));
+
+    int balance_node = h_right_left - h_left;
+    if (balance_node < -1 || balance_node > 1) {
+        return n;
+    }
+
+    if ((n_right_left == NULL || h_left == 0) && atomic_load(&(n->value)) == NULL) {
+        return n;
+    }
+
+    int balance_right = h_right_right - h_node_new;
+    if (balance_right < -1 || balance_right > 1) {
+        return n_right;
+    }
+
+    if (h_right_right == 0 && atomic_load(&(n_right->value)) == NULL) {
+        return n_right;
+    }
+
+    return concurrent_avl_fix_height_nl(n_parent);
+}
+
+static concurrent_avl_node *
+concurrent_avl_rotate_right_over_left_nl
+(
+    concurrent_avl_node *    n_parent,
+    concurrent_avl_node *    n,
+    concurrent_avl_node *    n_left,
+    int                      h_right,
+    int                      h_left_left,
+    concurrent_avl_node *    n_left_right,
+    int                      h_left_right_left
+)
+{
+    uint64_t node_version = atomic_load(&(n->version));
+    uint64_t left_version = atomic_load(&(n_left->version));
+    uint64_t left_right_version = atomic_load(&(n_left_right->version));
+
+    concurrent_avl_node *n_parent_left = atomic_load(&(n_parent->left_child));
+    concurrent_avl_node *n_left_right_left = atomic_load(&(n_left_right->left_child));
+    concurrent_avl_node *n_left_right_right = atomic_load(&(n_left_right->right_child));
+    int h_left_right_right = concurrent_avl_height(n_left_right_right);
+
+    atomic_store(&(n->version), concurrent_avl_begin_shrink(node_version));
+    atomic_store(&(n_left->version), concurrent_avl_begin_shrink(left_version));
+    atomic_store(&(n_left_right->version), concurrent_avl_begin_grow(left_right_version));
+
+    atomic_store(&(n->left_child), n_left_right_right);
+    atomic_store(&(n_left->right_child), n_left_right_left);
+    atomic_store(&(n_left_right->left_child), n_left);
+    atomic_store(&(n_left_right->right_child), n);
+    if (n_parent_left == n) {
+        atomic_store(&(n_parent->left_child), n_left_right);
+    }
+    else {
+        atomic_store(&(n_parent->right_child), n_left_right);
+    }
+
+    atomic_store(&(n_left_right->parent), n_parent);
+    atomic_store(&(n_left->parent), n_left_right);
+    atomic_store(&(n->parent), n_left_right);
+    if (n_left_right_right != NULL) {
+        atomic_store(&(n_left_right_right->parent), n);
+    }
+    if (n_left_right_left != NULL) {
+        atomic_store(&(n_left_right_left->parent), n_left);
+    }
+
+    int h_node_new = 1 + (h_left_right_right > h_right ? h_left_right_right : h_right);
+    atomic_store(&(n->height), h_node_new);
+    int h_left_new = 1 + (h_left_left > h_left_right_left ? h_left_left : h_left_right_left);
+    atomic_store(&(n_left->height), h_left_new);
+    atomic_store(&(n_left_right->height), 1 + (h_left_new > h_node_new ? h_left_new : h_node_new));
+
+    atomic_store(&(n_left_right->version), concurrent_avl_end_grow(left_right_version));
+    atomic_store(&(n_left->version), concurrent_avl_end_shrink(left_version));
+    atomic_store(&(n->version), concurrent_avl_end_shrink(node_version));
+
+    int balance_node = h_left_right_right - h_right;
+    if (balance_node < -1 || balance_node > 1) {
+        return n;
+    }
+
+    if ((n_left_right_right == NULL || h_right == 0) && atomic_load(&(n->value)) == NULL) {
+        return n;
+    }
+
+    int balance_left_right = h_left_new - h_node_new;
+    if (balance_left_right < -1 || balance_left_right > 1) {
+        return n_left_right;
+    }
+
+    return concurrent_avl_fix_height_nl(n_parent);
+}
+
+static concurrent_avl_node *
+concurrent_avl_rotate_left_over_right_nl
+(
+    concurrent_avl_node *    n_parent,
+    concurrent_avl_node *    n,
+    int                      h_left,
+    concurrent_avl_node *    n_right,
+    concurrent_avl_node *    n_right_left,
+    int                      h_right_right,
+    int                      h_right_left_right
+)
+{
+    uint64_t node_version = atomic_load(&(n->version));
+    uint64_t right_version = atomic_load(&(n_right->version));
+    uint64_t right_left_version = atomic_load(&(n_right_left->version));
+
+    concurrent_avl_node *n_parent_left = atomic_load(&(n_parent->left_child));
+    concurrent_avl_node *n_right_left_left = atomic_load(&(n_right_left->left_child));
+    int h_right_left_left = concurrent_avl_height(n_right_left_left);
+    concurrent_avl_node *n_right_left_right = atomic_load(&(n_right_left->right_child));
+
+    atomic_store(&(n->version), concurrent_avl_begin_shrink(node_version));
+    atomic_store(&(n_right->version), concurrent_avl_begin_shrink(right_version));
+    atomic_store(&(n_right_left->version), concurrent_avl_begin_grow(right_left_version));
+
+    atomic_store(&(n->right_child), n_right_left_left);
+    atomic_store(&(n_right->left_child), n_right_left_right);
+    atomic_store(&(n_right_left->right_child), n_right);
+    atomic_store(&(n_right_left->left_child), n);
+    if (n_parent_left == n) {
+        atomic_store(&(n_parent->left_child), n_right_left);
+    }
+    else {
+        atomic_store(&(n_parent->right_child), n_right_left);
+    }
+
+    atomic_store(&(n_right_left->parent), n_parent);
+    atomic_store(&(n_right->parent), n_right_left);
+    atomic_store(&(n->parent), n_right_left);
+    if (n_right_left_left != NULL) {
+        atomic_store(&(n_right_left_left->parent), n);
+    }
+    if (n_right_left_right != NULL) {
+        atomic_store(&(n_right_left_right->parent), n_right);
+    }
+
+    int h_node_new = 1 + (h_left > h_right_left_left ? h_left : h_right_left_left);
+    atomic_store(&(n->height), h_node_new);
+    int h_right_new = 1 + (h_right_left_right > h_right_right ? h_right_left_right : h_right_right);
+    atomic_store(&(n_right->height), h_right_new);
+    atomic_store(&(n_right_left->height), 1 + (h_node_new > h_right_new ? h_node_new : h_right_new));
+
+    atomic_store(&(n_right_left->version), concurrent_avl_end_grow(right_left_version));
+    atomic_store(&(n_right->version), concurrent_avl_end_shrink(right_version));
+    atomic_store(&(n->version), concurrent_avl_end_shrink(node_version));
+
+    int balance_node = h_right_left_left - h_left;
+    if (balance_node < -1 || balance_node > 1) {
+        return n;
+    }
+
+    if ((n_right_left_left == NULL || h_left == 0) && atomic_load(&(n->value)) == NULL) {
+        return n;
+    }
+
+    int balance_right_left = h_right_new - h_node_new;
+    if (balance_right_left < -1 || balance_right_left > 1) {
+        return n_right_left;
+    }
+
+    return concurrent_avl_fix_height_nl(n_parent);
+}
+
+
+/**
+ * Вспомогательные функции (конец)
+ */
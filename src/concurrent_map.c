@@ -0,0 +1,301 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <concurrent_map.h>
+#include <memory.h>
+#include <pthread.h>
+
+struct _concurrent_map
+{
+    map *               mp;
+    uint16_t            value_size;
+    pthread_rwlock_t    lock;
+};
+
+
+/**
+ * Прототипы вспомогательных функций (начало)
+ */
+
+
+/**
+ * Завершает программу с сообщением об ошибке, если cmap равен NULL
+ * 
+ * Принимает в качестве аргументов указатель на concurrent_map и имя 
+ * вызывающей функции
+ */
+static void
+concurrent_map_check_null
+(
+    concurrent_map *    cmap,
+    const char *        func_name
+);
+
+/**
+ * Захватывает блокировку на чтение (read == true) или на запись и завершает 
+ * программу с сообщением об ошибке, если это не удалось
+ */
+static void
+concurrent_map_lock
+(
+    concurrent_map *    cmap,
+    bool                read
+);
+
+/**
+ * Освобождает блокировку
+ */
+static void
+concurrent_map_unlock
+(
+    concurrent_map *cmap
+);
+
+
+/**
+ * Прототипы вспомогательных функций (конец)
+ */
+
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/**
+ * Определения основных функций (API) (начало)
+ */
+
+
+concurrent_map *
+concurrent_map_create
+(
+    uint16_t    key_size, 
+    uint16_t    value_size, 
+    int         (*compare_func)       (const void *f, const void *s),
+    void        (*key_destroyer)      (void *key),
+    void        (*value_destroyer)    (void *value)
+)
+{
+    concurrent_map *cmap = (concurrent_map *)malloc(sizeof(concurrent_map));
+    if (cmap == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    cmap->mp = map_create(key_size, value_size, compare_func, key_destroyer, value_destroyer);
+    cmap->value_size = value_size;
+
+    if (pthread_rwlock_init(&(cmap->lock), NULL) != 0)
+    {
+        fprintf(stderr, "concurrent_map_create: не удалось инициализировать блокировку\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return cmap;
+}
+
+void
+concurrent_map_free
+(
+    concurrent_map *cmap
+)
+{
+    concurrent_map_check_null(cmap, "concurrent_map_free");
+
+    pthread_rwlock_destroy(&(cmap->lock));
+    map_free(cmap->mp);
+    free(cmap);
+}
+
+size_t
+concurrent_map_size
+(
+    concurrent_map *cmap
+)
+{
+    concurrent_map_check_null(cmap, "concurrent_map_size");
+
+    concurrent_map_lock(cmap, true);
+    size_t size = map_size(cmap->mp);
+    concurrent_map_unlock(cmap);
+
+    return size;
+}
+
+void
+_concurrent_map_insert
+(
+    concurrent_map *    cmap,
+    void *              key,
+    void *              value
+)
+{
+    concurrent_map_check_null(cmap, "concurrent_map_insert");
+
+    concurrent_map_lock(cmap, false);
+    _map_insert(cmap->mp, key, value);
+    concurrent_map_unlock(cmap);
+}
+
+bool
+_concurrent_map_find
+(
+    concurrent_map *    cmap,
+    void *              key,
+    void *              value
+)
+{
+    concurrent_map_check_null(cmap, "concurrent_map_find");
+    if (key == NULL || value == NULL)
+    {
+        fprintf(stderr, "concurrent_map_find: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bool found = false;
+
+    concurrent_map_lock(cmap, true);
+
+    map_iterator it = _map_find(cmap->mp, key);
+    if (map_iterator_compare(it, map_iterator_end(cmap->mp)) != 0)
+    {
+        memcpy(value, _map_iterator_get_value(it), cmap->value_size);
+        found = true;
+    }
+
+    concurrent_map_unlock(cmap);
+
+    return found;
+}
+
+bool
+_concurrent_map_erase
+(
+    concurrent_map *    cmap,
+    void *              key
+)
+{
+    concurrent_map_check_null(cmap, "concurrent_map_erase");
+    if (key == NULL)
+    {
+        fprintf(stderr, "concurrent_map_erase: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bool erased = false;
+
+    concurrent_map_lock(cmap, false);
+
+    map_iterator it = _map_find(cmap->mp, key);
+    if (map_iterator_compare(it, map_iterator_end(cmap->mp)) != 0)
+    {
+        map_erase(cmap->mp, it);
+        erased = true;
+    }
+
+    concurrent_map_unlock(cmap);
+
+    return erased;
+}
+
+map *
+concurrent_map_read_lock
+(
+    concurrent_map *cmap
+)
+{
+    concurrent_map_check_null(cmap, "concurrent_map_read_lock");
+
+    concurrent_map_lock(cmap, true);
+    return cmap->mp;
+}
+
+void
+concurrent_map_read_unlock
+(
+    concurrent_map *cmap
+)
+{
+    concurrent_map_check_null(cmap, "concurrent_map_read_unlock");
+
+    concurrent_map_unlock(cmap);
+}
+
+map *
+concurrent_map_write_lock
+(
+    concurrent_map *cmap
+)
+{
+    concurrent_map_check_null(cmap, "concurrent_map_write_lock");
+
+    concurrent_map_lock(cmap, false);
+    return cmap->mp;
+}
+
+void
+concurrent_map_write_unlock
+(
+    concurrent_map *cmap
+)
+{
+    concurrent_map_check_null(cmap, "concurrent_map_write_unlock");
+
+    concurrent_map_unlock(cmap);
+}
+
+
+/**
+ * Определения основных функций (API) (конец)
+ */
+
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/**
+ * Вспомогательные функции (начало)
+ */
+
+
+static void
+concurrent_map_check_null
+(
+    concurrent_map *    cmap,
+    const char *        func_name
+)
+{
+    if (cmap == NULL)
+    {
+        fprintf(stderr, "%s: в качестве аргумента передан нулевой указатель\n", func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+concurrent_map_lock
+(
+    concurrent_map *    cmap,
+    bool                read
+)
+{
+    int result = read ? pthread_rwlock_rdlock(&(cmap->lock)) : pthread_rwlock_wrlock(&(cmap->lock));
+    if (result != 0)
+    {
+        fprintf(stderr, "concurrent_map: не удалось захватить блокировку\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+concurrent_map_unlock
+(
+    concurrent_map *cmap
+)
+{
+    if (pthread_rwlock_unlock(&(cmap->lock)) != 0)
+    {
+        fprintf(stderr, "concurrent_map: не удалось освободить блокировку\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/**
+ * Вспомогательные функции (конец)
+ */
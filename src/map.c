@@ -1,17 +1,277 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <map.h>
+#include <avl_link.h>
+#include <map_btree.h>
 #include <memory.h>
+#include <string.h>
+#include <stddef.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FROZEN_MAP_X86
+#endif
+
+/**
+ * Запись и чтение полей узла, которые читают RCU-читатели (см. map_rcu_find):
+ * корня, указателей на детей, ключа и значения. Запись с семантикой release
+ * гарантирует, что читатель, увидевший новый указатель, увидит и данные, 
+ * на которые он указывает. На x86 обе операции компилируются в обычный mov
+ */
+#define MAP_PUBLISH(field,new_value) __atomic_store_n(&(field), (new_value), __ATOMIC_RELEASE)
+#define MAP_READ(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+
+/**
+ * Предвыборка обоих детей узла при спуске. Загрузка детей идёт одновременно
+ * с загрузкой ключа узла (ключ хранится в отдельном блоке памяти), и к 
+ * моменту перехода на следующий уровень узел уже в кэше
+ */
+#define MAP_PREFETCH_CHILDREN(node) \
+    do { __builtin_prefetch((node)->link.child[0]); __builtin_prefetch((node)->link.child[1]); } while(0)
+
+/**
+ * Максимальная глубина спуска RCU-читателя. Высота AVL-дерева не превышает 
+ * 1.44 * log2(n), поэтому более глубокий спуск возможен только при чтении 
+ * дерева в момент поворота - такая попытка поиска повторяется
+ */
+#define MAP_RCU_MAX_DEPTH 128
+
+/**
+ * Количество ключей в блоке блочного индекса frozen_map (см. struct _frozen_map)
+ * и максимальное число уровней индекса. 16 ключей int32_t занимают одну
+ * кэш-линию, uint64_t - две
+ */
+#define FROZEN_MAP_BLOCK 16
+#define FROZEN_MAP_MAX_LAYERS 16
+
+/**
+ * Количество записей в наборе кэша поиска (см. map_set_find_cache). Набор
+ * из четырёх хешей и четырёх указателей занимает одну кэш-линию
+ */
+#define MAP_FIND_CACHE_WAYS 4
+
+/**
+ * Параметры фильтра Блума (см. map_set_bloom_filter): блок фильтра - 512 бит
+ * (одна кэш-линия), ключ устанавливает MAP_BLOOM_HASHES бит своего блока. 
+ * Фильтр рассчитан на MAP_BLOOM_KEYS_PER_BLOCK ключей на блок (8 бит на 
+ * ключ) при полной загрузке, после каждого построения загружен не более 
+ * чем наполовину
+ */
+#define MAP_BLOOM_BLOCK_WORDS 8
+#define MAP_BLOOM_HASHES 6
+#define MAP_BLOOM_KEYS_PER_BLOCK 64
+
+/**
+ * Минимальное количество слотов хеш-индекса (см. map_set_hash_index). 
+ * Индекс заполнен не более чем наполовину
+ */
+#define MAP_HASH_INDEX_MIN_SLOTS 16
+
+/**
+ * Вместимость массива контейнера MAP_BACKEND_SMALL и количество элементов,
+ * при котором контейнер возвращается от дерева к массиву
+ */
+#define MAP_SMALL_CAPACITY 16
+#define MAP_SMALL_DEMOTE_SIZE 8
 
 typedef struct _avl_node avl_node;
+typedef struct _map_tree_ref map_tree_ref;
+typedef struct _map_rcu map_rcu;
+typedef struct _map_rcu_garbage map_rcu_garbage;
+typedef struct _map_find_cache map_find_cache;
+typedef struct _map_find_cache_set map_find_cache_set;
+typedef struct _map_bloom map_bloom;
+typedef struct _map_hash_slot map_hash_slot;
+typedef struct _map_hash_index map_hash_index;
+
+/**
+ * Тип ключа, распознанный по функции сравнения (см. MAP_KEY_I32 и др. в map.h)
+ * MAP_KEY_KIND_CUSTOM - пользовательская функция сравнения
+ */
+typedef enum map_key_kind
+{
+    MAP_KEY_KIND_CUSTOM,
+    MAP_KEY_KIND_I32,
+    MAP_KEY_KIND_U64,
+    MAP_KEY_KIND_CSTR,
+    MAP_KEY_KIND_BYTES
+} map_key_kind;
 
+/**
+ * Связи узла (link) - первое поле, поэтому перебалансировка avl_link работает
+ * с &node->link, а узел по связям получается функцией map_node_of
+ */
 struct _avl_node
 {
-    avl_node *    parent;
-    avl_node *    left_child;
-    avl_node *    right_child;
+    /**
+     * Родитель и дети (child[0] - левый, child[1] - правый) указывают на 
+     * поля link других узлов
+     */
+    avl_link      link;
+    /**
+     * Количество ссылок на узел: из родителей и из корней контейнеров, 
+     * разделяющих дерево (см. map_snapshot). Узел с refs > 1 разделяется и
+     * перед изменением заменяется копией
+     * 
+     * Хвост avl_link после balance не доступен полям узла, поэтому поле
+     * вместе с выравниванием занимает ещё 8 байт
+     */
+    atomic_uint   refs;
     void *        key;
     void *        value;
-    int8_t        balance; 
+    /**
+     * Префикс ключа (см. map_set_key_prefix). Не используется, если функция
+     * получения префикса не задана
+     * 
+     * Поле увеличивает узел с 56 до 64 байт, и glibc malloc выделяет под 
+     * узел блок в 80 байт вместо 64
+     */
+    uint64_t      prefix;
+};
+
+/**
+ * Счётчик контейнеров (сам контейнер и его снимки), которые разделяют узлы
+ * дерева (см. map_snapshot). Узлы освобождаются по собственным счётчикам 
+ * ссылок (avl_node.refs), этот счётчик показывает, остались ли снимки
+ */
+struct _map_tree_ref
+{
+    atomic_size_t count;
+};
+
+/**
+ * Слот читателя (см. map_rcu_register). Каждый слот занимает отдельную
+ * кэш-линию, чтобы читатели не мешали друг другу
+ */
+struct _map_rcu_reader
+{
+    /**
+     * Эпоха, в которую читатель начал текущий поиск. 0 - читатель не 
+     * находится внутри поиска
+     */
+    _Alignas(64) atomic_size_t    epoch;
+    atomic_bool                   in_use;
+    map_rcu_reader *              next;
+};
+
+/**
+ * Узел или буфер значения, исключённый из дерева, освобождение которого 
+ * отложено до тех пор, пока его не перестанут читать RCU-читатели
+ */
+struct _map_rcu_garbage
+{
+    map_rcu_garbage *    next;
+    /**
+     * Эпоха, в которую объект был исключён из дерева
+     */
+    size_t               epoch;
+    avl_node *           node;
+    void *               key;
+    void *               value;
+    bool                 use_deleters;
+};
+
+/**
+ * Состояние режима RCU (см. map_rcu_enable)
+ */
+struct _map_rcu
+{
+    /**
+     * Счётчик записей: нечётный, пока писатель изменяет дерево. Читатель 
+     * повторяет поиск, если счётчик изменился за время поиска
+     */
+    atomic_size_t                  seq;
+    /**
+     * Глобальная эпоха, увеличивается после каждого изменения дерева
+     */
+    atomic_size_t                  epoch;
+    _Atomic(map_rcu_reader *)      readers;
+    /**
+     * Очередь объектов, ожидающих освобождения, упорядоченная по эпохам
+     */
+    map_rcu_garbage *              garbage_head;
+    map_rcu_garbage *              garbage_tail;
+};
+
+/**
+ * Набор кэша поиска. Запись i пуста, если node[i] == NULL. Новая запись 
+ * помещается в начало набора, остальные сдвигаются, последняя вытесняется
+ */
+struct _map_find_cache_set
+{
+    _Alignas(64) uint64_t    hash[MAP_FIND_CACHE_WAYS];
+    avl_node *               node[MAP_FIND_CACHE_WAYS];
+};
+
+/**
+ * Кэш поиска (см. map_set_find_cache)
+ */
+struct _map_find_cache
+{
+    uint64_t                (*key_hash)    (const void *key);
+    /**
+     * Наборы кэша, их количество - степень двойки, набор ключа - 
+     * sets[hash & mask]
+     */
+    map_find_cache_set *    sets;
+    size_t                  mask;
+    size_t                  hits;
+    size_t                  misses;
+};
+
+/**
+ * Блочный фильтр Блума ключей контейнера (см. map_set_bloom_filter)
+ */
+struct _map_bloom
+{
+    uint64_t      (*key_hash)    (const void *key);
+    /**
+     * Блоки по MAP_BLOOM_BLOCK_WORDS слов, их количество - степень двойки,
+     * блок ключа - hash & mask
+     */
+    uint64_t *    blocks;
+    size_t        mask;
+    /**
+     * Количество ключей, на которое рассчитан фильтр. При превышении фильтр
+     * строится заново большего размера
+     */
+    size_t        capacity;
+    /**
+     * Количество удалений с последнего построения. Биты удалённых ключей 
+     * остаются в фильтре и увеличивают долю ложных срабатываний, поэтому 
+     * после capacity / 4 удалений фильтр строится заново
+     */
+    size_t        erased;
+};
+
+/**
+ * Слот хеш-индекса. Слот пуст, если node == NULL
+ */
+struct _map_hash_slot
+{
+    uint64_t      hash;
+    avl_node *    node;
+};
+
+/**
+ * Хеш-индекс узлов дерева с открытой адресацией и линейным пробированием
+ * (см. map_set_hash_index). При удалении следующие слоты цепочки сдвигаются
+ * назад, поэтому метки удалённых слотов не нужны
+ */
+struct _map_hash_index
+{
+    uint64_t           (*key_hash)    (const void *key);
+    /**
+     * Слоты, их количество - степень двойки, поиск ключа начинается 
+     * со слота hash & mask
+     */
+    map_hash_slot *    slots;
+    size_t             mask;
+    size_t             count;
 };
 
 struct _map
@@ -30,6 +290,75 @@ struct _map
     void        (*value_destroyer)    (void *value);
 
     size_t      size;
+    /**
+     * Счётчик структурных изменений дерева (вставка нового элемента, удаление,
+     * очистка). Нужен для проверки валидности токенов продолжения map_scan
+     */
+    size_t      version;
+
+    /**
+     * Функции копирования ключа и значения, которые используются при
+     * копировании узлов, разделяемых со снимками (NULL - побайтовое копирование)
+     */
+    void        (*key_copier)         (void *dst, const void *src);
+    void        (*value_copier)       (void *dst, const void *src);
+    /**
+     * Если не NULL, то узлы дерева разделяются со снимками
+     */
+    map_tree_ref *tree_ref;
+    /**
+     * true - часть узлов дерева разделяется с другими деревьями, и их поля
+     * parent могут указывать на узлы другого дерева. Пока флаг установлен,
+     * переход к соседнему узлу выполняется спуском от корня (см. map_next_node)
+     */
+    bool        stale_parents;
+    /**
+     * true - контейнер является снимком и не может быть изменён
+     */
+    bool        read_only;
+    /**
+     * Если не NULL, то контейнер находится в режиме RCU (см. map_rcu_enable)
+     */
+    map_rcu *   rcu;
+    /**
+     * Тип ключа для встроенного сравнения (см. map_compare_keys)
+     */
+    map_key_kind key_kind;
+    /**
+     * Функция получения префикса ключа (NULL - префиксы не используются)
+     */
+    uint64_t    (*key_prefix)         (const void *key);
+    /**
+     * Если не NULL, то элементы хранятся в B+-дереве, а не в AVL-дереве
+     * (см. MAP_BACKEND_BTREE). Итератор такого контейнера указывает на слот
+     * элемента в листе B+-дерева (см. map_btree.h)
+     */
+    map_btree * btree;
+    /**
+     * Если не NULL, то перед спуском по дереву map_find ищет узел в кэше
+     * (см. map_set_find_cache)
+     */
+    map_find_cache *find_cache;
+    /**
+     * Если не NULL, то map_find сначала проверяет ключ фильтром Блума
+     * (см. map_set_bloom_filter)
+     */
+    map_bloom * bloom;
+    /**
+     * Если не NULL, то map_find ищет узел в хеш-индексе вместо спуска по
+     * дереву (см. map_set_hash_index). Индекс содержит все узлы дерева
+     */
+    map_hash_index *hash_index;
+    /**
+     * Если не NULL, то контейнер создан с MAP_BACKEND_SMALL: массив из 
+     * MAP_SMALL_CAPACITY ключей, за которым следуют значения (см. 
+     * map_small_value), выделенный вместе со структурой контейнера. Пока
+     * small_active == true, элементы хранятся в массиве по возрастанию 
+     * ключей, а дерево пусто. Итератор в этом режиме указывает на ключ
+     * в массиве
+     */
+    uint8_t *   small_keys;
+    bool        small_active;
 };
 
 typedef struct _map_iterator_impl
@@ -42,178 +371,257 @@ typedef struct _map_iterator_impl
     void *    this_node;
 } map_iterator_impl;
 
+/**
+ * Аргументы потоков параллельной сортировки и построения дерева
+ * (см. map_build_parallel)
+ */
+typedef struct _map_build_args
+{
+    map *              mp;
+    const uint8_t *    keys;
+    const uint8_t *    values;
+    /**
+     * Индексы входных элементов в порядке сортировки и буфер для слияния
+     */
+    size_t *           order;
+    size_t *           tmp;
+    size_t             lo;
+    size_t             hi;
+    size_t             threads;
+    avl_node *         parent;
+    avl_node *         result;
+} map_build_args;
 
 /**
- * Прототипы вспомогательных функций (начало)
+ * Аргументы потока копирования поддерева (см. map_clone_parallel)
  */
+typedef struct _map_clone_args
+{
+    map *         mp;
+    avl_node *    node;
+    avl_node *    parent;
+    void          (*key_copier)      (void *dst, const void *src);
+    void          (*value_copier)    (void *dst, const void *src);
+    size_t        threads;
+    avl_node *    result;
+} map_clone_args;
 
+/**
+ * Часть дерева, которую обрабатывает один поток в map_parallel_for и 
+ * map_parallel_reduce: всё поддерево с корнем node или только сам узел node
+ */
+typedef struct _map_parallel_task
+{
+    avl_node *    node;
+    bool          single;
+} map_parallel_task;
 
 /**
- * Функция восстанавливает свойства дерева и при необходимости 
- * выполняет перебалансировку после вставки элемента
- * 
- * В качестве аргументов принимает указатель на map и только что вставленный узел
+ * Общее состояние потоков map_parallel_for и map_parallel_reduce
  */
-static void 
-map_restore_properties_after_insert
-(
-    map *         mp, 
-    avl_node *    node
-);
+typedef struct _map_parallel_args
+{
+    map *                  mp;
+    const void *           lo;
+    const void *           hi;
+    void                   (*fn)          (const void *key, void *value, void *ctx);
+    void                   (*map_fn)      (const void *key, const void *value, void *acc, void *ctx);
+    void *                 ctx;
+    /**
+     * Задачи в порядке возрастания ключей. Потоки разбирают их по одной, 
+     * увеличивая next, поэтому освободившийся поток сразу берёт следующую
+     */
+    map_parallel_task *    tasks;
+    size_t                 tasks_count;
+    atomic_size_t          next;
+    /**
+     * Аккумуляторы задач (только для map_parallel_reduce), по acc_size байт
+     */
+    uint8_t *              accs;
+    size_t                 acc_size;
+    const void *           identity;
+} map_parallel_args;
+
+typedef struct _map_resume_token_impl
+{
+    map *     this_map;
+    /**
+     * Узел, с которого начнётся следующая порция. NULL - обход окончен
+     */
+    void *    next_node;
+    size_t    version;
+} map_resume_token_impl;
+
+typedef struct _map_cursor_impl
+{
+    map *     this_map;
+    /**
+     * Узел, найденный предыдущим поиском. NULL - следующий поиск начнётся 
+     * от корня
+     */
+    void *    this_node;
+    /**
+     * Версия контейнера на момент предыдущего поиска. Если версия изменилась,
+     * узел мог быть удалён
+     */
+    size_t    version;
+} map_cursor_impl;
 
 /**
- * Функция восстанавливает свойства дерева и при необходимости
- * выполняет перебалансировку после удаления элемента
+ * Неизменяемая копия контейнера, оптимизированная для поиска (см. map_freeze)
  * 
- * В качестве аргументов принимает указатель на map и отца удаленного элемента
+ * По умолчанию элементы хранятся в порядке Эйтцингера: массив keys[1..size] - 
+ * неявное двоичное дерево поиска, записанное по уровням, дети позиции k 
+ * находятся на позициях 2k и 2k + 1. Верхние уровни дерева лежат в начале 
+ * массива и остаются в кэше, а потомки позиции на несколько уровней вниз 
+ * лежат подряд, поэтому их можно загрузить заранее одной предвыборкой
+ * 
+ * Для ключей MAP_KEY_I32 и MAP_KEY_U64 используется блочное расположение:
+ * keys - ключи по возрастанию, разбитые на блоки по FROZEN_MAP_BLOCK, а над
+ * ними строится неявное (FROZEN_MAP_BLOCK + 1)-арное дерево поиска из таких
+ * же блоков. Ключ i узла j - минимальный ключ поддерева его ребёнка i + 1,
+ * дети узла j - узлы j * (FROZEN_MAP_BLOCK + 1) + i следующего уровня. На 
+ * каждом уровне ключ сравнивается со всем блоком сразу (см. frozen_map_rank),
+ * поэтому поиск делает log17(n) шагов вместо log2(n). Позиция элемента
+ * в этом случае - его номер по возрастанию, увеличенный на 1
  */
-static void 
-map_restore_properties_after_erase
-(
-    map *         mp, 
-    avl_node *    node
-);
+struct _frozen_map
+{
+    size_t          size;
+    uint16_t        key_size;
+    uint16_t        value_size;
+    int             (*compare_func)    (const void *f, const void *s);
+    map_key_kind    key_kind;
+    /**
+     * Ключи и значения в порядке Эйтцингера (позиция 0 не используется) или,
+     * при блочном расположении, в порядке возрастания ключей. В последнем
+     * случае массив ключей дополнен до целого числа блоков максимальным ключом
+     */
+    uint8_t *       keys;
+    uint8_t *       values;
+
+    /**
+     * true - блочное расположение
+     */
+    bool            blocked;
+    /**
+     * Уровни индекса над блоками ключей: уровень h (1 <= h <= height) 
+     * начинается с ключа layer_offset[h] массива index, уровень height - 
+     * корень. При height == 0 все ключи помещаются в один блок
+     */
+    uint8_t *       index;
+    size_t          height;
+    size_t          layer_offset[FROZEN_MAP_MAX_LAYERS + 1];
+    /**
+     * Возвращает количество ключей блока, меньших key. Выбирается при 
+     * создании по возможностям процессора (AVX2, SSE4.2 или скалярный код)
+     */
+    size_t          (*block_rank)    (const void *block, const void *key);
+};
 
 /**
- * Создаёт новый узел и возвращает на него указатель
- * 
- * В качестве аргументов принимает указатели на ключ и значение, а так же их размеры 
- * Возвращает указатель на созданный узел
+ * Значение всех элементов множества (контейнера с value_size == 0, см. 
+ * map_create_set). Память под значения узлов множества не выделяется, 
+ * вместо неё используется этот буфер, поэтому указатель на значение 
+ * никогда не равен NULL и копирование нуля байт значения корректно
  */
-static avl_node *
-map_create_new_node
-(
-    void *      key, 
-    void *      value, 
-    uint16_t    key_size, 
-    uint16_t    value_size
-);
+static uint8_t map_empty_value[1];
+
 
 /**
- * Малый правый поворот + смена балансов
- * 
- *                  X                  Y
- *                /   \              /   \ 
- *              Y       R   ===>   L       X
- *            /   \                      /   \ 
- *          L       W                  W       R
- * 
- * Принимает в качестве аргументов указатель на map и узел X
- * Возвращает узел Y
+ * Прототипы вспомогательных функций (начало)
  */
-static avl_node *
-map_right_small_rotate
-(
-    map *mp, avl_node *node
-);
+
 
 /**
- * Малый левый поворот + смена балансов
- * 
- *              X                          Y
- *            /   \                      /   \ 
- *          L       Y       ===>       X       R
- *                /   \              /   \ 
- *              W       R          L       W
- * 
- * Принимает в качестве аргументов указатель на map и узел X
- * Возвращает узел Y
+ * Преобразуют внутреннее представление итератора, токена продолжения и 
+ * курсора в открытый тип (map_*_wrap) и обратно (map_*_unwrap). Открытые
+ * типы - непрозрачные буферы другого типа, поэтому байты копируются memcpy,
+ * а не через приведение указателей (оно нарушало бы strict aliasing)
  */
-static avl_node *
-map_left_small_rotate
+static inline map_iterator
+map_iterator_wrap
 (
-    map *         mp, 
-    avl_node *    node
+    map_iterator_impl iter_impl
 );
 
-/**
- * Большой правый поворот + смена балансов
- * 
- *                     X                            Z   
- *                 /       \                    /       \
- *               Y           c1   ===>        Y           X
- *             /   \                        /   \       /   \
- *          c2       Z                   c2       c3 c4       c1
- *                 /   \
- *              c3       c4
- *
- * Принимает в качестве аргументов указатель на map и узел X
- * Возвращает узел Z
- */
-static avl_node *
-map_right_big_rotate
+static inline map_iterator_impl
+map_iterator_unwrap
 (
-    map *         mp, 
-    avl_node *    node
+    map_iterator iter
+);
+
+static inline map_resume_token
+map_resume_token_wrap
+(
+    map_resume_token_impl token_impl
+);
+
+static inline map_resume_token_impl
+map_resume_token_unwrap
+(
+    map_resume_token token
+);
+
+static inline map_cursor
+map_cursor_wrap
+(
+    map_cursor_impl cursor_impl
+);
+
+static inline map_cursor_impl
+map_cursor_unwrap
+(
+    map_cursor cursor
 );
 
 /**
- * Большой левый поворот + смена балансов
- * 
- *                 X                                Z
- *             /       \                        /       \
- *          c1           Y        ===>        X           Y
- *                     /   \                /   \       /   \
- *                   Z       c2          c1       c3 c4       c2
- *                 /   \
- *              c3       c4
- *
- * Принимает в качестве аргументов указатель на map и узел X 
- * Возвращает узел Z
+ * Возвращает узел, связями которого является link, или NULL, если link == NULL
  */
-static avl_node *
-map_left_big_rotate
+static inline avl_node *
+map_node_of
 (
-    map *         mp, 
-    avl_node *    node
+    avl_link *link
 );
 
 /**
- * Удаление из дерева узла, у которого нет детей
- * 
- * Принимает в качестве аргументов указатель на дерево и на удаляемый узел
- * Возвращает предка удаляемого узла
+ * Возвращает связи узла node или NULL, если node == NULL
  */
-static avl_node *
-map_erase_case_no_children
+static inline avl_link *
+map_node_link
 (
-    map *         mp, 
-    avl_node *    node,
-    bool          use_deleters
+    avl_node *node
 );
 
 /**
- * Удаление из дерева узла, у которого один ребёнок
- * 
- * Принимает в качестве аргументов указатель на дерево и на удаляемый узел
- * Возвращает предка удаляемого узла
+ * Возвращают ребёнка node с номером dir (0 - левый, 1 - правый) и родителя node
  */
-static avl_node *
-map_erase_case_one_children
+static inline avl_node *
+map_node_child
 (
-    map *         mp, 
     avl_node *    node,
-    bool          use_deleters
+    int           dir
+);
+
+static inline avl_node *
+map_node_parent
+(
+    avl_node *node
 );
 
 /**
- * Удаление из дерева узла, у которого два ребенка
- * 
- * Принимает в качестве аргументов указатель на дерево и на удаляемый узел
- * Возвращает предка удаляемого узла
+ * Создаёт новый узел и возвращает на него указатель
  * 
- * Стоит отметить, что фактически мы не удаляем узел с двумя потомками, а
- * находим узел с минимальным ключом из правого поддерева, свапаем ключ и значение
- * с ключом и значением узла, который мы хотели удалить, и удаляем уже тот самый
- * узел с мин. ключом из правого поддерева, у которого, в свою очередь, либо один,
- * либо вообще нет потомков. Соответственно, функция возвращает предка этого самого узла
+ * В качестве аргументов принимает указатели на ключ и значение, а так же их размеры 
+ * Возвращает указатель на созданный узел
  */
 static avl_node *
-map_erase_case_two_children
+map_create_new_node
 (
-    map *         mp, 
-    avl_node *    node,
-    bool          use_deleters
+    void *      key, 
+    void *      value, 
+    uint16_t    key_size, 
+    uint16_t    value_size
 );
 
 /**
@@ -257,969 +665,5676 @@ map_free_helper
     avl_node *    node
 );
 
-
+/**
+ * Вспомогательная функция для рекурсивного копирования поддерева с корнем node
+ * 
+ * Принимает в качестве аргументов указатель на исходный map, корень копируемого
+ * поддерева, будущего родителя копии, функции копирования ключа и значения
+ * (могут быть NULL - тогда ключ и значение копируются побайтово) и количество
+ * потоков: при threads > 1 левое поддерево копирует новый поток
+ * Возвращает корень копии поддерева
+ */
+static avl_node *
+map_clone_helper
+(
+    map *         mp,
+    avl_node *    node,
+    avl_node *    parent,
+    void          (*key_copier)      (void *dst, const void *src),
+    void          (*value_copier)    (void *dst, const void *src),
+    size_t        threads
+);
+
+/**
+ * Точка входа потока копирования поддерева. Принимает указатель на map_clone_args
+ */
+static void *
+map_clone_thread
+(
+    void *arg
+);
+
+/**
+ * Если дерево контейнера разделяется со снимками, делает для контейнера
+ * собственную копию всего дерева. Нужна изменениям, которые затрагивают 
+ * каждый узел (см. map_set_key_prefix)
+ * 
+ * Принимает в качестве аргумента указатель на map
+ * Возвращает true, если узлы дерева были заменены копиями
+ */
+static bool
+map_unshare_tree
+(
+    map *mp
+);
+
+/**
+ * Проверяет, разделяет ли контейнер узлы дерева со снимками. Если снимков 
+ * не осталось, дерево снова принадлежит только контейнеру: указатели parent
+ * восстанавливаются, счётчик tree_ref освобождается
+ * 
+ * Принимает в качестве аргумента указатель на map
+ * Возвращает true, если перед изменением дерева узлы нужно копировать
+ * (см. map_own_path)
+ */
+static bool
+map_tree_shared
+(
+    map *mp
+);
+
+/**
+ * Спускается от корня к узлу с ключом key, заменяя разделяемые узлы пути 
+ * копиями (copy-on-write), так что весь путь принадлежит только контейнеру.
+ * Остальные узлы дерева по-прежнему разделяются со снимками
+ * 
+ * Возвращает узел с ключом key или NULL, если его нет. В parent записывается
+ * последний пройденный узел, в cmp - результат сравнения его ключа с key
+ */
+static avl_node *
+map_own_path
+(
+    map *           mp,
+    const void *    key,
+    avl_node **     parent,
+    int *           cmp
+);
+
+/**
+ * Делает ребёнка parent с номером dir (корень дерева, если parent == NULL)
+ * собственным узлом контейнера: разделяемый узел заменяется у родителя 
+ * копией. Записывает в поле parent узла значение parent
+ * 
+ * Принимает в качестве аргументов указатель на map, родителя и номер ребёнка
+ * Возвращает собственный узел или NULL, если ребёнка нет
+ */
+static avl_node *
+map_own_node
+(
+    map *         mp,
+    avl_node *    parent,
+    int           dir
+);
+
+/**
+ * Делает ребёнка map_node_child(parent, dir) собственным узлом контейнера ctx (см.
+ * avl_link_owner). Вызывается перебалансировкой перед изменением ребёнка,
+ * parent к этому моменту уже принадлежит контейнеру
+ */
+static void
+map_own_child
+(
+    avl_link *    parent,
+    int           dir,
+    void *        ctx
+);
+
+/**
+ * Создаёт копию разделяемого узла node с копиями ключа и значения (см. 
+ * map_set_copiers). Копия ссылается на тех же детей, ссылка на node 
+ * освобождается
+ * 
+ * Принимает в качестве аргументов указатель на map и узел
+ * Возвращает копию узла
+ */
+static avl_node *
+map_copy_node
+(
+    map *         mp,
+    avl_node *    node
+);
+
+/**
+ * Освобождает ссылку на узел node. Узел, на который не осталось ссылок,
+ * освобождается вместе с ключом и значением, а ссылки на его детей 
+ * освобождаются рекурсивно
+ * 
+ * Принимает в качестве аргументов указатель на map и узел
+ */
+static void
+map_release_node
+(
+    map *         mp,
+    avl_node *    node
+);
+
+/**
+ * Записывает в поля parent узлов поддерева с корнем node верные значения
+ * 
+ * Принимает в качестве аргументов корень поддерева и его родителя
+ */
+static void
+map_repair_parents
+(
+    avl_node *    node,
+    avl_node *    parent
+);
+
+/**
+ * Находит самый левый и самый правый узлы дерева спуском от корня и 
+ * записывает их в header
+ * 
+ * Принимает в качестве аргумента указатель на map
+ */
+static void
+map_restore_header_bounds
+(
+    map *mp
+);
+
+/**
+ * Вставка в дерево, которое разделяется со снимками (см. _map_insert):
+ * копируются только узлы пути от корня и узлы, затронутые поворотами
+ */
+static void
+map_insert_shared
+(
+    map *     mp, 
+    void *    key, 
+    void *    value
+);
+
+/**
+ * Удаление узла с ключом key из дерева, которое разделяется со снимками
+ * (см. _map_erase и map_insert_shared)
+ */
+static void
+map_erase_shared
+(
+    map *           mp,
+    const void *    key,
+    bool            use_deleters
+);
+
+/**
+ * Освобождает ссылку контейнера на дерево. Узлы освобождаются только в том
+ * случае, если на них не ссылаются другие контейнеры
+ * 
+ * Принимает в качестве аргумента указатель на map
+ */
+static void
+map_release_tree
+(
+    map *mp
+);
+
+/**
+ * Завершает программу с сообщением об ошибке, если контейнер является снимком
+ * 
+ * Принимает в качестве аргументов указатель на map и имя вызывающей функции
+ */
+static void
+map_check_writable
+(
+    map *           mp,
+    const char *    func_name
+);
+
+/**
+ * Завершает программу с сообщением об ошибке, если элементы контейнера
+ * хранятся в B+-дереве (функция поддерживается только для AVL-дерева и
+ * массива MAP_BACKEND_SMALL)
+ * 
+ * Принимает в качестве аргументов указатель на map и имя вызывающей функции
+ */
+static void
+map_check_not_btree
+(
+    map *           mp,
+    const char *    func_name
+);
+
+/**
+ * То же, что map_check_not_btree, но контейнер MAP_BACKEND_SMALL 
+ * окончательно переводит на AVL-дерево (для функций, подключающих к дереву
+ * своё состояние)
+ */
+static void
+map_check_avl
+(
+    map *           mp,
+    const char *    func_name
+);
+
+/**
+ * Возвращает узел, следующий за node в порядке возрастания ключей,
+ * или NULL, если node - последний узел дерева
+ * 
+ * Если указатели parent могут быть неверны (см. map.stale_parents), 
+ * следующий узел ищется спуском от корня за O(log n)
+ */
+static avl_node *
+map_next_node
+(
+    map *         mp,
+    avl_node *    node
+);
+
+/**
+ * Возвращает узел, предшествующий node в порядке возрастания ключей,
+ * или NULL, если node - первый узел дерева (см. map_next_node)
+ */
+static avl_node *
+map_prev_node
+(
+    map *         mp,
+    avl_node *    node
+);
+
+/**
+ * Возвращает итератор на первый элемент, ключ которого больше пробы (upper == true)
+ * или не меньше неё (upper == false), либо map_iterator_end(mp)
+ * (см. map_lower_bound_with)
+ */
+static map_iterator
+map_bound_with
+(
+    map *           mp,
+    const void *    probe,
+    int             (*probe_cmp)    (const void *node_key, const void *probe),
+    bool            upper
+);
+
+/**
+ * Определяет тип ключа по функции сравнения, переданной в map_create
+ */
+static map_key_kind
+map_detect_key_kind
+(
+    int    (*compare_func)    (const void *f, const void *s)
+);
+
+/**
+ * Сравнивает ключи f и s контейнера mp: встроенным кодом, если тип ключа
+ * распознан, иначе пользовательской функцией сравнения
+ */
+static inline int
+map_compare_keys
+(
+    map *           mp,
+    const void *    f,
+    const void *    s
+);
+
+/**
+ * Побайтово сравнивает ключи f и s размера size как memcmp. Ключи длиной 
+ * 8 и 16 байт сравниваются как 64-битные слова в порядке big-endian
+ */
+static inline int
+map_compare_bytes
+(
+    const void *    f,
+    const void *    s,
+    size_t          size
+);
+
+/**
+ * Читает 64-битное слово, записанное старшим байтом вперёд
+ */
+static inline uint64_t
+map_load_be64
+(
+    const void *p
+);
+
+/**
+ * Записывает в ключ size байт из bytes (см. map_key_encoder)
+ */
+static void
+map_key_encode_bytes
+(
+    map_key_encoder *    enc,
+    const uint8_t *      bytes,
+    size_t               size
+);
+
+/**
+ * Спускается от корня к узлу с ключом key и возвращает его или NULL, если
+ * такого узла нет. В parent записывается последний пройденный узел, в cmp - 
+ * результат сравнения его ключа с key (нужны для вставки)
+ * 
+ * Тип ключа проверяется один раз до начала спуска
+ */
+static avl_node *
+map_descend
+(
+    map *           mp,
+    const void *    key,
+    avl_node **     parent,
+    int *           cmp
+);
+
+/**
+ * Возвращает узел с минимальным ключом, не меньшим key, или NULL, если
+ * такого узла нет
+ * 
+ * Принимает в качестве аргументов указатель на map и ключ key
+ */
+static avl_node *
+map_lower_bound_node
+(
+    map *           mp,
+    const void *    key
+);
+
+/**
+ * То же, что map_lower_bound_node, но поиск начинается от узла finger: 
+ * подъём до поддерева, в диапазон ключей которого попадает key, затем 
+ * спуск в нём
+ */
+static avl_node *
+map_finger_lower_bound
+(
+    map *           mp,
+    avl_node *      finger,
+    const void *    key
+);
+
+
+/**
+ * Освобождает узел, исключённый из дерева, вместе с ключом и значением.
+ * В режиме RCU освобождение откладывается (см. map_rcu_retire)
+ * 
+ * Принимает в качестве аргументов указатель на map, узел и флаг, указывающий,
+ * нужно ли вызывать удалители для ключа и значения
+ */
+static void
+map_free_node
+(
+    map *         mp,
+    avl_node *    node,
+    bool          use_deleters
+);
+
+/**
+ * Ищет узел с ключом key сначала в кэше поиска, затем спуском по дереву.
+ * Найденный спуском узел записывается в кэш. Возвращает NULL, если узла нет
+ */
+static avl_node *
+map_find_cached
+(
+    map *           mp,
+    const void *    key
+);
+
+/**
+ * Убирает узел из кэша поиска перед его удалением из дерева или заменой
+ * копией
+ */
+static void
+map_find_cache_forget
+(
+    map *         mp,
+    avl_node *    node
+);
+
+/**
+ * Очищает кэш поиска (если он включён). Вызывается, когда узлы дерева
+ * освобождаются или заменяются копиями
+ */
+static void
+map_find_cache_flush
+(
+    map *mp
+);
+
+/**
+ * Строит фильтр Блума заново по текущим ключам контейнера, выбирая размер
+ * по количеству элементов
+ */
+static void
+map_bloom_rebuild
+(
+    map *mp
+);
+
+/**
+ * Добавляет ключ в фильтр Блума (если он включён), вызывается после 
+ * вставки нового элемента
+ */
+static void
+map_bloom_add
+(
+    map *           mp,
+    const void *    key
+);
+
+/**
+ * Учитывает удаление элемента: после достаточного числа удалений фильтр 
+ * строится заново
+ */
+static void
+map_bloom_erased
+(
+    map *mp
+);
+
+/**
+ * Возвращает false, если ключа key точно нет в контейнере
+ */
+static inline bool
+map_bloom_may_contain
+(
+    map_bloom *     bloom,
+    const void *    key
+);
+
+/**
+ * Строит хеш-индекс заново по текущим узлам дерева (если индекс включён),
+ * выбирая размер по количеству элементов
+ */
+static void
+map_hash_index_rebuild
+(
+    map *mp
+);
+
+/**
+ * Возвращает узел с ключом key из хеш-индекса или NULL, если узла нет
+ */
+static avl_node *
+map_hash_index_find
+(
+    map_hash_index *    index,
+    map *               mp,
+    const void *        key
+);
+
+/**
+ * Добавляет в хеш-индекс (если он включён) только что вставленный узел,
+ * при необходимости увеличивая индекс
+ */
+static void
+map_hash_index_add
+(
+    map *         mp,
+    avl_node *    node
+);
+
+/**
+ * Убирает узел из хеш-индекса (если он включён) перед удалением из дерева
+ */
+static void
+map_hash_index_remove
+(
+    map *         mp,
+    avl_node *    node
+);
+
+/**
+ * Заменяет в хеш-индексе (если он включён) узел node его копией copy
+ */
+static void
+map_hash_index_replace
+(
+    map *         mp,
+    avl_node *    node,
+    avl_node *    copy
+);
+
+/**
+ * Смещение значений от начала массива MAP_BACKEND_SMALL: ключи занимают
+ * MAP_SMALL_CAPACITY * key_size байт, округлённых до 16
+ */
+static inline size_t
+map_small_values_offset
+(
+    size_t key_size
+);
+
+/**
+ * Возвращают указатель на ключ (map_small_key) или значение (map_small_value)
+ * элемента с номером i массива MAP_BACKEND_SMALL
+ */
+static inline uint8_t *
+map_small_key
+(
+    map *     mp,
+    size_t    i
+);
+
+static inline uint8_t *
+map_small_value
+(
+    map *     mp,
+    size_t    i
+);
+
+/**
+ * Возвращает номер первого элемента массива, ключ которого не меньше key
+ * (upper == false) или больше key (upper == true). probe_cmp(node_key, probe)
+ * сравнивает ключ с пробой, NULL - сравнение ключей контейнера
+ */
+static size_t
+map_small_bound
+(
+    map *           mp,
+    const void *    probe,
+    int             (*probe_cmp)    (const void *node_key, const void *probe),
+    bool            upper
+);
+
+/**
+ * Возвращает номер первого элемента массива, ключ которого не меньше hi 
+ * (NULL - размер массива), и записывает в *begin номер первого элемента, 
+ * ключ которого не меньше lo (NULL - 0): элементы [*begin, end) образуют 
+ * диапазон [lo, hi)
+ */
+static size_t
+map_small_range
+(
+    map *           mp,
+    const void *    lo,
+    const void *    hi,
+    size_t *        begin
+);
+
+/**
+ * Копирует элементы массива контейнера mp в пустой массив контейнера copy 
+ * (см. map_clone)
+ */
+static void
+map_small_copy
+(
+    map *    mp,
+    map *    copy,
+    void     (*key_copier)      (void *dst, const void *src),
+    void     (*value_copier)    (void *dst, const void *src)
+);
+
+/**
+ * Вставляет элемент в массив. Возвращает false, если массив заполнен и 
+ * ключа key в нём нет - тогда элементы уже перенесены в дерево и вставку 
+ * нужно выполнить в дерево
+ */
+static bool
+map_small_insert
+(
+    map *           mp,
+    const void *    key,
+    const void *    value
+);
+
+/**
+ * Переносит элементы из массива в дерево: строит идеально сбалансированное 
+ * дерево сразу из отсортированного массива (ключи и значения переносятся 
+ * побайтово, как и в map_small_demote)
+ */
+static void
+map_small_promote
+(
+    map *mp
+);
+
+/**
+ * Переносит элементы из дерева в массив, освобождая узлы (удалители не 
+ * вызываются: ключи и значения переносятся побайтово)
+ */
+static void
+map_small_demote
+(
+    map *mp
+);
+
+/**
+ * Копирует элементы поддерева node в массив, начиная с номера *pos, и 
+ * освобождает узлы поддерева
+ */
+static void
+map_small_demote_helper
+(
+    map *         mp,
+    avl_node *    node,
+    size_t *      pos
+);
+
+/**
+ * Перемешивает биты 64-битного числа (финализатор MurmurHash3)
+ */
+static inline uint64_t
+map_hash_mix
+(
+    uint64_t x
+);
+
+/**
+ * Ставит узел и/или буфер значения в очередь на освобождение. Объекты 
+ * освобождаются, когда все читатели, которые могли их видеть, завершат поиск
+ * 
+ * Принимает в качестве аргументов указатель на map, узел (может быть NULL),
+ * ключ и значение (могут быть NULL) и флаг вызова удалителей
+ */
+static void
+map_rcu_retire
+(
+    map *         mp,
+    avl_node *    node,
+    void *        key,
+    void *        value,
+    bool          use_deleters
+);
+
+/**
+ * Отмечает начало изменения дерева для RCU-читателей. Вне режима RCU 
+ * ничего не делает
+ */
+static void
+map_rcu_write_begin
+(
+    map *mp
+);
+
+/**
+ * Отмечает окончание изменения дерева для RCU-читателей, начинает новую эпоху
+ * и освобождает объекты, которые больше не может видеть ни один читатель.
+ * Вне режима RCU ничего не делает
+ */
+static void
+map_rcu_write_end
+(
+    map *mp
+);
+
+/**
+ * Начинает новую эпоху и возвращает её номер
+ */
+static size_t
+map_rcu_advance_epoch
+(
+    map_rcu *rcu
+);
+
+/**
+ * Освобождает объекты из очереди, исключённые из дерева в эпоху, меньшую epoch
+ */
+static void
+map_rcu_free_garbage
+(
+    map *     mp,
+    size_t    epoch
+);
+
+/**
+ * Устойчиво сортирует индексы order[lo..hi) по ключам keys, используя до 
+ * threads потоков (см. map_build_parallel). tmp - буфер того же размера, что order
+ */
+static void
+map_build_sort
+(
+    map *              mp,
+    const uint8_t *    keys,
+    size_t *           order,
+    size_t *           tmp,
+    size_t             lo,
+    size_t             hi,
+    size_t             threads
+);
+
+/**
+ * Точка входа потока сортировки. Принимает указатель на map_build_args
+ */
+static void *
+map_build_sort_thread
+(
+    void *arg
+);
+
+/**
+ * Строит идеально сбалансированное поддерево из элементов order[lo..hi), 
+ * используя до threads потоков, и возвращает его корень
+ * 
+ * Принимает в качестве аргументов указатель на map, массивы ключей и значений, 
+ * отсортированные индексы без повторов, границы диапазона, будущего родителя 
+ * корня поддерева и количество потоков
+ */
+static avl_node *
+map_build_subtree
+(
+    map *              mp,
+    const uint8_t *    keys,
+    const uint8_t *    values,
+    const size_t *     order,
+    size_t             lo,
+    size_t             hi,
+    avl_node *         parent,
+    size_t             threads
+);
+
+/**
+ * Точка входа потока построения поддерева. Принимает указатель на map_build_args
+ */
+static void *
+map_build_subtree_thread
+(
+    void *arg
+);
+
+/**
+ * Возвращает высоту идеально сбалансированного дерева из size элементов
+ */
+static int
+map_build_height
+(
+    size_t size
+);
+
+/**
+ * Разбивает дерево на задачи и обрабатывает их в threads потоках
+ * (см. map_parallel_for и map_parallel_reduce)
+ */
+static void
+map_parallel_run
+(
+    map_parallel_args *    args,
+    size_t                 threads
+);
+
+/**
+ * Добавляет в args->tasks задачи для поддерева с корнем node: поддеревья 
+ * на глубине depth целиком и узлы выше них по одному. Поддеревья вне 
+ * диапазона [args->lo, args->hi) пропускаются
+ */
+static void
+map_parallel_gather
+(
+    map_parallel_args *    args,
+    avl_node *             node,
+    size_t                 depth
+);
+
+/**
+ * Точка входа потока: разбирает задачи, пока они не кончатся. 
+ * Принимает указатель на map_parallel_args
+ */
+static void *
+map_parallel_worker
+(
+    void *arg
+);
+
+/**
+ * Обходит поддерево с корнем node в порядке возрастания ключей, обрабатывая
+ * элементы из диапазона [args->lo, args->hi). acc - аккумулятор задачи
+ */
+static void
+map_parallel_walk
+(
+    map_parallel_args *    args,
+    avl_node *             node,
+    void *                 acc
+);
+
+/**
+ * Передаёт элемент node функции args->fn или args->map_fn. Принадлежность
+ * элемента диапазону проверяет вызывающая функция
+ */
+static void
+map_parallel_visit
+(
+    map_parallel_args *    args,
+    avl_node *             node,
+    void *                 acc
+);
+
+/**
+ * Возвращает позицию первого элемента, ключ которого больше key (upper == true)
+ * или не меньше key (upper == false), либо FROZEN_MAP_END
+ */
+static size_t
+frozen_map_search
+(
+    frozen_map *    fm,
+    const void *    key,
+    bool            upper
+);
+
+/**
+ * То же, что frozen_map_search, для блочного расположения
+ */
+static size_t
+frozen_map_search_blocks
+(
+    frozen_map *    fm,
+    const void *    key,
+    bool            upper
+);
+
+/**
+ * Раскладывает элементы контейнера mp в массивы frozen_map в порядке
+ * Эйтцингера
+ */
+static void
+frozen_map_build_eytzinger
+(
+    frozen_map *    fm,
+    map *           mp
+);
+
+/**
+ * Раскладывает элементы контейнера mp в массивы frozen_map по возрастанию
+ * ключей и строит блочный индекс
+ */
+static void
+frozen_map_build_blocks
+(
+    frozen_map *    fm,
+    map *           mp
+);
+
+/**
+ * Возвращает индекс элемента в массивах keys и values по его позиции
+ */
+static inline size_t
+frozen_map_slot
+(
+    frozen_map *    fm,
+    size_t          pos
+);
+
+/**
+ * Функции подсчёта ключей блока, меньших key (см. frozen_map::block_rank)
+ */
+static size_t
+frozen_map_rank_i32
+(
+    const void *    block,
+    const void *    key
+);
+
+static size_t
+frozen_map_rank_u64
+(
+    const void *    block,
+    const void *    key
+);
+
+#ifdef FROZEN_MAP_X86
+static size_t
+frozen_map_rank_i32_sse42
+(
+    const void *    block,
+    const void *    key
+);
+
+static size_t
+frozen_map_rank_u64_sse42
+(
+    const void *    block,
+    const void *    key
+);
+
+static size_t
+frozen_map_rank_i32_avx2
+(
+    const void *    block,
+    const void *    key
+);
+
+static size_t
+frozen_map_rank_u64_avx2
+(
+    const void *    block,
+    const void *    key
+);
+#endif
+
+/**
+ * Завершает программу с сообщением об ошибке, если pos не является позицией
+ * элемента frozen_map
+ * 
+ * Принимает в качестве аргументов указатель на frozen_map, позицию и имя 
+ * вызывающей функции
+ */
+static void
+frozen_map_check_pos
+(
+    frozen_map *    fm,
+    size_t          pos,
+    const char *    func_name
+);
+
+
 /**
  * Прототипы вспомогательных функций (конец)
  */
 
-/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/**
+ * Определения основных функций (API) (начало)
+ */
+
+
+map *
+map_create
+(
+    uint16_t    key_size, 
+    uint16_t    value_size, 
+    int         (*compare_func)       (const void *f, const void *s),
+    void        (*key_destroyer)      (void *key),
+    void        (*value_destroyer)    (void *value)
+)
+{
+    return map_create_backend(key_size, value_size, compare_func, key_destroyer, value_destroyer, 
+        MAP_BACKEND_AVL);
+}
+
+map *
+map_create_backend
+(
+    uint16_t       key_size, 
+    uint16_t       value_size, 
+    int            (*compare_func)       (const void *f, const void *s),
+    void           (*key_destroyer)      (void *key),
+    void           (*value_destroyer)    (void *value),
+    map_backend    backend
+)
+{
+    if (compare_func == NULL)
+    {
+        fprintf(stderr, "map_create: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (backend != MAP_BACKEND_AVL && backend != MAP_BACKEND_BTREE && backend != MAP_BACKEND_SMALL)
+    {
+        fprintf(stderr, "map_create: неизвестный тип хранилища\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (value_size == 0 && value_destroyer != NULL)
+    {
+        fprintf(stderr, "map_create: у множества (value_size == 0) не может быть удалителя значения\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_key_kind key_kind = map_detect_key_kind(compare_func);
+    if ((key_kind == MAP_KEY_KIND_I32 && key_size != sizeof(int32_t))
+        || (key_kind == MAP_KEY_KIND_U64 && key_size != sizeof(uint64_t))
+        || (key_kind == MAP_KEY_KIND_CSTR && key_size != sizeof(char *)))
+    {
+        fprintf(stderr, "map_create: размер ключа не соответствует встроенной функции сравнения\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Массив MAP_BACKEND_SMALL располагается сразу за структурой контейнера */
+    size_t small_bytes = (backend == MAP_BACKEND_SMALL) 
+        ? map_small_values_offset(key_size) + MAP_SMALL_CAPACITY * value_size : 0;
+    map *mp = (map *)malloc(sizeof(map) + small_bytes);
+    if (mp == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    *mp = (map) 
+    {
+        .header.root = NULL,
+        .header.most_left = NULL,
+        .header.most_right = NULL,
+        .key_size = key_size,
+        .value_size = value_size,
+        .compare_func = compare_func,
+        .key_destroyer = key_destroyer,
+        .value_destroyer = value_destroyer,
+        .size = 0,
+        .version = 0,
+        .key_copier = NULL,
+        .value_copier = NULL,
+        .tree_ref = NULL,
+        .stale_parents = false,
+        .read_only = false,
+        .rcu = NULL,
+        .key_kind = key_kind,
+        .key_prefix = NULL,
+        .btree = NULL,
+        .find_cache = NULL,
+        .bloom = NULL,
+        .hash_index = NULL,
+        .small_keys = NULL,
+        .small_active = false
+    };
+
+    if (backend == MAP_BACKEND_BTREE) {
+        mp->btree = map_btree_create(key_size, value_size, compare_func);
+    }
+    else if (backend == MAP_BACKEND_SMALL)
+    {
+        mp->small_keys = (uint8_t *)(mp + 1);
+        mp->small_active = true;
+    }
+
+    return mp;
+}
+
+map *
+map_create_set
+(
+    uint16_t    key_size, 
+    int         (*compare_func)     (const void *f, const void *s),
+    void        (*key_destroyer)    (void *key)
+)
+{
+    return map_create_backend(key_size, 0, compare_func, key_destroyer, NULL, MAP_BACKEND_AVL);
+}
+
+void
+map_free
+(
+    map *mp
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_free: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_release_tree(mp);
+
+    if (mp->btree != NULL) {
+        map_btree_free(mp->btree, NULL, NULL);
+    }
+
+    if (mp->find_cache != NULL)
+    {
+        free(mp->find_cache->sets);
+        free(mp->find_cache);
+    }
+
+    if (mp->bloom != NULL)
+    {
+        free(mp->bloom->blocks);
+        free(mp->bloom);
+    }
+
+    if (mp->hash_index != NULL)
+    {
+        free(mp->hash_index->slots);
+        free(mp->hash_index);
+    }
+
+    if (mp->rcu != NULL)
+    {
+        map_rcu_free_garbage(mp, SIZE_MAX);
+
+        map_rcu_reader *reader = atomic_load(&(mp->rcu->readers));
+        while (reader != NULL)
+        {
+            map_rcu_reader *next = reader->next;
+            free(reader);
+            reader = next;
+        }
+
+        free(mp->rcu);
+    }
+
+    free(mp);
+}
+
+size_t 
+map_size
+(
+    map *mp
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_size: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return mp->size;
+}
+
+bool
+map_empty
+(
+    map *mp
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_empty: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return (mp->size == 0 ? true : false);
+}
+
+void 
+_map_insert
+(
+    map *     mp, 
+    void *    key, 
+    void *    value
+)
+{
+    if (mp == NULL || key == NULL || (value == NULL && mp->value_size != 0))
+    {
+        fprintf(stderr, "map_insert: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Множество (map_insert_key): значение пустое */
+    if (value == NULL) {
+        value = map_empty_value;
+    }
+
+    map_check_writable(mp, "map_insert");
+
+    if (mp->small_active && map_small_insert(mp, key, value)) {
+        return;
+    }
+
+    if (mp->btree != NULL)
+    {
+        if (map_btree_insert(mp->btree, key, value))
+        {
+            (mp->size)++;
+            (mp->version)++;
+            map_bloom_add(mp, key);
+        }
+        return;
+    }
+
+    if (map_tree_shared(mp))
+    {
+        map_insert_shared(mp, key, value);
+        return;
+    }
+
+    map_rcu_write_begin(mp);
+
+    /**
+     * Результат сравнения ключа узла parent со вставляемым ключом
+     */
+    int cmp = 0;
+    avl_node *parent = NULL;
+    avl_node *current = map_descend(mp, key, &parent, &cmp);
+    /**
+     * Если true - вставляем элемент, в противном случае элемент с ключом key
+     * в дереве уже есть и мы просто заменяем старое значение (value) на новое
+     */
+    bool insert = current == NULL;
+
+    if (!insert && mp->value_size != 0)
+    {
+        if (mp->rcu != NULL)
+        /* Старое значение могут копировать читатели - заменяем буфер целиком */
+        {
+            void *new_value = malloc(mp->value_size);
+            if (new_value == NULL)
+            {
+                perror("");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(new_value, value, mp->value_size);
+
+            void *old_value = current->value;
+            MAP_PUBLISH(current->value, new_value);
+            map_rcu_retire(mp, NULL, NULL, old_value, false);
+        }
+        else {
+            memcpy(current->value, value, mp->value_size);
+        }
+    }
+
+    if (insert)
+    /**
+     * Вставляем элемент (либо дерево пустое, либо элемент с ключом key
+     * в дереве не обнаружен)
+     */
+    {
+        avl_node *insert_node = map_create_new_node(key, value, mp->key_size, mp->value_size);
+        if (mp->key_prefix != NULL) {
+            insert_node->prefix = mp->key_prefix(key);
+        }
+        map_restore_header_properties_after_insert(mp, insert_node);
+
+        avl_link *root = map_node_link(mp->header.root);
+        avl_link_insert(&root, map_node_link(parent), cmp > 0, &(insert_node->link));
+        MAP_PUBLISH(mp->header.root, map_node_of(root));
+    
+        (mp->size)++;
+        (mp->version)++;
+        map_bloom_add(mp, key);
+        map_hash_index_add(mp, insert_node);
+    }
+
+    map_rcu_write_end(mp);
+}
+
+void 
+_map_erase
+(
+    map *           mp, 
+    map_iterator    iter,
+    bool            use_deleters
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_erase: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_check_writable(mp, "map_erase");
+
+    /* Удостоверимся, что итератор принадлежит данному дереву */
+    map_iterator_impl input_iter_impl = map_iterator_unwrap(iter);
+
+    if (mp->small_active)
+    {
+        uint8_t *slot = input_iter_impl.this_node;
+        size_t pos = (size_t)(slot - mp->small_keys) / mp->key_size;
+        if (input_iter_impl.this_map != mp || slot < mp->small_keys || pos >= mp->size 
+            || slot != map_small_key(mp, pos))
+        {
+            fprintf(stderr, "map_erase: итератор iter не принадлежит контейнеру\n");
+            exit(EXIT_FAILURE);
+        }
+
+        if (use_deleters)
+        {
+            if (mp->key_destroyer != NULL) {
+                mp->key_destroyer(map_small_key(mp, pos));
+            }
+            if (mp->value_destroyer != NULL) {
+                mp->value_destroyer(map_small_value(mp, pos));
+            }
+        }
+
+        memmove(map_small_key(mp, pos), map_small_key(mp, pos + 1), (mp->size - pos - 1) * mp->key_size);
+        memmove(map_small_value(mp, pos), map_small_value(mp, pos + 1), 
+            (mp->size - pos - 1) * mp->value_size);
+
+        (mp->size)--;
+        (mp->version)++;
+        map_bloom_erased(mp);
+        return;
+    }
+
+    if (mp->btree != NULL)
+    {
+        if (input_iter_impl.this_map != mp || input_iter_impl.this_node == &(mp->header))
+        {
+            fprintf(stderr, "map_erase: итератор iter не принадлежит контейнеру\n");
+            exit(EXIT_FAILURE);
+        }
+
+        map_btree_erase(mp->btree, input_iter_impl.this_node, 
+            use_deleters ? mp->key_destroyer : NULL, use_deleters ? mp->value_destroyer : NULL);
+
+        (mp->size)--;
+        (mp->version)++;
+        map_bloom_erased(mp);
+        return;
+    }
+
+    map_iterator find_elem = _map_find(mp, ((avl_node *)(input_iter_impl.this_node))->key);
+    if (map_iterator_compare(find_elem, map_iterator_end(mp)) == 0) 
+    {
+        fprintf(stderr, "map_erase: итератор iter не принадлежит контейнеру\n");
+        exit(EXIT_FAILURE);
+    }
+    else if (map_iterator_compare(iter, find_elem) != 0)
+    {
+        fprintf(stderr, "map_erase: итератор iter не принадлежит контейнеру\n");
+        exit(EXIT_FAILURE);   
+    }
+
+    /* Дошли до сюда - всё ок */
+
+    if (map_tree_shared(mp)) 
+    /* Узел и путь к нему могут разделяться со снимками - копируем путь */
+    {
+        map_erase_shared(mp, ((avl_node *)(input_iter_impl.this_node))->key, use_deleters);
+        return;
+    }
+
+    map_rcu_write_begin(mp);
+
+    map_iterator_impl find_iter_impl = map_iterator_unwrap(find_elem);
+    avl_node *erase_node = find_iter_impl.this_node;
+    map_restore_header_properties_after_erase(mp, erase_node);
+    map_find_cache_forget(mp, erase_node);
+    map_hash_index_remove(mp, erase_node);
+
+    avl_link *root = map_node_link(mp->header.root);
+    avl_link_erase(&root, &(erase_node->link));
+    MAP_PUBLISH(mp->header.root, map_node_of(root));
+    map_free_node(mp, erase_node, use_deleters);
+    
+    (mp->size)--;
+    (mp->version)++;
+    map_bloom_erased(mp);
+
+    map_rcu_write_end(mp);
+
+    if (mp->small_keys != NULL && mp->size <= MAP_SMALL_DEMOTE_SIZE) {
+        map_small_demote(mp);
+    }
+}
+
+void
+map_clear
+(
+    map *mp
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_clear: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_check_writable(mp, "map_clear");
+    map_rcu_write_begin(mp);
+    map_release_tree(mp);
+
+    mp->size = 0;
+    (mp->version)++;
+    /* Пустой контейнер MAP_BACKEND_SMALL снова хранит элементы в массиве */
+    if (mp->small_keys != NULL) {
+        mp->small_active = true;
+    }
+    if (mp->bloom != NULL) {
+        map_bloom_rebuild(mp);
+    }
+    map_rcu_write_end(mp);
+}
+
+void 
+_map_iterator_next
+(
+    map *             mp, 
+    map_iterator *    iter
+)
+{
+    if (iter == NULL)
+    {
+        fprintf(stderr, "map_iterator_next_elem: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+ 
+    map_iterator_impl iter_impl = map_iterator_unwrap(*iter);
+    avl_node *curr_node = (avl_node *)(iter_impl.this_node);
+
+    if (mp->small_active)
+    {
+        if (iter_impl.this_node == &(mp->header))
+        {
+            fprintf(stderr, "map_iterator_next_elem: произведена попытка выйти за границы контейнера\n");
+            exit(EXIT_FAILURE);
+        }
+
+        uint8_t *slot = (uint8_t *)iter_impl.this_node + mp->key_size;
+        iter_impl.this_node = (slot < map_small_key(mp, mp->size)) ? (void *)slot 
+            : (void *)&(mp->header);
+        *iter = map_iterator_wrap(iter_impl);
+        return;
+    }
+
+    if (mp->btree != NULL)
+    {
+        if (iter_impl.this_node == &(mp->header))
+        {
+            fprintf(stderr, "map_iterator_next_elem: произведена попытка выйти за границы контейнера\n");
+            exit(EXIT_FAILURE);
+        }
+
+        void *slot = map_btree_next(mp->btree, iter_impl.this_node);
+        iter_impl.this_node = (slot != NULL) ? slot : (void *)&(mp->header);
+        *iter = map_iterator_wrap(iter_impl);
+        return;
+    }
+
+    if (map_iterator_compare(*iter, map_iterator_last(mp)) == 0) {
+        curr_node = (avl_node *)((void *)(&(mp->header)));
+    }
+    else if (map_iterator_compare(*iter, map_iterator_end(mp)) == 0) 
+    {
+        fprintf(stderr, "map_iterator_next_elem: произведена попытка выйти за границы контейнера\n");
+        exit(EXIT_FAILURE);
+    }
+    else {
+        curr_node = map_next_node(mp, curr_node);
+    }
+
+    iter_impl.this_node = curr_node;
+    *iter = map_iterator_wrap(iter_impl);
+}   
+
+void 
+_map_iterator_prev
+(
+    map *             mp, 
+    map_iterator *    iter
+)
+{
+    if (iter == NULL)
+    {
+        fprintf(stderr, "map_iterator_next_elem: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+ 
+    map_iterator_impl iter_impl = map_iterator_unwrap(*iter);
+    avl_node *curr_node = iter_impl.this_node;
+
+    if (mp->small_active)
+    {
+        uint8_t *slot = (iter_impl.this_node == &(mp->header))
+            ? map_small_key(mp, mp->size) : (uint8_t *)iter_impl.this_node;
+        if (slot == mp->small_keys)
+        {
+            fprintf(stderr, "map_iterator_prev: произведена попытка выйти за границы контейнера\n");
+            exit(EXIT_FAILURE);
+        }
+
+        iter_impl.this_node = slot - mp->key_size;
+        *iter = map_iterator_wrap(iter_impl);
+        return;
+    }
+
+    if (mp->btree != NULL)
+    {
+        void *slot = (iter_impl.this_node == &(mp->header)) 
+            ? map_btree_last(mp->btree) 
+            : map_btree_prev(mp->btree, iter_impl.this_node);
+        if (slot == NULL)
+        {
+            fprintf(stderr, "map_iterator_prev: произведена попытка выйти за границы контейнера\n");
+            exit(EXIT_FAILURE);
+        }
+
+        iter_impl.this_node = slot;
+        *iter = map_iterator_wrap(iter_impl);
+        return;
+    }
+
+    if (map_iterator_compare(*iter, map_iterator_end(mp)) == 0) {
+        curr_node = mp->header.most_right;
+    }
+    else if (map_iterator_compare(*iter, map_iterator_first(mp)) == 0) 
+    {
+        fprintf(stderr, "map_iterator_prev: произведена попытка выйти за границы контейнера\n");
+        exit(EXIT_FAILURE);
+    }
+    else {
+        curr_node = map_prev_node(mp, curr_node);
+    }
+
+    iter_impl.this_node = curr_node;
+    *iter = map_iterator_wrap(iter_impl);
+}
+
+int 
+map_iterator_compare
+(
+    map_iterator f, 
+    map_iterator s
+)
+{
+    map_iterator_impl iter_impl_f = map_iterator_unwrap(f);
+    map_iterator_impl iter_impl_s = map_iterator_unwrap(s);
+
+    return (!(iter_impl_f.this_map == iter_impl_s.this_map
+        && iter_impl_f.this_node == iter_impl_s.this_node));
+}
+
+map_iterator 
+_map_find
+(
+    map *     mp, 
+    void *    key
+)
+{
+    if (mp == NULL || key == NULL)
+    {
+        fprintf(stderr, "map_find: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_iterator_impl iter_impl = {.this_map = mp, .this_node = NULL};
+
+    if (mp->bloom != NULL && !map_bloom_may_contain(mp->bloom, key))
+    {
+        iter_impl.this_node = &(mp->header);
+        return map_iterator_wrap(iter_impl);
+    }
+
+    if (mp->small_active)
+    {
+        size_t pos = map_small_bound(mp, key, NULL, false);
+        iter_impl.this_node = (pos < mp->size && map_compare_keys(mp, map_small_key(mp, pos), key) == 0) 
+            ? (void *)map_small_key(mp, pos) : (void *)&(mp->header);
+        return map_iterator_wrap(iter_impl);
+    }
+
+    if (mp->btree != NULL)
+    {
+        void *slot = map_btree_find(mp->btree, key);
+        iter_impl.this_node = (slot != NULL) ? slot : (void *)&(mp->header);
+        return map_iterator_wrap(iter_impl);
+    }
+
+    avl_node *curr_elem;
+    if (mp->hash_index != NULL) {
+        curr_elem = map_hash_index_find(mp->hash_index, mp, key);
+    }
+    else if (mp->find_cache != NULL) {
+        curr_elem = map_find_cached(mp, key);
+    }
+    else
+    {
+        avl_node *parent;
+        int cmp;
+        curr_elem = map_descend(mp, key, &parent, &cmp);
+    }
+    iter_impl.this_node = curr_elem;
+
+    if (curr_elem == NULL) {
+        iter_impl.this_node = &(mp->header);
+    }
+    return map_iterator_wrap(iter_impl);
+}
+
+map_iterator
+map_find_with
+(
+    map *           mp,
+    const void *    probe,
+    int             (*probe_cmp)    (const void *node_key, const void *probe)
+)
+{
+    if (mp == NULL || probe_cmp == NULL)
+    {
+        fprintf(stderr, "map_find_with: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_iterator_impl iter_impl = {.this_map = mp, .this_node = &(mp->header)};
+
+    if (mp->small_active)
+    {
+        size_t pos = map_small_bound(mp, probe, probe_cmp, false);
+        if (pos < mp->size && probe_cmp(map_small_key(mp, pos), probe) == 0) {
+            iter_impl.this_node = map_small_key(mp, pos);
+        }
+        return map_iterator_wrap(iter_impl);
+    }
+
+    if (mp->btree != NULL)
+    {
+        void *slot = map_btree_bound(mp->btree, probe, probe_cmp, false);
+        if (slot != NULL && probe_cmp(slot, probe) == 0) {
+            iter_impl.this_node = slot;
+        }
+        return map_iterator_wrap(iter_impl);
+    }
+
+    avl_node *curr_elem = mp->header.root;
+    while (curr_elem != NULL)
+    {
+        MAP_PREFETCH_CHILDREN(curr_elem);
+        int cmp = probe_cmp(curr_elem->key, probe);
+        if (cmp == 0)
+        {
+            iter_impl.this_node = curr_elem;
+            break;
+        }
+        curr_elem = map_node_child(curr_elem, cmp < 0);
+    }
+
+    return map_iterator_wrap(iter_impl);
+}
+
+map_iterator
+map_lower_bound_with
+(
+    map *           mp,
+    const void *    probe,
+    int             (*probe_cmp)    (const void *node_key, const void *probe)
+)
+{
+    if (mp == NULL || probe_cmp == NULL)
+    {
+        fprintf(stderr, "map_lower_bound_with: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return map_bound_with(mp, probe, probe_cmp, false);
+}
+
+map_iterator
+map_upper_bound_with
+(
+    map *           mp,
+    const void *    probe,
+    int             (*probe_cmp)    (const void *node_key, const void *probe)
+)
+{
+    if (mp == NULL || probe_cmp == NULL)
+    {
+        fprintf(stderr, "map_upper_bound_with: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return map_bound_with(mp, probe, probe_cmp, true);
+}
+
+map_iterator 
+map_iterator_first
+(
+    map *mp
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_iterator_first: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (mp->size == 0) {
+        return map_iterator_end(mp);
+    }
+
+    map_iterator_impl iter_impl = {.this_map = mp, .this_node = mp->header.most_left};
+    if (mp->small_active) {
+        iter_impl.this_node = mp->small_keys;
+    }
+    else if (mp->btree != NULL) {
+        iter_impl.this_node = map_btree_first(mp->btree);
+    }
+    return map_iterator_wrap(iter_impl);
+}
+
+map_iterator 
+map_iterator_last
+(
+    map *mp
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_iterator_last в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (mp->size == 0) {
+        return map_iterator_end(mp);
+    }
+
+    map_iterator_impl iter_impl = {.this_map = mp, .this_node = mp->header.most_right};
+    if (mp->small_active) {
+        iter_impl.this_node = map_small_key(mp, mp->size - 1);
+    }
+    else if (mp->btree != NULL) {
+        iter_impl.this_node = map_btree_last(mp->btree);
+    }
+    return map_iterator_wrap(iter_impl);
+}
+
+map_iterator 
+map_iterator_end
+(
+    map *mp
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_iterator_end в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_iterator_impl iter_impl = {.this_map = mp, .this_node = &(mp->header)};
+    return map_iterator_wrap(iter_impl);
+}
+
+
+void *
+_map_iterator_get_key
+(
+    map_iterator iter
+)
+{
+    map_iterator_impl iter_impl = map_iterator_unwrap(iter);
+
+    if (iter_impl.this_map->btree != NULL || iter_impl.this_map->small_active) {
+        return iter_impl.this_node;
+    }
+    return ((avl_node *)(iter_impl.this_node))->key;
+}
+
+void *
+_map_iterator_get_value
+(
+    map_iterator iter
+)
+{
+    map_iterator_impl iter_impl = map_iterator_unwrap(iter);
+
+    if (iter_impl.this_map->btree != NULL) {
+        return map_btree_value(iter_impl.this_map->btree, iter_impl.this_node);
+    }
+    if (iter_impl.this_map->small_active)
+    {
+        map *mp = iter_impl.this_map;
+        return map_small_value(mp, (size_t)((uint8_t *)iter_impl.this_node - mp->small_keys) / mp->key_size);
+    }
+    return ((avl_node *)(iter_impl.this_node))->value;
+}
+
+map *
+map_clone
+(
+    map *    mp,
+    void     (*key_copier)      (void *dst, const void *src),
+    void     (*value_copier)    (void *dst, const void *src)
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_clone: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return map_clone_parallel(mp, key_copier, value_copier, 1);
+}
+
+map *
+map_clone_parallel
+(
+    map *     mp,
+    void      (*key_copier)      (void *dst, const void *src),
+    void      (*value_copier)    (void *dst, const void *src),
+    size_t    threads
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_clone_parallel: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_check_not_btree(mp, "map_clone_parallel");
+
+    /* Копия контейнера, элементы которого лежат в массиве, тоже хранит их в массиве */
+    map *clone = map_create_backend(mp->key_size, mp->value_size, mp->compare_func, 
+        mp->key_destroyer, mp->value_destroyer, mp->small_active ? MAP_BACKEND_SMALL : MAP_BACKEND_AVL);
+
+    clone->key_copier = mp->key_copier;
+    clone->value_copier = mp->value_copier;
+    clone->key_prefix = mp->key_prefix;
+
+    if (mp->small_active)
+    {
+        map_small_copy(mp, clone, key_copier, value_copier);
+        return clone;
+    }
+
+    if (mp->header.root == NULL) {
+        return clone;
+    }
+
+    avl_node *root = map_clone_helper(mp, mp->header.root, NULL, key_copier, value_copier, threads);
+
+    avl_node *most_left = root;
+    while (map_node_child(most_left, 0)) {
+        most_left = map_node_child(most_left, 0);
+    }
+    avl_node *most_right = root;
+    while (map_node_child(most_right, 1)) {
+        most_right = map_node_child(most_right, 1);
+    }
+
+    clone->header.root = root;
+    clone->header.most_left = most_left;
+    clone->header.most_right = most_right;
+    clone->size = mp->size;
+
+    return clone;
+}
+
+void
+map_set_copiers
+(
+    map *    mp,
+    void     (*key_copier)      (void *dst, const void *src),
+    void     (*value_copier)    (void *dst, const void *src)
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_set_copiers: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    mp->key_copier = key_copier;
+    mp->value_copier = value_copier;
+}
+
+map *
+map_snapshot
+(
+    map *mp
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_snapshot: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_check_not_btree(mp, "map_snapshot");
+
+    if (mp->rcu != NULL)
+    {
+        fprintf(stderr, "map_snapshot: контейнер находится в режиме RCU\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map *snapshot = map_create_backend(mp->key_size, mp->value_size, mp->compare_func, 
+        mp->key_destroyer, mp->value_destroyer, mp->small_active ? MAP_BACKEND_SMALL : MAP_BACKEND_AVL);
+
+    snapshot->key_copier = mp->key_copier;
+    snapshot->value_copier = mp->value_copier;
+    snapshot->key_prefix = mp->key_prefix;
+    snapshot->read_only = true;
+
+    /**
+     * Массиву нечего разделять, а элементов в нём не больше MAP_SMALL_CAPACITY,
+     * поэтому снимок получает их копию (функциями из map_set_copiers)
+     */
+    if (mp->small_active)
+    {
+        map_small_copy(mp, snapshot, mp->key_copier, mp->value_copier);
+        return snapshot;
+    }
+
+    /* Дерево, разделяемое со снимками, не должно возвращаться к массиву */
+    map_check_avl(mp, "map_snapshot");
+
+    if (mp->header.root == NULL) {
+        return snapshot;
+    }
+
+    if (mp->tree_ref == NULL)
+    {
+        mp->tree_ref = (map_tree_ref *)malloc(sizeof(map_tree_ref));
+        if (mp->tree_ref == NULL)
+        {
+            perror("");
+            exit(EXIT_FAILURE);
+        }
+        atomic_init(&(mp->tree_ref->count), 1);
+    }
+
+    atomic_fetch_add(&(mp->tree_ref->count), 1);
+    atomic_fetch_add(&(mp->header.root->refs), 1);
+
+    snapshot->header.root = mp->header.root;
+    snapshot->header.most_left = mp->header.most_left;
+    snapshot->header.most_right = mp->header.most_right;
+    snapshot->size = mp->size;
+    snapshot->tree_ref = mp->tree_ref;
+    snapshot->stale_parents = mp->stale_parents;
+
+    return snapshot;
+}
+
+map_resume_token
+map_resume_token_init
+(
+    void
+)
+{
+    map_resume_token_impl token_impl = {.this_map = NULL, .next_node = NULL, .version = 0};
+    return map_resume_token_wrap(token_impl);
+}
+
+size_t
+map_scan
+(
+    map *                 mp,
+    const void *          start_key,
+    size_t                max,
+    void *                keys_out,
+    void *                values_out,
+    map_resume_token *    token
+)
+{
+    if (mp == NULL || token == NULL)
+    {
+        fprintf(stderr, "map_scan: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_check_not_btree(mp, "map_scan");
+
+    map_resume_token_impl token_impl = map_resume_token_unwrap(*token);
+    avl_node *curr_node = NULL;
+    size_t pos = 0;
+
+    if (token_impl.this_map == NULL)
+    /* Первый вызов - начинаем с первого ключа, не меньшего start_key */
+    {
+        if (mp->small_active) {
+            pos = (start_key != NULL) ? map_small_bound(mp, start_key, NULL, false) : 0;
+        }
+        else if (start_key != NULL) {
+            curr_node = map_lower_bound_node(mp, start_key);
+        }
+        else {
+            curr_node = mp->header.most_left;
+        }
+        token_impl.this_map = mp;
+    }
+    else 
+    {
+        if (token_impl.this_map != mp)
+        {
+            fprintf(stderr, "map_scan: токен token не принадлежит контейнеру\n");
+            exit(EXIT_FAILURE);
+        }
+        if (token_impl.version != mp->version)
+        {
+            fprintf(stderr, "map_scan: контейнер был изменён после предыдущего вызова map_scan\n");
+            exit(EXIT_FAILURE);
+        }
+        if (mp->small_active) {
+            pos = (token_impl.next_node != NULL) 
+                ? (size_t)((uint8_t *)token_impl.next_node - mp->small_keys) / mp->key_size : mp->size;
+        }
+        else {
+            curr_node = token_impl.next_node;
+        }
+    }
+
+    uint8_t *keys_dst = keys_out;
+    uint8_t *values_dst = values_out;
+    size_t count = 0;
+
+    if (mp->small_active)
+    /* Элементы массива лежат подряд - порция копируется целиком */
+    {
+        count = (mp->size - pos < max) ? mp->size - pos : max;
+        if (keys_dst != NULL) {
+            memcpy(keys_dst, map_small_key(mp, pos), count * mp->key_size);
+        }
+        if (values_dst != NULL) {
+            memcpy(values_dst, map_small_value(mp, pos), count * mp->value_size);
+        }
+
+        token_impl.next_node = (pos + count < mp->size) ? map_small_key(mp, pos + count) : NULL;
+        token_impl.version = mp->version;
+        *token = map_resume_token_wrap(token_impl);
+
+        return count;
+    }
+
+    while (curr_node != NULL && count < max)
+    {
+        if (keys_dst != NULL) 
+        {
+            memcpy(keys_dst, curr_node->key, mp->key_size);
+            keys_dst += mp->key_size;
+        }
+        if (values_dst != NULL) 
+        {
+            memcpy(values_dst, curr_node->value, mp->value_size);
+            values_dst += mp->value_size;
+        }
+
+        count++;
+        curr_node = map_next_node(mp, curr_node);
+    }
+
+    token_impl.next_node = curr_node;
+    token_impl.version = mp->version;
+    *token = map_resume_token_wrap(token_impl);
+
+    return count;
+}
+
+map_cursor
+map_cursor_init
+(
+    map *mp
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_cursor_init: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_check_not_btree(mp, "map_cursor_init");
+
+    map_cursor_impl cursor_impl = {.this_map = mp, .this_node = NULL, .version = mp->version};
+    return map_cursor_wrap(cursor_impl);
+}
+
+map_iterator
+_map_cursor_seek
+(
+    map_cursor *    cursor,
+    const void *    key
+)
+{
+    if (cursor == NULL || key == NULL)
+    {
+        fprintf(stderr, "map_cursor_seek: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_cursor_impl cursor_impl = map_cursor_unwrap(*cursor);
+    map *mp = cursor_impl.this_map;
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_cursor_seek: курсор не инициализирован\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (mp->small_active)
+    {
+        size_t pos = map_small_bound(mp, key, NULL, false);
+        cursor_impl.this_node = NULL;
+        cursor_impl.version = mp->version;
+        *cursor = map_cursor_wrap(cursor_impl);
+
+        map_iterator_impl iter_impl = {.this_map = mp, .this_node = &(mp->header)};
+        if (pos < mp->size) {
+            iter_impl.this_node = map_small_key(mp, pos);
+        }
+        return map_iterator_wrap(iter_impl);
+    }
+
+    avl_node *node;
+    /* Подъём от пальца идёт по указателям parent */
+    if (cursor_impl.this_node != NULL && cursor_impl.version == mp->version && !mp->stale_parents) {
+        node = map_finger_lower_bound(mp, cursor_impl.this_node, key);
+    }
+    else {
+        node = map_lower_bound_node(mp, key);
+    }
+
+    /* Если все ключи меньше key, запоминаем ближайший к нему узел */
+    cursor_impl.this_node = (node != NULL) ? node : mp->header.most_right;
+    cursor_impl.version = mp->version;
+    *cursor = map_cursor_wrap(cursor_impl);
+
+    map_iterator_impl iter_impl = {.this_map = mp, .this_node = node};
+    if (node == NULL) {
+        iter_impl.this_node = &(mp->header);
+    }
+    return map_iterator_wrap(iter_impl);
+}
+
+void
+map_rcu_enable
+(
+    map *mp
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_rcu_enable: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_check_avl(mp, "map_rcu_enable");
+
+    map_check_writable(mp, "map_rcu_enable");
+
+    if (map_tree_shared(mp))
+    {
+        fprintf(stderr, "map_rcu_enable: дерево контейнера разделяется со снимками\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (mp->rcu != NULL) {
+        return;
+    }
+
+    mp->rcu = (map_rcu *)malloc(sizeof(map_rcu));
+    if (mp->rcu == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    atomic_init(&(mp->rcu->seq), 0);
+    /* Эпоха 0 в слоте читателя означает, что читатель неактивен */
+    atomic_init(&(mp->rcu->epoch), 1);
+    atomic_init(&(mp->rcu->readers), NULL);
+    mp->rcu->garbage_head = NULL;
+    mp->rcu->garbage_tail = NULL;
+}
+
+map_rcu_reader *
+map_rcu_register
+(
+    map *mp
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_rcu_register: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (mp->rcu == NULL)
+    {
+        fprintf(stderr, "map_rcu_register: контейнер не находится в режиме RCU\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Сначала попробуем занять слот, освобождённый другим читателем */
+    for (map_rcu_reader *reader = atomic_load(&(mp->rcu->readers)); reader != NULL; reader = reader->next)
+    {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&(reader->in_use), &expected, true)) {
+            return reader;
+        }
+    }
+
+    map_rcu_reader *reader = (map_rcu_reader *)aligned_alloc(_Alignof(map_rcu_reader), sizeof(map_rcu_reader));
+    if (reader == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    atomic_init(&(reader->epoch), 0);
+    atomic_init(&(reader->in_use), true);
+    reader->next = atomic_load(&(mp->rcu->readers));
+    while (!atomic_compare_exchange_weak(&(mp->rcu->readers), &(reader->next), reader)) {
+    }
+
+    return reader;
+}
+
+void
+map_rcu_unregister
+(
+    map *               mp,
+    map_rcu_reader *    reader
+)
+{
+    if (mp == NULL || reader == NULL)
+    {
+        fprintf(stderr, "map_rcu_unregister: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    atomic_store_explicit(&(reader->epoch), 0, memory_order_release);
+    atomic_store_explicit(&(reader->in_use), false, memory_order_release);
+}
+
+bool
+_map_rcu_find
+(
+    map *               mp,
+    map_rcu_reader *    reader,
+    void *              key,
+    void *              value
+)
+{
+    if (mp == NULL || reader == NULL || key == NULL || value == NULL)
+    {
+        fprintf(stderr, "map_rcu_find: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_rcu *rcu = mp->rcu;
+    bool found;
+
+    for (;;)
+    {
+        /**
+         * Вход в эпоху. Барьер гарантирует, что писатель, начавший новую эпоху 
+         * после нашего входа, увидит наш слот до освобождения объектов
+         */
+        atomic_store_explicit(&(reader->epoch), 
+            atomic_load_explicit(&(rcu->epoch), memory_order_acquire), memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        size_t seq = atomic_load_explicit(&(rcu->seq), memory_order_acquire);
+
+        found = false;
+        size_t depth = 0;
+        avl_node *curr_elem = MAP_READ(mp->header.root);
+        while (curr_elem != NULL && depth++ < MAP_RCU_MAX_DEPTH)
+        {
+            int result_of_compare_func = map_compare_keys(mp, MAP_READ(curr_elem->key), key);
+            if (result_of_compare_func == 0)
+            {
+                memcpy(value, MAP_READ(curr_elem->value), mp->value_size);
+                found = true;
+                break;
+            }
+            curr_elem = map_node_of(MAP_READ(curr_elem->link.child[result_of_compare_func < 0]));
+        }
+
+        atomic_store_explicit(&(reader->epoch), 0, memory_order_release);
+
+        /**
+         * Результат верен, если спуск завершился и во время поиска писатель 
+         * не изменял дерево (счётчик записей чётный и не изменился)
+         */
+        bool complete = found || curr_elem == NULL;
+        atomic_thread_fence(memory_order_acquire);
+        if (complete && (seq & 1) == 0 
+            && atomic_load_explicit(&(rcu->seq), memory_order_relaxed) == seq)
+        {
+            return found;
+        }
+    }
+}
+
+void
+map_rcu_synchronize
+(
+    map *mp
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_rcu_synchronize: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (mp->rcu == NULL) {
+        return;
+    }
+
+    size_t epoch = map_rcu_advance_epoch(mp->rcu);
+
+    for (map_rcu_reader *reader = atomic_load(&(mp->rcu->readers)); reader != NULL; reader = reader->next)
+    {
+        size_t reader_epoch = atomic_load_explicit(&(reader->epoch), memory_order_acquire);
+        while (reader_epoch != 0 && reader_epoch < epoch)
+        {
+            sched_yield();
+            reader_epoch = atomic_load_explicit(&(reader->epoch), memory_order_acquire);
+        }
+    }
+
+    map_rcu_free_garbage(mp, epoch);
+}
+
+void
+map_build_parallel
+(
+    map *           mp,
+    const void *    keys,
+    const void *    values,
+    size_t          n,
+    size_t          threads
+)
+{
+    if (mp == NULL || ((keys == NULL || (values == NULL && mp->value_size != 0)) && n > 0))
+    {
+        fprintf(stderr, "map_build_parallel: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (values == NULL) {
+        values = map_empty_value;
+    }
+
+    map_check_writable(mp, "map_build_parallel");
+
+    const uint8_t *keys_bytes = keys;
+    const uint8_t *values_bytes = values;
+
+    if (mp->size != 0 || mp->btree != NULL || mp->small_keys != NULL)
+    /**
+     * Контейнер не пуст или хранит элементы в B+-дереве - AVL-дерево целиком 
+     * построить нельзя, вставляем по одному
+     */
+    {
+        for (size_t i = 0; i < n; ++i) {
+            _map_insert(mp, (void *)(keys_bytes + i * mp->key_size), (void *)(values_bytes + i * mp->value_size));
+        }
+        return;
+    }
+
+    if (n == 0) {
+        return;
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    size_t *order = (size_t *)malloc(n * sizeof(size_t));
+    size_t *tmp = (size_t *)malloc(n * sizeof(size_t));
+    if (order == NULL || tmp == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        order[i] = i;
+    }
+
+    map_build_sort(mp, keys_bytes, order, tmp, 0, n, threads);
+
+    /**
+     * Сортировка устойчива, поэтому среди равных ключей последним идёт 
+     * элемент, встретившийся во входных данных последним - его и оставляем,
+     * как если бы элементы вставлялись по очереди функцией map_insert
+     */
+    size_t unique = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (i + 1 < n && map_compare_keys(mp, keys_bytes + order[i] * mp->key_size, 
+            keys_bytes + order[i + 1] * mp->key_size) == 0) 
+        {
+            continue;
+        }
+        order[unique++] = order[i];
+    }
+    free(tmp);
+
+    map_rcu_write_begin(mp);
+
+    avl_node *root = map_build_subtree(mp, keys_bytes, values_bytes, order, 0, unique, NULL, threads);
+    free(order);
+
+    avl_node *most_left = root;
+    while (map_node_child(most_left, 0)) {
+        most_left = map_node_child(most_left, 0);
+    }
+    avl_node *most_right = root;
+    while (map_node_child(most_right, 1)) {
+        most_right = map_node_child(most_right, 1);
+    }
+
+    MAP_PUBLISH(mp->header.root, root);
+    mp->header.most_left = most_left;
+    mp->header.most_right = most_right;
+    mp->size = unique;
+    (mp->version)++;
+    if (mp->bloom != NULL) {
+        map_bloom_rebuild(mp);
+    }
+    map_hash_index_rebuild(mp);
+
+    map_rcu_write_end(mp);
+}
+
+void
+map_parallel_for
+(
+    map *     mp,
+    void      (*fn)    (const void *key, void *value, void *ctx),
+    void *    ctx,
+    size_t    threads
+)
+{
+    if (mp == NULL || fn == NULL)
+    {
+        fprintf(stderr, "map_parallel_for: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_parallel_for_range(mp, NULL, NULL, fn, ctx, threads);
+}
+
+void
+map_parallel_for_range
+(
+    map *           mp,
+    const void *    lo,
+    const void *    hi,
+    void            (*fn)    (const void *key, void *value, void *ctx),
+    void *          ctx,
+    size_t          threads
+)
+{
+    if (mp == NULL || fn == NULL)
+    {
+        fprintf(stderr, "map_parallel_for_range: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_check_not_btree(mp, "map_parallel_for_range");
+
+    if (mp->small_active)
+    /* Не больше MAP_SMALL_CAPACITY элементов - запуск потоков не окупится */
+    {
+        size_t begin;
+        size_t end = map_small_range(mp, lo, hi, &begin);
+        for (size_t i = begin; i < end; ++i) {
+            fn(map_small_key(mp, i), map_small_value(mp, i), ctx);
+        }
+        return;
+    }
+
+    map_parallel_args args = {.mp = mp, .lo = lo, .hi = hi, .fn = fn, .ctx = ctx};
+    map_parallel_run(&args, threads);
+    free(args.tasks);
+}
+
+void
+map_parallel_reduce
+(
+    map *           mp,
+    void            (*map_fn)        (const void *key, const void *value, void *acc, void *ctx),
+    void            (*combine_fn)    (void *acc, const void *other, void *ctx),
+    const void *    identity,
+    size_t          acc_size,
+    void *          result,
+    void *          ctx,
+    size_t          threads
+)
+{
+    if (mp == NULL || map_fn == NULL || combine_fn == NULL || identity == NULL || result == NULL)
+    {
+        fprintf(stderr, "map_parallel_reduce: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_parallel_reduce_range(mp, NULL, NULL, map_fn, combine_fn, identity, acc_size, result, ctx, threads);
+}
+
+void
+map_parallel_reduce_range
+(
+    map *           mp,
+    const void *    lo,
+    const void *    hi,
+    void            (*map_fn)        (const void *key, const void *value, void *acc, void *ctx),
+    void            (*combine_fn)    (void *acc, const void *other, void *ctx),
+    const void *    identity,
+    size_t          acc_size,
+    void *          result,
+    void *          ctx,
+    size_t          threads
+)
+{
+    if (mp == NULL || map_fn == NULL || combine_fn == NULL || identity == NULL || result == NULL)
+    {
+        fprintf(stderr, "map_parallel_reduce_range: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_check_not_btree(mp, "map_parallel_reduce_range");
+
+    if (mp->small_active)
+    /* Весь массив обрабатывается одной задачей в вызывающем потоке */
+    {
+        uint8_t *acc = (uint8_t *)malloc(acc_size + 1);
+        if (acc == NULL)
+        {
+            perror("");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(acc, identity, acc_size);
+
+        size_t begin;
+        size_t end = map_small_range(mp, lo, hi, &begin);
+        for (size_t i = begin; i < end; ++i) {
+            map_fn(map_small_key(mp, i), map_small_value(mp, i), acc, ctx);
+        }
+
+        memcpy(result, identity, acc_size);
+        combine_fn(result, acc, ctx);
+        free(acc);
+        return;
+    }
+
+    map_parallel_args args = {.mp = mp, .lo = lo, .hi = hi, .map_fn = map_fn, .ctx = ctx, 
+        .acc_size = acc_size, .identity = identity};
+    map_parallel_run(&args, threads);
+
+    /**
+     * Задачи упорядочены по ключам, поэтому аккумуляторы объединяются в 
+     * порядке обхода и от combine_fn требуется только ассоциативность
+     */
+    memcpy(result, identity, acc_size);
+    for (size_t i = 0; i < args.tasks_count; ++i) {
+        combine_fn(result, args.accs + i * acc_size, ctx);
+    }
+
+    free(args.tasks);
+    free(args.accs);
+}
+
+
+void
+map_set_key_prefix
+(
+    map *       mp,
+    uint64_t    (*key_prefix)    (const void *key)
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_set_key_prefix: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_check_avl(mp, "map_set_key_prefix");
+
+    map_check_writable(mp, "map_set_key_prefix");
+
+    map_unshare_tree(mp);
+    mp->key_prefix = key_prefix;
+
+    for (avl_node *node = mp->header.most_left; node != NULL; node = map_next_node(mp, node)) {
+        node->prefix = (key_prefix != NULL) ? key_prefix(node->key) : 0;
+    }
+}
+
+void
+map_set_find_cache
+(
+    map *       mp,
+    size_t      entries,
+    uint64_t    (*key_hash)    (const void *key)
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_set_find_cache: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_check_avl(mp, "map_set_find_cache");
+
+    if (mp->find_cache != NULL)
+    {
+        free(mp->find_cache->sets);
+        free(mp->find_cache);
+        mp->find_cache = NULL;
+    }
+
+    if (entries == 0 || key_hash == NULL) {
+        return;
+    }
+
+    size_t sets_count = 1;
+    while (sets_count * MAP_FIND_CACHE_WAYS < entries) {
+        sets_count <<= 1;
+    }
+
+    map_find_cache *cache = (map_find_cache *)malloc(sizeof(map_find_cache));
+    map_find_cache_set *sets = (map_find_cache_set *)aligned_alloc(_Alignof(map_find_cache_set), 
+        sets_count * sizeof(map_find_cache_set));
+    if (cache == NULL || sets == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+    memset(sets, 0, sets_count * sizeof(map_find_cache_set));
+
+    *cache = (map_find_cache)
+    {
+        .key_hash = key_hash,
+        .sets = sets,
+        .mask = sets_count - 1,
+        .hits = 0,
+        .misses = 0
+    };
+    mp->find_cache = cache;
+}
+
+map_find_cache_stats
+map_get_find_cache_stats
+(
+    map *mp
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_get_find_cache_stats: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_find_cache_stats stats = {.hits = 0, .misses = 0};
+    if (mp->find_cache != NULL)
+    {
+        stats.hits = mp->find_cache->hits;
+        stats.misses = mp->find_cache->misses;
+    }
+    return stats;
+}
+
+void
+map_set_bloom_filter
+(
+    map *       mp,
+    uint64_t    (*key_hash)    (const void *key)
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_set_bloom_filter: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (mp->bloom != NULL)
+    {
+        free(mp->bloom->blocks);
+        free(mp->bloom);
+        mp->bloom = NULL;
+    }
+
+    if (key_hash == NULL) {
+        return;
+    }
+
+    mp->bloom = (map_bloom *)malloc(sizeof(map_bloom));
+    if (mp->bloom == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+    *mp->bloom = (map_bloom){.key_hash = key_hash, .blocks = NULL, .mask = 0, .capacity = 0, .erased = 0};
+
+    map_bloom_rebuild(mp);
+}
+
+void
+map_set_hash_index
+(
+    map *       mp,
+    uint64_t    (*key_hash)    (const void *key)
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_set_hash_index: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    map_check_avl(mp, "map_set_hash_index");
+
+    if (mp->hash_index != NULL)
+    {
+        free(mp->hash_index->slots);
+        free(mp->hash_index);
+        mp->hash_index = NULL;
+    }
+
+    if (key_hash == NULL) {
+        return;
+    }
+
+    mp->hash_index = (map_hash_index *)malloc(sizeof(map_hash_index));
+    if (mp->hash_index == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+    *mp->hash_index = (map_hash_index){.key_hash = key_hash, .slots = NULL, .mask = 0, .count = 0};
+
+    map_hash_index_rebuild(mp);
+}
+
+uint64_t
+map_key_prefix_cstr
+(
+    const void *key
+)
+{
+    const unsigned char *str = *(const unsigned char * const *)key;
+    uint64_t prefix = 0;
+
+    size_t i = 0;
+    for (; i < sizeof(uint64_t) && str[i] != '\0'; ++i) {
+        prefix = (prefix << 8) | str[i];
+    }
+    /* Недостающие байты - нули, как завершающий нуль строки */
+    return (i == 0) ? 0 : prefix << (8 * (sizeof(uint64_t) - i));
+}
+
+uint64_t
+map_key_hash_i32
+(
+    const void *key
+)
+{
+    return map_hash_mix((uint32_t)*(const int32_t *)key);
+}
+
+uint64_t
+map_key_hash_u64
+(
+    const void *key
+)
+{
+    return map_hash_mix(*(const uint64_t *)key);
+}
+
+uint64_t
+map_key_hash_cstr
+(
+    const void *key
+)
+{
+    /* FNV-1a */
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (const unsigned char *str = *(const unsigned char * const *)key; *str != '\0'; ++str)
+    {
+        hash ^= *str;
+        hash *= 0x100000001B3ull;
+    }
+    return map_hash_mix(hash);
+}
+
+void
+map_key_encoder_init
+(
+    map_key_encoder *    enc,
+    void *               buf,
+    size_t               size
+)
+{
+    if (enc == NULL || buf == NULL)
+    {
+        fprintf(stderr, "map_key_encoder_init: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(buf, 0, size);
+    *enc = (map_key_encoder){.buf = (uint8_t *)buf, .size = size, .pos = 0};
+}
+
+void
+map_key_encode_u64
+(
+    map_key_encoder *    enc,
+    uint64_t             value
+)
+{
+    uint8_t bytes[8];
+    for (int i = 7; i >= 0; --i)
+    {
+        bytes[i] = (uint8_t)value;
+        value >>= 8;
+    }
+    map_key_encode_bytes(enc, bytes, sizeof(bytes));
+}
+
+void
+map_key_encode_u32
+(
+    map_key_encoder *    enc,
+    uint32_t             value
+)
+{
+    uint8_t bytes[4];
+    for (int i = 3; i >= 0; --i)
+    {
+        bytes[i] = (uint8_t)value;
+        value >>= 8;
+    }
+    map_key_encode_bytes(enc, bytes, sizeof(bytes));
+}
+
+void
+map_key_encode_i64
+(
+    map_key_encoder *    enc,
+    int64_t              value
+)
+{
+    map_key_encode_u64(enc, (uint64_t)value ^ ((uint64_t)1 << 63));
+}
+
+void
+map_key_encode_i32
+(
+    map_key_encoder *    enc,
+    int32_t              value
+)
+{
+    map_key_encode_u32(enc, (uint32_t)value ^ ((uint32_t)1 << 31));
+}
+
+void
+map_key_encode_f64
+(
+    map_key_encoder *    enc,
+    double               value
+)
+{
+    if (value != value)
+    /* NaN */
+    {
+        map_key_encode_u64(enc, UINT64_MAX);
+        return;
+    }
+    if (value == 0.0) {
+        value = 0.0;
+    }
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bits = (bits >> 63) ? ~bits : bits ^ ((uint64_t)1 << 63);
+    map_key_encode_u64(enc, bits);
+}
+
+void
+map_key_encode_str
+(
+    map_key_encoder *    enc,
+    const char *         str,
+    size_t               width
+)
+{
+    if (str == NULL)
+    {
+        fprintf(stderr, "map_key_encode_str: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t length = strnlen(str, width);
+    if (enc->pos + width > enc->size)
+    {
+        fprintf(stderr, "map_key_encode: поле не помещается в ключ\n");
+        exit(EXIT_FAILURE);
+    }
+    /* Буфер заполнен нулями в map_key_encoder_init - дополнение не нужно */
+    map_key_encode_bytes(enc, (const uint8_t *)str, length);
+    enc->pos += width - length;
+}
+
+int
+map_key_compare_i32
+(
+    const void *    f,
+    const void *    s
+)
+{
+    int32_t int_f = *(const int32_t *)f;
+    int32_t int_s = *(const int32_t *)s;
+    return (int_f > int_s) - (int_f < int_s);
+}
+
+int
+map_key_compare_u64
+(
+    const void *    f,
+    const void *    s
+)
+{
+    uint64_t u64_f = *(const uint64_t *)f;
+    uint64_t u64_s = *(const uint64_t *)s;
+    return (u64_f > u64_s) - (u64_f < u64_s);
+}
+
+int
+map_key_compare_cstr
+(
+    const void *    f,
+    const void *    s
+)
+{
+    return strcmp(*(const char * const *)f, *(const char * const *)s);
+}
+
+int
+map_key_compare_sized
+(
+    int             (*compare_func)       (const void *f, const void *s),
+    uint16_t        key_size,
+    const void *    f,
+    const void *    s
+)
+{
+    if (compare_func == MAP_KEY_BYTES) {
+        return map_compare_bytes(f, s, key_size);
+    }
+    return compare_func(f, s);
+}
+
+frozen_map *
+map_freeze
+(
+    map *mp
+)
+{
+    if (mp == NULL)
+    {
+        fprintf(stderr, "map_freeze: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    frozen_map *fm = (frozen_map *)malloc(sizeof(frozen_map));
+    if (fm == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    *fm = (frozen_map)
+    {
+        .size = mp->size,
+        .key_size = mp->key_size,
+        .value_size = mp->value_size,
+        .compare_func = mp->compare_func,
+        .key_kind = mp->key_kind,
+        .blocked = mp->key_kind == MAP_KEY_KIND_I32 || mp->key_kind == MAP_KEY_KIND_U64,
+        .index = NULL,
+        .height = 0,
+        .block_rank = NULL
+    };
+
+    fm->values = (uint8_t *)malloc((mp->size + 1) * mp->value_size + 1);
+    if (fm->values == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    if (fm->blocked) {
+        frozen_map_build_blocks(fm, mp);
+    }
+    else {
+        frozen_map_build_eytzinger(fm, mp);
+    }
+
+    return fm;
+}
+
+void
+frozen_map_free
+(
+    frozen_map *fm
+)
+{
+    if (fm == NULL)
+    {
+        fprintf(stderr, "frozen_map_free: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    free(fm->keys);
+    free(fm->values);
+    free(fm->index);
+    free(fm);
+}
+
+size_t
+frozen_map_size
+(
+    frozen_map *fm
+)
+{
+    if (fm == NULL)
+    {
+        fprintf(stderr, "frozen_map_size: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return fm->size;
+}
+
+size_t
+_frozen_map_find
+(
+    frozen_map *    fm,
+    const void *    key
+)
+{
+    if (fm == NULL || key == NULL)
+    {
+        fprintf(stderr, "frozen_map_find: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t pos = frozen_map_search(fm, key, false);
+    if (pos == FROZEN_MAP_END) {
+        return FROZEN_MAP_END;
+    }
+
+    const void *found = fm->keys + frozen_map_slot(fm, pos) * fm->key_size;
+    int cmp = (fm->key_kind == MAP_KEY_KIND_BYTES) 
+        ? map_compare_bytes(found, key, fm->key_size) 
+        : fm->compare_func(found, key);
+    return (cmp == 0) ? pos : FROZEN_MAP_END;
+}
+
+size_t
+_frozen_map_lower_bound
+(
+    frozen_map *    fm,
+    const void *    key
+)
+{
+    if (fm == NULL || key == NULL)
+    {
+        fprintf(stderr, "frozen_map_lower_bound: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return frozen_map_search(fm, key, false);
+}
+
+size_t
+_frozen_map_upper_bound
+(
+    frozen_map *    fm,
+    const void *    key
+)
+{
+    if (fm == NULL || key == NULL)
+    {
+        fprintf(stderr, "frozen_map_upper_bound: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return frozen_map_search(fm, key, true);
+}
+
+size_t
+frozen_map_first
+(
+    frozen_map *fm
+)
+{
+    if (fm == NULL)
+    {
+        fprintf(stderr, "frozen_map_first: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (fm->size == 0) {
+        return FROZEN_MAP_END;
+    }
+    if (fm->blocked) {
+        return 1;
+    }
+
+    /* Минимальный ключ - самая левая позиция неявного дерева */
+    size_t pos = 1;
+    while (2 * pos <= fm->size) {
+        pos *= 2;
+    }
+    return pos;
+}
+
+size_t
+frozen_map_next
+(
+    frozen_map *    fm,
+    size_t          pos
+)
+{
+    if (fm == NULL)
+    {
+        fprintf(stderr, "frozen_map_next: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    frozen_map_check_pos(fm, pos, "frozen_map_next");
+
+    if (fm->blocked) {
+        return (pos < fm->size) ? pos + 1 : FROZEN_MAP_END;
+    }
+
+    if (2 * pos + 1 <= fm->size)
+    /* Есть правое поддерево - спускаемся в его самую левую позицию */
+    {
+        pos = 2 * pos + 1;
+        while (2 * pos <= fm->size) {
+            pos *= 2;
+        }
+        return pos;
+    }
+
+    /**
+     * Поднимаемся, пока позиция - правый ребёнок (нечётна), и ещё на один
+     * уровень. Если подъём дошёл до корня, получается FROZEN_MAP_END
+     */
+    return pos >> (__builtin_ctzll(~(unsigned long long)pos) + 1);
+}
+
+void *
+_frozen_map_get_key
+(
+    frozen_map *    fm,
+    size_t          pos
+)
+{
+    frozen_map_check_pos(fm, pos, "frozen_map_get_key");
+    return fm->keys + frozen_map_slot(fm, pos) * fm->key_size;
+}
+
+void *
+_frozen_map_get_value
+(
+    frozen_map *    fm,
+    size_t          pos
+)
+{
+    frozen_map_check_pos(fm, pos, "frozen_map_get_value");
+    return fm->values + frozen_map_slot(fm, pos) * fm->value_size;
+}
+
+
+/**
+ * Определения основных функций (API) (конец)
+ */
+
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/**
+ * Вспомогательные функции (начало)
+ */
+
+
+static inline map_iterator
+map_iterator_wrap
+(
+    map_iterator_impl iter_impl
+)
+{
+    map_iterator iter;
+    memcpy(&iter, &iter_impl, sizeof(iter_impl));
+    return iter;
+}
+
+static inline map_iterator_impl
+map_iterator_unwrap
+(
+    map_iterator iter
+)
+{
+    map_iterator_impl iter_impl;
+    memcpy(&iter_impl, &iter, sizeof(iter_impl));
+    return iter_impl;
+}
+
+static inline map_resume_token
+map_resume_token_wrap
+(
+    map_resume_token_impl token_impl
+)
+{
+    map_resume_token token;
+    memcpy(&token, &token_impl, sizeof(token_impl));
+    return token;
+}
+
+static inline map_resume_token_impl
+map_resume_token_unwrap
+(
+    map_resume_token token
+)
+{
+    map_resume_token_impl token_impl;
+    memcpy(&token_impl, &token, sizeof(token_impl));
+    return token_impl;
+}
+
+static inline map_cursor
+map_cursor_wrap
+(
+    map_cursor_impl cursor_impl
+)
+{
+    map_cursor cursor;
+    memcpy(&cursor, &cursor_impl, sizeof(cursor_impl));
+    return cursor;
+}
+
+static inline map_cursor_impl
+map_cursor_unwrap
+(
+    map_cursor cursor
+)
+{
+    map_cursor_impl cursor_impl;
+    memcpy(&cursor_impl, &cursor, sizeof(cursor_impl));
+    return cursor_impl;
+}
+
+static inline avl_node *
+map_node_of
+(
+    avl_link *link
+)
+{
+    return (link != NULL) ? (avl_node *)((uint8_t *)link - offsetof(avl_node, link)) : NULL;
+}
+
+static inline avl_link *
+map_node_link
+(
+    avl_node *node
+)
+{
+    return (node != NULL) ? &(node->link) : NULL;
+}
+
+static inline avl_node *
+map_node_child
+(
+    avl_node *    node,
+    int           dir
+)
+{
+    return map_node_of(node->link.child[dir]);
+}
+
+static inline avl_node *
+map_node_parent
+(
+    avl_node *node
+)
+{
+    return map_node_of(node->link.parent);
+}
+
+static avl_node *
+map_create_new_node
+(
+    void *      key, 
+    void *      value, 
+    uint16_t    key_size, 
+    uint16_t    value_size
+)
+{
+    avl_node *insert_node = (avl_node *)malloc(sizeof(avl_node));
+    if (insert_node == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    *insert_node = (avl_node)
+    {
+        .link.parent = NULL,
+        .link.child = {NULL, NULL},
+        .link.balance = 0,
+        .key = NULL,
+        .value = NULL,
+        .prefix = 0
+    };
+    atomic_init(&(insert_node->refs), 1);
+
+    insert_node->key = malloc(key_size);
+    if (insert_node->key == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(insert_node->key, key, key_size);
+
+    if (value_size == 0)
+    {
+        insert_node->value = map_empty_value;
+        return insert_node;
+    }
+
+    insert_node->value = malloc(value_size);
+    if (insert_node->value == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(insert_node->value, value, value_size);
+
+    return insert_node;
+}
+
+static void 
+map_restore_header_properties_after_erase
+(
+    map *         mp,
+    avl_node *    node
+)
+{
+    if (node == mp->header.most_left) {
+        mp->header.most_left = map_node_of(avl_link_next(&(node->link)));
+    }
+    if (node == mp->header.most_right) {
+        mp->header.most_right = map_node_of(avl_link_prev(&(node->link)));
+    }
+}
+
+static void 
+map_restore_header_properties_after_insert
+(
+    map *         mp, 
+    avl_node *    node
+)
+{
+    if (mp->header.root == NULL)
+    {
+        mp->header.most_left = node;
+        mp->header.most_right = node;
+    }
+    else 
+    {
+        if (map_compare_keys(mp, node->key, mp->header.most_left->key) < 0) {
+            mp->header.most_left = node;
+        }
+        else if (map_compare_keys(mp, node->key, mp->header.most_right->key) > 0) {
+            mp->header.most_right = node;
+        }
+    }
+}
+
+static void 
+map_free_helper
+(
+    map *         mp, 
+    avl_node *    node
+)
+{
+    if (map_node_child(node, 0) != NULL) {
+        map_free_helper(mp, map_node_child(node, 0));
+    }
+    if (map_node_child(node, 1) != NULL) {
+        map_free_helper(mp, map_node_child(node, 1));
+    }
+
+    if (mp->key_destroyer != NULL) {
+        mp->key_destroyer(node->key);                
+    }
+    free(node->key);
+
+    if (mp->value_destroyer != NULL) {
+        mp->value_destroyer(node->value);
+    }
+    if (mp->value_size != 0) {
+        free(node->value);
+    }
+
+    free(node);
+}
+
+static avl_node *
+map_clone_helper
+(
+    map *         mp,
+    avl_node *    node,
+    avl_node *    parent,
+    void          (*key_copier)      (void *dst, const void *src),
+    void          (*value_copier)    (void *dst, const void *src),
+    size_t        threads
+)
+{
+    avl_node *clone = map_create_new_node(node->key, node->value, mp->key_size, mp->value_size);
+
+    if (key_copier != NULL) {
+        key_copier(clone->key, node->key);
+    }
+    if (value_copier != NULL) {
+        value_copier(clone->value, node->value);
+    }
+
+    /* Форма дерева сохраняется, поэтому перебалансировка не нужна */
+    clone->link.balance = node->link.balance;
+    clone->prefix = node->prefix;
+    clone->link.parent = map_node_link(parent);
+
+    if (threads > 1 && map_node_child(node, 0) != NULL && map_node_child(node, 1) != NULL)
+    /* Левое поддерево копирует новый поток, правое - текущий */
+    {
+        map_clone_args args = {.mp = mp, .node = map_node_child(node, 0), .parent = clone, 
+            .key_copier = key_copier, .value_copier = value_copier, .threads = threads / 2};
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, map_clone_thread, &args) != 0)
+        {
+            fprintf(stderr, "map_clone_parallel: не удалось создать поток\n");
+            exit(EXIT_FAILURE);
+        }
+        clone->link.child[1] = map_node_link(map_clone_helper(mp, map_node_child(node, 1), clone, 
+            key_copier, value_copier, threads - threads / 2));
+        pthread_join(thread, NULL);
+        clone->link.child[0] = map_node_link(args.result);
+        return clone;
+    }
+
+    if (map_node_child(node, 0) != NULL) {
+        clone->link.child[0] = map_node_link(map_clone_helper(mp, map_node_child(node, 0), clone, key_copier, value_copier, threads));
+    }
+    if (map_node_child(node, 1) != NULL) {
+        clone->link.child[1] = map_node_link(map_clone_helper(mp, map_node_child(node, 1), clone, key_copier, value_copier, threads));
+    }
+
+    return clone;
+}
+
+static void *
+map_clone_thread
+(
+    void *arg
+)
+{
+    map_clone_args *args = (map_clone_args *)arg;
+    args->result = map_clone_helper(args->mp, args->node, args->parent, args->key_copier, 
+        args->value_copier, args->threads);
+    return NULL;
+}
+
+static bool
+map_unshare_tree
+(
+    map *mp
+)
+{
+    if (!map_tree_shared(mp)) {
+        return false;
+    }
+
+    avl_node *old_root = mp->header.root;
+    mp->header.root = map_clone_helper(mp, old_root, NULL, mp->key_copier, mp->value_copier, 1);
+    map_restore_header_bounds(mp);
+    (mp->version)++;
+    map_find_cache_flush(mp);
+    map_hash_index_rebuild(mp);
+
+    /**
+     * Ссылку на дерево отпускаем только после узлов: пока счётчик больше
+     * единицы, контейнер не считает дерево своим
+     */
+    map_release_node(mp, old_root);
+    if (atomic_fetch_sub(&(mp->tree_ref->count), 1) == 1) {
+        free(mp->tree_ref);
+    }
+    mp->tree_ref = NULL;
+    mp->stale_parents = false;
+
+    return true;
+}
+
+static bool
+map_tree_shared
+(
+    map *mp
+)
+{
+    if (mp->tree_ref == NULL) {
+        return false;
+    }
+    if (atomic_load(&(mp->tree_ref->count)) > 1) {
+        return true;
+    }
+
+    /* Снимков не осталось - дерево снова принадлежит только контейнеру */
+    if (mp->stale_parents)
+    {
+        map_repair_parents(mp->header.root, NULL);
+        mp->stale_parents = false;
+    }
+    free(mp->tree_ref);
+    mp->tree_ref = NULL;
+
+    return false;
+}
+
+static avl_node *
+map_own_path
+(
+    map *           mp,
+    const void *    key,
+    avl_node **     parent,
+    int *           cmp
+)
+{
+    avl_node *node = mp->header.root;
+    *parent = NULL;
+    *cmp = 0;
+
+    while (node != NULL)
+    {
+        /**
+         * Сравниваем до копирования: если key - ключ этого узла, узел может
+         * быть освобождён при копировании, и после него key не читается
+         */
+        int result = map_compare_keys(mp, node->key, key);
+        node = map_own_node(mp, *parent, *cmp < 0);
+        if (result == 0) {
+            return node;
+        }
+
+        *parent = node;
+        *cmp = result;
+        node = map_node_child(node, result < 0);
+    }
+
+    return NULL;
+}
+
+static avl_node *
+map_own_node
+(
+    map *         mp,
+    avl_node *    parent,
+    int           dir
+)
+{
+    avl_node *node = (parent != NULL) ? map_node_child(parent, dir) : mp->header.root;
+    if (node == NULL) {
+        return NULL;
+    }
+
+    if (atomic_load(&(node->refs)) > 1)
+    {
+        node = map_copy_node(mp, node);
+        if (parent != NULL) {
+            parent->link.child[dir] = &(node->link);
+        }
+        else {
+            mp->header.root = node;
+        }
+    }
+    node->link.parent = map_node_link(parent);
+
+    return node;
+}
+
+static void
+map_own_child
+(
+    avl_link *    parent,
+    int           dir,
+    void *        ctx
+)
+{
+    map_own_node((map *)ctx, map_node_of(parent), dir);
+}
+
+static avl_node *
+map_copy_node
+(
+    map *         mp,
+    avl_node *    node
+)
+{
+    avl_node *copy = map_create_new_node(node->key, node->value, mp->key_size, mp->value_size);
+
+    if (mp->key_copier != NULL) {
+        mp->key_copier(copy->key, node->key);
+    }
+    if (mp->value_copier != NULL) {
+        mp->value_copier(copy->value, node->value);
+    }
+
+    copy->link.balance = node->link.balance;
+    copy->prefix = node->prefix;
+    for (int dir = 0; dir < 2; ++dir)
+    {
+        copy->link.child[dir] = node->link.child[dir];
+        if (copy->link.child[dir] != NULL)
+        /* Поле parent ребёнка по-прежнему указывает на node */
+        {
+            atomic_fetch_add(&(map_node_child(copy, dir)->refs), 1);
+            mp->stale_parents = true;
+        }
+    }
+
+    /* Итераторы, курсоры и токены map_scan могут указывать на node */
+    (mp->version)++;
+    map_find_cache_forget(mp, node);
+    map_hash_index_replace(mp, node, copy);
+
+    /* Снимок мог быть освобождён после проверки счётчика ссылок */
+    map_release_node(mp, node);
+
+    return copy;
+}
+
+static void
+map_release_node
+(
+    map *         mp,
+    avl_node *    node
+)
+{
+    if (atomic_fetch_sub(&(node->refs), 1) != 1) {
+        return;
+    }
+
+    for (int dir = 0; dir < 2; ++dir)
+    {
+        if (map_node_child(node, dir) != NULL) {
+            map_release_node(mp, map_node_child(node, dir));
+        }
+    }
+
+    if (mp->key_destroyer != NULL) {
+        mp->key_destroyer(node->key);                
+    }
+    free(node->key);
+
+    if (mp->value_destroyer != NULL) {
+        mp->value_destroyer(node->value);
+    }
+    if (mp->value_size != 0) {
+        free(node->value);
+    }
+
+    free(node);
+}
+
+static void
+map_repair_parents
+(
+    avl_node *    node,
+    avl_node *    parent
+)
+{
+    while (node != NULL)
+    {
+        node->link.parent = map_node_link(parent);
+        map_repair_parents(map_node_child(node, 0), node);
+        parent = node;
+        node = map_node_child(node, 1);
+    }
+}
+
+static void
+map_restore_header_bounds
+(
+    map *mp
+)
+{
+    avl_node *most_left = mp->header.root;
+    avl_node *most_right = mp->header.root;
+    if (most_left != NULL)
+    {
+        while (map_node_child(most_left, 0)) {
+            most_left = map_node_child(most_left, 0);
+        }
+        while (map_node_child(most_right, 1)) {
+            most_right = map_node_child(most_right, 1);
+        }
+    }
+
+    mp->header.most_left = most_left;
+    mp->header.most_right = most_right;
+}
+
+static void
+map_insert_shared
+(
+    map *     mp, 
+    void *    key, 
+    void *    value
+)
+{
+    int cmp;
+    avl_node *parent;
+    avl_node *current = map_own_path(mp, key, &parent, &cmp);
+    /* Крайние узлы могли быть заменены копиями */
+    map_restore_header_bounds(mp);
+
+    if (current != NULL)
+    /* Узел уже скопирован - заменяем значение в копии */
+    {
+        if (mp->value_size != 0) {
+            memcpy(current->value, value, mp->value_size);
+        }
+        return;
+    }
+
+    avl_node *insert_node = map_create_new_node(key, value, mp->key_size, mp->value_size);
+    if (mp->key_prefix != NULL) {
+        insert_node->prefix = mp->key_prefix(key);
+    }
+
+    avl_link_owner owner = {.own = map_own_child, .ctx = mp};
+    avl_link *root = map_node_link(mp->header.root);
+    avl_link_insert_owned(&root, map_node_link(parent), cmp > 0, &(insert_node->link), &owner);
+    mp->header.root = map_node_of(root);
+    map_restore_header_bounds(mp);
+
+    (mp->size)++;
+    (mp->version)++;
+    map_bloom_add(mp, key);
+    map_hash_index_add(mp, insert_node);
+}
+
+static void
+map_erase_shared
+(
+    map *           mp,
+    const void *    key,
+    bool            use_deleters
+)
+{
+    int cmp;
+    avl_node *parent;
+    avl_node *erase_node = map_own_path(mp, key, &parent, &cmp);
+
+    map_find_cache_forget(mp, erase_node);
+    map_hash_index_remove(mp, erase_node);
+
+    avl_link_owner owner = {.own = map_own_child, .ctx = mp};
+    avl_link *root = map_node_link(mp->header.root);
+    avl_link_erase_owned(&root, &(erase_node->link), &owner);
+    mp->header.root = map_node_of(root);
+    map_free_node(mp, erase_node, use_deleters);
+    map_restore_header_bounds(mp);
+
+    (mp->size)--;
+    (mp->version)++;
+    map_bloom_erased(mp);
+}
+
+static void
+map_release_tree
+(
+    map *mp
+)
+{
+    if (mp->small_active)
+    {
+        for (size_t i = 0; i < mp->size; ++i)
+        {
+            if (mp->key_destroyer != NULL) {
+                mp->key_destroyer(map_small_key(mp, i));
+            }
+            if (mp->value_destroyer != NULL) {
+                mp->value_destroyer(map_small_value(mp, i));
+            }
+        }
+        return;
+    }
+
+    if (mp->btree != NULL)
+    {
+        map_btree_clear(mp->btree, mp->key_destroyer, mp->value_destroyer);
+        return;
+    }
+
+    avl_node *root = mp->header.root;
+
+    MAP_PUBLISH(mp->header.root, NULL);
+    mp->header.most_left = NULL;
+    mp->header.most_right = NULL;
+    map_find_cache_flush(mp);
+    if (mp->hash_index != NULL)
+    {
+        memset(mp->hash_index->slots, 0, (mp->hash_index->mask + 1) * sizeof(map_hash_slot));
+        mp->hash_index->count = 0;
+    }
+
+    if (mp->rcu != NULL)
+    /* Дождёмся, пока читатели покинут старое дерево */
+    {
+        map_rcu_synchronize(mp);
+    }
+
+    if (mp->tree_ref != NULL)
+    /* Ссылку на дерево отпускаем после узлов (см. map_tree_shared) */
+    {
+        if (root != NULL) {
+            map_release_node(mp, root);
+        }
+        if (atomic_fetch_sub(&(mp->tree_ref->count), 1) == 1) {
+            free(mp->tree_ref);
+        }
+        mp->tree_ref = NULL;
+        mp->stale_parents = false;
+    }
+    else if (root != NULL) {
+        map_free_helper(mp, root);
+    }
+}
+
+static void
+map_check_writable
+(
+    map *           mp,
+    const char *    func_name
+)
+{
+    if (mp->read_only)
+    {
+        fprintf(stderr, "%s: контейнер является снимком и не может быть изменён\n", func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+map_check_not_btree
+(
+    map *           mp,
+    const char *    func_name
+)
+{
+    if (mp->btree != NULL)
+    {
+        fprintf(stderr, "%s: функция не поддерживается для контейнера на B+-дереве\n", func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+map_check_avl
+(
+    map *           mp,
+    const char *    func_name
+)
+{
+    map_check_not_btree(mp, func_name);
+
+    if (mp->small_keys != NULL)
+    /**
+     * Функция работает с деревом и может подключить к нему состояние (снимки,
+     * индексы, RCU), которое не пережило бы возврата к массиву, поэтому 
+     * контейнер переходит на дерево окончательно
+     */
+    {
+        if (mp->small_active) {
+            map_small_promote(mp);
+        }
+        mp->small_keys = NULL;
+    }
+}
+
+static avl_node *
+map_next_node
+(
+    map *         mp,
+    avl_node *    node
+)
+{
+    if (map_node_child(node, 1) != NULL)
+    {
+        node = map_node_child(node, 1);
+        while (map_node_child(node, 0)) {
+            node = map_node_child(node, 0);
+        }
+        return node;
+    }
+
+    if (mp->stale_parents)
+    /* Следующий узел - последний, от которого спуск к node идёт влево */
+    {
+        avl_node *result = NULL;
+        avl_node *curr_node = mp->header.root;
+        while (curr_node != node)
+        {
+            bool right = map_compare_keys(mp, curr_node->key, node->key) < 0;
+            result = right ? result : curr_node;
+            curr_node = map_node_child(curr_node, right);
+        }
+        return result;
+    }
+
+    while (map_node_parent(node) && map_node_child(map_node_parent(node), 0) != node) {
+        node = map_node_parent(node);
+    }
+    return map_node_parent(node);
+}
+
+static map_iterator
+map_bound_with
+(
+    map *           mp,
+    const void *    probe,
+    int             (*probe_cmp)    (const void *node_key, const void *probe),
+    bool            upper
+)
+{
+    map_iterator_impl iter_impl = {.this_map = mp, .this_node = &(mp->header)};
+
+    if (mp->small_active)
+    {
+        size_t pos = map_small_bound(mp, probe, probe_cmp, upper);
+        if (pos < mp->size) {
+            iter_impl.this_node = map_small_key(mp, pos);
+        }
+        return map_iterator_wrap(iter_impl);
+    }
+
+    if (mp->btree != NULL)
+    {
+        void *slot = map_btree_bound(mp->btree, probe, probe_cmp, upper);
+        if (slot != NULL) {
+            iter_impl.this_node = slot;
+        }
+        return map_iterator_wrap(iter_impl);
+    }
+
+    avl_node *curr_elem = mp->header.root;
+    while (curr_elem != NULL)
+    {
+        MAP_PREFETCH_CHILDREN(curr_elem);
+        int cmp = probe_cmp(curr_elem->key, probe);
+        /* Если узел подходит, ищем меньший подходящий в левом поддереве */
+        bool right = cmp < 0 || (cmp == 0 && upper);
+        iter_impl.this_node = right ? iter_impl.this_node : curr_elem;
+        curr_elem = map_node_child(curr_elem, right);
+    }
+
+    return map_iterator_wrap(iter_impl);
+}
+
+static map_key_kind
+map_detect_key_kind
+(
+    int    (*compare_func)    (const void *f, const void *s)
+)
+{
+    if (compare_func == MAP_KEY_I32) {
+        return MAP_KEY_KIND_I32;
+    }
+    else if (compare_func == MAP_KEY_U64) {
+        return MAP_KEY_KIND_U64;
+    }
+    else if (compare_func == MAP_KEY_CSTR) {
+        return MAP_KEY_KIND_CSTR;
+    }
+    else if (compare_func == MAP_KEY_BYTES) {
+        return MAP_KEY_KIND_BYTES;
+    }
+    return MAP_KEY_KIND_CUSTOM;
+}
+
+static inline int
+map_compare_keys
+(
+    map *           mp,
+    const void *    f,
+    const void *    s
+)
+{
+    switch (mp->key_kind)
+    {
+        case MAP_KEY_KIND_I32:
+            return map_key_compare_i32(f, s);
+        case MAP_KEY_KIND_U64:
+            return map_key_compare_u64(f, s);
+        case MAP_KEY_KIND_CSTR:
+            return map_key_compare_cstr(f, s);
+        case MAP_KEY_KIND_BYTES:
+            return map_compare_bytes(f, s, mp->key_size);
+        default:
+            return mp->compare_func(f, s);
+    }
+}
+
+static inline uint64_t
+map_load_be64
+(
+    const void *p
+)
+{
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+static inline int
+map_compare_bytes
+(
+    const void *    f,
+    const void *    s,
+    size_t          size
+)
+{
+    if (size == 8 || size == 16)
+    {
+        uint64_t word_f = map_load_be64(f);
+        uint64_t word_s = map_load_be64(s);
+        if (word_f == word_s && size == 16)
+        {
+            word_f = map_load_be64((const uint8_t *)f + 8);
+            word_s = map_load_be64((const uint8_t *)s + 8);
+        }
+        return (word_f > word_s) - (word_f < word_s);
+    }
+    return memcmp(f, s, size);
+}
+
+static void
+map_key_encode_bytes
+(
+    map_key_encoder *    enc,
+    const uint8_t *      bytes,
+    size_t               size
+)
+{
+    if (enc->pos + size > enc->size)
+    {
+        fprintf(stderr, "map_key_encode: поле не помещается в ключ\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(enc->buf + enc->pos, bytes, size);
+    enc->pos += size;
+}
+
+/**
+ * Цикл спуска map_descend. COMPARE(node_key) - выражение, сравнивающее ключ
+ * узла с искомым ключом
+ * 
+ * Ребёнок выбирается индексом по знаку сравнения, поэтому единственное 
+ * ветвление цикла - выход при совпадении, и оно хорошо предсказывается
+ */
+#define MAP_DESCEND_LOOP(COMPARE)                       \
+    while (current != NULL)                             \
+    {                                                   \
+        MAP_PREFETCH_CHILDREN(current);                 \
+        *parent = current;                              \
+        *cmp = COMPARE(current->key);                   \
+        if (*cmp == 0) {                                \
+            break;                                      \
+        }                                               \
+        current = map_node_child(current, *cmp < 0);    \
+    }
+
+#define MAP_COMPARE_I32(node_key) map_key_compare_i32(node_key, key)
+#define MAP_COMPARE_U64(node_key) map_key_compare_u64(node_key, key)
+#define MAP_COMPARE_CSTR(node_key) strcmp(*(const char * const *)(node_key), key_str)
+#define MAP_COMPARE_BYTES(node_key) map_compare_bytes(node_key, key, key_size)
+#define MAP_COMPARE_CUSTOM(node_key) compare_func(node_key, key)
+#define MAP_COMPARE_PREFIXED(node_key) (current->prefix != key_prefix \
+    ? (current->prefix < key_prefix ? -1 : 1) : map_compare_keys(mp, node_key, key))
+
+static avl_node *
+map_descend
+(
+    map *           mp,
+    const void *    key,
+    avl_node **     parent,
+    int *           cmp
+)
+{
+    avl_node *current = mp->header.root;
+    *parent = NULL;
+    *cmp = 0;
+
+    if (mp->key_prefix != NULL)
+    /* Ключи сравниваются целиком, только если префиксы совпали */
+    {
+        uint64_t key_prefix = mp->key_prefix(key);
+        MAP_DESCEND_LOOP(MAP_COMPARE_PREFIXED)
+        return current;
+    }
+
+    switch (mp->key_kind)
+    {
+        case MAP_KEY_KIND_I32:
+            MAP_DESCEND_LOOP(MAP_COMPARE_I32)
+            break;
+        case MAP_KEY_KIND_U64:
+            MAP_DESCEND_LOOP(MAP_COMPARE_U64)
+            break;
+        case MAP_KEY_KIND_CSTR:
+        {
+            const char *key_str = *(const char * const *)key;
+            MAP_DESCEND_LOOP(MAP_COMPARE_CSTR)
+            break;
+        }
+        case MAP_KEY_KIND_BYTES:
+        {
+            size_t key_size = mp->key_size;
+            MAP_DESCEND_LOOP(MAP_COMPARE_BYTES)
+            break;
+        }
+        default:
+        {
+            int (*compare_func)(const void *f, const void *s) = mp->compare_func;
+            MAP_DESCEND_LOOP(MAP_COMPARE_CUSTOM)
+            break;
+        }
+    }
+
+    return current;
+}
+
+static avl_node *
+map_prev_node
+(
+    map *         mp,
+    avl_node *    node
+)
+{
+    if (map_node_child(node, 0) != NULL)
+    {
+        node = map_node_child(node, 0);
+        while (map_node_child(node, 1)) {
+            node = map_node_child(node, 1);
+        }
+        return node;
+    }
+
+    if (mp->stale_parents)
+    {
+        avl_node *result = NULL;
+        avl_node *curr_node = mp->header.root;
+        while (curr_node != node)
+        {
+            bool right = map_compare_keys(mp, curr_node->key, node->key) < 0;
+            result = right ? curr_node : result;
+            curr_node = map_node_child(curr_node, right);
+        }
+        return result;
+    }
+
+    while (map_node_parent(node) && map_node_child(map_node_parent(node), 1) != node) {
+        node = map_node_parent(node);
+    }
+    return map_node_parent(node);
+}
+
+static avl_node *
+map_lower_bound_node
+(
+    map *           mp,
+    const void *    key
+)
+{
+    avl_node *result = NULL;
+    avl_node *curr_node = mp->header.root;
+
+    while (curr_node != NULL)
+    {
+        MAP_PREFETCH_CHILDREN(curr_node);
+        int cmp = map_compare_keys(mp, curr_node->key, key);
+        if (cmp == 0) {
+            return curr_node;
+        }
+        result = (cmp > 0) ? curr_node : result;
+        curr_node = map_node_child(curr_node, cmp < 0);
+    }
+
+    return result;
+}
+
+static avl_node *
+map_finger_lower_bound
+(
+    map *           mp,
+    avl_node *      finger,
+    const void *    key
+)
+{
+    int cmp = map_compare_keys(mp, finger->key, key);
+    if (cmp == 0) {
+        return finger;
+    }
+
+    /**
+     * right == true - key больше ключа finger. Поднимаемся, пока узел лежит 
+     * в поддереве child[right] своего родителя (ключ родителя с той же стороны
+     * от key, что и ключ узла) или пока ключ родителя по ту же сторону от key.
+     * Останавливаемся на первом родителе, ключ которого ограничивает поддерево 
+     * узла с другой стороны от key
+     */
+    bool right = cmp < 0;
+    avl_node *node = finger;
+    /**
+     * Предок, который окажется ответом, если в поддереве нет ключей, не 
+     * меньших key (только при подъёме вправо)
+     */
+    avl_node *result = NULL;
+    while (node->link.parent != NULL)
+    {
+        avl_node *parent = map_node_parent(node);
+        if (map_node_child(parent, right) != node)
+        {
+            cmp = map_compare_keys(mp, parent->key, key);
+            if (right && cmp >= 0)
+            {
+                result = parent;
+                break;
+            }
+            if (!right && cmp < 0) {
+                break;
+            }
+        }
+        node = parent;
+    }
 
-/**
- * Определения основных функций (API) (начало)
- */
+    while (node != NULL)
+    {
+        cmp = map_compare_keys(mp, node->key, key);
+        if (cmp == 0) {
+            return node;
+        }
+        result = (cmp > 0) ? node : result;
+        node = map_node_child(node, cmp < 0);
+    }
 
+    return result;
+}
 
-map *
-map_create
+static void
+map_free_node
 (
-    uint16_t    key_size, 
-    uint16_t    value_size, 
-    int         (*compare_func)       (const void *f, const void *s),
-    void        (*key_destroyer)      (void *key),
-    void        (*value_destroyer)    (void *value)
+    map *         mp,
+    avl_node *    node,
+    bool          use_deleters
 )
 {
-    if (compare_func == NULL)
+    if (mp->rcu != NULL)
     {
-        fprintf(stderr, "map_create: в качестве аргумента передан нулевой указатель\n");
-        exit(EXIT_FAILURE);
+        map_rcu_retire(mp, node, node->key, node->value, use_deleters);
+        return;
     }
 
-    map *mp = (map *)malloc(sizeof(map));
-    if (mp == NULL)
+    if (use_deleters)
     {
-        perror("");
-        exit(EXIT_FAILURE);
+        if (mp->key_destroyer != NULL) {
+            mp->key_destroyer(node->key);                
+        }
+        if (mp->value_destroyer != NULL) {
+            mp->value_destroyer(node->value);
+        }   
     }
 
-    *mp = (map) 
-    {
-        .header.root = NULL,
-        .header.most_left = NULL,
-        .header.most_right = NULL,
-        .key_size = key_size,
-        .value_size = value_size,
-        .compare_func = compare_func,
-        .key_destroyer = key_destroyer,
-        .value_destroyer = value_destroyer,
-        .size = 0
-    };
-
-    return mp;
+    free(node->key);
+    if (mp->value_size != 0) {
+        free(node->value);
+    }
+    free(node);
 }
 
-void
-map_free
+static avl_node *
+map_find_cached
 (
-    map *mp
+    map *           mp,
+    const void *    key
 )
 {
-    if (mp == NULL)
+    map_find_cache *cache = mp->find_cache;
+    uint64_t hash = cache->key_hash(key);
+    map_find_cache_set *set = cache->sets + (hash & cache->mask);
+
+    for (size_t i = 0; i < MAP_FIND_CACHE_WAYS; ++i)
     {
-        fprintf(stderr, "map_free: в качестве аргумента передан нулевой указатель\n");
-        exit(EXIT_FAILURE);
+        if (set->node[i] != NULL && set->hash[i] == hash 
+            && map_compare_keys(mp, set->node[i]->key, key) == 0)
+        {
+            (cache->hits)++;
+            return set->node[i];
+        }
     }
+    (cache->misses)++;
 
-    if (mp->header.root != NULL) {
-        map_free_helper(mp, mp->header.root);
+    avl_node *parent;
+    int cmp;
+    avl_node *node = map_descend(mp, key, &parent, &cmp);
+    if (node == NULL) {
+        return NULL;
     }
 
-    free(mp);
+    memmove(set->hash + 1, set->hash, (MAP_FIND_CACHE_WAYS - 1) * sizeof(uint64_t));
+    memmove(set->node + 1, set->node, (MAP_FIND_CACHE_WAYS - 1) * sizeof(avl_node *));
+    set->hash[0] = hash;
+    set->node[0] = node;
+
+    return node;
 }
 
-size_t 
-map_size
+static void
+map_find_cache_forget
 (
-    map *mp
+    map *         mp,
+    avl_node *    node
 )
 {
-    if (mp == NULL)
-    {
-        fprintf(stderr, "map_size: в качестве аргумента передан нулевой указатель\n");
-        exit(EXIT_FAILURE);
+    map_find_cache *cache = mp->find_cache;
+    if (cache == NULL) {
+        return;
     }
 
-    return mp->size;
+    map_find_cache_set *set = cache->sets + (cache->key_hash(node->key) & cache->mask);
+    for (size_t i = 0; i < MAP_FIND_CACHE_WAYS; ++i)
+    {
+        if (set->node[i] == node) {
+            set->node[i] = NULL;
+        }
+    }
 }
 
-bool
-map_empty
+static void
+map_find_cache_flush
 (
     map *mp
 )
 {
-    if (mp == NULL)
-    {
-        fprintf(stderr, "map_empty: в качестве аргумента передан нулевой указатель\n");
-        exit(EXIT_FAILURE);
+    if (mp->find_cache != NULL) {
+        memset(mp->find_cache->sets, 0, (mp->find_cache->mask + 1) * sizeof(map_find_cache_set));
     }
-
-    return (mp->size == 0 ? true : false);
 }
 
-void 
-_map_insert
+static void
+map_bloom_rebuild
 (
-    map *     mp, 
-    void *    key, 
-    void *    value
+    map *mp
 )
 {
-    if (mp == NULL || key == NULL || value == NULL)
-    {
-        fprintf(stderr, "map_insert: в качестве аргумента передан нулевой указатель\n");
-        exit(EXIT_FAILURE);
+    map_bloom *bloom = mp->bloom;
+
+    size_t capacity = MAP_BLOOM_KEYS_PER_BLOCK;
+    while (capacity < 2 * mp->size) {
+        capacity <<= 1;
     }
+    size_t blocks_count = capacity / MAP_BLOOM_KEYS_PER_BLOCK;
+    size_t bytes = blocks_count * MAP_BLOOM_BLOCK_WORDS * sizeof(uint64_t);
 
-    /**
-     * Если true - вставляем элемент, в противном случае элемент с ключом key
-     * в дереве уже есть и мы просто заменяем старое значение (value) на новое
-     */
-    bool insert = true;
-    /**
-     * Результат сравнения ключа узла из дерева со вставляемым ключом
-     */
-    int cmp;
-    avl_node *parent = NULL;
-    avl_node *current = mp->header.root;
-    while (current) 
+    if (bloom->blocks == NULL || bloom->mask + 1 != blocks_count)
     {
-        parent = current;
-
-        cmp = mp->compare_func(current->key, key);
-
-        if (cmp < 0) {
-            current = current->right_child;
-        }
-        else if (cmp > 0) {
-            current = current->left_child;
-        }
-        else
+        free(bloom->blocks);
+        bloom->blocks = (uint64_t *)aligned_alloc(64, bytes);
+        if (bloom->blocks == NULL)
         {
-            memcpy(current->value, value, mp->value_size);
-            insert = false;
-            break;
+            perror("");
+            exit(EXIT_FAILURE);
         }
+        bloom->mask = blocks_count - 1;
     }
+    memset(bloom->blocks, 0, bytes);
+    bloom->capacity = capacity;
+    bloom->erased = 0;
 
-    if (insert)
-    /**
-     * Вставляем элемент (либо дерево пустое, либо элемент с ключом key
-     * в дереве не обнаружен)
-     */
+    /* Добавление не вызывает перестроение: capacity вдвое больше size */
+    if (mp->small_active)
     {
-        avl_node *insert_node = map_create_new_node(key, value, mp->key_size, mp->value_size);
-        map_restore_header_properties_after_insert(mp, insert_node);
-
-        if (parent != NULL)
-        {
-            if (cmp < 0) 
-            {
-                parent->right_child = insert_node;
-                if (insert_node->key > mp->header.most_right->key) {
-                    mp->header.most_right = insert_node;
-                }
-            }
-            else 
-            {
-                parent->left_child = insert_node;
-                if (insert_node->key < mp->header.most_left->key) {
-                    mp->header.most_left = insert_node;
-                }
-            }
-            insert_node->parent = parent;
+        for (size_t i = 0; i < mp->size; ++i) {
+            map_bloom_add(mp, map_small_key(mp, i));
+        }
+    }
+    else if (mp->btree != NULL)
+    {
+        for (void *slot = map_btree_first(mp->btree); slot != NULL; slot = map_btree_next(mp->btree, slot)) {
+            map_bloom_add(mp, slot);
+        }
+    }
+    else
+    {
+        for (avl_node *node = mp->header.most_left; node != NULL; node = map_next_node(mp, node)) {
+            map_bloom_add(mp, node->key);
         }
-    
-        (mp->size)++;
-
-        map_restore_properties_after_insert(mp, insert_node);
     }
 }
 
-void 
-_map_erase
+static void
+map_bloom_add
 (
-    map *           mp, 
-    map_iterator    iter,
-    bool            use_deleters
+    map *           mp,
+    const void *    key
 )
 {
-    if (mp == NULL)
-    {
-        fprintf(stderr, "map_erase: в качестве аргумента передан нулевой указатель\n");
-        exit(EXIT_FAILURE);
+    map_bloom *bloom = mp->bloom;
+    if (bloom == NULL) {
+        return;
     }
-
-    /* Удостоверимся, что итератор принадлежит данному дереву */
-    map_iterator_impl input_iter_impl = *(map_iterator_impl *)&iter;
-
-    map_iterator find_elem = _map_find(mp, ((avl_node *)(input_iter_impl.this_node))->key);
-    if (map_iterator_compare(find_elem, map_iterator_end(mp)) == 0) 
+    if (mp->size > bloom->capacity)
     {
-        fprintf(stderr, "map_erase: итератор iter не принадлежит контейнеру\n");
-        exit(EXIT_FAILURE);
+        map_bloom_rebuild(mp);
+        return;
     }
-    else if (map_iterator_compare(iter, find_elem) != 0)
+
+    uint64_t hash = bloom->key_hash(key);
+    uint64_t *block = bloom->blocks + (hash & bloom->mask) * MAP_BLOOM_BLOCK_WORDS;
+    /* Номера бит в блоке - 9-битные части другой перемешанной копии хеша */
+    uint64_t bits = hash * 0x9E3779B97F4A7C15ull;
+    for (int i = 0; i < MAP_BLOOM_HASHES; ++i)
     {
-        fprintf(stderr, "map_erase: итератор iter не принадлежит контейнеру\n");
-        exit(EXIT_FAILURE);   
+        unsigned bit = (unsigned)(bits >> (64 - 9 * (i + 1))) & 511;
+        block[bit >> 6] |= (uint64_t)1 << (bit & 63);
     }
+}
 
-    /* Дошли до сюда - всё ок */
-
-    map_iterator_impl find_iter_impl = *(map_iterator_impl *)&find_elem;
-    avl_node *erase_node = find_iter_impl.this_node;
-    map_restore_header_properties_after_erase(mp, erase_node);
-
-    avl_node *parent;
+static void
+map_bloom_erased
+(
+    map *mp
+)
+{
+    map_bloom *bloom = mp->bloom;
+    if (bloom != NULL && ++(bloom->erased) > bloom->capacity / 4) {
+        map_bloom_rebuild(mp);
+    }
+}
 
-    if (erase_node->left_child == NULL && erase_node->right_child == NULL) {
-        parent = map_erase_case_no_children(mp, erase_node, use_deleters);
-    }  
-    else if (erase_node->left_child != NULL && erase_node->right_child != NULL) {
-        parent = map_erase_case_two_children(mp, erase_node, use_deleters);
-    }                                         
-    else {
-        parent = map_erase_case_one_children(mp, erase_node, use_deleters);
-    }       
-    
-    (mp->size)--;
-    map_restore_properties_after_erase(mp, parent);
+static inline bool
+map_bloom_may_contain
+(
+    map_bloom *     bloom,
+    const void *    key
+)
+{
+    uint64_t hash = bloom->key_hash(key);
+    const uint64_t *block = bloom->blocks + (hash & bloom->mask) * MAP_BLOOM_BLOCK_WORDS;
+    uint64_t bits = hash * 0x9E3779B97F4A7C15ull;
+    bool found = true;
+    for (int i = 0; i < MAP_BLOOM_HASHES; ++i)
+    {
+        unsigned bit = (unsigned)(bits >> (64 - 9 * (i + 1))) & 511;
+        found &= (block[bit >> 6] >> (bit & 63)) & 1;
+    }
+    return found;
 }
 
-void
-map_clear
+static void
+map_hash_index_rebuild
 (
     map *mp
 )
 {
-    if (mp == NULL)
+    map_hash_index *index = mp->hash_index;
+    if (index == NULL) {
+        return;
+    }
+
+    size_t slots_count = MAP_HASH_INDEX_MIN_SLOTS;
+    while (slots_count < 2 * mp->size) {
+        slots_count <<= 1;
+    }
+
+    free(index->slots);
+    index->slots = (map_hash_slot *)calloc(slots_count, sizeof(map_hash_slot));
+    if (index->slots == NULL)
     {
-        fprintf(stderr, "map_clear: в качестве аргумента передан нулевой указатель\n");
+        perror("");
         exit(EXIT_FAILURE);
     }
+    index->mask = slots_count - 1;
+    index->count = 0;
 
-    if (mp->header.root != NULL) {
-        map_free_helper(mp, mp->header.root);
-    }    
-
-    mp->header.root = NULL;
-    mp->header.most_left = NULL;
-    mp->header.most_right = NULL;
-    mp->size = 0;
+    for (avl_node *node = mp->header.most_left; node != NULL; node = map_next_node(mp, node)) {
+        map_hash_index_add(mp, node);
+    }
 }
 
-void 
-_map_iterator_next
+static avl_node *
+map_hash_index_find
 (
-    map *             mp, 
-    map_iterator *    iter
+    map_hash_index *    index,
+    map *               mp,
+    const void *        key
 )
 {
-    if (iter == NULL)
+    uint64_t hash = index->key_hash(key);
+    for (size_t i = hash & index->mask; index->slots[i].node != NULL; i = (i + 1) & index->mask)
     {
-        fprintf(stderr, "map_iterator_next_elem: в качестве аргумента передан нулевой указатель\n");
-        exit(EXIT_FAILURE);
+        if (index->slots[i].hash == hash && map_compare_keys(mp, index->slots[i].node->key, key) == 0) {
+            return index->slots[i].node;
+        }
     }
- 
-    map_iterator_impl *implementation_of_iter = (map_iterator_impl *)iter;
-    avl_node *curr_node = (avl_node *)(implementation_of_iter->this_node);
+    return NULL;
+}
 
-    if (map_iterator_compare(*iter, map_iterator_last(mp)) == 0) {
-        curr_node = (avl_node *)((void *)(&(mp->header)));
+static void
+map_hash_index_add
+(
+    map *         mp,
+    avl_node *    node
+)
+{
+    map_hash_index *index = mp->hash_index;
+    if (index == NULL) {
+        return;
     }
-    else if (map_iterator_compare(*iter, map_iterator_end(mp)) == 0) 
+    if (2 * (index->count + 1) > index->mask + 1)
+    /* Узел уже в дереве, поэтому перестроение добавит и его */
     {
-        fprintf(stderr, "map_iterator_next_elem: произведена попытка выйти за границы контейнера\n");
-        exit(EXIT_FAILURE);
+        map_hash_index_rebuild(mp);
+        return;
+    }
+
+    uint64_t hash = index->key_hash(node->key);
+    size_t i = hash & index->mask;
+    while (index->slots[i].node != NULL) {
+        i = (i + 1) & index->mask;
+    }
+    index->slots[i] = (map_hash_slot){.hash = hash, .node = node};
+    (index->count)++;
+}
+
+static void
+map_hash_index_remove
+(
+    map *         mp,
+    avl_node *    node
+)
+{
+    map_hash_index *index = mp->hash_index;
+    if (index == NULL) {
+        return;
+    }
+
+    size_t i = index->key_hash(node->key) & index->mask;
+    while (index->slots[i].node != node) {
+        i = (i + 1) & index->mask;
     }
-    else if (curr_node->right_child)
+
+    /**
+     * Сдвигаем назад элементы цепочки, которые не могут стоять в своём
+     * начальном слоте или между ним и освободившимся слотом i
+     */
+    for (size_t j = (i + 1) & index->mask; index->slots[j].node != NULL; j = (j + 1) & index->mask)
     {
-        curr_node = curr_node->right_child;
-        while (curr_node->left_child) {
-            curr_node = curr_node->left_child;
+        size_t home = index->slots[j].hash & index->mask;
+        bool movable = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+        if (movable)
+        {
+            index->slots[i] = index->slots[j];
+            i = j;
         }
     }
-    else
+    index->slots[i].node = NULL;
+    (index->count)--;
+}
+
+static void
+map_hash_index_replace
+(
+    map *         mp,
+    avl_node *    node,
+    avl_node *    copy
+)
+{
+    map_hash_index *index = mp->hash_index;
+    if (index == NULL) {
+        return;
+    }
+
+    size_t i = index->key_hash(node->key) & index->mask;
+    while (index->slots[i].node != node) {
+        i = (i + 1) & index->mask;
+    }
+    index->slots[i].node = copy;
+}
+
+static inline size_t
+map_small_values_offset
+(
+    size_t key_size
+)
+{
+    return (MAP_SMALL_CAPACITY * key_size + 15) & ~(size_t)15;
+}
+
+static inline uint8_t *
+map_small_key
+(
+    map *     mp,
+    size_t    i
+)
+{
+    return mp->small_keys + i * mp->key_size;
+}
+
+static inline uint8_t *
+map_small_value
+(
+    map *     mp,
+    size_t    i
+)
+{
+    return mp->small_keys + map_small_values_offset(mp->key_size) + i * mp->value_size;
+}
+
+static size_t
+map_small_bound
+(
+    map *           mp,
+    const void *    probe,
+    int             (*probe_cmp)    (const void *node_key, const void *probe),
+    bool            upper
+)
+{
+    /* Не больше 16 ключей подряд - линейный поиск не уступает двоичному */
+    size_t i = 0;
+    for (; i < mp->size; ++i)
     {
-        while (curr_node->parent && curr_node->parent->left_child != curr_node) {
-            curr_node = curr_node->parent;
+        int cmp = (probe_cmp != NULL) ? probe_cmp(map_small_key(mp, i), probe)
+            : map_compare_keys(mp, map_small_key(mp, i), probe);
+        if (cmp > 0 || (cmp == 0 && !upper)) {
+            break;
         }
-        curr_node = curr_node->parent;
     }
+    return i;
+}
 
-    implementation_of_iter->this_node = curr_node;
-}   
+static size_t
+map_small_range
+(
+    map *           mp,
+    const void *    lo,
+    const void *    hi,
+    size_t *        begin
+)
+{
+    *begin = (lo != NULL) ? map_small_bound(mp, lo, NULL, false) : 0;
+    return (hi != NULL) ? map_small_bound(mp, hi, NULL, false) : mp->size;
+}
 
-void 
-_map_iterator_prev
+static void
+map_small_copy
 (
-    map *             mp, 
-    map_iterator *    iter
+    map *    mp,
+    map *    copy,
+    void     (*key_copier)      (void *dst, const void *src),
+    void     (*value_copier)    (void *dst, const void *src)
 )
 {
-    if (iter == NULL)
-    {
-        fprintf(stderr, "map_iterator_next_elem: в качестве аргумента передан нулевой указатель\n");
-        exit(EXIT_FAILURE);
-    }
- 
-    map_iterator_impl *implementation_of_iter = (map_iterator_impl *)iter;
-    avl_node *curr_node = implementation_of_iter->this_node;
+    memcpy(copy->small_keys, mp->small_keys, mp->size * mp->key_size);
+    memcpy(map_small_value(copy, 0), map_small_value(mp, 0), mp->size * mp->value_size);
 
-    if (map_iterator_compare(*iter, map_iterator_end(mp)) == 0) {
-        curr_node = mp->header.most_right;
-    }
-    else if (map_iterator_compare(*iter, map_iterator_first(mp)) == 0) 
+    for (size_t i = 0; i < mp->size; ++i)
     {
-        fprintf(stderr, "map_iterator_prev: произведена попытка выйти за границы контейнера\n");
-        exit(EXIT_FAILURE);
-    }
-    else if (curr_node->left_child)
-    {
-        curr_node = curr_node->left_child;
-        while (curr_node->right_child) {
-            curr_node = curr_node->right_child;
+        if (key_copier != NULL) {
+            key_copier(map_small_key(copy, i), map_small_key(mp, i));
         }
-    }
-    else
-    {
-        while (curr_node->parent && curr_node->parent->right_child != curr_node) {
-            curr_node = curr_node->parent;
+        if (value_copier != NULL) {
+            value_copier(map_small_value(copy, i), map_small_value(mp, i));
         }
-        curr_node = curr_node->parent;
     }
 
-    implementation_of_iter->this_node = curr_node;
+    copy->size = mp->size;
 }
 
-int 
-map_iterator_compare
+static bool
+map_small_insert
 (
-    map_iterator f, 
-    map_iterator s
+    map *           mp,
+    const void *    key,
+    const void *    value
 )
 {
-    map_iterator_impl iter_impl_f = *(map_iterator_impl *)&f;
-    map_iterator_impl iter_impl_s = *(map_iterator_impl *)&s;
+    size_t pos = map_small_bound(mp, key, NULL, false);
+    if (pos < mp->size && map_compare_keys(mp, map_small_key(mp, pos), key) == 0)
+    {
+        memcpy(map_small_value(mp, pos), value, mp->value_size);
+        return true;
+    }
 
-    return (!(iter_impl_f.this_map == iter_impl_s.this_map
-        && iter_impl_f.this_node == iter_impl_s.this_node));
+    if (mp->size < MAP_SMALL_CAPACITY)
+    {
+        memmove(map_small_key(mp, pos + 1), map_small_key(mp, pos), (mp->size - pos) * mp->key_size);
+        memmove(map_small_value(mp, pos + 1), map_small_value(mp, pos), (mp->size - pos) * mp->value_size);
+        memcpy(map_small_key(mp, pos), key, mp->key_size);
+        memcpy(map_small_value(mp, pos), value, mp->value_size);
+
+        (mp->size)++;
+        (mp->version)++;
+        map_bloom_add(mp, key);
+        return true;
+    }
+
+    /* Массив заполнен - переносим элементы в дерево */
+    map_small_promote(mp);
+    return false;
 }
 
-map_iterator 
-_map_find
+static void
+map_small_promote
 (
-    map *     mp, 
-    void *    key
+    map *mp
 )
 {
-    if (mp == NULL || key == NULL)
-    {
-        fprintf(stderr, "map_find: в качестве аргумента передан нулевой указатель\n");
-        exit(EXIT_FAILURE);
+    /* Массив уже отсортирован и не содержит повторов */
+    size_t order[MAP_SMALL_CAPACITY];
+    for (size_t i = 0; i < mp->size; ++i) {
+        order[i] = i;
     }
 
-    map_iterator_impl iter_impl = {.this_map = mp, .this_node = NULL};
+    avl_node *root = map_build_subtree(mp, mp->small_keys, map_small_value(mp, 0), order, 0, mp->size, NULL, 1);
 
-    avl_node *curr_elem = mp->header.root;
-    while (curr_elem != NULL)
+    avl_node *most_left = root;
+    avl_node *most_right = root;
+    if (root != NULL)
     {
-        int result_of_compare_func = mp->compare_func(curr_elem->key, key);
-        if (result_of_compare_func < 0) {
-            curr_elem = curr_elem->right_child;
+        while (map_node_child(most_left, 0)) {
+            most_left = map_node_child(most_left, 0);
         }
-        else if (result_of_compare_func > 0) {
-            curr_elem = curr_elem->left_child;
+        while (map_node_child(most_right, 1)) {
+            most_right = map_node_child(most_right, 1);
         }
-        else
-        {
-            iter_impl.this_node = curr_elem;
-            break;
-        }
-    }   
-    if (curr_elem == NULL) {
-        iter_impl.this_node = &(mp->header);
     }
-    return *(map_iterator *)&iter_impl;
+
+    mp->header.root = root;
+    mp->header.most_left = most_left;
+    mp->header.most_right = most_right;
+    mp->small_active = false;
+    (mp->version)++;
 }
 
-map_iterator 
-map_iterator_first
+static void
+map_small_demote
 (
     map *mp
 )
 {
-    if (mp == NULL)
-    {
-        fprintf(stderr, "map_iterator_first: в качестве аргумента передан нулевой указатель\n");
-        exit(EXIT_FAILURE);
-    }
-
-    if (mp->size == 0) {
-        return map_iterator_end(mp);
-    }
+    size_t pos = 0;
+    map_small_demote_helper(mp, mp->header.root, &pos);
 
-    map_iterator_impl iter_impl = {.this_map = mp, .this_node = mp->header.most_left};
-    return *((map_iterator *)&iter_impl);
+    mp->header.root = NULL;
+    mp->header.most_left = NULL;
+    mp->header.most_right = NULL;
+    mp->small_active = true;
+    (mp->version)++;
 }
 
-map_iterator 
-map_iterator_last
+static void
+map_small_demote_helper
 (
-    map *mp
+    map *         mp,
+    avl_node *    node,
+    size_t *      pos
 )
 {
-    if (mp == NULL)
-    {
-        fprintf(stderr, "map_iterator_last в качестве аргумента передан нулевой указатель\n");
-        exit(EXIT_FAILURE);
+    if (node == NULL) {
+        return;
     }
 
-    if (mp->size == 0) {
-        return map_iterator_end(mp);
+    map_small_demote_helper(mp, map_node_child(node, 0), pos);
+    memcpy(map_small_key(mp, *pos), node->key, mp->key_size);
+    memcpy(map_small_value(mp, *pos), node->value, mp->value_size);
+    (*pos)++;
+    map_small_demote_helper(mp, map_node_child(node, 1), pos);
+
+    free(node->key);
+    if (mp->value_size != 0) {
+        free(node->value);
     }
+    free(node);
+}
 
-    map_iterator_impl iter_impl = {.this_map = mp, .this_node = mp->header.most_right};
-    return *((map_iterator *)&iter_impl);
+static inline uint64_t
+map_hash_mix
+(
+    uint64_t x
+)
+{
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDull;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ull;
+    x ^= x >> 33;
+    return x;
 }
 
-map_iterator 
-map_iterator_end
+static void
+map_rcu_retire
 (
-    map *mp
+    map *         mp,
+    avl_node *    node,
+    void *        key,
+    void *        value,
+    bool          use_deleters
 )
 {
-    if (mp == NULL)
+    map_rcu_garbage *garbage = (map_rcu_garbage *)malloc(sizeof(map_rcu_garbage));
+    if (garbage == NULL)
     {
-        fprintf(stderr, "map_iterator_end в качестве аргумента передан нулевой указатель\n");
+        perror("");
         exit(EXIT_FAILURE);
     }
 
-    map_iterator_impl iter_impl = {.this_map = mp, .this_node = &(mp->header)};
-    return *((map_iterator *)(&iter_impl));
-}
+    *garbage = (map_rcu_garbage)
+    {
+        .next = NULL,
+        .epoch = atomic_load_explicit(&(mp->rcu->epoch), memory_order_relaxed),
+        .node = node,
+        .key = key,
+        .value = value,
+        .use_deleters = use_deleters
+    };
 
+    if (mp->rcu->garbage_tail != NULL) {
+        mp->rcu->garbage_tail->next = garbage;
+    }
+    else {
+        mp->rcu->garbage_head = garbage;
+    }
+    mp->rcu->garbage_tail = garbage;
+}
 
-void *
-_map_iterator_get_key
+static void
+map_rcu_write_begin
 (
-    map_iterator iter
+    map *mp
 )
 {
-    map_iterator_impl iter_impl = *(map_iterator_impl *)&iter;
+    if (mp->rcu == NULL) {
+        return;
+    }
 
-    return ((avl_node *)(iter_impl.this_node))->key;
+    size_t seq = atomic_load_explicit(&(mp->rcu->seq), memory_order_relaxed);
+    atomic_store_explicit(&(mp->rcu->seq), seq + 1, memory_order_relaxed);
+    /* Читатель, увидевший любое последующее изменение, увидит и нечётный счётчик */
+    atomic_thread_fence(memory_order_release);
 }
 
-void *
-_map_iterator_get_value
+static void
+map_rcu_write_end
 (
-    map_iterator iter
+    map *mp
 )
 {
-    map_iterator_impl iter_impl = *(map_iterator_impl *)&iter;
+    if (mp->rcu == NULL) {
+        return;
+    }
 
-    return ((avl_node *)(iter_impl.this_node))->value;
-}
+    size_t seq = atomic_load_explicit(&(mp->rcu->seq), memory_order_relaxed);
+    atomic_store_explicit(&(mp->rcu->seq), seq + 1, memory_order_release);
 
+    if (mp->rcu->garbage_head == NULL) {
+        return;
+    }
 
-/**
- * Определения основных функций (API) (конец)
- */
+    /**
+     * Объект, исключённый в эпоху e, могут видеть только читатели, вошедшие
+     * в эпоху не позже e. Освобождаем всё, что старше самого старого активного читателя
+     */
+    size_t min_epoch = map_rcu_advance_epoch(mp->rcu);
+    for (map_rcu_reader *reader = atomic_load(&(mp->rcu->readers)); reader != NULL; reader = reader->next)
+    {
+        size_t reader_epoch = atomic_load_explicit(&(reader->epoch), memory_order_acquire);
+        if (reader_epoch != 0 && reader_epoch < min_epoch) {
+            min_epoch = reader_epoch;
+        }
+    }
 
-/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+    map_rcu_free_garbage(mp, min_epoch);
+}
 
-/**
- * Вспомогательные функции (начало)
- */
+static size_t
+map_rcu_advance_epoch
+(
+    map_rcu *rcu
+)
+{
+    size_t epoch = atomic_load_explicit(&(rcu->epoch), memory_order_relaxed) + 1;
+    atomic_store_explicit(&(rcu->epoch), epoch, memory_order_seq_cst);
+    atomic_thread_fence(memory_order_seq_cst);
 
+    return epoch;
+}
 
-static void 
-map_restore_properties_after_insert
+static void
+map_rcu_free_garbage
 (
-    map *         mp, 
-    avl_node *    node
+    map *     mp,
+    size_t    epoch
 )
 {
-    while (node->parent != NULL)
+    map_rcu *rcu = mp->rcu;
+
+    while (rcu->garbage_head != NULL && rcu->garbage_head->epoch < epoch)
     {
-        avl_node *parent = node->parent;
+        map_rcu_garbage *garbage = rcu->garbage_head;
+        rcu->garbage_head = garbage->next;
 
-        parent->balance += (node->parent->left_child == node) ?  1 : -1;
-        
-        if (parent->balance == 0) 
-        /* Восстановление свойств окончено */
-        {
-            break;
-        }
-        else if (abs(parent->balance) == 2)
+        if (garbage->use_deleters)
         {
-            if (parent->balance == 2 && node->balance == 1)
-            /* Малый правый поворот */
-            {
-                node = map_right_small_rotate(mp, parent);
-                break;
-            }
-            else if (parent->balance == -2 && node->balance == -1)
-            /* Малый левый поворот */
-            {
-                node = map_left_small_rotate(mp, parent);
-                break;
-            }
-            else if (parent->balance == 2 && node->balance == -1)
-            /* Большой правый поворот */
-            {
-                node = map_right_big_rotate(mp, parent);
-                if (node->balance == 0) {
-                    break;
-                }
+            if (mp->key_destroyer != NULL) {
+                mp->key_destroyer(garbage->key);
             }
-            else
-            /* Большой левый поворот */
-            {
-                node = map_left_big_rotate(mp, parent);
-                if (node->balance == 0) {
-                    break;
-                }
+            if (mp->value_destroyer != NULL) {
+                mp->value_destroyer(garbage->value);
             }
         }
 
-        node = node->parent;
+        free(garbage->key);
+        if (mp->value_size != 0) {
+            free(garbage->value);
+        }
+        free(garbage->node);
+        free(garbage);
+    }
+
+    if (rcu->garbage_head == NULL) {
+        rcu->garbage_tail = NULL;
     }
 }
 
-static void 
-map_restore_properties_after_erase
+static void
+map_build_sort
 (
-    map *         mp, 
-    avl_node *    node
+    map *              mp,
+    const uint8_t *    keys,
+    size_t *           order,
+    size_t *           tmp,
+    size_t             lo,
+    size_t             hi,
+    size_t             threads
 )
 {
-    while (node != NULL)
+    if (hi - lo < 2) {
+        return;
+    }
+
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (threads > 1)
+    /* Левую половину сортирует новый поток, правую - текущий */
     {
-        if (abs(node->balance) == 2)
+        map_build_args args = {.mp = mp, .keys = keys, .order = order, .tmp = tmp, 
+            .lo = lo, .hi = mid, .threads = threads / 2};
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, map_build_sort_thread, &args) != 0)
         {
-            if ((node->balance == 2 && node->left_child->balance == 1)
-                || (node->balance == 2 && node->left_child->balance == 0))
-            {
-                node = map_right_small_rotate(mp, node);
-            }
-            else if ((node->balance == -2 && node->right_child->balance == -1)
-                || (node->balance == -2 && node->right_child->balance == 0))
-            {
-                node = map_left_small_rotate(mp, node);
-            }
-            else if (node->balance == 2 && node->left_child->balance == -1) {
-                node = map_right_big_rotate(mp, node);
-            }
-            else {
-                node = map_left_big_rotate(mp, node);
-            }
+            fprintf(stderr, "map_build_parallel: не удалось создать поток\n");
+            exit(EXIT_FAILURE);
         }
+        map_build_sort(mp, keys, order, tmp, mid, hi, threads - threads / 2);
+        pthread_join(thread, NULL);
+    }
+    else 
+    {
+        map_build_sort(mp, keys, order, tmp, lo, mid, 1);
+        map_build_sort(mp, keys, order, tmp, mid, hi, 1);
+    }
 
-        if (abs(node->balance) == 1) {
-            break;
+    /* Слияние: при равных ключах первым идёт элемент из левой половины */
+    size_t left = lo;
+    size_t right = mid;
+    size_t out = lo;
+    while (left < mid && right < hi)
+    {
+        if (map_compare_keys(mp, keys + order[left] * mp->key_size, keys + order[right] * mp->key_size) <= 0) {
+            tmp[out++] = order[left++];
         }
-
-        if (node->parent != NULL)
-        {
-            if (node->parent->right_child == node) {
-                node->parent->balance++;
-            }
-            else {
-                node->parent->balance--;
-            }   
+        else {
+            tmp[out++] = order[right++];
         }
-
-        node = node->parent;
     }
+    while (left < mid) {
+        tmp[out++] = order[left++];
+    }
+    while (right < hi) {
+        tmp[out++] = order[right++];
+    }
+
+    memcpy(order + lo, tmp + lo, (hi - lo) * sizeof(size_t));
+}
+
+static void *
+map_build_sort_thread
+(
+    void *arg
+)
+{
+    map_build_args *args = (map_build_args *)arg;
+    map_build_sort(args->mp, args->keys, args->order, args->tmp, args->lo, args->hi, args->threads);
+    return NULL;
 }
 
 static avl_node *
-map_create_new_node
+map_build_subtree
 (
-    void *      key, 
-    void *      value, 
-    uint16_t    key_size, 
-    uint16_t    value_size
+    map *              mp,
+    const uint8_t *    keys,
+    const uint8_t *    values,
+    const size_t *     order,
+    size_t             lo,
+    size_t             hi,
+    avl_node *         parent,
+    size_t             threads
 )
 {
-    avl_node *insert_node = (avl_node *)malloc(sizeof(avl_node));
-    if (insert_node == NULL)
+    if (lo == hi) {
+        return NULL;
+    }
+
+    size_t mid = lo + (hi - lo) / 2;
+
+    avl_node *node = map_create_new_node((void *)(keys + order[mid] * mp->key_size), 
+        (void *)(values + order[mid] * mp->value_size), mp->key_size, mp->value_size);
+    if (mp->key_prefix != NULL) {
+        node->prefix = mp->key_prefix(node->key);
+    }
+    node->link.parent = map_node_link(parent);
+    /* Левое поддерево не меньше правого, поэтому баланс равен 0 или 1 */
+    node->link.balance = (int8_t)(map_build_height(mid - lo) - map_build_height(hi - mid - 1));
+
+    if (threads > 1)
+    /* Левое поддерево строит новый поток, правое - текущий */
     {
-        perror("");
-        exit(EXIT_FAILURE);
+        map_build_args args = {.mp = mp, .keys = keys, .values = values, .order = (size_t *)order, 
+            .lo = lo, .hi = mid, .threads = threads / 2, .parent = node};
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, map_build_subtree_thread, &args) != 0)
+        {
+            fprintf(stderr, "map_build_parallel: не удалось создать поток\n");
+            exit(EXIT_FAILURE);
+        }
+        node->link.child[1] = map_node_link(map_build_subtree(mp, keys, values, order, mid + 1, hi, node, 
+            threads - threads / 2));
+        pthread_join(thread, NULL);
+        node->link.child[0] = map_node_link(args.result);
+    }
+    else 
+    {
+        node->link.child[0] = map_node_link(map_build_subtree(mp, keys, values, order, lo, mid, node, 1));
+        node->link.child[1] = map_node_link(map_build_subtree(mp, keys, values, order, mid + 1, hi, node, 1));
     }
 
-    *insert_node = (avl_node)
+    return node;
+}
+
+static void *
+map_build_subtree_thread
+(
+    void *arg
+)
+{
+    map_build_args *args = (map_build_args *)arg;
+    args->result = map_build_subtree(args->mp, args->keys, args->values, args->order, 
+        args->lo, args->hi, args->parent, args->threads);
+    return NULL;
+}
+
+static int
+map_build_height
+(
+    size_t size
+)
+{
+    int height = 0;
+    while (size != 0)
     {
-        .parent = NULL,
-        .left_child = NULL,
-        .right_child = NULL,
-        .key = NULL,
-        .value = NULL,
-        .balance = 0
-    };
+        size >>= 1;
+        height++;
+    }
+    return height;
+}
 
-    insert_node->key = malloc(key_size);
-    if (insert_node->key == NULL)
+static void
+map_parallel_run
+(
+    map_parallel_args *    args,
+    size_t                 threads
+)
+{
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    /**
+     * Около 8 задач на поток: поддеревья одной глубины в AVL-дереве 
+     * различаются по размеру, и мелкие задачи выравнивают нагрузку
+     */
+    size_t depth = 0;
+    while (((size_t)1 << depth) < threads * 8 && depth < 20) {
+        depth++;
+    }
+
+    args->tasks = (map_parallel_task *)malloc(((size_t)2 << depth) * sizeof(map_parallel_task));
+    if (args->tasks == NULL)
     {
         perror("");
         exit(EXIT_FAILURE);
     }
+    args->tasks_count = 0;
+    map_parallel_gather(args, args->mp->header.root, depth);
 
-    memcpy(insert_node->key, key, key_size);
+    if (args->map_fn != NULL)
+    {
+        args->accs = (uint8_t *)malloc(args->tasks_count * args->acc_size + 1);
+        if (args->accs == NULL)
+        {
+            perror("");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    insert_node->value = malloc(value_size);
-    if (insert_node->value == NULL)
+    atomic_init(&(args->next), 0);
+
+    if (threads > args->tasks_count) {
+        threads = args->tasks_count > 0 ? args->tasks_count : 1;
+    }
+
+    /* Вызывающий поток тоже разбирает задачи */
+    pthread_t *workers = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    if (workers == NULL)
     {
         perror("");
         exit(EXIT_FAILURE);
     }
+    for (size_t i = 1; i < threads; ++i)
+    {
+        if (pthread_create(&workers[i], NULL, map_parallel_worker, args) != 0)
+        {
+            fprintf(stderr, "map_parallel: не удалось создать поток\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    map_parallel_worker(args);
+    for (size_t i = 1; i < threads; ++i) {
+        pthread_join(workers[i], NULL);
+    }
 
-    memcpy(insert_node->value, value, value_size);
-
-    return insert_node;
+    free(workers);
 }
 
-static avl_node *
-map_right_small_rotate
+static void
+map_parallel_gather
 (
-    map *         mp, 
-    avl_node *    node
+    map_parallel_args *    args,
+    avl_node *             node,
+    size_t                 depth
 )
 {
-    avl_node *new_parent = node->left_child;
-    avl_node *weak_node = new_parent->right_child;
-
-    int8_t old_node_balance = node->balance;
-    int8_t old_new_parent_balance = new_parent->balance;
+    if (node == NULL) {
+        return;
+    }
 
-    new_parent->parent = node->parent;
-    if (node->parent) 
+    if (depth == 0)
     {
-        if (node->parent->left_child == node) {
-            node->parent->left_child = new_parent;
-        }
-        else {
-            node->parent->right_child = new_parent;
-        }
-    } 
-    else {
-        mp->header.root = new_parent;
+        args->tasks[args->tasks_count++] = (map_parallel_task){.node = node, .single = false};
+        return;
     }
 
-    new_parent->right_child = node;
-    node->parent = new_parent;
+    bool above_lo = args->lo == NULL || map_compare_keys(args->mp, node->key, args->lo) >= 0;
+    bool below_hi = args->hi == NULL || map_compare_keys(args->mp, node->key, args->hi) < 0;
 
-    node->left_child = weak_node;
-    if (weak_node) {
-        weak_node->parent = node;
+    if (above_lo) {
+        map_parallel_gather(args, map_node_child(node, 0), depth - 1);
+    }
+    if (above_lo && below_hi) {
+        args->tasks[args->tasks_count++] = (map_parallel_task){.node = node, .single = true};
+    }
+    if (below_hi) {
+        map_parallel_gather(args, map_node_child(node, 1), depth - 1);
     }
-
-    node->balance = old_node_balance - 1 - (old_new_parent_balance > 0 ? old_new_parent_balance : 0);
-    new_parent->balance = old_new_parent_balance - 1 + (node->balance < 0 ? node->balance : 0);
-
-    return new_parent;
 }
 
-static avl_node *
-map_left_small_rotate
+static void *
+map_parallel_worker
 (
-    map *         mp, 
-    avl_node *    node
+    void *arg
 )
 {
-    avl_node *new_parent = node->right_child;
-    avl_node *weak_node = new_parent->left_child;
-
-    int8_t old_node_balance = node->balance;
-    int8_t old_new_parent_balance = new_parent->balance;
+    map_parallel_args *args = (map_parallel_args *)arg;
 
-    new_parent->parent = node->parent;
-    if (node->parent) 
+    for (;;)
     {
-        if (node->parent->left_child == node) {
-            node->parent->left_child = new_parent;
+        size_t index = atomic_fetch_add_explicit(&(args->next), 1, memory_order_relaxed);
+        if (index >= args->tasks_count) {
+            break;
+        }
+
+        map_parallel_task task = args->tasks[index];
+        void *acc = NULL;
+        if (args->map_fn != NULL) 
+        {
+            acc = args->accs + index * args->acc_size;
+            memcpy(acc, args->identity, args->acc_size);
+        }
+
+        if (task.single) {
+            map_parallel_visit(args, task.node, acc);
         }
         else {
-            node->parent->right_child = new_parent;
+            map_parallel_walk(args, task.node, acc);
         }
-    } 
-    else {
-        mp->header.root = new_parent;
     }
 
-    new_parent->left_child = node;
-    node->parent = new_parent;
+    return NULL;
+}
 
-    node->right_child = weak_node;
-    if (weak_node) {
-        weak_node->parent = node;
+static void
+map_parallel_walk
+(
+    map_parallel_args *    args,
+    avl_node *             node,
+    void *                 acc
+)
+{
+    if (node == NULL) {
+        return;
     }
 
-    node->balance = old_node_balance + 1 - (old_new_parent_balance < 0 ? old_new_parent_balance : 0);
-    new_parent->balance = old_new_parent_balance + 1 + (node->balance > 0 ? node->balance : 0);
+    bool above_lo = args->lo == NULL || map_compare_keys(args->mp, node->key, args->lo) >= 0;
+    bool below_hi = args->hi == NULL || map_compare_keys(args->mp, node->key, args->hi) < 0;
 
-    return new_parent;
+    if (above_lo) {
+        map_parallel_walk(args, map_node_child(node, 0), acc);
+    }
+    if (above_lo && below_hi) {
+        map_parallel_visit(args, node, acc);
+    }
+    if (below_hi) {
+        map_parallel_walk(args, map_node_child(node, 1), acc);
+    }
 }
 
-static avl_node *
-map_right_big_rotate
+static void
+map_parallel_visit
 (
-    map *         mp, 
-    avl_node *    node
+    map_parallel_args *    args,
+    avl_node *             node,
+    void *                 acc
 )
 {
-    map_left_small_rotate(mp, node->left_child);
-    return map_right_small_rotate(mp, node);
+    if (args->fn != NULL) {
+        args->fn(node->key, node->value, args->ctx);
+    }
+    else {
+        args->map_fn(node->key, node->value, acc, args->ctx);
+    }
 }
 
-static avl_node *
-map_left_big_rotate
+
+/**
+ * Цикл спуска frozen_map_search. GOES_RIGHT - выражение, равное 1, если 
+ * искомая позиция находится правее позиции pos. Спуск не содержит ветвлений,
+ * зависящих от ключей: результат сравнения становится младшим битом позиции
+ * 
+ * Позиции 16 * pos ... 16 * pos + 15 - потомки pos на четыре уровня ниже,
+ * для небольших ключей они занимают одну кэш-линию и загружаются заранее
+ */
+#define FROZEN_MAP_SEARCH_LOOP(GOES_RIGHT)                                      \
+    while (pos <= size)                                                         \
+    {                                                                           \
+        __builtin_prefetch(fm->keys + (pos << 4) * key_size);                   \
+        pos = 2 * pos + (GOES_RIGHT);                                           \
+    }
+
+#define FROZEN_MAP_COMPARE_I32 ((keys_i32[pos] > target_i32) - (keys_i32[pos] < target_i32))
+#define FROZEN_MAP_COMPARE_U64 ((keys_u64[pos] > target_u64) - (keys_u64[pos] < target_u64))
+#define FROZEN_MAP_COMPARE_BYTES map_compare_bytes(fm->keys + pos * key_size, key, key_size)
+#define FROZEN_MAP_COMPARE_CUSTOM compare_func(fm->keys + pos * key_size, key)
+
+static size_t
+frozen_map_search
 (
-    map *         mp, 
-    avl_node *    node
+    frozen_map *    fm,
+    const void *    key,
+    bool            upper
 )
 {
-    map_right_small_rotate(mp, node->right_child);
-    return map_left_small_rotate(mp, node);
-}
+    if (fm->blocked) {
+        return frozen_map_search_blocks(fm, key, upper);
+    }
 
-static avl_node *
-map_erase_case_no_children
-(
-    map *         mp, 
-    avl_node *    node,
-    bool          use_deleters
-)
-{       
-    avl_node *parent = node->parent;
+    size_t size = fm->size;
+    size_t key_size = fm->key_size;
+    size_t pos = 1;
+    /**
+     * Позиция подходит, если сравнение её ключа с key меньше limit:
+     * для нижней границы ключ меньше key, для верхней - не больше
+     */
+    int limit = upper ? 1 : 0;
 
-    if (parent != NULL)
+    switch (fm->key_kind)
     {
-        if (parent->right_child == node) 
+        case MAP_KEY_KIND_I32:
         {
-            parent->balance++;
-            parent->right_child = NULL;
+            const int32_t *keys_i32 = (const int32_t *)fm->keys;
+            int32_t target_i32;
+            memcpy(&target_i32, key, sizeof(target_i32));
+            FROZEN_MAP_SEARCH_LOOP(FROZEN_MAP_COMPARE_I32 < limit)
+            break;
         }
-        else 
+        case MAP_KEY_KIND_U64:
         {
-            parent->balance--;
-            parent->left_child = NULL;
-        }   
-    }
-    else 
-    {
-        mp->header.root = NULL;
-        mp->header.most_left = NULL;
-        mp->header.most_right = NULL;
-    }
-
-    if (use_deleters)
-    {
-        if (mp->key_destroyer != NULL) {
-            mp->key_destroyer(node->key);                
+            const uint64_t *keys_u64 = (const uint64_t *)fm->keys;
+            uint64_t target_u64;
+            memcpy(&target_u64, key, sizeof(target_u64));
+            FROZEN_MAP_SEARCH_LOOP(FROZEN_MAP_COMPARE_U64 < limit)
+            break;
+        }
+        case MAP_KEY_KIND_BYTES:
+            FROZEN_MAP_SEARCH_LOOP(FROZEN_MAP_COMPARE_BYTES < limit)
+            break;
+        default:
+        {
+            int (*compare_func)(const void *f, const void *s) = fm->compare_func;
+            FROZEN_MAP_SEARCH_LOOP(FROZEN_MAP_COMPARE_CUSTOM < limit)
+            break;
         }
-        if (mp->value_destroyer != NULL) {
-            mp->value_destroyer(node->value);
-        }   
     }
 
-    free(node->key);
-    free(node->value);
-    free(node);
+    /**
+     * Спуск закончился за пределами массива. Искомая позиция - последняя,
+     * из которой спуск ушёл налево: отбрасываем завершающие единицы (шаги
+     * направо) и ещё один бит. Если шагов налево не было, получается 0
+     */
+    return pos >> (__builtin_ctzll(~(unsigned long long)pos) + 1);
+}
 
-    return parent;
-}   
+static void
+frozen_map_check_pos
+(
+    frozen_map *    fm,
+    size_t          pos,
+    const char *    func_name
+)
+{
+    if (pos == FROZEN_MAP_END || pos > fm->size)
+    {
+        fprintf(stderr, "%s: произведена попытка выйти за границы контейнера\n", func_name);
+        exit(EXIT_FAILURE);
+    }
+}
 
-static avl_node *
-map_erase_case_one_children
+static size_t
+frozen_map_search_blocks
 (
-    map *         mp, 
-    avl_node *    node,
-    bool          use_deleters
+    frozen_map *    fm,
+    const void *    key,
+    bool            upper
 )
 {
-    avl_node *parent = node->parent;    
-    
-    if (parent != NULL)
+    if (fm->size == 0) {
+        return FROZEN_MAP_END;
+    }
+
+    /**
+     * Верхняя граница key - нижняя граница key + 1. Больше максимального
+     * значения типа ключей быть не может
+     */
+    union
     {
-        if (node->right_child != NULL) 
+        int32_t     i32;
+        uint64_t    u64;
+    } target;
+    memcpy(&target, key, fm->key_size);
+    if (upper)
+    {
+        if (fm->key_kind == MAP_KEY_KIND_I32)
         {
-            node->right_child->parent = parent;
-
-            if (parent->right_child == node) 
-            {
-                parent->right_child = node->right_child;
-                parent->balance++;
-            }
-            else 
-            {
-                parent->left_child = node->right_child;
-                parent->balance--;
+            if (target.i32 == INT32_MAX) {
+                return FROZEN_MAP_END;
             }
+            target.i32++;
         }
-        else 
+        else
         {
-            node->left_child->parent = parent;
-
-            if (parent->right_child == node) 
-            {
-                parent->right_child = node->left_child;
-                parent->balance++;
-            }
-            else 
-            {
-                parent->left_child = node->left_child;
-                parent->balance--;
+            if (target.u64 == UINT64_MAX) {
+                return FROZEN_MAP_END;
             }
+            target.u64++;
         }
     }
-    else 
+
+    /**
+     * На каждом уровне спускаемся в ребёнка, номер которого равен числу 
+     * ключей узла, меньших target. Ключи узлов - минимумы поддеревьев, 
+     * поэтому искомый элемент либо в этом поддереве, либо первый после него
+     */
+    size_t block_bytes = FROZEN_MAP_BLOCK * (size_t)fm->key_size;
+    size_t node = 0;
+    for (size_t h = fm->height; h >= 1; --h)
     {
-        if (node->right_child != NULL) 
-        {
-            mp->header.root = node->right_child;
-            mp->header.root->parent = NULL;
-        }
-        else 
-        {
-            mp->header.root = node->left_child;
-            mp->header.root->parent = NULL;
-        }
+        const uint8_t *block = fm->index + fm->layer_offset[h] * fm->key_size + node * block_bytes;
+        node = node * (FROZEN_MAP_BLOCK + 1) + fm->block_rank(block, &target);
     }
 
-    if (use_deleters)
+    size_t rank = node * FROZEN_MAP_BLOCK + fm->block_rank(fm->keys + node * block_bytes, &target);
+    return (rank < fm->size) ? rank + 1 : FROZEN_MAP_END;
+}
+
+static void
+frozen_map_build_eytzinger
+(
+    frozen_map *    fm,
+    map *           mp
+)
+{
+    /**
+     * Ключи выравниваются по кэш-линии, чтобы потомки позиции, загружаемые
+     * предвыборкой, не пересекали границу линии
+     */
+    size_t keys_bytes = ((fm->size + 1) * fm->key_size + 63) & ~(size_t)63;
+    fm->keys = (uint8_t *)aligned_alloc(64, keys_bytes);
+    if (fm->keys == NULL)
     {
-        if (mp->key_destroyer != NULL) {
-            mp->key_destroyer(node->key);                
-        }
-        if (mp->value_destroyer != NULL) {
-            mp->value_destroyer(node->value);
-        }   
+        perror("");
+        exit(EXIT_FAILURE);
     }
-    
-    free(node->key);
-    free(node->value);
-    free(node);
 
-    return parent;
+    /**
+     * Обход позиций Эйтцингера в порядке возрастания совпадает с обходом
+     * контейнера, поэтому элементы раскладываются за один проход
+     */
+    size_t pos = frozen_map_first(fm);
+    for (map_iterator it = map_iterator_first(mp); map_iterator_compare(it, map_iterator_end(mp)) != 0;
+        map_iterator_next(mp, it))
+    {
+        memcpy(fm->keys + pos * fm->key_size, _map_iterator_get_key(it), fm->key_size);
+        memcpy(fm->values + pos * fm->value_size, _map_iterator_get_value(it), fm->value_size);
+        pos = frozen_map_next(fm, pos);
+    }
 }
 
-static avl_node *
-map_erase_case_two_children
+static void
+frozen_map_build_blocks
 (
-    map *         mp, 
-    avl_node *    node,
-    bool          use_deleters
+    frozen_map *    fm,
+    map *           mp
 )
-{       
-    avl_node *parent;
-    avl_node *replacement = node->right_child;
-
-    while (replacement->left_child) {
-        replacement = replacement->left_child;
+{
+    bool is_i32 = fm->key_kind == MAP_KEY_KIND_I32;
+    size_t key_size = fm->key_size;
+    size_t block_bytes = FROZEN_MAP_BLOCK * key_size;
+
+    fm->block_rank = is_i32 ? frozen_map_rank_i32 : frozen_map_rank_u64;
+#ifdef FROZEN_MAP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        fm->block_rank = is_i32 ? frozen_map_rank_i32_avx2 : frozen_map_rank_u64_avx2;
     }
+    else if (__builtin_cpu_supports("sse4.2")) {
+        fm->block_rank = is_i32 ? frozen_map_rank_i32_sse42 : frozen_map_rank_u64_sse42;
+    }
+#endif
 
-    void *temp_node_key = replacement->key;
-    void *temp_node_value = replacement->value;
+    /* Максимальный ключ, которым дополняются неполные блоки */
+    uint8_t max_key[sizeof(uint64_t)];
+    int32_t max_i32 = INT32_MAX;
+    uint64_t max_u64 = UINT64_MAX;
+    memcpy(max_key, is_i32 ? (const void *)&max_i32 : (const void *)&max_u64, key_size);
 
-    replacement->key = node->key;
-    replacement->value = node->value;
+    size_t blocks = (fm->size + FROZEN_MAP_BLOCK - 1) / FROZEN_MAP_BLOCK;
+    if (blocks == 0) {
+        blocks = 1;
+    }
 
-    node->key = temp_node_key;
-    node->value = temp_node_value;
+    fm->keys = (uint8_t *)aligned_alloc(64, blocks * block_bytes);
+    if (fm->keys == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
 
-    if (replacement->right_child == NULL && replacement->left_child == NULL) {
-        parent = map_erase_case_no_children(mp, replacement, use_deleters);
+    size_t i = 0;
+    for (map_iterator it = map_iterator_first(mp); map_iterator_compare(it, map_iterator_end(mp)) != 0;
+        map_iterator_next(mp, it))
+    {
+        memcpy(fm->keys + i * key_size, _map_iterator_get_key(it), key_size);
+        memcpy(fm->values + i * fm->value_size, _map_iterator_get_value(it), fm->value_size);
+        i++;
     }
-    else {
-        parent = map_erase_case_one_children(mp, replacement, use_deleters);
+    for (; i < blocks * FROZEN_MAP_BLOCK; ++i) {
+        memcpy(fm->keys + i * key_size, max_key, key_size);
     }
 
-    return parent;
-}                                  
+    /* Размеры уровней индекса: уровень h содержит nodes[h] блоков */
+    size_t nodes[FROZEN_MAP_MAX_LAYERS + 1];
+    size_t total = 0;
+    nodes[0] = blocks;
+    while (nodes[fm->height] > 1)
+    {
+        fm->height++;
+        nodes[fm->height] = (nodes[fm->height - 1] + FROZEN_MAP_BLOCK) / (FROZEN_MAP_BLOCK + 1);
+        fm->layer_offset[fm->height] = total;
+        total += nodes[fm->height] * FROZEN_MAP_BLOCK;
+    }
 
-static void 
-map_restore_header_properties_after_erase
-(
-    map *         mp,
-    avl_node *    node
-)
-{
-    if (node->key == mp->header.most_left->key)
+    if (fm->height == 0) {
+        return;
+    }
+
+    fm->index = (uint8_t *)aligned_alloc(64, total * key_size);
+    if (fm->index == NULL)
     {
-        if (node->right_child != NULL) {
-            mp->header.most_left = node->right_child;
-        }
-        else {
-            mp->header.most_left = node->parent;
-        }
+        perror("");
+        exit(EXIT_FAILURE);
     }
-    else if (node->key == mp->header.most_right->key)
+
+    /**
+     * Ключ i узла j уровня h - первый ключ самого левого блока поддерева
+     * ребёнка c = j * (FROZEN_MAP_BLOCK + 1) + i + 1. Для отсутствующих 
+     * детей записывается максимальный ключ - спуск в них не заходит
+     */
+    size_t stride = 1;
+    for (size_t h = 1; h <= fm->height; ++h)
     {
-        if (node->left_child != NULL) {
-            mp->header.most_right = node->left_child;
-        }
-        else {
-            mp->header.most_right = node->parent;
+        uint8_t *layer = fm->index + fm->layer_offset[h] * key_size;
+        for (size_t j = 0; j < nodes[h]; ++j)
+        {
+            for (size_t k = 0; k < FROZEN_MAP_BLOCK; ++k)
+            {
+                size_t child = j * (FROZEN_MAP_BLOCK + 1) + k + 1;
+                uint8_t *dst = layer + (j * FROZEN_MAP_BLOCK + k) * key_size;
+                if (child < nodes[h - 1]) {
+                    memcpy(dst, fm->keys + child * stride * block_bytes, key_size);
+                }
+                else {
+                    memcpy(dst, max_key, key_size);
+                }
+            }
         }
+        stride *= FROZEN_MAP_BLOCK + 1;
     }
 }
 
-static void 
-map_restore_header_properties_after_insert
+static inline size_t
+frozen_map_slot
 (
-    map *         mp, 
-    avl_node *    node
+    frozen_map *    fm,
+    size_t          pos
 )
 {
-    if (mp->header.root == NULL)
-    {
-        mp->header.root = node;
-        mp->header.most_left = node;
-        mp->header.most_right = node;
-    }
-    else 
-    {
-        if (mp->compare_func(node->key, mp->header.most_left->key) < 0) {
-            mp->header.most_left = node;
-        }
-        else if (mp->compare_func(node->key, mp->header.most_right->key) > 0) {
-            mp->header.most_right = node;
-        }
-    }
+    return fm->blocked ? pos - 1 : pos;
 }
 
-static void 
-map_free_helper
+static size_t
+frozen_map_rank_i32
 (
-    map *         mp, 
-    avl_node *    node
+    const void *    block,
+    const void *    key
 )
 {
-    if (node->left_child != NULL) {
-        map_free_helper(mp, node->left_child);
+    const int32_t *keys = (const int32_t *)block;
+    int32_t target = *(const int32_t *)key;
+    size_t rank = 0;
+    for (size_t i = 0; i < FROZEN_MAP_BLOCK; ++i) {
+        rank += keys[i] < target;
     }
-    if (node->right_child != NULL) {
-        map_free_helper(mp, node->right_child);
+    return rank;
+}
+
+static size_t
+frozen_map_rank_u64
+(
+    const void *    block,
+    const void *    key
+)
+{
+    const uint64_t *keys = (const uint64_t *)block;
+    uint64_t target = *(const uint64_t *)key;
+    size_t rank = 0;
+    for (size_t i = 0; i < FROZEN_MAP_BLOCK; ++i) {
+        rank += keys[i] < target;
     }
+    return rank;
+}
 
-    if (mp->key_destroyer != NULL) {
-        mp->key_destroyer(node->key);                
+#ifdef FROZEN_MAP_X86
+/**
+ * Блок сравнивается с ключом целиком: маски сравнения собираются movemask
+ * и подсчитываются popcount. Блоки выровнены по 64 байтам. В наборах команд
+ * x86 есть только знаковое сравнение 64-битных чисел, поэтому у беззнаковых
+ * ключей перед сравнением инвертируется старший бит
+ */
+__attribute__((target("sse4.2")))
+static size_t
+frozen_map_rank_i32_sse42
+(
+    const void *    block,
+    const void *    key
+)
+{
+    const __m128i *keys = (const __m128i *)block;
+    __m128i target = _mm_set1_epi32(*(const int32_t *)key);
+    size_t rank = 0;
+    for (size_t i = 0; i < FROZEN_MAP_BLOCK / 4; ++i)
+    {
+        __m128i less = _mm_cmpgt_epi32(target, _mm_load_si128(keys + i));
+        rank += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(less)));
     }
-    free(node->key);
+    return rank;
+}
 
-    if (mp->value_destroyer != NULL) {
-        mp->value_destroyer(node->value);
+__attribute__((target("sse4.2")))
+static size_t
+frozen_map_rank_u64_sse42
+(
+    const void *    block,
+    const void *    key
+)
+{
+    const __m128i *keys = (const __m128i *)block;
+    __m128i sign = _mm_set1_epi64x(INT64_MIN);
+    __m128i target = _mm_xor_si128(_mm_set1_epi64x(*(const int64_t *)key), sign);
+    size_t rank = 0;
+    for (size_t i = 0; i < FROZEN_MAP_BLOCK / 2; ++i)
+    {
+        __m128i less = _mm_cmpgt_epi64(target, _mm_xor_si128(_mm_load_si128(keys + i), sign));
+        rank += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(less)));
     }
-    free(node->value);
+    return rank;
+}
 
-    free(node);
+__attribute__((target("avx2")))
+static size_t
+frozen_map_rank_i32_avx2
+(
+    const void *    block,
+    const void *    key
+)
+{
+    const __m256i *keys = (const __m256i *)block;
+    __m256i target = _mm256_set1_epi32(*(const int32_t *)key);
+    __m256i less_lo = _mm256_cmpgt_epi32(target, _mm256_load_si256(keys));
+    __m256i less_hi = _mm256_cmpgt_epi32(target, _mm256_load_si256(keys + 1));
+    /* Упаковка двух масок в одну: 32 бита на ключ -> 16 бит на ключ */
+    __m256i less = _mm256_packs_epi32(less_lo, less_hi);
+    return (size_t)__builtin_popcount(_mm256_movemask_epi8(less)) / 2;
 }
 
+__attribute__((target("avx2")))
+static size_t
+frozen_map_rank_u64_avx2
+(
+    const void *    block,
+    const void *    key
+)
+{
+    const __m256i *keys = (const __m256i *)block;
+    __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    __m256i target = _mm256_xor_si256(_mm256_set1_epi64x(*(const int64_t *)key), sign);
+    size_t rank = 0;
+    for (size_t i = 0; i < FROZEN_MAP_BLOCK / 4; ++i)
+    {
+        __m256i less = _mm256_cmpgt_epi64(target, _mm256_xor_si256(_mm256_load_si256(keys + i), sign));
+        rank += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(less)));
+    }
+    return rank;
+}
+#endif
 
 /**
  * Вспомогательные функции (конец)
@@ -1278,7 +6393,7 @@ static void map_print_subtree(avl_node *node, int depth, char prefix, char *(*ke
         return;
     
     // Сначала правый ребенок (будет напечатан выше)
-    map_print_subtree(node->right_child, depth + 1, '/', key_to_str, value_to_str);
+    map_print_subtree(map_node_child(node, 1), depth + 1, '/', key_to_str, value_to_str);
     
     // Затем текущий узел
     for (int i = 0; i < depth; i++)
@@ -1289,7 +6404,7 @@ static void map_print_subtree(avl_node *node, int depth, char prefix, char *(*ke
     printf("\n");
     
     // Затем левый ребенок (будет напечатан ниже)
-    map_print_subtree(node->left_child, depth + 1, '\\', key_to_str, value_to_str);
+    map_print_subtree(map_node_child(node, 0), depth + 1, '\\', key_to_str, value_to_str);
 }
 
 /**
@@ -1318,7 +6433,7 @@ static void map_print_node(avl_node *node, char prefix, char *(*key_to_str)(cons
     else
         printf("%p", node->value);
     
-    printf(" B:%d]", node->balance);
+    printf(" B:%d]", node->link.balance);
     
     // Очищаем временные строки, если они были созданы
     // (предполагается, что вызывающая функция отвечает за освобождение памяти)
@@ -0,0 +1,1051 @@
+#include <map_btree.h>
+#include <map.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Желаемый размер узла в байтах. Если в узел такого размера не помещается
+ * MAP_BTREE_MIN_CAPACITY элементов, размер узла удваивается
+ */
+#define MAP_BTREE_NODE_BYTES 512
+#define MAP_BTREE_MIN_CAPACITY 4
+
+/**
+ * Смещение массива ключей от начала узла (заголовок, выровненный по 16 байт)
+ */
+#define MAP_BTREE_KEYS_OFFSET 32
+
+/**
+ * Максимальная высота дерева. При минимальной ёмкости узла 4 и заполнении
+ * узлов не менее чем наполовину в дерево высоты 64 помещается больше 2^64
+ * элементов
+ */
+#define MAP_BTREE_MAX_DEPTH 64
+
+typedef struct _map_btree_node map_btree_node;
+
+/**
+ * Заголовок узла. За ним следуют массив ключей и массив значений (лист) или
+ * массив указателей на детей (внутренний узел)
+ * 
+ * Во внутреннем узле с count ключами count + 1 детей, ключ i - минимальный
+ * ключ поддерева ребёнка i + 1 на момент его создания: все ключи ребёнка i
+ * меньше ключа i, все ключи ребёнка i + 1 не меньше него
+ */
+struct _map_btree_node
+{
+    uint16_t            count;
+    bool                leaf;
+    /**
+     * Соседние листья (только у листьев)
+     */
+    map_btree_node *    prev;
+    map_btree_node *    next;
+};
+
+/**
+ * Способ сравнения ключей внутри узла
+ */
+typedef enum map_btree_kind
+{
+    MAP_BTREE_KIND_CUSTOM,
+    MAP_BTREE_KIND_I32,
+    MAP_BTREE_KIND_U64,
+    MAP_BTREE_KIND_BYTES
+} map_btree_kind;
+
+struct _map_btree
+{
+    map_btree_node *    root;
+    map_btree_node *    first_leaf;
+    map_btree_node *    last_leaf;
+
+    uint16_t            key_size;
+    uint16_t            value_size;
+    int                 (*compare_func)    (const void *f, const void *s);
+    map_btree_kind      kind;
+
+    /**
+     * Размер листа - степень двойки, листья выравниваются по своему размеру.
+     * Поэтому лист, которому принадлежит слот, находится обнулением младших
+     * битов адреса слота
+     */
+    size_t              leaf_bytes;
+    size_t              leaf_capacity;
+    size_t              values_offset;
+
+    size_t              inner_bytes;
+    size_t              inner_capacity;
+    size_t              children_offset;
+
+    /**
+     * Буфер на два ключа для разделителей при разбиении и ключа удаляемого
+     * элемента
+     */
+    uint8_t *           scratch;
+};
+
+
+/**
+ * Прототипы вспомогательных функций (начало)
+ */
+
+
+/**
+ * Возвращает указатель на i-й ключ узла
+ */
+static inline uint8_t *
+map_btree_key
+(
+    map_btree *         bt,
+    map_btree_node *    node,
+    size_t              i
+);
+
+/**
+ * Возвращает указатель на i-е значение листа
+ */
+static inline uint8_t *
+map_btree_leaf_value
+(
+    map_btree *         bt,
+    map_btree_node *    leaf,
+    size_t              i
+);
+
+/**
+ * Возвращает массив указателей на детей внутреннего узла
+ */
+static inline map_btree_node **
+map_btree_children
+(
+    map_btree *         bt,
+    map_btree_node *    node
+);
+
+/**
+ * Возвращает лист, которому принадлежит слот
+ */
+static inline map_btree_node *
+map_btree_leaf_of
+(
+    map_btree *    bt,
+    void *         slot
+);
+
+/**
+ * Сравнивает ключи f и s
+ */
+static inline int
+map_btree_compare
+(
+    map_btree *     bt,
+    const void *    f,
+    const void *    s
+);
+
+/**
+ * Возвращает индекс первого ключа узла, большего key (upper == true) или
+ * не меньшего key (upper == false). Если probe_cmp != NULL, key - проба,
+ * и ключи сравниваются с ней функцией probe_cmp
+ */
+static size_t
+map_btree_search
+(
+    map_btree *         bt,
+    map_btree_node *    node,
+    const void *        key,
+    int                 (*probe_cmp)    (const void *node_key, const void *probe),
+    bool                upper
+);
+
+/**
+ * Выделяет память под пустой лист или внутренний узел
+ */
+static map_btree_node *
+map_btree_new_node
+(
+    map_btree *    bt,
+    bool           leaf
+);
+
+/**
+ * Перемещает count элементов листа (ключи и значения) с позиции from на позицию to
+ * (листы могут совпадать)
+ */
+static void
+map_btree_move_entries
+(
+    map_btree *         bt,
+    map_btree_node *    to_leaf,
+    size_t              to,
+    map_btree_node *    from_leaf,
+    size_t              from,
+    size_t              count
+);
+
+/**
+ * Вставляет в внутренний узел ключ key на позицию i и ребёнка child на
+ * позицию i + 1 (в узле должно быть свободное место)
+ */
+static void
+map_btree_inner_insert
+(
+    map_btree *         bt,
+    map_btree_node *    node,
+    size_t              i,
+    const void *        key,
+    map_btree_node *    child
+);
+
+/**
+ * Удаляет из внутреннего узла ключ i и ребёнка i + 1
+ */
+static void
+map_btree_inner_remove
+(
+    map_btree *         bt,
+    map_btree_node *    node,
+    size_t              i
+);
+
+/**
+ * Восстанавливает заполненность узла path[depth] после удаления из него
+ * элемента, при необходимости поднимаясь вверх по пути path.
+ * index[d] - номер ребёнка узла path[d], через который шёл спуск
+ */
+static void
+map_btree_rebalance
+(
+    map_btree *          bt,
+    map_btree_node **    path,
+    size_t *             index,
+    size_t               depth
+);
+
+/**
+ * Рекурсивно освобождает поддерево с корнем node
+ */
+static void
+map_btree_free_node
+(
+    map_btree *         bt,
+    map_btree_node *    node,
+    void                (*key_destroyer)      (void *key),
+    void                (*value_destroyer)    (void *value)
+);
+
+
+/**
+ * Прототипы вспомогательных функций (конец)
+ */
+
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/**
+ * Определения основных функций (API) (начало)
+ */
+
+
+map_btree *
+map_btree_create
+(
+    uint16_t    key_size,
+    uint16_t    value_size,
+    int         (*compare_func)    (const void *f, const void *s)
+)
+{
+    map_btree *bt = (map_btree *)malloc(sizeof(map_btree));
+    if (bt == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    *bt = (map_btree)
+    {
+        .root = NULL,
+        .first_leaf = NULL,
+        .last_leaf = NULL,
+        .key_size = key_size,
+        .value_size = value_size,
+        .compare_func = compare_func,
+        .kind = MAP_BTREE_KIND_CUSTOM
+    };
+
+    if (compare_func == MAP_KEY_I32) {
+        bt->kind = MAP_BTREE_KIND_I32;
+    }
+    else if (compare_func == MAP_KEY_U64) {
+        bt->kind = MAP_BTREE_KIND_U64;
+    }
+    else if (compare_func == MAP_KEY_BYTES) {
+        bt->kind = MAP_BTREE_KIND_BYTES;
+    }
+
+    /* Ёмкость листа: ключи, затем значения, выровненные по 16 байт */
+    for (bt->leaf_bytes = MAP_BTREE_NODE_BYTES; ; bt->leaf_bytes *= 2)
+    {
+        size_t capacity = (bt->leaf_bytes - MAP_BTREE_KEYS_OFFSET) / ((size_t)key_size + value_size + 1);
+        while (capacity > 0 && ((MAP_BTREE_KEYS_OFFSET + capacity * key_size + 15) & ~(size_t)15)
+            + capacity * value_size > bt->leaf_bytes)
+        {
+            capacity--;
+        }
+        if (capacity >= MAP_BTREE_MIN_CAPACITY)
+        {
+            bt->leaf_capacity = (capacity > UINT16_MAX) ? UINT16_MAX : capacity;
+            bt->values_offset = (MAP_BTREE_KEYS_OFFSET + bt->leaf_capacity * key_size + 15) & ~(size_t)15;
+            break;
+        }
+    }
+
+    /* Ёмкость внутреннего узла: ключи, затем capacity + 1 указателей на детей */
+    for (bt->inner_bytes = MAP_BTREE_NODE_BYTES; ; bt->inner_bytes *= 2)
+    {
+        size_t capacity = (bt->inner_bytes - MAP_BTREE_KEYS_OFFSET - sizeof(void *))
+            / ((size_t)key_size + sizeof(void *) + 1);
+        if (capacity >= MAP_BTREE_MIN_CAPACITY)
+        {
+            bt->inner_capacity = (capacity > UINT16_MAX) ? UINT16_MAX : capacity;
+            bt->children_offset = (MAP_BTREE_KEYS_OFFSET + bt->inner_capacity * key_size + 7) & ~(size_t)7;
+            break;
+        }
+    }
+
+    bt->scratch = (uint8_t *)malloc(2 * (size_t)key_size + 1);
+    if (bt->scratch == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    return bt;
+}
+
+void
+map_btree_clear
+(
+    map_btree *    bt,
+    void           (*key_destroyer)      (void *key),
+    void           (*value_destroyer)    (void *value)
+)
+{
+    if (bt->root != NULL) {
+        map_btree_free_node(bt, bt->root, key_destroyer, value_destroyer);
+    }
+    bt->root = NULL;
+    bt->first_leaf = NULL;
+    bt->last_leaf = NULL;
+}
+
+void
+map_btree_free
+(
+    map_btree *    bt,
+    void           (*key_destroyer)      (void *key),
+    void           (*value_destroyer)    (void *value)
+)
+{
+    map_btree_clear(bt, key_destroyer, value_destroyer);
+    free(bt->scratch);
+    free(bt);
+}
+
+bool
+map_btree_insert
+(
+    map_btree *     bt,
+    const void *    key,
+    const void *    value
+)
+{
+    if (bt->root == NULL)
+    {
+        bt->root = map_btree_new_node(bt, true);
+        bt->first_leaf = bt->root;
+        bt->last_leaf = bt->root;
+    }
+
+    map_btree_node *path[MAP_BTREE_MAX_DEPTH];
+    size_t index[MAP_BTREE_MAX_DEPTH];
+    size_t depth = 0;
+
+    map_btree_node *node = bt->root;
+    while (!node->leaf)
+    {
+        size_t i = map_btree_search(bt, node, key, NULL, true);
+        path[depth] = node;
+        index[depth] = i;
+        depth++;
+        node = map_btree_children(bt, node)[i];
+    }
+
+    size_t pos = map_btree_search(bt, node, key, NULL, false);
+    if (pos < node->count && map_btree_compare(bt, map_btree_key(bt, node, pos), key) == 0)
+    {
+        memcpy(map_btree_leaf_value(bt, node, pos), value, bt->value_size);
+        return false;
+    }
+
+    if (node->count < bt->leaf_capacity)
+    {
+        map_btree_move_entries(bt, node, pos + 1, node, pos, node->count - pos);
+        memcpy(map_btree_key(bt, node, pos), key, bt->key_size);
+        memcpy(map_btree_leaf_value(bt, node, pos), value, bt->value_size);
+        node->count++;
+        return true;
+    }
+
+    /* Лист заполнен - переносим его правую половину в новый лист */
+    map_btree_node *right = map_btree_new_node(bt, true);
+    size_t mid = node->count / 2;
+    map_btree_move_entries(bt, right, 0, node, mid, node->count - mid);
+    right->count = node->count - mid;
+    node->count = mid;
+
+    right->prev = node;
+    right->next = node->next;
+    if (node->next != NULL) {
+        node->next->prev = right;
+    }
+    else {
+        bt->last_leaf = right;
+    }
+    node->next = right;
+
+    map_btree_node *target = node;
+    if (pos >= mid)
+    {
+        target = right;
+        pos -= mid;
+    }
+    map_btree_move_entries(bt, target, pos + 1, target, pos, target->count - pos);
+    memcpy(map_btree_key(bt, target, pos), key, bt->key_size);
+    memcpy(map_btree_leaf_value(bt, target, pos), value, bt->value_size);
+    target->count++;
+
+    /* Поднимаем разделитель вверх, разбивая заполненные внутренние узлы */
+    uint8_t *separator = bt->scratch;
+    uint8_t *promoted = bt->scratch + bt->key_size;
+    memcpy(separator, map_btree_key(bt, right, 0), bt->key_size);
+    map_btree_node *child = right;
+
+    while (depth > 0)
+    {
+        depth--;
+        map_btree_node *parent = path[depth];
+        size_t i = index[depth];
+
+        if (parent->count < bt->inner_capacity)
+        {
+            map_btree_inner_insert(bt, parent, i, separator, child);
+            return true;
+        }
+
+        map_btree_node *sibling = map_btree_new_node(bt, false);
+        map_btree_node **parent_children = map_btree_children(bt, parent);
+        map_btree_node **sibling_children = map_btree_children(bt, sibling);
+        size_t count = parent->count;
+        mid = count / 2;
+
+        if (i == mid)
+        /* Новый разделитель сам поднимается выше */
+        {
+            memcpy(promoted, separator, bt->key_size);
+            memcpy(map_btree_key(bt, sibling, 0), map_btree_key(bt, parent, mid),
+                (count - mid) * bt->key_size);
+            sibling_children[0] = child;
+            memcpy(sibling_children + 1, parent_children + mid + 1, (count - mid) * sizeof(map_btree_node *));
+            sibling->count = (uint16_t)(count - mid);
+            parent->count = (uint16_t)mid;
+        }
+        else
+        {
+            memcpy(promoted, map_btree_key(bt, parent, mid), bt->key_size);
+            memcpy(map_btree_key(bt, sibling, 0), map_btree_key(bt, parent, mid + 1),
+                (count - mid - 1) * bt->key_size);
+            memcpy(sibling_children, parent_children + mid + 1, (count - mid) * sizeof(map_btree_node *));
+            sibling->count = (uint16_t)(count - mid - 1);
+            parent->count = (uint16_t)mid;
+
+            if (i < mid) {
+                map_btree_inner_insert(bt, parent, i, separator, child);
+            }
+            else {
+                map_btree_inner_insert(bt, sibling, i - mid - 1, separator, child);
+            }
+        }
+
+        memcpy(separator, promoted, bt->key_size);
+        child = sibling;
+    }
+
+    /* Разбит корень - дерево растёт вверх */
+    map_btree_node *root = map_btree_new_node(bt, false);
+    memcpy(map_btree_key(bt, root, 0), separator, bt->key_size);
+    map_btree_children(bt, root)[0] = bt->root;
+    map_btree_children(bt, root)[1] = child;
+    root->count = 1;
+    bt->root = root;
+
+    return true;
+}
+
+void *
+map_btree_find
+(
+    map_btree *     bt,
+    const void *    key
+)
+{
+    map_btree_node *node = bt->root;
+    if (node == NULL) {
+        return NULL;
+    }
+
+    while (!node->leaf) {
+        node = map_btree_children(bt, node)[map_btree_search(bt, node, key, NULL, true)];
+    }
+
+    size_t pos = map_btree_search(bt, node, key, NULL, false);
+    if (pos < node->count && map_btree_compare(bt, map_btree_key(bt, node, pos), key) == 0) {
+        return map_btree_key(bt, node, pos);
+    }
+    return NULL;
+}
+
+void *
+map_btree_bound
+(
+    map_btree *     bt,
+    const void *    probe,
+    int             (*probe_cmp)    (const void *node_key, const void *probe),
+    bool            upper
+)
+{
+    map_btree_node *node = bt->root;
+    if (node == NULL) {
+        return NULL;
+    }
+
+    /**
+     * Во внутреннем узле спускаемся в ребёнка, ключи которого могут быть
+     * не меньше (больше) пробы: разделитель, равный пробе, ведёт направо
+     * только при поиске верхней границы
+     */
+    while (!node->leaf) {
+        node = map_btree_children(bt, node)[map_btree_search(bt, node, probe, probe_cmp, upper)];
+    }
+
+    size_t pos = map_btree_search(bt, node, probe, probe_cmp, upper);
+    if (pos < node->count) {
+        return map_btree_key(bt, node, pos);
+    }
+    return (node->next != NULL) ? map_btree_key(bt, node->next, 0) : NULL;
+}
+
+void
+map_btree_erase
+(
+    map_btree *    bt,
+    void *         slot,
+    void           (*key_destroyer)      (void *key),
+    void           (*value_destroyer)    (void *value)
+)
+{
+    map_btree_node *leaf = map_btree_leaf_of(bt, slot);
+    size_t pos = ((uint8_t *)slot - map_btree_key(bt, leaf, 0)) / bt->key_size;
+
+    /* Путь к листу восстанавливаем спуском по ключу удаляемого элемента */
+    map_btree_node *path[MAP_BTREE_MAX_DEPTH];
+    size_t index[MAP_BTREE_MAX_DEPTH];
+    size_t depth = 0;
+
+    uint8_t *key = bt->scratch;
+    memcpy(key, slot, bt->key_size);
+
+    map_btree_node *node = bt->root;
+    while (!node->leaf)
+    {
+        size_t i = map_btree_search(bt, node, key, NULL, true);
+        path[depth] = node;
+        index[depth] = i;
+        depth++;
+        node = map_btree_children(bt, node)[i];
+    }
+
+    if (key_destroyer != NULL) {
+        key_destroyer(slot);
+    }
+    if (value_destroyer != NULL) {
+        value_destroyer(map_btree_leaf_value(bt, leaf, pos));
+    }
+
+    map_btree_move_entries(bt, leaf, pos, leaf, pos + 1, leaf->count - pos - 1);
+    leaf->count--;
+
+    path[depth] = leaf;
+    map_btree_rebalance(bt, path, index, depth);
+}
+
+void *
+map_btree_first
+(
+    map_btree *bt
+)
+{
+    return (bt->first_leaf != NULL) ? map_btree_key(bt, bt->first_leaf, 0) : NULL;
+}
+
+void *
+map_btree_last
+(
+    map_btree *bt
+)
+{
+    return (bt->last_leaf != NULL) ? map_btree_key(bt, bt->last_leaf, bt->last_leaf->count - 1) : NULL;
+}
+
+void *
+map_btree_next
+(
+    map_btree *    bt,
+    void *         slot
+)
+{
+    map_btree_node *leaf = map_btree_leaf_of(bt, slot);
+    uint8_t *next = (uint8_t *)slot + bt->key_size;
+
+    if (next < map_btree_key(bt, leaf, leaf->count)) {
+        return next;
+    }
+    return (leaf->next != NULL) ? map_btree_key(bt, leaf->next, 0) : NULL;
+}
+
+void *
+map_btree_prev
+(
+    map_btree *    bt,
+    void *         slot
+)
+{
+    map_btree_node *leaf = map_btree_leaf_of(bt, slot);
+
+    if ((uint8_t *)slot > map_btree_key(bt, leaf, 0)) {
+        return (uint8_t *)slot - bt->key_size;
+    }
+    return (leaf->prev != NULL) ? map_btree_key(bt, leaf->prev, leaf->prev->count - 1) : NULL;
+}
+
+void *
+map_btree_value
+(
+    map_btree *    bt,
+    void *         slot
+)
+{
+    map_btree_node *leaf = map_btree_leaf_of(bt, slot);
+    size_t pos = ((uint8_t *)slot - map_btree_key(bt, leaf, 0)) / bt->key_size;
+    return map_btree_leaf_value(bt, leaf, pos);
+}
+
+
+/**
+ * Определения основных функций (API) (конец)
+ */
+
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/**
+ * Вспомогательные функции (начало)
+ */
+
+
+static inline uint8_t *
+map_btree_key
+(
+    map_btree *         bt,
+    map_btree_node *    node,
+    size_t              i
+)
+{
+    return (uint8_t *)node + MAP_BTREE_KEYS_OFFSET + i * bt->key_size;
+}
+
+static inline uint8_t *
+map_btree_leaf_value
+(
+    map_btree *         bt,
+    map_btree_node *    leaf,
+    size_t              i
+)
+{
+    return (uint8_t *)leaf + bt->values_offset + i * bt->value_size;
+}
+
+static inline map_btree_node **
+map_btree_children
+(
+    map_btree *         bt,
+    map_btree_node *    node
+)
+{
+    return (map_btree_node **)((uint8_t *)node + bt->children_offset);
+}
+
+static inline map_btree_node *
+map_btree_leaf_of
+(
+    map_btree *    bt,
+    void *         slot
+)
+{
+    return (map_btree_node *)((uintptr_t)slot & ~(uintptr_t)(bt->leaf_bytes - 1));
+}
+
+static inline int
+map_btree_compare
+(
+    map_btree *     bt,
+    const void *    f,
+    const void *    s
+)
+{
+    if (bt->kind == MAP_BTREE_KIND_BYTES) {
+        return memcmp(f, s, bt->key_size);
+    }
+    return bt->compare_func(f, s);
+}
+
+static size_t
+map_btree_search
+(
+    map_btree *         bt,
+    map_btree_node *    node,
+    const void *        key,
+    int                 (*probe_cmp)    (const void *node_key, const void *probe),
+    bool                upper
+)
+{
+    size_t lo = 0;
+    size_t hi = node->count;
+
+    if (probe_cmp != NULL)
+    {
+        while (lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            int cmp = probe_cmp(map_btree_key(bt, node, mid), key);
+            if (cmp < 0 || (upper && cmp == 0)) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    switch (bt->kind)
+    {
+        case MAP_BTREE_KIND_I32:
+        {
+            int32_t target;
+            memcpy(&target, key, sizeof(target));
+            const int32_t *keys = (const int32_t *)map_btree_key(bt, node, 0);
+            while (lo < hi)
+            {
+                size_t mid = lo + (hi - lo) / 2;
+                if (keys[mid] < target || (upper && keys[mid] == target)) {
+                    lo = mid + 1;
+                }
+                else {
+                    hi = mid;
+                }
+            }
+            break;
+        }
+        case MAP_BTREE_KIND_U64:
+        {
+            uint64_t target;
+            memcpy(&target, key, sizeof(target));
+            const uint64_t *keys = (const uint64_t *)map_btree_key(bt, node, 0);
+            while (lo < hi)
+            {
+                size_t mid = lo + (hi - lo) / 2;
+                if (keys[mid] < target || (upper && keys[mid] == target)) {
+                    lo = mid + 1;
+                }
+                else {
+                    hi = mid;
+                }
+            }
+            break;
+        }
+        default:
+        {
+            while (lo < hi)
+            {
+                size_t mid = lo + (hi - lo) / 2;
+                int cmp = map_btree_compare(bt, map_btree_key(bt, node, mid), key);
+                if (cmp < 0 || (upper && cmp == 0)) {
+                    lo = mid + 1;
+                }
+                else {
+                    hi = mid;
+                }
+            }
+            break;
+        }
+    }
+
+    return lo;
+}
+
+static map_btree_node *
+map_btree_new_node
+(
+    map_btree *    bt,
+    bool           leaf
+)
+{
+    map_btree_node *node = leaf
+        ? (map_btree_node *)aligned_alloc(bt->leaf_bytes, bt->leaf_bytes)
+        : (map_btree_node *)malloc(bt->inner_bytes);
+    if (node == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    *node = (map_btree_node){.count = 0, .leaf = leaf, .prev = NULL, .next = NULL};
+    return node;
+}
+
+static void
+map_btree_move_entries
+(
+    map_btree *         bt,
+    map_btree_node *    to_leaf,
+    size_t              to,
+    map_btree_node *    from_leaf,
+    size_t              from,
+    size_t              count
+)
+{
+    memmove(map_btree_key(bt, to_leaf, to), map_btree_key(bt, from_leaf, from), count * bt->key_size);
+    memmove(map_btree_leaf_value(bt, to_leaf, to), map_btree_leaf_value(bt, from_leaf, from),
+        count * bt->value_size);
+}
+
+static void
+map_btree_inner_insert
+(
+    map_btree *         bt,
+    map_btree_node *    node,
+    size_t              i,
+    const void *        key,
+    map_btree_node *    child
+)
+{
+    map_btree_node **children = map_btree_children(bt, node);
+
+    memmove(map_btree_key(bt, node, i + 1), map_btree_key(bt, node, i), (node->count - i) * bt->key_size);
+    memmove(children + i + 2, children + i + 1, (node->count - i) * sizeof(map_btree_node *));
+    memcpy(map_btree_key(bt, node, i), key, bt->key_size);
+    children[i + 1] = child;
+    node->count++;
+}
+
+static void
+map_btree_inner_remove
+(
+    map_btree *         bt,
+    map_btree_node *    node,
+    size_t              i
+)
+{
+    map_btree_node **children = map_btree_children(bt, node);
+
+    memmove(map_btree_key(bt, node, i), map_btree_key(bt, node, i + 1), (node->count - i - 1) * bt->key_size);
+    memmove(children + i + 1, children + i + 2, (node->count - i - 1) * sizeof(map_btree_node *));
+    node->count--;
+}
+
+static void
+map_btree_rebalance
+(
+    map_btree *          bt,
+    map_btree_node **    path,
+    size_t *             index,
+    size_t               depth
+)
+{
+    while (true)
+    {
+        map_btree_node *node = path[depth];
+
+        if (depth == 0)
+        /* Корень может быть заполнен как угодно, но не должен быть пустым */
+        {
+            if (node->count > 0) {
+                return;
+            }
+            if (node->leaf)
+            {
+                free(node);
+                bt->root = NULL;
+                bt->first_leaf = NULL;
+                bt->last_leaf = NULL;
+            }
+            else
+            {
+                bt->root = map_btree_children(bt, node)[0];
+                free(node);
+            }
+            return;
+        }
+
+        size_t min_count = (node->leaf ? bt->leaf_capacity : bt->inner_capacity) / 2;
+        if (node->count >= min_count) {
+            return;
+        }
+
+        map_btree_node *parent = path[depth - 1];
+        size_t i = index[depth - 1];
+        map_btree_node **parent_children = map_btree_children(bt, parent);
+        map_btree_node *left = (i > 0) ? parent_children[i - 1] : NULL;
+        map_btree_node *right = (i < parent->count) ? parent_children[i + 1] : NULL;
+
+        if (node->leaf)
+        {
+            if (left != NULL && left->count > min_count)
+            /* Забираем последний элемент левого соседа */
+            {
+                map_btree_move_entries(bt, node, 1, node, 0, node->count);
+                map_btree_move_entries(bt, node, 0, left, left->count - 1, 1);
+                left->count--;
+                node->count++;
+                memcpy(map_btree_key(bt, parent, i - 1), map_btree_key(bt, node, 0), bt->key_size);
+                return;
+            }
+            if (right != NULL && right->count > min_count)
+            /* Забираем первый элемент правого соседа */
+            {
+                map_btree_move_entries(bt, node, node->count, right, 0, 1);
+                map_btree_move_entries(bt, right, 0, right, 1, right->count - 1);
+                right->count--;
+                node->count++;
+                memcpy(map_btree_key(bt, parent, i), map_btree_key(bt, right, 0), bt->key_size);
+                return;
+            }
+
+            /* Сливаем лист с соседом: правый из пары листьев исчезает */
+            if (left != NULL)
+            {
+                right = node;
+                node = left;
+                i--;
+            }
+            map_btree_move_entries(bt, node, node->count, right, 0, right->count);
+            node->count += right->count;
+
+            node->next = right->next;
+            if (right->next != NULL) {
+                right->next->prev = node;
+            }
+            else {
+                bt->last_leaf = node;
+            }
+            free(right);
+        }
+        else
+        {
+            map_btree_node **children = map_btree_children(bt, node);
+
+            if (left != NULL && left->count > min_count)
+            /* Поворот направо через разделитель родителя */
+            {
+                map_btree_node **left_children = map_btree_children(bt, left);
+                memmove(map_btree_key(bt, node, 1), map_btree_key(bt, node, 0), node->count * bt->key_size);
+                memmove(children + 1, children, (node->count + 1) * sizeof(map_btree_node *));
+                memcpy(map_btree_key(bt, node, 0), map_btree_key(bt, parent, i - 1), bt->key_size);
+                children[0] = left_children[left->count];
+                memcpy(map_btree_key(bt, parent, i - 1), map_btree_key(bt, left, left->count - 1), bt->key_size);
+                left->count--;
+                node->count++;
+                return;
+            }
+            if (right != NULL && right->count > min_count)
+            /* Поворот налево через разделитель родителя */
+            {
+                map_btree_node **right_children = map_btree_children(bt, right);
+                memcpy(map_btree_key(bt, node, node->count), map_btree_key(bt, parent, i), bt->key_size);
+                children[node->count + 1] = right_children[0];
+                memcpy(map_btree_key(bt, parent, i), map_btree_key(bt, right, 0), bt->key_size);
+                memmove(map_btree_key(bt, right, 0), map_btree_key(bt, right, 1), (right->count - 1) * bt->key_size);
+                memmove(right_children, right_children + 1, right->count * sizeof(map_btree_node *));
+                right->count--;
+                node->count++;
+                return;
+            }
+
+            /* Сливаем узел с соседом, опуская между ними разделитель родителя */
+            if (left != NULL)
+            {
+                right = node;
+                node = left;
+                i--;
+            }
+            children = map_btree_children(bt, node);
+            map_btree_node **right_children = map_btree_children(bt, right);
+            memcpy(map_btree_key(bt, node, node->count), map_btree_key(bt, parent, i), bt->key_size);
+            memcpy(map_btree_key(bt, node, node->count + 1), map_btree_key(bt, right, 0), right->count * bt->key_size);
+            memcpy(children + node->count + 1, right_children, (right->count + 1) * sizeof(map_btree_node *));
+            node->count += right->count + 1;
+            free(right);
+        }
+
+        /* Из родителя исчезли разделитель i и ребёнок i + 1 */
+        map_btree_inner_remove(bt, parent, i);
+        depth--;
+    }
+}
+
+static void
+map_btree_free_node
+(
+    map_btree *         bt,
+    map_btree_node *    node,
+    void                (*key_destroyer)      (void *key),
+    void                (*value_destroyer)    (void *value)
+)
+{
+    if (node->leaf)
+    {
+        for (size_t i = 0; i < node->count; ++i)
+        {
+            if (key_destroyer != NULL) {
+                key_destroyer(map_btree_key(bt, node, i));
+            }
+            if (value_destroyer != NULL) {
+                value_destroyer(map_btree_leaf_value(bt, node, i));
+            }
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i <= node->count; ++i) {
+            map_btree_free_node(bt, map_btree_children(bt, node)[i], key_destroyer, value_destroyer);
+        }
+    }
+
+    free(node);
+}
+
+
+/**
+ * Вспомогательные функции (конец)
+ */
@@ -0,0 +1,838 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <sharded_map.h>
+#include <concurrent_map.h>
+#include <memory.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+typedef struct _sharded_map_shard
+{
+    concurrent_map *    cmap;
+    /**
+     * Внутренний контейнер cmap. Указатель не меняется за время жизни шарда,
+     * поэтому его можно использовать без повторного взятия блокировки шарда
+     */
+    map *               mp;
+} sharded_map_shard;
+
+typedef struct _sharded_map_layout sharded_map_layout;
+
+/**
+ * Разбиение контейнера на шарды. Опубликованное разбиение не меняется:
+ * sharded_map_split и sharded_map_join строят новое и подменяют им текущее
+ */
+struct _sharded_map_layout
+{
+    size_t                  shards_count;
+    /**
+     * shards_count - 1 ключей, разделяющих шарды, по key_size байт
+     */
+    uint8_t *               split_keys;
+    /**
+     * Замещённые разбиения образуют список и освобождаются в sharded_map_free:
+     * операция, прочитавшая разбиение до замены, ещё может к нему обращаться.
+     * dropped - шард, исключённый из контейнера при замене (sharded_map_join)
+     */
+    sharded_map_layout *    retired_next;
+    concurrent_map *        dropped;
+    sharded_map_shard       shards[];
+};
+
+struct _sharded_map
+{
+    uint16_t             key_size;
+    uint16_t             value_size;
+    int                  (*compare_func)       (const void *f, const void *s);
+    void                 (*key_destroyer)      (void *key);
+    void                 (*value_destroyer)    (void *value);
+
+    /**
+     * Текущее разбиение. Вставка, поиск и удаление читают его без 
+     * блокировок (см. sharded_map_lock_shard)
+     */
+    _Atomic(sharded_map_layout *)    layout;
+    sharded_map_layout *             retired;
+
+    /**
+     * Блокировка разбиения: на запись её берут sharded_map_split и 
+     * sharded_map_join, на чтение - операции над всеми шардами сразу
+     */
+    pthread_rwlock_t     layout_lock;
+};
+
+
+/**
+ * Прототипы вспомогательных функций (начало)
+ */
+
+
+/**
+ * Завершает программу с сообщением об ошибке, если smap равен NULL
+ * 
+ * Принимает в качестве аргументов указатель на sharded_map и имя
+ * вызывающей функции
+ */
+static void
+sharded_map_check_null
+(
+    sharded_map *    smap,
+    const char *     func_name
+);
+
+/**
+ * Захватывает блокировку разбиения на чтение (read == true) или на запись и
+ * завершает программу с сообщением об ошибке, если это не удалось
+ */
+static void
+sharded_map_lock
+(
+    sharded_map *    smap,
+    bool             read
+);
+
+/**
+ * Освобождает блокировку разбиения
+ */
+static void
+sharded_map_unlock
+(
+    sharded_map *smap
+);
+
+/**
+ * Возвращает текущее разбиение контейнера
+ */
+static inline sharded_map_layout *
+sharded_map_get_layout
+(
+    sharded_map *smap
+);
+
+/**
+ * Выделяет разбиение на shards_count шардов (шарды и границы не заполняются)
+ */
+static sharded_map_layout *
+sharded_map_create_layout
+(
+    sharded_map *    smap,
+    size_t           shards_count
+);
+
+/**
+ * Подменяет текущее разбиение контейнера разбиением layout, а текущее
+ * откладывает до sharded_map_free. Вызывается под блокировкой разбиения
+ * на запись и под блокировками изменяемых шардов
+ */
+static void
+sharded_map_publish_layout
+(
+    sharded_map *            smap,
+    sharded_map_layout *     layout,
+    concurrent_map *         dropped
+);
+
+/**
+ * Находит шард, которому принадлежит ключ key, и захватывает его блокировку
+ * на чтение (read == true) или на запись. Разбиение читается без блокировок:
+ * если после захвата шарда оно оказалось заменено, поиск повторяется
+ * 
+ * Возвращает захваченный шард
+ */
+static sharded_map_shard
+sharded_map_lock_shard
+(
+    sharded_map *    smap,
+    const void *     key,
+    bool             read
+);
+
+/**
+ * Сравнивает ключи f и s так же, как их сравнивают шарды (см. map_key_compare_sized)
+ */
+static inline int
+sharded_map_compare
+(
+    sharded_map *    smap,
+    const void *     f,
+    const void *     s
+);
+
+/**
+ * Возвращает индекс шарда разбиения layout, которому принадлежит ключ key
+ */
+static size_t
+sharded_map_find_shard
+(
+    sharded_map *           smap,
+    sharded_map_layout *    layout,
+    const void *            key
+);
+
+/**
+ * Создаёт пустой шард
+ */
+static sharded_map_shard
+sharded_map_create_shard
+(
+    sharded_map *smap
+);
+
+/**
+ * Переносит элемент, на который указывает итератор iter, из контейнера src
+ * в контейнер dst без вызова удалителей
+ */
+static void
+sharded_map_move_element
+(
+    map *           src,
+    map_iterator    iter,
+    map *           dst
+);
+
+/**
+ * Возвращает итератор на первый элемент первого непустого шарда, начиная с
+ * шарда shard, или sharded_map_iterator_end, если такого шарда нет
+ */
+static sharded_map_iterator
+sharded_map_first_from
+(
+    sharded_map *           smap,
+    sharded_map_layout *    layout,
+    size_t                  shard
+);
+
+
+/**
+ * Прототипы вспомогательных функций (конец)
+ */
+
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/**
+ * Определения основных функций (API) (начало)
+ */
+
+
+sharded_map *
+sharded_map_create
+(
+    uint16_t        key_size,
+    uint16_t        value_size,
+    int             (*compare_func)       (const void *f, const void *s),
+    void            (*key_destroyer)      (void *key),
+    void            (*value_destroyer)    (void *value),
+    size_t          shards_count,
+    const void *    split_keys
+)
+{
+    if (compare_func == NULL || (shards_count > 1 && split_keys == NULL))
+    {
+        fprintf(stderr, "sharded_map_create: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+    if (shards_count == 0)
+    {
+        fprintf(stderr, "sharded_map_create: количество шардов должно быть больше нуля\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const uint8_t *keys = split_keys;
+    for (size_t i = 1; i + 1 < shards_count; ++i)
+    {
+        if (map_key_compare_sized(compare_func, key_size, keys + (i - 1) * key_size,
+            keys + i * key_size) >= 0)
+        {
+            fprintf(stderr, "sharded_map_create: ключи split_keys должны строго возрастать\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    sharded_map *smap = (sharded_map *)malloc(sizeof(sharded_map));
+    if (smap == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    smap->key_size = key_size;
+    smap->value_size = value_size;
+    smap->compare_func = compare_func;
+    smap->key_destroyer = key_destroyer;
+    smap->value_destroyer = value_destroyer;
+    smap->retired = NULL;
+
+    sharded_map_layout *layout = sharded_map_create_layout(smap, shards_count);
+    for (size_t i = 0; i < shards_count; ++i) {
+        layout->shards[i] = sharded_map_create_shard(smap);
+    }
+    if (shards_count > 1) {
+        memcpy(layout->split_keys, split_keys, (shards_count - 1) * key_size);
+    }
+    atomic_init(&(smap->layout), layout);
+
+    if (pthread_rwlock_init(&(smap->layout_lock), NULL) != 0)
+    {
+        fprintf(stderr, "sharded_map_create: не удалось инициализировать блокировку\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return smap;
+}
+
+void
+sharded_map_free
+(
+    sharded_map *smap
+)
+{
+    sharded_map_check_null(smap, "sharded_map_free");
+
+    sharded_map_layout *layout = sharded_map_get_layout(smap);
+    for (size_t i = 0; i < layout->shards_count; ++i) {
+        concurrent_map_free(layout->shards[i].cmap);
+    }
+    free(layout);
+
+    /* Шарды замещённых разбиений, кроме исключённых, перешли в текущее */
+    while (smap->retired != NULL)
+    {
+        sharded_map_layout *next = smap->retired->retired_next;
+        if (smap->retired->dropped != NULL) {
+            concurrent_map_free(smap->retired->dropped);
+        }
+        free(smap->retired);
+        smap->retired = next;
+    }
+
+    pthread_rwlock_destroy(&(smap->layout_lock));
+    free(smap);
+}
+
+size_t
+sharded_map_size
+(
+    sharded_map *smap
+)
+{
+    sharded_map_check_null(smap, "sharded_map_size");
+
+    size_t size = 0;
+
+    sharded_map_lock(smap, true);
+    sharded_map_layout *layout = sharded_map_get_layout(smap);
+    for (size_t i = 0; i < layout->shards_count; ++i) {
+        size += concurrent_map_size(layout->shards[i].cmap);
+    }
+    sharded_map_unlock(smap);
+
+    return size;
+}
+
+size_t
+sharded_map_shards_count
+(
+    sharded_map *smap
+)
+{
+    sharded_map_check_null(smap, "sharded_map_shards_count");
+
+    return sharded_map_get_layout(smap)->shards_count;
+}
+
+void
+_sharded_map_insert
+(
+    sharded_map *    smap,
+    void *           key,
+    void *           value
+)
+{
+    sharded_map_check_null(smap, "sharded_map_insert");
+    if (key == NULL || value == NULL)
+    {
+        fprintf(stderr, "sharded_map_insert: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    sharded_map_shard shard = sharded_map_lock_shard(smap, key, false);
+    _map_insert(shard.mp, key, value);
+    concurrent_map_write_unlock(shard.cmap);
+}
+
+bool
+_sharded_map_find
+(
+    sharded_map *    smap,
+    void *           key,
+    void *           value
+)
+{
+    sharded_map_check_null(smap, "sharded_map_find");
+    if (key == NULL || value == NULL)
+    {
+        fprintf(stderr, "sharded_map_find: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bool found = false;
+
+    sharded_map_shard shard = sharded_map_lock_shard(smap, key, true);
+    map_iterator it = _map_find(shard.mp, key);
+    if (map_iterator_compare(it, map_iterator_end(shard.mp)) != 0)
+    {
+        memcpy(value, _map_iterator_get_value(it), smap->value_size);
+        found = true;
+    }
+    concurrent_map_read_unlock(shard.cmap);
+
+    return found;
+}
+
+bool
+_sharded_map_erase
+(
+    sharded_map *    smap,
+    void *           key
+)
+{
+    sharded_map_check_null(smap, "sharded_map_erase");
+    if (key == NULL)
+    {
+        fprintf(stderr, "sharded_map_erase: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bool erased = false;
+
+    sharded_map_shard shard = sharded_map_lock_shard(smap, key, false);
+    map_iterator it = _map_find(shard.mp, key);
+    if (map_iterator_compare(it, map_iterator_end(shard.mp)) != 0)
+    {
+        map_erase(shard.mp, it);
+        erased = true;
+    }
+    concurrent_map_write_unlock(shard.cmap);
+
+    return erased;
+}
+
+void
+_sharded_map_split
+(
+    sharded_map *    smap,
+    void *           key
+)
+{
+    sharded_map_check_null(smap, "sharded_map_split");
+    if (key == NULL)
+    {
+        fprintf(stderr, "sharded_map_split: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    sharded_map_lock(smap, false);
+
+    sharded_map_layout *old_layout = sharded_map_get_layout(smap);
+    size_t shard = sharded_map_find_shard(smap, old_layout, key);
+    if (shard > 0 && sharded_map_compare(smap, old_layout->split_keys + (shard - 1) * smap->key_size, key) == 0)
+    {
+        fprintf(stderr, "sharded_map_split: ключ key уже является границей шардов\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Новый шард встаёт на место shard + 1, ключ key - на место границы shard */
+    size_t shards_count = old_layout->shards_count;
+    sharded_map_layout *layout = sharded_map_create_layout(smap, shards_count + 1);
+    memcpy(layout->shards, old_layout->shards, (shard + 1) * sizeof(sharded_map_shard));
+    memcpy(layout->shards + shard + 2, old_layout->shards + shard + 1,
+        (shards_count - shard - 1) * sizeof(sharded_map_shard));
+    memcpy(layout->split_keys, old_layout->split_keys, shard * smap->key_size);
+    memcpy(layout->split_keys + shard * smap->key_size, key, smap->key_size);
+    memcpy(layout->split_keys + (shard + 1) * smap->key_size, old_layout->split_keys + shard * smap->key_size,
+        (shards_count - shard - 1) * smap->key_size);
+    layout->shards[shard + 1] = sharded_map_create_shard(smap);
+
+    /**
+     * Новый шард ещё не опубликован, поэтому блокировать нужно только 
+     * исходный: операции, ожидающие его, после захвата увидят новое 
+     * разбиение и повторят поиск шарда
+     */
+    map *src = concurrent_map_write_lock(layout->shards[shard].cmap);
+    map *dst = layout->shards[shard + 1].mp;
+    while (!map_empty(src))
+    {
+        map_iterator it = map_iterator_last(src);
+        if (sharded_map_compare(smap, _map_iterator_get_key(it), key) < 0) {
+            break;
+        }
+        sharded_map_move_element(src, it, dst);
+    }
+
+    sharded_map_publish_layout(smap, layout, NULL);
+    concurrent_map_write_unlock(layout->shards[shard].cmap);
+
+    sharded_map_unlock(smap);
+}
+
+void
+sharded_map_join
+(
+    sharded_map *    smap,
+    size_t           shard
+)
+{
+    sharded_map_check_null(smap, "sharded_map_join");
+
+    sharded_map_lock(smap, false);
+
+    sharded_map_layout *old_layout = sharded_map_get_layout(smap);
+    size_t shards_count = old_layout->shards_count;
+    if (shard + 1 >= shards_count)
+    {
+        fprintf(stderr, "sharded_map_join: шард shard не имеет следующего шарда\n");
+        exit(EXIT_FAILURE);
+    }
+
+    sharded_map_layout *layout = sharded_map_create_layout(smap, shards_count - 1);
+    memcpy(layout->shards, old_layout->shards, (shard + 1) * sizeof(sharded_map_shard));
+    memcpy(layout->shards + shard + 1, old_layout->shards + shard + 2,
+        (shards_count - shard - 2) * sizeof(sharded_map_shard));
+    memcpy(layout->split_keys, old_layout->split_keys, shard * smap->key_size);
+    memcpy(layout->split_keys + shard * smap->key_size, old_layout->split_keys + (shard + 1) * smap->key_size,
+        (shards_count - shard - 2) * smap->key_size);
+
+    /**
+     * Исключённый шард освобождается только в sharded_map_free: операция,
+     * которая нашла его в старом разбиении, может ожидать его блокировку
+     */
+    concurrent_map *dropped = old_layout->shards[shard + 1].cmap;
+    map *dst = concurrent_map_write_lock(old_layout->shards[shard].cmap);
+    map *src = concurrent_map_write_lock(dropped);
+    while (!map_empty(src)) {
+        sharded_map_move_element(src, map_iterator_first(src), dst);
+    }
+
+    sharded_map_publish_layout(smap, layout, dropped);
+    concurrent_map_write_unlock(dropped);
+    concurrent_map_write_unlock(old_layout->shards[shard].cmap);
+
+    sharded_map_unlock(smap);
+}
+
+void
+sharded_map_read_lock
+(
+    sharded_map *smap
+)
+{
+    sharded_map_check_null(smap, "sharded_map_read_lock");
+
+    sharded_map_lock(smap, true);
+    sharded_map_layout *layout = sharded_map_get_layout(smap);
+    for (size_t i = 0; i < layout->shards_count; ++i) {
+        concurrent_map_read_lock(layout->shards[i].cmap);
+    }
+}
+
+void
+sharded_map_read_unlock
+(
+    sharded_map *smap
+)
+{
+    sharded_map_check_null(smap, "sharded_map_read_unlock");
+
+    sharded_map_layout *layout = sharded_map_get_layout(smap);
+    for (size_t i = 0; i < layout->shards_count; ++i) {
+        concurrent_map_read_unlock(layout->shards[i].cmap);
+    }
+    sharded_map_unlock(smap);
+}
+
+sharded_map_iterator
+sharded_map_iterator_first
+(
+    sharded_map *smap
+)
+{
+    sharded_map_check_null(smap, "sharded_map_iterator_first");
+
+    return sharded_map_first_from(smap, sharded_map_get_layout(smap), 0);
+}
+
+sharded_map_iterator
+sharded_map_iterator_end
+(
+    sharded_map *smap
+)
+{
+    sharded_map_check_null(smap, "sharded_map_iterator_end");
+
+    sharded_map_layout *layout = sharded_map_get_layout(smap);
+    size_t last = layout->shards_count - 1;
+    return (sharded_map_iterator){.iter = map_iterator_end(layout->shards[last].mp), .shard = last};
+}
+
+void
+_sharded_map_iterator_next
+(
+    sharded_map *             smap,
+    sharded_map_iterator *    iter
+)
+{
+    sharded_map_check_null(smap, "sharded_map_iterator_next");
+    if (iter == NULL)
+    {
+        fprintf(stderr, "sharded_map_iterator_next: в качестве аргумента передан нулевой указатель\n");
+        exit(EXIT_FAILURE);
+    }
+
+    sharded_map_layout *layout = sharded_map_get_layout(smap);
+    map *mp = layout->shards[iter->shard].mp;
+
+    map_iterator_next(mp, iter->iter);
+    if (map_iterator_compare(iter->iter, map_iterator_end(mp)) == 0 && iter->shard + 1 < layout->shards_count)
+    /* Шард закончился - переходим к следующему */
+    {
+        *iter = sharded_map_first_from(smap, layout, iter->shard + 1);
+    }
+}
+
+int
+sharded_map_iterator_compare
+(
+    sharded_map_iterator    f,
+    sharded_map_iterator    s
+)
+{
+    return (!(f.shard == s.shard && map_iterator_compare(f.iter, s.iter) == 0));
+}
+
+
+/**
+ * Определения основных функций (API) (конец)
+ */
+
+/*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*=*/
+
+/**
+ * Вспомогательные функции (начало)
+ */
+
+
+static void
+sharded_map_check_null
+(
+    sharded_map *    smap,
+    const char *     func_name
+)
+{
+    if (smap == NULL)
+    {
+        fprintf(stderr, "%s: в качестве аргумента передан нулевой указатель\n", func_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+sharded_map_lock
+(
+    sharded_map *    smap,
+    bool             read
+)
+{
+    int result = read ? pthread_rwlock_rdlock(&(smap->layout_lock)) : pthread_rwlock_wrlock(&(smap->layout_lock));
+    if (result != 0)
+    {
+        fprintf(stderr, "sharded_map: не удалось захватить блокировку\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+sharded_map_unlock
+(
+    sharded_map *smap
+)
+{
+    if (pthread_rwlock_unlock(&(smap->layout_lock)) != 0)
+    {
+        fprintf(stderr, "sharded_map: не удалось освободить блокировку\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static inline sharded_map_layout *
+sharded_map_get_layout
+(
+    sharded_map *smap
+)
+{
+    return atomic_load_explicit(&(smap->layout), memory_order_acquire);
+}
+
+static sharded_map_layout *
+sharded_map_create_layout
+(
+    sharded_map *    smap,
+    size_t           shards_count
+)
+{
+    /* Границы шардов располагаются сразу за массивом шардов */
+    size_t shards_bytes = shards_count * sizeof(sharded_map_shard);
+    sharded_map_layout *layout = (sharded_map_layout *)malloc(sizeof(sharded_map_layout) 
+        + shards_bytes + (shards_count - 1) * smap->key_size + 1);
+    if (layout == NULL)
+    {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    layout->shards_count = shards_count;
+    layout->split_keys = (uint8_t *)layout->shards + shards_bytes;
+    layout->retired_next = NULL;
+    layout->dropped = NULL;
+
+    return layout;
+}
+
+static void
+sharded_map_publish_layout
+(
+    sharded_map *            smap,
+    sharded_map_layout *     layout,
+    concurrent_map *         dropped
+)
+{
+    sharded_map_layout *old_layout = sharded_map_get_layout(smap);
+    atomic_store_explicit(&(smap->layout), layout, memory_order_release);
+
+    old_layout->dropped = dropped;
+    old_layout->retired_next = smap->retired;
+    smap->retired = old_layout;
+}
+
+static sharded_map_shard
+sharded_map_lock_shard
+(
+    sharded_map *    smap,
+    const void *     key,
+    bool             read
+)
+{
+    for (;;)
+    {
+        sharded_map_layout *layout = sharded_map_get_layout(smap);
+        sharded_map_shard shard = layout->shards[sharded_map_find_shard(smap, layout, key)];
+
+        if (read) {
+            concurrent_map_read_lock(shard.cmap);
+        }
+        else {
+            concurrent_map_write_lock(shard.cmap);
+        }
+
+        /**
+         * Разбиение подменяется под блокировкой изменяемого шарда, поэтому
+         * если после её захвата разбиение прежнее, ключ принадлежит шарду
+         */
+        if (sharded_map_get_layout(smap) == layout) {
+            return shard;
+        }
+
+        if (read) {
+            concurrent_map_read_unlock(shard.cmap);
+        }
+        else {
+            concurrent_map_write_unlock(shard.cmap);
+        }
+    }
+}
+
+static inline int
+sharded_map_compare
+(
+    sharded_map *    smap,
+    const void *     f,
+    const void *     s
+)
+{
+    return map_key_compare_sized(smap->compare_func, smap->key_size, f, s);
+}
+
+static size_t
+sharded_map_find_shard
+(
+    sharded_map *           smap,
+    sharded_map_layout *    layout,
+    const void *            key
+)
+{
+    /* Количество границ, не больших key (двоичный поиск) */
+    size_t left = 0;
+    size_t right = layout->shards_count - 1;
+    while (left < right)
+    {
+        size_t middle = left + (right - left) / 2;
+        if (sharded_map_compare(smap, layout->split_keys + middle * smap->key_size, key) <= 0) {
+            left = middle + 1;
+        }
+        else {
+            right = middle;
+        }
+    }
+
+    return left;
+}
+
+static sharded_map_shard
+sharded_map_create_shard
+(
+    sharded_map *smap
+)
+{
+    concurrent_map *cmap = concurrent_map_create(smap->key_size, smap->value_size, smap->compare_func,
+        smap->key_destroyer, smap->value_destroyer);
+
+    map *mp = concurrent_map_write_lock(cmap);
+    concurrent_map_write_unlock(cmap);
+
+    return (sharded_map_shard){.cmap = cmap, .mp = mp};
+}
+
+static void
+sharded_map_move_element
+(
+    map *           src,
+    map_iterator    iter,
+    map *           dst
+)
+{
+    _map_insert(dst, _map_iterator_get_key(iter), _map_iterator_get_value(iter));
+    map_steal(src, iter);
+}
+
+static sharded_map_iterator
+sharded_map_first_from
+(
+    sharded_map *           smap,
+    sharded_map_layout *    layout,
+    size_t                  shard
+)
+{
+    for (; shard < layout->shards_count; ++shard)
+    {
+        map *mp = layout->shards[shard].mp;
+        if (!map_empty(mp)) {
+            return (sharded_map_iterator){.iter = map_iterator_first(mp), .shard = shard};
+        }
+    }
+
+    return sharded_map_iterator_end(smap);
+}
+
+
+/**
+ * Вспомогательные функции (конец)
+ */